@@ -33,15 +33,25 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <sys/time.h>
+#include <stdatomic.h>
 
 #include "esp_system.h"
 #include "esp_log.h"
 #include "esp_log_buffer.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
 #include "nvs_flash.h"
+#include "nvs.h"
 #include "esp_bt.h"
 
 #include "blemidi.h"
+#include "blemidi_latency.h"
+#include "blemidi_packet.h"
+#include "blemidi_parser.h"
+#include "blemidi_rxqueue.h"
+#include "blemidi_txqueue.h"
 
 #if BLEMIDI_ENABLE_CONSOLE
 # include "esp_console.h"
@@ -60,29 +70,106 @@
 
  /* The max length of characteristic value. When the GATT client performs a write or prepare write operation,
  *  the data length must be less than GATTS_MIDI_CHAR_VAL_LEN_MAX.
+ *  It's also the local MTU: 247 bytes fit into a single 251 byte link layer PDU with data length extension.
  */
-#define GATTS_MIDI_CHAR_VAL_LEN_MAX 100
+#define GATTS_MIDI_CHAR_VAL_LEN_MAX 247
 #define PREPARE_BUF_MAX_SIZE        2048
 #define CHAR_DECLARATION_SIZE       (sizeof(uint8_t))
 
 #define ADV_CONFIG_FLAG             (1 << 0)
 #define SCAN_RSP_CONFIG_FLAG        (1 << 1)
 
+#define BLEMIDI_NVS_NAMESPACE       "blemidi" // CCC values of bonded centrals
+
 static uint8_t adv_config_done = 0;
 
 // the MTU can be changed by the client during runtime
-static size_t blemidi_mtu = GATTS_MIDI_CHAR_VAL_LEN_MAX - 3;
+static atomic_size_t blemidi_mtu = GATTS_MIDI_CHAR_VAL_LEN_MAX - 3;
 
-// This timestamp should be increased each mS from the application via blemidi_tick_ms() call:
-static uint16_t blemidi_timestamp = 0;
+// Connection parameters requested per link profile (intervals in 1.25 mS, timeout in 10 mS units)
+typedef struct
+{
+  const char* name;
+  uint16_t min_int;
+  uint16_t max_int;
+  uint16_t latency;
+  uint16_t timeout;
+  uint16_t tx_data_len;    // 0: don't request data length extension
+  uint8_t  prefer_2m_phy;
+  uint16_t max_packet_len; // limits BLE MIDI packets below the negotiated MTU
+} blemidi_link_profile_config_t;
+
+static const blemidi_link_profile_config_t blemidi_link_profiles[BLEMIDI_LINK_PROFILE_NUM] = {
+  // iOS rejects intervals below 15 mS, the upper limit leaves it a valid choice
+  [BLEMIDI_LINK_PROFILE_LOW_LATENCY] = { "low_latency", 0x06, 0x0c, 0, 400, 251, 1, GATTS_MIDI_CHAR_VAL_LEN_MAX - 3 },
+  [BLEMIDI_LINK_PROFILE_BALANCED]    = { "balanced",    0x0b, 0x10, 0, 400,   0, 0, 97 },
+  [BLEMIDI_LINK_PROFILE_LOW_POWER]   = { "low_power",   0x18, 0x28, 4, 600,   0, 0, GATTS_MIDI_CHAR_VAL_LEN_MAX - 3 },
+};
+
+static atomic_int blemidi_link_profile = BLEMIDI_LINK_PROFILE_DEFAULT;
 
-// we buffer outgoing MIDI messages for 10 mS - this should avoid that multiple BLE packets have to be queued for small messages
-static uint8_t  blemidi_outbuffer[BLEMIDI_NUM_PORTS][GATTS_MIDI_CHAR_VAL_LEN_MAX];
-static uint16_t blemidi_outbuffer_len[BLEMIDI_NUM_PORTS];
-static uint16_t blemidi_outbuffer_timestamp_last_flush = 0;
+// Connected centrals. The slot index is the target bit in the transmit queue.
+typedef struct
+{
+  bool in_use;
+  bool mtu_known;           // joined the targets, see BLEMIDI_MTU_EXCHANGE_WAIT_MS
+  int64_t connect_us;
+  esp_bd_addr_t bda;
+  blemidi_link_info_t link; // parameters granted by the central
+  blemidi_parser_t parser;  // to handle continued SysEx, only used by the BT task
+  bool data_len_wanted;     // the data length of the profile is still to be requested
+  bool data_len_requested;  // waits for ESP_GAP_BLE_SET_PKT_LENGTH_COMPLETE_EVT
+  bool bonded;              // encrypted with the keys of a bond, its CCC value is kept in NVS
+} blemidi_conn_t;
+_Static_assert(BLEMIDI_MAX_CONNECTIONS <= BLEMIDI_TXQUEUE_MAX_TARGETS, "too many connections for the transmit queue");
+
+// Written by the BT task, read by the senders and the console
+static portMUX_TYPE blemidi_link_lock = portMUX_INITIALIZER_UNLOCKED;
+static blemidi_conn_t blemidi_conns[BLEMIDI_MAX_CONNECTIONS];
+
+// Millisecond timestamp, refreshed whenever a packet is built or flushed
+static uint16_t blemidi_timestamp = 0;
 
-// to handled continued SysEx
-static size_t   blemidi_continued_sysex_pos[BLEMIDI_NUM_PORTS];
+// we buffer outgoing MIDI messages for a few mS - this should avoid that multiple BLE packets have to be queued for small messages
+// Messages are sent from several tasks, the packet builder lets them append while the flush task sends the previous packet
+static blemidi_packet_builder_t blemidi_outbuffer[BLEMIDI_NUM_PORTS];
+_Static_assert(BLEMIDI_PACKET_BUFFER_SIZE >= (GATTS_MIDI_CHAR_VAL_LEN_MAX - 3), "packet buffer smaller than the largest BLE MIDI packet");
+
+// The first push into an empty output buffer arms a flush, which is sent once
+// the coalescing window has passed (see blemidi_outbuffer_wait_flush)
+static SemaphoreHandle_t blemidi_flush_sem = NULL;
+static StaticSemaphore_t blemidi_flush_sem_buffer;
+static uint8_t  blemidi_flush_window_ms = BLEMIDI_OUTBUFFER_FLUSH_MS;
+static atomic_bool blemidi_flush_armed = false;
+static atomic_llong blemidi_flush_armed_us = 0;
+static void (*blemidi_callback_pre_flush)(void) = NULL;
+static TaskHandle_t blemidi_flushing_task = NULL;
+
+static void blemidi_tx_drain(void);
+static bool blemidi_tx_retry_pending(void);
+static void blemidi_link_update_max_len(void);
+
+// Packets ready to be sent. The queue is filled by whichever task flushes the output buffer,
+// therefore it's protected by a mutex. Congestion holds packets back until the link recovers.
+static blemidi_txqueue_t blemidi_txqueue;
+static SemaphoreHandle_t blemidi_tx_mutex = NULL;
+static StaticSemaphore_t blemidi_tx_mutex_buffer;
+static atomic_uint blemidi_tx_congested = 0;        // one bit per connection
+static atomic_uint blemidi_tx_removed_targets = 0;  // disconnected/unsubscribed since the last drain
+static atomic_uint blemidi_tx_congestion_events = 0;
+
+// Received messages, queued by the Bluetooth task and processed by an application task
+// once a notify callback is registered. The stats lock only guards the counters.
+static blemidi_rxqueue_t blemidi_rxqueue;
+static bool (*blemidi_callback_rx_notify)(void* arg) = NULL;
+static void* blemidi_rx_notify_arg = NULL;
+static atomic_bool blemidi_rx_notify_pending = false;
+static uint32_t blemidi_rx_packet_queued = 0;   // messages of the packet being parsed (Bluetooth task only)
+static uint32_t blemidi_rx_packet_dropped = 0;
+static int64_t blemidi_rx_packet_received_us = 0;
+static int64_t blemidi_rx_callback_received_us = 0; // see blemidi_get_received_time(), task of the receive callback only
+static portMUX_TYPE blemidi_rx_stats_lock = portMUX_INITIALIZER_UNLOCKED;
+static blemidi_rx_stats_t blemidi_rx_stats;
 
 /* Attributes State Machine */
 enum
@@ -100,10 +187,16 @@ typedef struct
 {
   uint8_t* prepare_buf;
   int                     prepare_len;
+  int                     conn;        // slot which owns prepare_buf while it is set
 } prepare_type_env_t;
 
 static prepare_type_env_t prepare_write_env;
 
+// Long writes and their responses are handled in the BT task only. One long write is open at
+// a time, a prepare write of another central is rejected until it has been executed or cancelled.
+static uint8_t blemidi_prepare_buf[PREPARE_BUF_MAX_SIZE];
+static esp_gatt_rsp_t blemidi_prepare_rsp;
+
 static uint8_t midi_service_uuid[16] = {
   /* LSB <--------------------------------------------------------------------------------> MSB */
   0x00, 0xC7, 0xC4, 0x4E, 0xE3, 0x6C, 0x51, 0xA7, 0x33, 0x4B, 0xE8, 0xED, 0x5A, 0x0E, 0xB8, 0x03
@@ -200,28 +293,56 @@ static const uint8_t blemidi_ccc[2] = { 0x00, 0x00 };
 
 void (*blemidi_callback_midi_message_received)(uint8_t blemidi_port, uint16_t timestamp, uint8_t midi_status, uint8_t* remaining_message, size_t len, size_t continued_sysex_pos);
 
-static int32_t blemidi_connected = 0;
+static atomic_int blemidi_connected = 0;
+static void (*blemidi_callback_connection_changed)(int32_t connected) = NULL;
 
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 // Timestamp handling
 ////////////////////////////////////////////////////////////////////////////////////////////////////
-void blemidi_tick(void)
+static int64_t blemidi_update_timestamp(void)
+{
+  int64_t now_us = esp_timer_get_time();
+  blemidi_timestamp = (uint16_t)(now_us / 1000); // 1 mS per increment
+  return now_us;
+}
+
+uint16_t blemidi_timestamp_at(int64_t time_us)
+{
+  return (uint16_t)((time_us / 1000) & 0x1fff); // same time base as blemidi_timestamp
+}
+
+static void blemidi_outbuffer_flush_all(void)
 {
-  struct timeval tv;
-  gettimeofday(&tv, NULL);
-  blemidi_timestamp = (tv.tv_sec * 1000 + (tv.tv_usec / 1000)); // 1 mS per increment
+  uint8_t blemidi_port;
+
+  // disarm first, so that messages pushed by other tasks from now on arm the next flush
+  atomic_store(&blemidi_flush_armed, false);
+  blemidi_flushing_task = xTaskGetCurrentTaskHandle();
 
-  if ((blemidi_outbuffer_timestamp_last_flush > blemidi_timestamp) ||
-    (blemidi_timestamp > (blemidi_outbuffer_timestamp_last_flush + BLEMIDI_OUTBUFFER_FLUSH_MS)))
+  // give the application a last chance to add messages it held back
+  if (blemidi_callback_pre_flush != NULL)
+    blemidi_callback_pre_flush();
+
+  for (blemidi_port = 0; blemidi_port < BLEMIDI_NUM_PORTS; ++blemidi_port)
   {
-    uint8_t blemidi_port;
-    for (blemidi_port = 0; blemidi_port < BLEMIDI_NUM_PORTS; ++blemidi_port)
-    {
-      blemidi_outbuffer_flush(blemidi_port);
-    }
+    blemidi_outbuffer_flush(blemidi_port);
+  }
+  blemidi_flushing_task = NULL;
+}
+
+void blemidi_tick(void)
+{
+  int64_t now_us = blemidi_update_timestamp();
 
-    blemidi_outbuffer_timestamp_last_flush = blemidi_timestamp;
+  if (atomic_load(&blemidi_flush_armed) &&
+    (now_us - atomic_load(&blemidi_flush_armed_us)) >= (int64_t)blemidi_flush_window_ms * 1000)
+  {
+    blemidi_outbuffer_flush_all();
+  }
+  else if (blemidi_tx_retry_pending())
+  {
+    blemidi_tx_drain();
   }
 }
 
@@ -237,97 +358,398 @@ uint8_t blemidi_timestamp_low(void)
 
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////
-// Flush Output Buffer (normally done by blemidi_tick_ms each 15 mS)
+// Transmit Queue
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Applies connection changes of the BT task to the transmit queue, must be called with blemidi_tx_mutex taken.
+// Returns the connections which packets are sent to, and optionally their conn_ids and packet size limits.
+static uint8_t blemidi_tx_sync_targets(uint16_t* conn_ids, size_t* max_lens)
+{
+  uint8_t removed = (uint8_t) atomic_exchange(&blemidi_tx_removed_targets, 0);
+  uint8_t targets = 0;
+  bool joined = false;
+  int64_t now_us = esp_timer_get_time();
+  uint8_t i;
+
+  // removals first, a slot could have been taken by a new central meanwhile
+  for (i = 0; i < BLEMIDI_MAX_CONNECTIONS; ++i)
+  {
+    if (removed & (1 << i))
+      blemidi_txqueue_remove_target(&blemidi_txqueue, i);
+  }
+
+  portENTER_CRITICAL(&blemidi_link_lock);
+  for (i = 0; i < BLEMIDI_MAX_CONNECTIONS; ++i)
+  {
+    blemidi_conn_t* conn = &blemidi_conns[i];
+    if (!conn->in_use || !conn->link.subscribed)
+      continue;
+
+    // a new central waits for its MTU exchange, otherwise packets built for the larger MTU
+    // of the others would be sent to it; one which doesn't exchange keeps the default MTU
+    if (!conn->mtu_known)
+    {
+      if ((now_us - conn->connect_us) < (BLEMIDI_MTU_EXCHANGE_WAIT_MS * 1000LL))
+        continue;
+      conn->mtu_known = true;
+      joined = true;
+    }
+
+    targets |= (1 << i);
+    if (conn_ids != NULL)
+      conn_ids[i] = conn->link.conn_id;
+    if (max_lens != NULL)
+      max_lens[i] = (conn->link.mtu <= 3) ? 0 : (conn->link.mtu - 3);
+  }
+  portEXIT_CRITICAL(&blemidi_link_lock);
+
+  if (joined)
+    blemidi_link_update_max_len();
+
+  blemidi_txqueue_set_targets(&blemidi_txqueue, targets);
+  return targets;
+}
+
+static void blemidi_tx_drain(void)
+{
+  uint16_t conn_ids[BLEMIDI_MAX_CONNECTIONS];
+  size_t max_lens[BLEMIDI_MAX_CONNECTIONS];
+  uint8_t targets;
+  bool progress;
+
+  xSemaphoreTake(blemidi_tx_mutex, portMAX_DELAY);
+
+  targets = blemidi_tx_sync_targets(conn_ids, max_lens);
+  if (!targets)
+    blemidi_txqueue_clear(&blemidi_txqueue); // nobody to send to
+
+  // one packet per central and round, so that a second central doesn't wait until the first got all.
+  // Every central is notified from the same queue entry, a congested one only holds back its own packets.
+  do
+  {
+    uint8_t i;
+
+    progress = false;
+    for (i = 0; i < BLEMIDI_MAX_CONNECTIONS; ++i)
+    {
+      const blemidi_txqueue_entry_t* entry;
+
+      if (!(targets & (1 << i)) || (atomic_load(&blemidi_tx_congested) & (1 << i)))
+        continue;
+
+      entry = blemidi_txqueue_peek(&blemidi_txqueue, i);
+      if (entry == NULL)
+        continue;
+
+      if (entry->len > max_lens[i])
+      {
+        // built before the limit was lowered for this central: it would be truncated or rejected forever
+        blemidi_txqueue_skip_too_long(&blemidi_txqueue, i);
+        progress = true;
+        continue;
+      }
+
+      BLEMIDI_LATENCY_MARK(BLEMIDI_LATENCY_STAGE_NOTIFY);
+      esp_err_t ret = esp_ble_gatts_send_indicate(midi_profile_tab[PROFILE_APP_IDX].gatts_if, conn_ids[i], midi_handle_table[IDX_CHAR_VAL_A], entry->len, (uint8_t*) entry->data, false);
+      if (ret != ESP_OK)
+      {
+        // keep the packet, it's sent again with the next flush or after BLEMIDI_TX_RETRY_MS
+        blemidi_txqueue.stats.retried++;
+        targets &= ~(1 << i);
+        continue;
+      }
+      blemidi_txqueue_pop(&blemidi_txqueue, i);
+      progress = true;
+    }
+  } while (progress);
+
+  xSemaphoreGive(blemidi_tx_mutex);
+}
+
+// The queue only holds packets which must not be dropped: wait until the link takes some,
+// but not longer than BLEMIDI_TX_ENQUEUE_TIMEOUT_MS. Returns false once the time is up.
+static bool blemidi_tx_wait_for_room(TickType_t start)
+{
+  if ((xTaskGetTickCount() - start) >= pdMS_TO_TICKS(BLEMIDI_TX_ENQUEUE_TIMEOUT_MS))
+  {
+    xSemaphoreTake(blemidi_tx_mutex, portMAX_DELAY);
+    blemidi_txqueue.stats.dropped++;
+    blemidi_txqueue.stats.dropped_timeout++;
+    xSemaphoreGive(blemidi_tx_mutex);
+    return false;
+  }
+
+  blemidi_tx_drain();
+  vTaskDelay(pdMS_TO_TICKS(BLEMIDI_TX_RETRY_MS));
+  return true;
+}
+
+static int32_t blemidi_tx_enqueue(const uint8_t* packet, size_t len, bool protected_packet)
+{
+  TickType_t start = xTaskGetTickCount();
+
+  for (;;)
+  {
+    xSemaphoreTake(blemidi_tx_mutex, portMAX_DELAY);
+    blemidi_tx_sync_targets(NULL, NULL);
+    int32_t status = blemidi_txqueue_push(&blemidi_txqueue, packet, len, protected_packet);
+    xSemaphoreGive(blemidi_tx_mutex);
+
+    if (status != -1)
+      return 0;
+
+    if (!blemidi_tx_wait_for_room(start))
+      return -2; // dropped
+  }
+}
+
+static bool blemidi_tx_retry_pending(void)
+{
+  uint8_t congested = (uint8_t) atomic_load(&blemidi_tx_congested);
+  bool pending = false;
+  uint8_t i;
+
+  if (blemidi_txqueue_count(&blemidi_txqueue) == 0)
+    return false;
+
+  // congested centrals wait for the event
+  xSemaphoreTake(blemidi_tx_mutex, portMAX_DELAY);
+  for (i = 0; i < BLEMIDI_MAX_CONNECTIONS && !pending; ++i)
+  {
+    pending = !(congested & (1 << i)) && blemidi_txqueue_peek(&blemidi_txqueue, i) != NULL;
+  }
+  xSemaphoreGive(blemidi_tx_mutex);
+
+  return pending;
+}
+
+// Writes a part of a SysEx stream which fills a packet on its own into the next free queue slot,
+// so no temporary packet buffer is needed. SysEx is never dropped.
+static int32_t blemidi_tx_enqueue_message(const uint8_t* stream, size_t len)
+{
+  // new packet: with timestampHigh and timestampLow, or in case of continued SysEx packet: only timestampHigh
+  size_t header_len = (stream[0] >= 0x80) ? 2 : 1;
+  // the final F7 gets its own timestampLow
+  size_t sysex_end = (len > 1 && stream[len - 1] == 0xf7) ? 1 : 0;
+
+  if ((header_len + len + sysex_end) > BLEMIDI_PACKET_BUFFER_SIZE)
+    return -1;
+
+  TickType_t start = xTaskGetTickCount();
+  for (;;)
+  {
+    xSemaphoreTake(blemidi_tx_mutex, portMAX_DELAY);
+    blemidi_tx_sync_targets(NULL, NULL);
+    uint8_t* packet = blemidi_txqueue_reserve(&blemidi_txqueue);
+    if (packet != NULL)
+    {
+      packet[0] = blemidi_timestamp_high();
+      if (header_len == 2)
+        packet[1] = blemidi_timestamp_low();
+      memcpy(packet + header_len, stream, len - sysex_end);
+      if (sysex_end)
+      {
+        packet[header_len + len - 1] = blemidi_timestamp_low();
+        packet[header_len + len] = 0xf7;
+      }
+      blemidi_txqueue_commit(&blemidi_txqueue, header_len + len + sysex_end);
+      xSemaphoreGive(blemidi_tx_mutex);
+      return 0;
+    }
+    xSemaphoreGive(blemidi_tx_mutex);
+
+    if (!blemidi_tx_wait_for_room(start))
+      return -2; // dropped
+  }
+}
+
+void blemidi_get_tx_stats(blemidi_tx_stats_t* stats)
+{
+  xSemaphoreTake(blemidi_tx_mutex, portMAX_DELAY);
+  *stats = blemidi_txqueue.stats;
+  xSemaphoreGive(blemidi_tx_mutex);
+  stats->congestion_events = atomic_load(&blemidi_tx_congestion_events);
+}
+
+void blemidi_reset_tx_stats(void)
+{
+  xSemaphoreTake(blemidi_tx_mutex, portMAX_DELAY);
+  memset(&blemidi_txqueue.stats, 0, sizeof(blemidi_txqueue.stats));
+  xSemaphoreGive(blemidi_tx_mutex);
+  atomic_store(&blemidi_tx_congestion_events, 0);
+}
+
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Flush Output Buffer (normally done by blemidi_outbuffer_wait_flush)
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 int32_t blemidi_outbuffer_flush(uint8_t blemidi_port)
 {
   if (blemidi_port >= BLEMIDI_NUM_PORTS)
     return -1; // invalid port
 
-  if (blemidi_outbuffer_len[blemidi_port] > 0)
+  blemidi_packet_builder_t* builder = &blemidi_outbuffer[blemidi_port];
+  const uint8_t* packet;
+  size_t packet_len;
+  int32_t status = 0;
+
+  // only one flush at a time; producers keep appending to the other buffer meanwhile
+  while (!blemidi_packet_flush_begin(builder))
+    vTaskDelay(1);
+
+  packet_len = blemidi_packet_swap(builder, &packet);
+  if (packet_len > 0)
   {
-    esp_ble_gatts_send_indicate(midi_profile_tab[PROFILE_APP_IDX].gatts_if, midi_profile_tab[PROFILE_APP_IDX].conn_id, midi_handle_table[IDX_CHAR_VAL_A], blemidi_outbuffer_len[blemidi_port], blemidi_outbuffer[blemidi_port], false);
-    blemidi_outbuffer_len[blemidi_port] = 0;
+    // a producer which was preempted while copying its message finishes it first
+    while (!blemidi_packet_swap_complete(builder))
+      vTaskDelay(1);
+
+    status = blemidi_tx_enqueue(packet, packet_len, blemidi_packet_retired_is_protected(builder));
   }
-  return 0; // no error
+
+  blemidi_packet_flush_end(builder);
+
+  blemidi_tx_drain();
+  return status;
 }
 
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 // Push a new MIDI message to the output buffer
 ////////////////////////////////////////////////////////////////////////////////////////////////////
-static int32_t blemidi_outbuffer_push(uint8_t blemidi_port, uint8_t* stream, size_t len)
+static int32_t blemidi_outbuffer_push(uint8_t blemidi_port, uint8_t* stream, size_t len, bool priority, uint16_t timestamp)
 {
   const size_t max_header_size = 2;
 
   if (blemidi_port >= BLEMIDI_NUM_PORTS)
     return -1; // invalid port
 
-  // if len >= MTU, it makes sense to send out immediately
-  if (len >= (blemidi_mtu - max_header_size))
+  BLEMIDI_LATENCY_MARK(BLEMIDI_LATENCY_STAGE_PUSH);
+
+  int64_t now_us = blemidi_update_timestamp();
+  if (timestamp == BLEMIDI_TIMESTAMP_NOW)
+    timestamp = blemidi_timestamp_at(now_us);
+
+  // messages which don't fit into a packet are split by blemidi_send()
+  if (len >= (atomic_load(&blemidi_mtu) - max_header_size))
+    return -1; // MTU has been decreased meanwhile
+
+  int32_t status;
+  int32_t flush_status = 0;
+
+  // flush buffer if the new message doesn't fit anymore (or its timestamp is too far ahead of the packet), then add it to the next packet
+  while ((status = blemidi_packet_append(&blemidi_outbuffer[blemidi_port], timestamp, stream, len, priority)) == -2)
+    flush_status = blemidi_outbuffer_flush(blemidi_port);
+
+  if (status < 0)
+    return -1; // MTU has been decreased meanwhile
+
+  // first message of a new packet: start the coalescing window and wake up the flush task
+  if (status == 1)
+    blemidi_outbuffer_request_flush();
+
+  return flush_status; // -2 if the packet flushed to make room was dropped
+}
+
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Arms a flush if none is pending
+////////////////////////////////////////////////////////////////////////////////////////////////////
+void blemidi_outbuffer_request_flush(void)
+{
+  // messages pushed from the pre-flush callback go out with the running flush
+  if (blemidi_flushing_task != NULL && blemidi_flushing_task == xTaskGetCurrentTaskHandle())
+    return;
+
+  if (!atomic_exchange(&blemidi_flush_armed, true))
   {
-    // this is very unlikely, since applemidi_send_message() maintains the size
-    // but just in case of future extensions, we prepare dynamic memory allocation for "big packets"
-    blemidi_outbuffer_flush(blemidi_port);
-    {
-      size_t packet_len = max_header_size + len;
-      uint8_t* packet = malloc(packet_len);
-      if (packet == NULL)
-      {
-        return -1; // couldn't create temporary packet
-      }
-      else
-      {
-        // new packet: with timestampHigh and timestampLow, or in case of continued SysEx packet: only timestampHigh
-        packet[0] = blemidi_timestamp_high();
-        if (stream[0] >= 0x80)
-        {
-          packet[1] = blemidi_timestamp_low();
-          memcpy((uint8_t*) packet + 2, stream, len);
-        }
-        else
-        {
-          packet_len -= 1;
-          memcpy((uint8_t*) packet + 1, stream, len);
-        }
-        esp_ble_gatts_send_indicate(midi_profile_tab[PROFILE_APP_IDX].gatts_if, midi_profile_tab[PROFILE_APP_IDX].conn_id, midi_handle_table[IDX_CHAR_VAL_A], packet_len, packet, false);
-        free(packet);
-      }
-    }
+    atomic_store(&blemidi_flush_armed_us, esp_timer_get_time());
+    if (blemidi_flush_sem != NULL)
+      xSemaphoreGive(blemidi_flush_sem);
   }
-  else
-  {
-    // flush buffer before adding new message
-    if ((blemidi_outbuffer_len[blemidi_port] + len) >= blemidi_mtu)
-      blemidi_outbuffer_flush(blemidi_port);
+}
+
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Installs a callback which is called before the output buffer is flushed
+////////////////////////////////////////////////////////////////////////////////////////////////////
+void blemidi_set_pre_flush_callback(void (*callback_pre_flush)(void))
+{
+  blemidi_callback_pre_flush = callback_pre_flush;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Blocks until the output buffer has been armed, waits for the coalescing window and flushes
+////////////////////////////////////////////////////////////////////////////////////////////////////
+int32_t blemidi_outbuffer_wait_flush(uint32_t timeout_ms)
+{
+  if (blemidi_flush_sem == NULL)
+    return -1; // not initialized
 
-    // adding new message
-    if (blemidi_outbuffer_len[blemidi_port] == 0)
+  TickType_t timeout_ticks = (timeout_ms == BLEMIDI_WAIT_FOREVER) ? portMAX_DELAY : pdMS_TO_TICKS(timeout_ms);
+  for (;;)
+  {
+    // packets rejected by the BLE stack are retried periodically, congestion waits for the event
+    bool retry = blemidi_tx_retry_pending();
+    if (xSemaphoreTake(blemidi_flush_sem, retry ? pdMS_TO_TICKS(BLEMIDI_TX_RETRY_MS) : timeout_ticks) == pdTRUE)
     {
-      // new packet: with timestampHigh and timestampLow, or in case of continued SysEx packet: only timestampHigh
-      blemidi_outbuffer[blemidi_port][blemidi_outbuffer_len[blemidi_port]++] = blemidi_timestamp_high();
-      if (stream[0] >= 0x80)
-      {
-        blemidi_outbuffer[blemidi_port][blemidi_outbuffer_len[blemidi_port]++] = blemidi_timestamp_low();
-      }
+      if (atomic_load(&blemidi_flush_armed))
+        break;
+      blemidi_tx_drain(); // congestion is over
+    }
+    else if (retry)
+    {
+      blemidi_tx_drain();
     }
     else
     {
-      blemidi_outbuffer[blemidi_port][blemidi_outbuffer_len[blemidi_port]++] = blemidi_timestamp_low();
+      return -2; // nothing to send
     }
+  }
 
-    memcpy(&blemidi_outbuffer[blemidi_port][blemidi_outbuffer_len[blemidi_port]], stream, len);
-    blemidi_outbuffer_len[blemidi_port] += len;
+  // let further messages join the packet until the window has passed
+  int64_t deadline_us = atomic_load(&blemidi_flush_armed_us) + (int64_t)blemidi_flush_window_ms * 1000;
+  int64_t remaining_us = deadline_us - esp_timer_get_time();
+  if (remaining_us > 0)
+  {
+    vTaskDelay(pdMS_TO_TICKS((remaining_us + 999) / 1000));
+  }
+
+  int64_t now_us = blemidi_update_timestamp();
+  if (atomic_load(&blemidi_flush_armed)) // could have been flushed by blemidi_tick() meanwhile
+  {
+    blemidi_outbuffer_flush_all();
   }
 
+  int64_t late_us = now_us - deadline_us;
+  if (late_us < 0)
+    return 0;
+  return (late_us > INT32_MAX) ? INT32_MAX : (int32_t)late_us;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Coalescing window between the first buffered message and the flush
+////////////////////////////////////////////////////////////////////////////////////////////////////
+int32_t blemidi_set_flush_window(uint8_t window_ms)
+{
+  if (window_ms > BLEMIDI_OUTBUFFER_FLUSH_MAX_MS)
+    return -1; // out of range
+
+  blemidi_flush_window_ms = window_ms;
   return 0; // no error
 }
 
+uint8_t blemidi_get_flush_window(void)
+{
+  return blemidi_flush_window_ms;
+}
+
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 // Sends a BLE MIDI message
 ////////////////////////////////////////////////////////////////////////////////////////////////////
-int32_t blemidi_send_message(uint8_t blemidi_port, uint8_t* stream, size_t len)
+static int32_t blemidi_send(uint8_t blemidi_port, uint8_t* stream, size_t len, bool priority, uint16_t timestamp)
 {
   const size_t max_header_size = 2;
 
@@ -336,18 +758,29 @@ int32_t blemidi_send_message(uint8_t blemidi_port, uint8_t* stream, size_t len)
 
   // we've to consider blemidi_mtu
   // if more bytes need to be sent, split over multiple packets
-  // this will cost some extra stack space :-/ therefore handled separatly?
+  size_t mtu = atomic_load(&blemidi_mtu);
 
-  if (len < (blemidi_mtu - max_header_size))
+  if (len < (mtu - max_header_size))
   {
     // just add to output buffer
-    blemidi_outbuffer_push(blemidi_port, stream, len);
+    return blemidi_outbuffer_push(blemidi_port, stream, len, priority, timestamp);
+  }
+  else if (mtu <= 3)
+  {
+    return -1; // no room for data
   }
   else
   {
-    // sending packets
-    size_t max_size = blemidi_mtu - max_header_size; // -3 since blemidi_outbuffer_push() will add the timestamps
-    int pos;
+    // sending packets immediately, each one is written into the transmit queue
+    size_t max_size = mtu - 3; // -3 for the timestamps, and the timestampLow in front of the final F7
+    size_t pos;
+
+    BLEMIDI_LATENCY_MARK(BLEMIDI_LATENCY_STAGE_PUSH);
+    blemidi_update_timestamp();
+
+    // send what has been buffered before, so that the order is kept
+    int32_t flush_status = blemidi_outbuffer_flush(blemidi_port);
+
     for (pos = 0; pos < len; pos += max_size)
     {
       size_t packet_len = len - pos;
@@ -355,202 +788,508 @@ int32_t blemidi_send_message(uint8_t blemidi_port, uint8_t* stream, size_t len)
       {
         packet_len = max_size;
       }
-      blemidi_outbuffer_push(blemidi_port, &stream[pos], packet_len);
+      // the rest of a SysEx stream with a gap is useless to the receiver, it's dropped as well
+      int32_t status = blemidi_tx_enqueue_message(&stream[pos], packet_len);
+      if (status < 0)
+        return status; // -1: MTU has been increased beyond the packet buffer, -2: dropped
+      blemidi_tx_drain();
     }
+
+    return flush_status; // -2 if the packet buffered before was dropped
   }
 
 
   return 0; // no error
 }
 
+int32_t blemidi_send_message(uint8_t blemidi_port, uint8_t* stream, size_t len)
+{
+  return blemidi_send(blemidi_port, stream, len, false, BLEMIDI_TIMESTAMP_NOW);
+}
+
+int32_t blemidi_send_priority_message(uint8_t blemidi_port, uint8_t* stream, size_t len)
+{
+  return blemidi_send(blemidi_port, stream, len, true, BLEMIDI_TIMESTAMP_NOW);
+}
+
+int32_t blemidi_send_timestamped_message(uint8_t blemidi_port, uint8_t* stream, size_t len, uint16_t timestamp, bool priority)
+{
+  return blemidi_send(blemidi_port, stream, len, priority, timestamp);
+}
+
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Sends several channel messages in the same BLE packet
+////////////////////////////////////////////////////////////////////////////////////////////////////
+int32_t blemidi_send_transaction(uint8_t blemidi_port, uint8_t* stream, size_t len, bool priority)
+{
+  return blemidi_send_timestamped_transaction(blemidi_port, stream, len, BLEMIDI_TIMESTAMP_NOW, priority);
+}
+
+int32_t blemidi_send_timestamped_transaction(uint8_t blemidi_port, uint8_t* stream, size_t len, uint16_t timestamp, bool priority)
+{
+  int32_t status;
+  int32_t flush_status = 0;
+
+  if (blemidi_port >= BLEMIDI_NUM_PORTS)
+    return -1; // invalid port
+
+  BLEMIDI_LATENCY_MARK(BLEMIDI_LATENCY_STAGE_PUSH);
+
+  int64_t now_us = blemidi_update_timestamp();
+  if (timestamp == BLEMIDI_TIMESTAMP_NOW)
+    timestamp = blemidi_timestamp_at(now_us);
+
+  // flush first if the messages don't fit into the current packet anymore, they are never split
+  while ((status = blemidi_packet_append_group(&blemidi_outbuffer[blemidi_port], timestamp, stream, len, priority)) == -2)
+    flush_status = blemidi_outbuffer_flush(blemidi_port);
+
+  if (status < 0)
+    return -1; // invalid messages, or more than fits into a packet
+
+  // first message of a new packet: start the coalescing window and wake up the flush task
+  if (status == 1)
+    blemidi_outbuffer_request_flush();
+
+  return flush_status; // -2 if the packet flushed to make room was dropped
+}
+
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 // For internal usage only: receives a BLE MIDI packet and calls the specified callback function.
 // The user will specify this callback while calling blemidi_init()
 ////////////////////////////////////////////////////////////////////////////////////////////////////
-static int32_t blemidi_receive_packet(uint8_t blemidi_port, uint8_t* stream, size_t len, void* _callback_midi_message_received)
+static int32_t blemidi_receive_packet(uint8_t blemidi_port, blemidi_parser_t* parser, uint8_t* stream, size_t len, void* _callback_midi_message_received)
 {
-  void (*callback_midi_message_received)(uint8_t blemidi_port, uint16_t timestamp, uint8_t midi_status, uint8_t * remaining_message, size_t len, size_t continued_sysex_pos) = _callback_midi_message_received;
-
   if (blemidi_port >= BLEMIDI_NUM_PORTS)
     return -1; // invalid port
 
+  return blemidi_parse_packet(parser, blemidi_port, stream, len, (blemidi_message_callback_t) _callback_midi_message_received);
+}
+
+
+#if BLEMIDI_ENABLE_RX_TRACE
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Receive trace hooks of the parser, only built with BLEMIDI_ENABLE_RX_TRACE
+////////////////////////////////////////////////////////////////////////////////////////////////////
+void blemidi_rx_trace_packet(uint8_t blemidi_port, const uint8_t* stream, size_t len)
+{
   ESP_LOGI(BLEMIDI_TAG, "receive_packet blemidi_port=%d, len=%d, stream:", blemidi_port, len);
   ESP_LOG_BUFFER_HEX(BLEMIDI_TAG, stream, len);
+}
+
+void blemidi_rx_trace_error(uint8_t blemidi_port, int32_t error, size_t pos)
+{
+  ESP_LOGE(BLEMIDI_TAG, "receive_packet blemidi_port=%d: malformed packet, error %d at byte %d", blemidi_port, error, pos);
+}
+#endif
+
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Receive Queue: the Bluetooth task parses and enqueues, the application task processes
+////////////////////////////////////////////////////////////////////////////////////////////////////
+static void blemidi_rx_enqueue(uint8_t blemidi_port, uint16_t timestamp, uint8_t midi_status, uint8_t* remaining_message, size_t len, size_t continued_sysex_pos)
+{
+  if (blemidi_rxqueue_push(&blemidi_rxqueue, blemidi_port, timestamp, midi_status, remaining_message, len, continued_sysex_pos, blemidi_rx_packet_received_us) < 0)
+    blemidi_rx_packet_dropped++;
+  else
+    blemidi_rx_packet_queued++;
+}
+
+// Called from the GATT write event for each packet
+static void blemidi_rx_handle_packet(blemidi_parser_t* parser, uint8_t* stream, size_t len)
+{
+  int64_t start_us = esp_timer_get_time();
+  bool (*callback_notify)(void* arg) = blemidi_callback_rx_notify;
 
-  // detect continued SysEx
-  uint8_t continued_sysex = 0;
-  if (len > 2 && (stream[0] & 0x80) && !(stream[1] & 0x80))
+  blemidi_rx_packet_queued = 0;
+  blemidi_rx_packet_dropped = 0;
+  blemidi_rx_packet_received_us = start_us;
+  if (callback_notify == NULL)
   {
-    continued_sysex = 1;
+    // no application task: the receive callback runs in the Bluetooth task
+    blemidi_rx_callback_received_us = start_us;
+    blemidi_receive_packet(0, parser, stream, len, blemidi_callback_midi_message_received);
   }
   else
   {
-    blemidi_continued_sysex_pos[blemidi_port] = 0;
+    blemidi_receive_packet(0, parser, stream, len, blemidi_rx_enqueue);
+
+    if (blemidi_rx_packet_queued && !atomic_exchange(&blemidi_rx_notify_pending, true))
+    {
+      if (!callback_notify(blemidi_rx_notify_arg))
+        atomic_store(&blemidi_rx_notify_pending, false);
+    }
   }
 
+  uint32_t depth = blemidi_rxqueue_count(&blemidi_rxqueue);
+  uint32_t elapsed_us = (uint32_t) (esp_timer_get_time() - start_us);
+
+  portENTER_CRITICAL(&blemidi_rx_stats_lock);
+  blemidi_rx_stats.packets++;
+  blemidi_rx_stats.queued += blemidi_rx_packet_queued;
+  blemidi_rx_stats.dropped += blemidi_rx_packet_dropped;
+  if (depth > blemidi_rx_stats.max_depth)
+    blemidi_rx_stats.max_depth = depth;
+  blemidi_latency_hist_add(&blemidi_rx_stats.handler_time, elapsed_us);
+  portEXIT_CRITICAL(&blemidi_rx_stats_lock);
+}
+
+void blemidi_set_receive_notify_callback(bool (*callback_notify)(void* arg), void* arg)
+{
+  blemidi_rx_notify_arg = arg;
+  blemidi_callback_rx_notify = callback_notify;
+}
+
+size_t blemidi_process_received(size_t max_messages)
+{
+  size_t count = 0;
+  blemidi_rxqueue_slot_t* slot;
+
+  // re-arm first: messages queued after this point notify again
+  atomic_store(&blemidi_rx_notify_pending, false);
+  atomic_thread_fence(memory_order_seq_cst);
 
-  if (len < 3)
+  while (count < max_messages && (slot = blemidi_rxqueue_peek(&blemidi_rxqueue)) != NULL)
   {
-    ESP_LOGE(BLEMIDI_TAG, "stream length should be >=3");
-    return -1;
+    blemidi_rx_callback_received_us = slot->received_us;
+    if (blemidi_callback_midi_message_received)
+      blemidi_callback_midi_message_received(slot->blemidi_port, slot->timestamp, slot->midi_status, slot->data, slot->len, slot->continued_sysex_pos);
+    blemidi_rxqueue_release(&blemidi_rxqueue);
+    count++;
   }
-  else if (!(stream[0] & 0x80))
+
+  return count;
+}
+
+int64_t blemidi_get_received_time(void)
+{
+  return blemidi_rx_callback_received_us;
+}
+
+void blemidi_get_rx_stats(blemidi_rx_stats_t* stats)
+{
+  portENTER_CRITICAL(&blemidi_rx_stats_lock);
+  *stats = blemidi_rx_stats;
+  portEXIT_CRITICAL(&blemidi_rx_stats_lock);
+}
+
+void blemidi_reset_rx_stats(void)
+{
+  portENTER_CRITICAL(&blemidi_rx_stats_lock);
+  memset(&blemidi_rx_stats, 0, sizeof(blemidi_rx_stats));
+  portEXIT_CRITICAL(&blemidi_rx_stats_lock);
+}
+
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Dummy callback for demo and debugging purposes
+////////////////////////////////////////////////////////////////////////////////////////////////////
+void blemidi_receive_packet_callback_for_debugging(uint8_t blemidi_port, uint16_t timestamp, uint8_t midi_status, uint8_t* remaining_message, size_t len, size_t continued_sysex_pos)
+{
+  ESP_LOGI(BLEMIDI_TAG, "receive_packet CALLBACK blemidi_port=%d, timestamp=%d, midi_status=0x%02x, len=%d, continued_sysex_pos=%d, remaining_message:", blemidi_port, timestamp, midi_status, len, continued_sysex_pos);
+  ESP_LOG_BUFFER_HEX(BLEMIDI_TAG, remaining_message, len);
+}
+
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// From GATT Server Demo (customized for BLE MIDI service)
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+/* Full Database Description - Used to add attributes into the database */
+static const esp_gatts_attr_db_t gatt_db[HRS_IDX_NB] =
+{
+  // Service Declaration
+  [IDX_SVC] =
+  {{ESP_GATT_AUTO_RSP}, {ESP_UUID_LEN_16, (uint8_t*) &primary_service_uuid, ESP_GATT_PERM_READ,
+    16, sizeof(midi_service_uuid), (uint8_t*) &midi_service_uuid}},
+
+  /* Characteristic Declaration */
+  [IDX_CHAR_A] =
+  {{ESP_GATT_AUTO_RSP}, {ESP_UUID_LEN_16, (uint8_t*) &character_declaration_uuid, ESP_GATT_PERM_READ,
+    CHAR_DECLARATION_SIZE, CHAR_DECLARATION_SIZE, (uint8_t*) &char_prop_read_write_writenr_notify}},
+
+  /* Characteristic Value */
+  [IDX_CHAR_VAL_A] =
+  {{ESP_GATT_AUTO_RSP}, {ESP_UUID_LEN_128, (uint8_t*) &midi_characteristics_uuid, ESP_GATT_PERM_READ | ESP_GATT_PERM_WRITE,
+    GATTS_MIDI_CHAR_VAL_LEN_MAX, sizeof(char_value), (uint8_t*) char_value}},
+
+  /* Client Characteristic Configuration Descriptor (this is a BLE2902 descriptor) */
+  [IDX_CHAR_CFG_A] =
+  {{ESP_GATT_AUTO_RSP}, {ESP_UUID_LEN_16, (uint8_t*) &character_client_config_uuid, ESP_GATT_PERM_READ | ESP_GATT_PERM_WRITE,
+    sizeof(uint16_t), sizeof(blemidi_ccc), (uint8_t*) blemidi_ccc}},
+};
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Link profiles
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static int blemidi_conn_find(uint16_t conn_id)
+{
+  int i;
+  for (i = 0; i < BLEMIDI_MAX_CONNECTIONS; ++i)
   {
-    ESP_LOGE(BLEMIDI_TAG, "missing timestampHigh");
-    return -2;
+    if (blemidi_conns[i].in_use && blemidi_conns[i].link.conn_id == conn_id)
+      return i;
   }
-  else
+  return -1;
+}
+
+static int blemidi_conn_find_bda(const esp_bd_addr_t bda)
+{
+  int i;
+  for (i = 0; i < BLEMIDI_MAX_CONNECTIONS; ++i)
   {
-    size_t pos = 0;
+    if (blemidi_conns[i].in_use && memcmp(blemidi_conns[i].bda, bda, sizeof(esp_bd_addr_t)) == 0)
+      return i;
+  }
+  return -1;
+}
+
+// limits BLE MIDI packets to the maximum of the selected profile and the smallest MTU of all centrals
+// which receive packets, so that each packet can be sent to every one of them
+static void blemidi_link_update_max_len(void)
+{
+  const blemidi_link_profile_config_t* config = &blemidi_link_profiles[atomic_load(&blemidi_link_profile)];
+  uint8_t blemidi_port;
+  size_t len = (GATTS_MIDI_CHAR_VAL_LEN_MAX - 3);
+  int i;
 
-    // getting timestamp
-    uint16_t timestamp = (stream[pos++] & 0x3f) << 7;
+  if (len > config->max_packet_len)
+    len = config->max_packet_len;
 
-    // parsing stream
+  // called by the BT task and the senders, the limit is stored under the lock so a stale one never wins
+  portENTER_CRITICAL(&blemidi_link_lock);
+  for (i = 0; i < BLEMIDI_MAX_CONNECTIONS; ++i)
+  {
+    if (blemidi_conns[i].in_use && blemidi_conns[i].mtu_known)
     {
-      //! Number if expected bytes for a common MIDI event - 1
-      const uint8_t midi_expected_bytes_common[8] = {
-        2, // Note On
-        2, // Note Off
-        2, // Poly Preasure
-        2, // Controller
-        1, // Program Change
-        1, // Channel Preasure
-        2, // Pitch Bender
-        0, // System Message - must be zero, so that mios32_midi_expected_bytes_system[] will be used
-      };
-
-      //! Number if expected bytes for a system MIDI event - 1
-      const uint8_t midi_expected_bytes_system[16] = {
-        1, // SysEx Begin (endless until SysEx End F7)
-        1, // MTC Data frame
-        2, // Song Position
-        1, // Song Select
-        0, // Reserved
-        0, // Reserved
-        0, // Request Tuning Calibration
-        0, // SysEx End
-
-        // Note: just only for documentation, Realtime Messages don't change the running status
-        0, // MIDI Clock
-        0, // MIDI Tick
-        0, // MIDI Start
-        0, // MIDI Continue
-        0, // MIDI Stop
-        0, // Reserved
-        0, // Active Sense
-        0, // Reset
-      };
-
-      uint8_t midi_status = continued_sysex ? 0xf0 : 0x00;
-
-      while (pos < len)
-      {
-        if (!(stream[pos] & 0x80))
-        {
-          if (!continued_sysex)
-          {
-            ESP_LOGE(BLEMIDI_TAG, "missing timestampLow in parsed message");
-            return -3;
-          }
-        }
-        else
-        {
-          timestamp &= ~0x7f;
-          timestamp |= stream[pos++] & 0x7f;
-          continued_sysex = 0;
-          blemidi_continued_sysex_pos[blemidi_port] = 0;
-        }
+      size_t conn_len = (blemidi_conns[i].link.mtu <= 3) ? 3 : (blemidi_conns[i].link.mtu - 3);
+      if (len > conn_len)
+        len = conn_len;
+    }
+  }
+  for (i = 0; i < BLEMIDI_MAX_CONNECTIONS; ++i)
+  {
+    blemidi_conns[i].link.max_packet_len = len;
+  }
+  atomic_store(&blemidi_mtu, len);
+  for (blemidi_port = 0; blemidi_port < BLEMIDI_NUM_PORTS; ++blemidi_port)
+    blemidi_packet_set_max_len(&blemidi_outbuffer[blemidi_port], len);
+  portEXIT_CRITICAL(&blemidi_link_lock);
+}
 
-        if (stream[pos] & 0x80)
-        {
-          midi_status = stream[pos++];
-        }
+// CCC values of bonded centrals, one key per address; bonds of the BT stack are kept in NVS as well
+static void blemidi_ccc_key(const esp_bd_addr_t bda, char* key, size_t size)
+{
+  snprintf(key, size, "ccc%02x%02x%02x%02x%02x%02x", bda[0], bda[1], bda[2], bda[3], bda[4], bda[5]);
+}
 
-        if (midi_status == 0xf0)
-        {
-          size_t num_bytes;
-          for (num_bytes = 0; stream[pos + num_bytes] < 0x80; ++num_bytes)
-          {
-            if ((pos + num_bytes) >= len)
-            {
-              break;
-            }
-          }
-          if (_callback_midi_message_received)
-          {
-            callback_midi_message_received(blemidi_port, timestamp, midi_status, &stream[pos], num_bytes, blemidi_continued_sysex_pos[blemidi_port]);
-          }
-          pos += num_bytes;
-          blemidi_continued_sysex_pos[blemidi_port] += num_bytes; // we expect another packet with the remaining SysEx stream
-        }
-        else
-        {
-          uint8_t num_bytes = midi_expected_bytes_common[(midi_status >> 4) & 0x7];
-          if (num_bytes == 0)
-          { // System Message
-            num_bytes = midi_expected_bytes_system[midi_status & 0xf];
-          }
-
-          if ((pos + num_bytes) > len)
-          {
-            ESP_LOGE(BLEMIDI_TAG, "missing %d bytes in parsed message", num_bytes);
-            return -5;
-          }
-          else
-          {
-            if (_callback_midi_message_received)
-            {
-              callback_midi_message_received(blemidi_port, timestamp, midi_status, &stream[pos], num_bytes, 0);
-            }
-            pos += num_bytes;
-          }
-        }
-      }
+static uint8_t blemidi_ccc_load(const esp_bd_addr_t bda)
+{
+  char key[NVS_KEY_NAME_MAX_SIZE];
+  nvs_handle_t nvs;
+  uint8_t subscribed = 0;
+
+  blemidi_ccc_key(bda, key, sizeof(key));
+  if (nvs_open(BLEMIDI_NVS_NAMESPACE, NVS_READONLY, &nvs) != ESP_OK)
+    return 0; // nothing stored yet
+  if (nvs_get_u8(nvs, key, &subscribed) != ESP_OK)
+    subscribed = 0;
+  nvs_close(nvs);
+  return subscribed;
+}
+
+// called by the BT task when a bonded central writes its CCC and when a bond is removed
+static void blemidi_ccc_store(const esp_bd_addr_t bda, uint8_t subscribed)
+{
+  char key[NVS_KEY_NAME_MAX_SIZE];
+  nvs_handle_t nvs;
+  esp_err_t err;
+
+  blemidi_ccc_key(bda, key, sizeof(key));
+  err = nvs_open(BLEMIDI_NVS_NAMESPACE, NVS_READWRITE, &nvs);
+  if (err == ESP_OK)
+  {
+    if (subscribed)
+      err = nvs_set_u8(nvs, key, 1);
+    else
+    {
+      err = nvs_erase_key(nvs, key);
+      if (err == ESP_ERR_NVS_NOT_FOUND)
+        err = ESP_OK;
     }
+    if (err == ESP_OK)
+      err = nvs_commit(nvs);
+    nvs_close(nvs);
+  }
+  if (err != ESP_OK)
+    ESP_LOGW(BLEMIDI_TAG, "storing the CCC value failed: %s", esp_err_to_name(err));
+}
+
+// the data length event doesn't tell the central, so only one slot has a request outstanding
+// and the others wait for its answer
+static void blemidi_link_request_data_len(void)
+{
+  const blemidi_link_profile_config_t* config = &blemidi_link_profiles[atomic_load(&blemidi_link_profile)];
+  esp_bd_addr_t bda;
+  int next = -1;
+  int i;
+
+  portENTER_CRITICAL(&blemidi_link_lock);
+  for (i = 0; i < BLEMIDI_MAX_CONNECTIONS; ++i)
+  {
+    if (blemidi_conns[i].data_len_requested)
+      break;
+    if (next < 0 && blemidi_conns[i].in_use && blemidi_conns[i].data_len_wanted)
+      next = i;
+  }
+  if (i < BLEMIDI_MAX_CONNECTIONS || next < 0)
+  {
+    portEXIT_CRITICAL(&blemidi_link_lock);
+    return;
+  }
+  blemidi_conns[next].data_len_wanted = false;
+  blemidi_conns[next].data_len_requested = true;
+  memcpy(bda, blemidi_conns[next].bda, sizeof(esp_bd_addr_t));
+  portEXIT_CRITICAL(&blemidi_link_lock);
+
+  if (esp_ble_gap_set_pkt_data_len(bda, config->tx_data_len) != ESP_OK)
+  {
+    portENTER_CRITICAL(&blemidi_link_lock);
+    blemidi_conns[next].data_len_requested = false;
+    portEXIT_CRITICAL(&blemidi_link_lock);
+  }
+}
+
+// asks a central for the parameters of the selected profile, results are reported by GAP events
+static void blemidi_link_request(int conn)
+{
+  const blemidi_link_profile_config_t* config = &blemidi_link_profiles[atomic_load(&blemidi_link_profile)];
+  esp_bd_addr_t bda;
+
+  portENTER_CRITICAL(&blemidi_link_lock);
+  memcpy(bda, blemidi_conns[conn].bda, sizeof(esp_bd_addr_t));
+  portEXIT_CRITICAL(&blemidi_link_lock);
+
+  esp_ble_conn_update_params_t conn_params = { 0 };
+  memcpy(conn_params.bda, bda, sizeof(esp_bd_addr_t));
+  /* For the iOS system, please refer to Apple official documents about the BLE connection parameters restrictions. */
+  conn_params.latency = config->latency;
+  conn_params.max_int = config->max_int;
+  conn_params.min_int = config->min_int;
+  conn_params.timeout = config->timeout;
+  //start sent the update connection parameters to the peer device.
+  esp_ble_gap_update_conn_params(&conn_params);
+
+  if (config->tx_data_len)
+  {
+    portENTER_CRITICAL(&blemidi_link_lock);
+    blemidi_conns[conn].data_len_wanted = true;
+    portEXIT_CRITICAL(&blemidi_link_lock);
+    blemidi_link_request_data_len();
+  }
+
+#if CONFIG_BT_BLE_50_FEATURES_SUPPORTED
+  {
+    esp_ble_gap_phy_mask_t phy_mask = config->prefer_2m_phy ? ESP_BLE_GAP_PHY_2M_PREF_MASK : ESP_BLE_GAP_PHY_1M_PREF_MASK;
+    esp_ble_gap_set_preferred_phy(bda, 0, phy_mask, phy_mask, ESP_BLE_GAP_PHY_OPTIONS_NO_PREF);
+  }
+#else
+  if (config->prefer_2m_phy)
+    ESP_LOGI(BLEMIDI_TAG, "2M PHY not requested, it requires CONFIG_BT_BLE_50_FEATURES_SUPPORTED");
+#endif
+
+  ESP_LOGI(BLEMIDI_TAG, "requested link profile %s for connection %d", config->name, conn);
+}
+
+int32_t blemidi_set_link_profile(blemidi_link_profile_t profile)
+{
+  if (profile < 0 || profile >= BLEMIDI_LINK_PROFILE_NUM)
+    return -1; // invalid profile
+
+  atomic_store(&blemidi_link_profile, profile);
+  blemidi_link_update_max_len();
+
+  // the slots are changed by the BT task meanwhile; the GAP requests are queued to it,
+  // so they are made outside of the lock
+  uint8_t in_use = 0;
+  int i;
+  portENTER_CRITICAL(&blemidi_link_lock);
+  for (i = 0; i < BLEMIDI_MAX_CONNECTIONS; ++i)
+  {
+    if (blemidi_conns[i].in_use)
+      in_use |= 1 << i;
+  }
+  portEXIT_CRITICAL(&blemidi_link_lock);
+
+  for (i = 0; i < BLEMIDI_MAX_CONNECTIONS; ++i)
+  {
+    if (in_use & (1 << i))
+      blemidi_link_request(i);
   }
 
   return 0; // no error
 }
 
+blemidi_link_profile_t blemidi_get_link_profile(void)
+{
+  return (blemidi_link_profile_t) atomic_load(&blemidi_link_profile);
+}
 
-////////////////////////////////////////////////////////////////////////////////////////////////////
-// Dummy callback for demo and debugging purposes
-////////////////////////////////////////////////////////////////////////////////////////////////////
-void blemidi_receive_packet_callback_for_debugging(uint8_t blemidi_port, uint16_t timestamp, uint8_t midi_status, uint8_t* remaining_message, size_t len, size_t continued_sysex_pos)
+const char* blemidi_get_link_profile_name(blemidi_link_profile_t profile)
 {
-  ESP_LOGI(BLEMIDI_TAG, "receive_packet CALLBACK blemidi_port=%d, timestamp=%d, midi_status=0x%02x, len=%d, continued_sysex_pos=%d, remaining_message:", blemidi_port, timestamp, midi_status, len, continued_sysex_pos);
-  ESP_LOG_BUFFER_HEX(BLEMIDI_TAG, remaining_message, len);
+  if (profile < 0 || profile >= BLEMIDI_LINK_PROFILE_NUM)
+    return NULL;
+
+  return blemidi_link_profiles[profile].name;
+}
+
+void blemidi_get_link_info(blemidi_link_info_t* info)
+{
+  int i;
+  int first = -1;
+  uint8_t connected = 0;
+
+  memset(info, 0, sizeof(blemidi_link_info_t));
+  portENTER_CRITICAL(&blemidi_link_lock);
+  for (i = BLEMIDI_MAX_CONNECTIONS - 1; i >= 0; --i)
+  {
+    if (blemidi_conns[i].in_use)
+    {
+      *info = blemidi_conns[i].link;
+      first = i;
+      connected++;
+    }
+  }
+  info->max_packet_len = blemidi_conns[0].link.max_packet_len;
+  portEXIT_CRITICAL(&blemidi_link_lock);
+
+  info->profile = blemidi_get_link_profile();
+  info->connected = connected;
+  info->congested = (first >= 0 && (atomic_load(&blemidi_tx_congested) & (1 << first))) ? 1 : 0;
 }
 
+int32_t blemidi_get_connection_info(uint8_t index, blemidi_link_info_t* info)
+{
+  bool in_use;
 
-////////////////////////////////////////////////////////////////////////////////////////////////////
-// From GATT Server Demo (customized for BLE MIDI service)
-////////////////////////////////////////////////////////////////////////////////////////////////////
+  if (index >= BLEMIDI_MAX_CONNECTIONS)
+    return -1; // invalid slot
 
-/* Full Database Description - Used to add attributes into the database */
-static const esp_gatts_attr_db_t gatt_db[HRS_IDX_NB] =
-{
-  // Service Declaration
-  [IDX_SVC] =
-  {{ESP_GATT_AUTO_RSP}, {ESP_UUID_LEN_16, (uint8_t*) &primary_service_uuid, ESP_GATT_PERM_READ,
-    16, sizeof(midi_service_uuid), (uint8_t*) &midi_service_uuid}},
+  portENTER_CRITICAL(&blemidi_link_lock);
+  in_use = blemidi_conns[index].in_use;
+  *info = blemidi_conns[index].link;
+  info->rx_errors = blemidi_conns[index].parser.num_errors;
+  portEXIT_CRITICAL(&blemidi_link_lock);
 
-  /* Characteristic Declaration */
-  [IDX_CHAR_A] =
-  {{ESP_GATT_AUTO_RSP}, {ESP_UUID_LEN_16, (uint8_t*) &character_declaration_uuid, ESP_GATT_PERM_READ,
-    CHAR_DECLARATION_SIZE, CHAR_DECLARATION_SIZE, (uint8_t*) &char_prop_read_write_writenr_notify}},
+  if (!in_use)
+    return -1; // not connected
 
-  /* Characteristic Value */
-  [IDX_CHAR_VAL_A] =
-  {{ESP_GATT_AUTO_RSP}, {ESP_UUID_LEN_128, (uint8_t*) &midi_characteristics_uuid, ESP_GATT_PERM_READ | ESP_GATT_PERM_WRITE,
-    GATTS_MIDI_CHAR_VAL_LEN_MAX, sizeof(char_value), (uint8_t*) char_value}},
+  info->profile = blemidi_get_link_profile();
+  info->congested = (atomic_load(&blemidi_tx_congested) & (1 << index)) ? 1 : 0;
+  return 0; // no error
+}
 
-  /* Client Characteristic Configuration Descriptor (this is a BLE2902 descriptor) */
-  [IDX_CHAR_CFG_A] =
-  {{ESP_GATT_AUTO_RSP}, {ESP_UUID_LEN_16, (uint8_t*) &character_client_config_uuid, ESP_GATT_PERM_READ | ESP_GATT_PERM_WRITE,
-    sizeof(uint16_t), sizeof(blemidi_ccc), (uint8_t*) blemidi_ccc}},
-};
 
 static void gap_event_handler(esp_gap_ble_cb_event_t event, esp_ble_gap_cb_param_t* param)
 {
@@ -599,7 +1338,62 @@ static void gap_event_handler(esp_gap_ble_cb_event_t event, esp_ble_gap_cb_param
       param->update_conn_params.conn_int,
       param->update_conn_params.latency,
       param->update_conn_params.timeout);
+    if (param->update_conn_params.status == ESP_BT_STATUS_SUCCESS)
+    {
+      int conn = blemidi_conn_find_bda(param->update_conn_params.bda);
+      if (conn >= 0)
+      {
+        portENTER_CRITICAL(&blemidi_link_lock);
+        blemidi_conns[conn].link.conn_interval = param->update_conn_params.conn_int;
+        blemidi_conns[conn].link.latency = param->update_conn_params.latency;
+        blemidi_conns[conn].link.timeout = param->update_conn_params.timeout;
+        portEXIT_CRITICAL(&blemidi_link_lock);
+      }
+    }
+    break;
+  case ESP_GAP_BLE_SET_PKT_LENGTH_COMPLETE_EVT:
+    ESP_LOGI(BLEMIDI_TAG, "packet length status = %d, rx_len = %d, tx_len = %d",
+      param->pkt_data_length_cmpl.status,
+      param->pkt_data_length_cmpl.params.rx_len,
+      param->pkt_data_length_cmpl.params.tx_len);
+    {
+      // answers the one outstanding request, see blemidi_link_request_data_len()
+      portENTER_CRITICAL(&blemidi_link_lock);
+      for (int conn = 0; conn < BLEMIDI_MAX_CONNECTIONS; ++conn)
+      {
+        if (!blemidi_conns[conn].data_len_requested)
+          continue;
+        blemidi_conns[conn].data_len_requested = false;
+        if (param->pkt_data_length_cmpl.status == ESP_BT_STATUS_SUCCESS && blemidi_conns[conn].in_use)
+        {
+          blemidi_conns[conn].link.rx_data_len = param->pkt_data_length_cmpl.params.rx_len;
+          blemidi_conns[conn].link.tx_data_len = param->pkt_data_length_cmpl.params.tx_len;
+        }
+        break;
+      }
+      portEXIT_CRITICAL(&blemidi_link_lock);
+      blemidi_link_request_data_len();
+    }
+    break;
+#if CONFIG_BT_BLE_50_FEATURES_SUPPORTED
+  case ESP_GAP_BLE_PHY_UPDATE_COMPLETE_EVT:
+    ESP_LOGI(BLEMIDI_TAG, "PHY update status = %d, tx_phy = %d, rx_phy = %d",
+      param->phy_update.status,
+      param->phy_update.tx_phy,
+      param->phy_update.rx_phy);
+    if (param->phy_update.status == ESP_BT_STATUS_SUCCESS)
+    {
+      int conn = blemidi_conn_find_bda(param->phy_update.bda);
+      if (conn >= 0)
+      {
+        portENTER_CRITICAL(&blemidi_link_lock);
+        blemidi_conns[conn].link.tx_phy = param->phy_update.tx_phy;
+        blemidi_conns[conn].link.rx_phy = param->phy_update.rx_phy;
+        portEXIT_CRITICAL(&blemidi_link_lock);
+      }
+    }
     break;
+#endif
   case ESP_GAP_BLE_PASSKEY_REQ_EVT:
     ESP_LOGI(BLEMIDI_TAG, "ESP_GAP_BLE_PASSKEY_REQ_EVT");
     // No passkey required - just use default pairing
@@ -643,11 +1437,25 @@ static void gap_event_handler(esp_gap_ble_cb_event_t event, esp_ble_gap_cb_param
     else
     {
       ESP_LOGI(BLEMIDI_TAG, "Authentication complete, address type: %d", param->ble_security.auth_cmpl.addr_type);
+      int conn = blemidi_conn_find_bda(bd_addr);
+      if (conn >= 0 && (param->ble_security.auth_cmpl.auth_mode & ESP_LE_AUTH_BOND))
+      {
+        // a bonded central may rely on the CCC value it wrote in an earlier connection
+        uint8_t subscribed = blemidi_ccc_load(bd_addr);
+        ESP_LOGI(BLEMIDI_TAG, "connection %d is bonded, notifications %s", conn, subscribed ? "restored" : "off");
+        portENTER_CRITICAL(&blemidi_link_lock);
+        blemidi_conns[conn].bonded = true;
+        if (subscribed)
+          blemidi_conns[conn].link.subscribed = 1;
+        portEXIT_CRITICAL(&blemidi_link_lock);
+      }
     }
   }
   break;
   case ESP_GAP_BLE_REMOVE_BOND_DEV_COMPLETE_EVT:
     ESP_LOGI(BLEMIDI_TAG, "ESP_GAP_BLE_REMOVE_BOND_DEV_COMPLETE_EVT, status: %d", param->remove_bond_dev_cmpl.status);
+    if (param->remove_bond_dev_cmpl.status == ESP_BT_STATUS_SUCCESS)
+      blemidi_ccc_store(param->remove_bond_dev_cmpl.bd_addr, 0);
     break;
   default:
     break;
@@ -658,48 +1466,42 @@ static void blemidi_prepare_write_event_env(esp_gatt_if_t gatts_if, prepare_type
 {
   ESP_LOGI(BLEMIDI_TAG, "prepare write, handle = %d, value len = %d", param->write.handle, param->write.len);
   esp_gatt_status_t status = ESP_GATT_OK;
-  if (prepare_write_env->prepare_buf == NULL)
+  int conn = blemidi_conn_find(param->write.conn_id);
+  if (conn >= 0 && prepare_write_env->prepare_buf == NULL)
   {
-    prepare_write_env->prepare_buf = (uint8_t*) malloc(PREPARE_BUF_MAX_SIZE * sizeof(uint8_t));
+    prepare_write_env->prepare_buf = blemidi_prepare_buf;
     prepare_write_env->prepare_len = 0;
-    if (prepare_write_env->prepare_buf == NULL)
-    {
-      ESP_LOGE(BLEMIDI_TAG, "%s, Gatt_server prep no mem", __func__);
-      status = ESP_GATT_NO_RESOURCES;
-    }
+    prepare_write_env->conn = conn;
   }
-  else
+
+  if (conn < 0 || prepare_write_env->conn != conn)
   {
-    if (param->write.offset > PREPARE_BUF_MAX_SIZE)
-    {
-      status = ESP_GATT_INVALID_OFFSET;
-    }
-    else if ((param->write.offset + param->write.len) > PREPARE_BUF_MAX_SIZE)
-    {
-      status = ESP_GATT_INVALID_ATTR_LEN;
-    }
+    ESP_LOGW(BLEMIDI_TAG, "prepare write of connection %d rejected, connection %d has a long write open", conn, prepare_write_env->conn);
+    status = ESP_GATT_PREPARE_Q_FULL;
+  }
+  else if (param->write.offset > PREPARE_BUF_MAX_SIZE)
+  {
+    status = ESP_GATT_INVALID_OFFSET;
+  }
+  else if ((param->write.offset + param->write.len) > PREPARE_BUF_MAX_SIZE)
+  {
+    status = ESP_GATT_INVALID_ATTR_LEN;
   }
+
   /*send response when param->write.need_rsp is true */
   if (param->write.need_rsp)
   {
-    esp_gatt_rsp_t* gatt_rsp = (esp_gatt_rsp_t*) malloc(sizeof(esp_gatt_rsp_t));
-    if (gatt_rsp != NULL)
-    {
-      gatt_rsp->attr_value.len = param->write.len;
-      gatt_rsp->attr_value.handle = param->write.handle;
-      gatt_rsp->attr_value.offset = param->write.offset;
-      gatt_rsp->attr_value.auth_req = ESP_GATT_AUTH_REQ_NONE;
-      memcpy(gatt_rsp->attr_value.value, param->write.value, param->write.len);
-      esp_err_t response_err = esp_ble_gatts_send_response(gatts_if, param->write.conn_id, param->write.trans_id, status, gatt_rsp);
-      if (response_err != ESP_OK)
-      {
-        ESP_LOGE(BLEMIDI_TAG, "Send response error");
-      }
-      free(gatt_rsp);
-    }
-    else
+    esp_gatt_rsp_t* gatt_rsp = &blemidi_prepare_rsp;
+    memset(gatt_rsp, 0, sizeof(esp_gatt_rsp_t));
+    gatt_rsp->attr_value.len = param->write.len;
+    gatt_rsp->attr_value.handle = param->write.handle;
+    gatt_rsp->attr_value.offset = param->write.offset;
+    gatt_rsp->attr_value.auth_req = ESP_GATT_AUTH_REQ_NONE;
+    memcpy(gatt_rsp->attr_value.value, param->write.value, param->write.len);
+    esp_err_t response_err = esp_ble_gatts_send_response(gatts_if, param->write.conn_id, param->write.trans_id, status, gatt_rsp);
+    if (response_err != ESP_OK)
     {
-      ESP_LOGE(BLEMIDI_TAG, "%s, malloc failed", __func__);
+      ESP_LOGE(BLEMIDI_TAG, "Send response error");
     }
   }
   if (status != ESP_GATT_OK)
@@ -715,6 +1517,12 @@ static void blemidi_prepare_write_event_env(esp_gatt_if_t gatts_if, prepare_type
 
 static void blemidi_exec_write_event_env(prepare_type_env_t* prepare_write_env, esp_ble_gatts_cb_param_t* param)
 {
+  if (prepare_write_env->prepare_buf && blemidi_conn_find(param->exec_write.conn_id) != prepare_write_env->conn)
+  {
+    ESP_LOGW(BLEMIDI_TAG, "exec write of conn_id %d ignored, the open long write belongs to another connection", param->exec_write.conn_id);
+    return;
+  }
+
   if (param->exec_write.exec_write_flag == ESP_GATT_PREP_WRITE_EXEC && prepare_write_env->prepare_buf)
   {
     ESP_LOG_BUFFER_HEX(BLEMIDI_TAG, prepare_write_env->prepare_buf, prepare_write_env->prepare_len);
@@ -723,11 +1531,7 @@ static void blemidi_exec_write_event_env(prepare_type_env_t* prepare_write_env,
   {
     ESP_LOGI(BLEMIDI_TAG, "ESP_GATT_PREP_WRITE_CANCEL");
   }
-  if (prepare_write_env->prepare_buf)
-  {
-    free(prepare_write_env->prepare_buf);
-    prepare_write_env->prepare_buf = NULL;
-  }
+  prepare_write_env->prepare_buf = NULL; // static buffer, see blemidi_prepare_buf
   prepare_write_env->prepare_len = 0;
 }
 
@@ -771,6 +1575,10 @@ static void gatts_profile_event_handler(esp_gatts_cb_event_t event, esp_gatt_if_
   case ESP_GATTS_WRITE_EVT:
     if (!param->write.is_prep)
     {
+      int conn = blemidi_conn_find(param->write.conn_id);
+      if (conn < 0)
+        break;
+
       if (midi_handle_table[IDX_CHAR_VAL_A] == param->write.handle)
       {
         // the data length of gattc write  must be less than blemidi_mtu.
@@ -778,7 +1586,21 @@ static void gatts_profile_event_handler(esp_gatts_cb_event_t event, esp_gatt_if_
         ESP_LOGI(BLEMIDI_TAG, "GATT_WRITE_EVT, handle = %d, value len = %d, value :", param->write.handle, param->write.len);
         ESP_LOG_BUFFER_HEX(BLEMIDI_TAG, param->write.value, param->write.len);
 #endif
-        blemidi_receive_packet(0, param->write.value, param->write.len, blemidi_callback_midi_message_received);
+        blemidi_rx_handle_packet(&blemidi_conns[conn].parser, param->write.value, param->write.len);
+      }
+      else if (midi_handle_table[IDX_CHAR_CFG_A] == param->write.handle && param->write.len == 2)
+      {
+        // the descriptor value is shared by all connections (auto response), the subscription is tracked here
+        uint8_t subscribed = (param->write.value[0] & 0x01) ? 1 : 0;
+        ESP_LOGI(BLEMIDI_TAG, "connection %d %s notifications", conn, subscribed ? "enabled" : "disabled");
+        portENTER_CRITICAL(&blemidi_link_lock);
+        blemidi_conns[conn].link.subscribed = subscribed;
+        bool bonded = blemidi_conns[conn].bonded;
+        portEXIT_CRITICAL(&blemidi_link_lock);
+        if (!subscribed)
+          atomic_fetch_or(&blemidi_tx_removed_targets, 1 << conn);
+        if (bonded)
+          blemidi_ccc_store(blemidi_conns[conn].bda, subscribed);
       }
     }
     else
@@ -796,18 +1618,38 @@ static void gatts_profile_event_handler(esp_gatts_cb_event_t event, esp_gatt_if_
     ESP_LOGI(BLEMIDI_TAG, "ESP_GATTS_MTU_EVT, MTU %d", param->mtu.mtu);
 
     // change MTU for BLE MIDI transactions
-    if (param->mtu.mtu <= 3)
+    // the packet length is MTU - 3 to prevent following driver warning:
+    //  (30774) BT_GATT: attribute value too long, to be truncated to 97
+    // the packets are limited to the smallest MTU of all centrals
     {
-      blemidi_mtu = 3; // very unlikely...
+      int conn = blemidi_conn_find(param->mtu.conn_id);
+      if (conn < 0)
+        break;
+      portENTER_CRITICAL(&blemidi_link_lock);
+      // failsave
+      blemidi_conns[conn].link.mtu = (param->mtu.mtu > GATTS_MIDI_CHAR_VAL_LEN_MAX) ? GATTS_MIDI_CHAR_VAL_LEN_MAX : param->mtu.mtu;
+      blemidi_conns[conn].mtu_known = true; // packets are sent to it from now on
+      portEXIT_CRITICAL(&blemidi_link_lock);
     }
-    else
+    blemidi_link_update_max_len();
+    break;
+  case ESP_GATTS_CONGEST_EVT:
+    ESP_LOGD(BLEMIDI_TAG, "ESP_GATTS_CONGEST_EVT, conn_id = %d, congested = %d", param->congest.conn_id, param->congest.congested);
     {
-      // we decrease -10 to prevent following driver warning:
-      //  (30774) BT_GATT: attribute value too long, to be truncated to 97
-      blemidi_mtu = param->mtu.mtu - 3;
-      // failsave
-      if (blemidi_mtu > (GATTS_MIDI_CHAR_VAL_LEN_MAX - 3))
-        blemidi_mtu = (GATTS_MIDI_CHAR_VAL_LEN_MAX - 3);
+      int conn = blemidi_conn_find(param->congest.conn_id);
+      if (conn < 0)
+        break;
+      if (param->congest.congested)
+      {
+        atomic_fetch_or(&blemidi_tx_congested, 1 << conn);
+        atomic_fetch_add(&blemidi_tx_congestion_events, 1);
+      }
+      else
+      {
+        atomic_fetch_and(&blemidi_tx_congested, ~(1 << conn));
+        if (blemidi_flush_sem != NULL)
+          xSemaphoreGive(blemidi_flush_sem); // let the flush task send what has been queued meanwhile
+      }
     }
     break;
   case ESP_GATTS_CONF_EVT:
@@ -817,24 +1659,94 @@ static void gatts_profile_event_handler(esp_gatts_cb_event_t event, esp_gatt_if_
     ESP_LOGI(BLEMIDI_TAG, "SERVICE_START_EVT, status %d, service_handle %d", param->start.status, param->start.service_handle);
     break;
   case ESP_GATTS_CONNECT_EVT:
+  {
     ESP_LOGI(BLEMIDI_TAG, "ESP_GATTS_CONNECT_EVT, conn_id = %d", param->connect.conn_id);
     ESP_LOG_BUFFER_HEX(BLEMIDI_TAG, param->connect.remote_bda, 6);
-    blemidi_connected = 1;
-    esp_ble_conn_update_params_t conn_params = { 0 };
-    memcpy(conn_params.bda, param->connect.remote_bda, sizeof(esp_bd_addr_t));
-    /* For the iOS system, please refer to Apple official documents about the BLE connection parameters restrictions. */
-    conn_params.latency = 0;
-    conn_params.max_int = 0x10;    // max_int = 0x10*1.25ms = 20ms
-    conn_params.min_int = 0x0b;    // min_int = 0x0b*1.25ms = 15ms
-    conn_params.timeout = 400;    // timeout = 400*10ms = 4000ms
-    //start sent the update connection parameters to the peer device.
-    esp_ble_gap_update_conn_params(&conn_params);
-    break;
+
+    int conn = 0;
+    while (conn < BLEMIDI_MAX_CONNECTIONS && blemidi_conns[conn].in_use)
+      ++conn;
+    if (conn >= BLEMIDI_MAX_CONNECTIONS)
+    {
+      ESP_LOGW(BLEMIDI_TAG, "all %d connections in use, disconnecting", BLEMIDI_MAX_CONNECTIONS);
+      esp_ble_gap_disconnect(param->connect.remote_bda);
+      break;
+    }
+
+    // defaults of a new link until the central agrees to something else
+    blemidi_parser_init(&blemidi_conns[conn].parser);
+    portENTER_CRITICAL(&blemidi_link_lock);
+    memcpy(blemidi_conns[conn].bda, param->connect.remote_bda, sizeof(esp_bd_addr_t));
+    blemidi_link_info_t* link = &blemidi_conns[conn].link;
+    memset(link, 0, sizeof(blemidi_link_info_t));
+    link->connected = 1;
+    // notifications start with a CCC write, or with the stored value once a bond encrypts the link
+    link->subscribed = 0;
+    link->conn_id = param->connect.conn_id;
+    link->conn_interval = param->connect.conn_params.interval;
+    link->latency = param->connect.conn_params.latency;
+    link->timeout = param->connect.conn_params.timeout;
+    link->mtu = 23;
+    link->tx_data_len = 27;
+    link->rx_data_len = 27;
+    link->tx_phy = 1;
+    link->rx_phy = 1;
+    blemidi_conns[conn].in_use = true;
+    blemidi_conns[conn].bonded = false;
+    blemidi_conns[conn].data_len_wanted = false; // a request of the previous central may still be outstanding
+    // not a target before the MTU exchange, so it doesn't lower the packet size yet
+    blemidi_conns[conn].mtu_known = false;
+    blemidi_conns[conn].connect_us = esp_timer_get_time();
+    portEXIT_CRITICAL(&blemidi_link_lock);
+    atomic_fetch_and(&blemidi_tx_congested, ~(1 << conn));
+    blemidi_link_update_max_len();
+
+    int32_t connected = atomic_fetch_add(&blemidi_connected, 1) + 1;
+    if (blemidi_callback_connection_changed)
+    {
+      blemidi_callback_connection_changed(connected);
+    }
+    blemidi_link_request(conn);
+
+    // advertising stops with each connection, keep accepting further centrals
+    if (connected < BLEMIDI_MAX_CONNECTIONS)
+      esp_ble_gap_start_advertising(&adv_params);
+  }
+  break;
   case ESP_GATTS_DISCONNECT_EVT:
-    ESP_LOGI(BLEMIDI_TAG, "ESP_GATTS_DISCONNECT_EVT, reason = 0x%x", param->disconnect.reason);
-    blemidi_connected = 0;
-    esp_ble_gap_start_advertising(&adv_params);
-    break;
+  {
+    ESP_LOGI(BLEMIDI_TAG, "ESP_GATTS_DISCONNECT_EVT, conn_id = %d, reason = 0x%x", param->disconnect.conn_id, param->disconnect.reason);
+    int conn = blemidi_conn_find(param->disconnect.conn_id);
+    if (conn < 0)
+      break; // rejected connection
+
+    portENTER_CRITICAL(&blemidi_link_lock);
+    blemidi_conns[conn].in_use = false;
+    blemidi_conns[conn].bonded = false;
+    blemidi_conns[conn].data_len_wanted = false;
+    blemidi_conns[conn].link.connected = 0;
+    blemidi_conns[conn].link.subscribed = 0;
+    portEXIT_CRITICAL(&blemidi_link_lock);
+    if (prepare_write_env.prepare_buf && prepare_write_env.conn == conn)
+    {
+      prepare_write_env.prepare_buf = NULL; // the long write was never executed
+      prepare_write_env.prepare_len = 0;
+    }
+    atomic_fetch_and(&blemidi_tx_congested, ~(1 << conn));
+    atomic_fetch_or(&blemidi_tx_removed_targets, 1 << conn); // the next drain releases its packets
+    blemidi_link_update_max_len();
+
+    int32_t connected = atomic_fetch_sub(&blemidi_connected, 1) - 1;
+    if (blemidi_callback_connection_changed)
+    {
+      blemidi_callback_connection_changed(connected);
+    }
+
+    // advertising was stopped when the last free slot was taken
+    if (connected == (BLEMIDI_MAX_CONNECTIONS - 1))
+      esp_ble_gap_start_advertising(&adv_params);
+  }
+  break;
   case ESP_GATTS_CREAT_ATTR_TAB_EVT:
   {
     if (param->add_attr_tab.status != ESP_GATT_OK)
@@ -859,7 +1771,6 @@ static void gatts_profile_event_handler(esp_gatts_cb_event_t event, esp_gatt_if_
   case ESP_GATTS_CANCEL_OPEN_EVT:
   case ESP_GATTS_CLOSE_EVT:
   case ESP_GATTS_LISTEN_EVT:
-  case ESP_GATTS_CONGEST_EVT:
   case ESP_GATTS_UNREG_EVT:
   case ESP_GATTS_DELETE_EVT:
   default:
@@ -1007,11 +1918,22 @@ int32_t blemidi_init(void* _callback_midi_message_received)
     uint32_t blemidi_port;
     for (blemidi_port = 0; blemidi_port < BLEMIDI_NUM_PORTS; ++blemidi_port)
     {
-      blemidi_outbuffer_len[blemidi_port] = 0;
-      blemidi_continued_sysex_pos[blemidi_port] = 0;
+      blemidi_packet_init(&blemidi_outbuffer[blemidi_port], atomic_load(&blemidi_mtu));
     }
+    blemidi_link_update_max_len();
+
+    atomic_store(&blemidi_flush_armed, false);
+    if (blemidi_flush_sem == NULL)
+      blemidi_flush_sem = xSemaphoreCreateBinaryStatic(&blemidi_flush_sem_buffer);
+    if (blemidi_tx_mutex == NULL)
+      blemidi_tx_mutex = xSemaphoreCreateMutexStatic(&blemidi_tx_mutex_buffer);
+    blemidi_txqueue_init(&blemidi_txqueue);
   }
 
+  // Receive Queue
+  blemidi_rxqueue_init(&blemidi_rxqueue);
+  atomic_store(&blemidi_rx_notify_pending, false);
+
   // Finally install callback
   blemidi_callback_midi_message_received = _callback_midi_message_received;
 
@@ -1026,7 +1948,20 @@ int32_t blemidi_init(void* _callback_midi_message_received)
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 int32_t blemidi_is_connected(void)
 {
-  return blemidi_connected;
+  return atomic_load(&blemidi_connected) > 0 ? 1 : 0;
+}
+
+int32_t blemidi_get_num_connections(void)
+{
+  return atomic_load(&blemidi_connected);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Connection state callback
+////////////////////////////////////////////////////////////////////////////////////////////////////
+void blemidi_set_connection_callback(void (*callback_connection_changed)(int32_t connected))
+{
+  blemidi_callback_connection_changed = callback_connection_changed;
 }
 
 #if BLEMIDI_ENABLE_CONSOLE
@@ -1063,6 +1998,195 @@ static int cmd_blemidi_debug(int argc, char** argv)
   return 0; // no error
 }
 
+static struct
+{
+  struct arg_int* window_ms;
+  struct arg_end* end;
+} blemidi_flush_window_args;
+
+static int cmd_blemidi_flush_window(int argc, char** argv)
+{
+  int nerrors = arg_parse(argc, argv, (void**) &blemidi_flush_window_args);
+  if (nerrors != 0)
+  {
+    arg_print_errors(stderr, blemidi_flush_window_args.end, argv[0]);
+    return 1;
+  }
+
+  if (blemidi_flush_window_args.window_ms->count > 0)
+  {
+    int window_ms = blemidi_flush_window_args.window_ms->ival[0];
+    if (window_ms < 0 || blemidi_set_flush_window((uint8_t) window_ms) < 0)
+    {
+      printf("Flush window must be 0..%d mS\n", BLEMIDI_OUTBUFFER_FLUSH_MAX_MS);
+      return 1;
+    }
+  }
+
+  printf("Flush window: %d mS\n", blemidi_get_flush_window());
+  return 0; // no error
+}
+
+#if BLEMIDI_ENABLE_LATENCY_TRACE
+static struct
+{
+  struct arg_str* reset;
+  struct arg_end* end;
+} blemidi_latency_args;
+
+static int cmd_blemidi_latency(int argc, char** argv)
+{
+  int nerrors = arg_parse(argc, argv, (void**) &blemidi_latency_args);
+  if (nerrors != 0)
+  {
+    arg_print_errors(stderr, blemidi_latency_args.end, argv[0]);
+    return 1;
+  }
+
+  blemidi_latency_print(stdout);
+
+  if (blemidi_latency_args.reset->count > 0 && strcasecmp(blemidi_latency_args.reset->sval[0], "reset") == 0)
+  {
+    blemidi_latency_reset();
+    printf("Latency histograms cleared\n");
+  }
+
+  return 0; // no error
+}
+#endif
+
+static struct
+{
+  struct arg_str* profile;
+  struct arg_end* end;
+} blemidi_link_args;
+
+static int cmd_blemidi_link(int argc, char** argv)
+{
+  int nerrors = arg_parse(argc, argv, (void**) &blemidi_link_args);
+  if (nerrors != 0)
+  {
+    arg_print_errors(stderr, blemidi_link_args.end, argv[0]);
+    return 1;
+  }
+
+  if (blemidi_link_args.profile->count > 0)
+  {
+    int profile;
+    for (profile = 0; profile < BLEMIDI_LINK_PROFILE_NUM; ++profile)
+    {
+      if (strcasecmp(blemidi_link_args.profile->sval[0], blemidi_get_link_profile_name(profile)) == 0)
+        break;
+    }
+
+    if (profile >= BLEMIDI_LINK_PROFILE_NUM)
+    {
+      printf("Link profile must be low_latency, balanced or low_power\n");
+      return 1;
+    }
+    blemidi_set_link_profile(profile);
+  }
+
+  blemidi_link_info_t info;
+  blemidi_get_link_info(&info);
+  printf("Link profile: %s\n", blemidi_get_link_profile_name(info.profile));
+  if (!info.connected)
+  {
+    printf("Not connected\n");
+  }
+  else
+  {
+    uint8_t index;
+    printf("Connected centrals: %d/%d, max packet: %d\n", info.connected, BLEMIDI_MAX_CONNECTIONS, info.max_packet_len);
+    for (index = 0; index < BLEMIDI_MAX_CONNECTIONS; ++index)
+    {
+      if (blemidi_get_connection_info(index, &info) < 0)
+        continue;
+      printf("[%d] conn_id: %d, interval: %d.%02d mS, latency: %d, timeout: %d mS, MTU: %d, data length tx/rx: %d/%d, PHY tx/rx: %dM/%dM, malformed rx packets: %"PRIu32"%s%s\n",
+             index, info.conn_id, info.conn_interval * 125 / 100, info.conn_interval * 125 % 100, info.latency, info.timeout * 10,
+             info.mtu, info.tx_data_len, info.rx_data_len, info.tx_phy, info.rx_phy, info.rx_errors,
+             info.subscribed ? "" : ", not subscribed", info.congested ? ", congested" : "");
+    }
+  }
+
+  return 0; // no error
+}
+
+static struct
+{
+  struct arg_str* reset;
+  struct arg_end* end;
+} blemidi_tx_stats_args;
+
+static int cmd_blemidi_tx_stats(int argc, char** argv)
+{
+  int nerrors = arg_parse(argc, argv, (void**) &blemidi_tx_stats_args);
+  if (nerrors != 0)
+  {
+    arg_print_errors(stderr, blemidi_tx_stats_args.end, argv[0]);
+    return 1;
+  }
+
+  blemidi_tx_stats_t stats;
+  blemidi_get_tx_stats(&stats);
+  printf("queued: %"PRIu32", sent: %"PRIu32", retried: %"PRIu32", dropped: %"PRIu32" (superseded: %"PRIu32", timeout: %"PRIu32"), too long: %"PRIu32", congestion events: %"PRIu32", max depth: %"PRIu32"/%d\n",
+         stats.queued, stats.sent, stats.retried, stats.dropped, stats.dropped_superseded, stats.dropped_timeout, stats.too_long, stats.congestion_events, stats.max_depth, BLEMIDI_TX_QUEUE_LEN);
+
+  if (blemidi_tx_stats_args.reset->count > 0 && strcasecmp(blemidi_tx_stats_args.reset->sval[0], "reset") == 0)
+  {
+    blemidi_reset_tx_stats();
+    printf("Transmit counters cleared\n");
+  }
+
+  return 0; // no error
+}
+
+static struct
+{
+  struct arg_str* reset;
+  struct arg_end* end;
+} blemidi_rx_stats_args;
+
+static void (*blemidi_callback_rx_stats_print)(void) = NULL;
+
+void blemidi_set_rx_stats_print_callback(void (*callback_print)(void))
+{
+  blemidi_callback_rx_stats_print = callback_print;
+}
+
+static int cmd_blemidi_rx_stats(int argc, char** argv)
+{
+  int nerrors = arg_parse(argc, argv, (void**) &blemidi_rx_stats_args);
+  if (nerrors != 0)
+  {
+    arg_print_errors(stderr, blemidi_rx_stats_args.end, argv[0]);
+    return 1;
+  }
+
+  blemidi_rx_stats_t stats;
+  blemidi_get_rx_stats(&stats);
+  printf("packets: %"PRIu32", queued: %"PRIu32", dropped: %"PRIu32", max depth: %"PRIu32"/%d\n",
+         stats.packets, stats.queued, stats.dropped, stats.max_depth, BLEMIDI_RX_QUEUE_LEN);
+  if (stats.handler_time.count)
+  {
+    printf("Bluetooth task time per packet: avg %"PRIu32" uS, p50 <= %"PRIu32" uS, p99 <= %"PRIu32" uS, max %"PRIu32" uS\n",
+           (uint32_t) (stats.handler_time.sum_us / stats.handler_time.count),
+           blemidi_latency_hist_percentile(&stats.handler_time, 50),
+           blemidi_latency_hist_percentile(&stats.handler_time, 99),
+           stats.handler_time.max_us);
+  }
+  if (blemidi_callback_rx_stats_print != NULL)
+    blemidi_callback_rx_stats_print();
+
+  if (blemidi_rx_stats_args.reset->count > 0 && strcasecmp(blemidi_rx_stats_args.reset->sval[0], "reset") == 0)
+  {
+    blemidi_reset_rx_stats();
+    printf("Receive counters cleared\n");
+  }
+
+  return 0; // no error
+}
+
 void blemidi_register_console_commands(void)
 {
   {
@@ -1079,6 +2203,83 @@ void blemidi_register_console_commands(void)
 
     ESP_ERROR_CHECK(esp_console_cmd_register(&blemidi_debug_cmd));
   }
+
+  {
+    blemidi_flush_window_args.window_ms = arg_int0(NULL, NULL, "<ms>", "Coalescing window in mS (0..15)");
+    blemidi_flush_window_args.end = arg_end(20);
+
+    const esp_console_cmd_t blemidi_flush_window_cmd = {
+      .command = "blemidi_flush_window",
+      .help = "Prints or sets the output buffer coalescing window",
+      .hint = NULL,
+      .func = &cmd_blemidi_flush_window,
+      .argtable = &blemidi_flush_window_args
+    };
+
+    ESP_ERROR_CHECK(esp_console_cmd_register(&blemidi_flush_window_cmd));
+  }
+
+  {
+    blemidi_link_args.profile = arg_str0(NULL, NULL, "<low_latency|balanced|low_power>", "Selects the connection parameters requested from the central");
+    blemidi_link_args.end = arg_end(20);
+
+    const esp_console_cmd_t blemidi_link_cmd = {
+      .command = "blemidi_link",
+      .help = "Prints or selects the link profile, and prints the negotiated connection parameters",
+      .hint = NULL,
+      .func = &cmd_blemidi_link,
+      .argtable = &blemidi_link_args
+    };
+
+    ESP_ERROR_CHECK(esp_console_cmd_register(&blemidi_link_cmd));
+  }
+
+  {
+    blemidi_tx_stats_args.reset = arg_str0(NULL, NULL, "<reset>", "Clears the counters after printing them");
+    blemidi_tx_stats_args.end = arg_end(20);
+
+    const esp_console_cmd_t blemidi_tx_stats_cmd = {
+      .command = "blemidi_tx_stats",
+      .help = "Prints the transmit queue counters",
+      .hint = NULL,
+      .func = &cmd_blemidi_tx_stats,
+      .argtable = &blemidi_tx_stats_args
+    };
+
+    ESP_ERROR_CHECK(esp_console_cmd_register(&blemidi_tx_stats_cmd));
+  }
+
+  {
+    blemidi_rx_stats_args.reset = arg_str0(NULL, NULL, "<reset>", "Clears the counters after printing them");
+    blemidi_rx_stats_args.end = arg_end(20);
+
+    const esp_console_cmd_t blemidi_rx_stats_cmd = {
+      .command = "blemidi_rx_stats",
+      .help = "Prints the receive queue counters and the Bluetooth task time per packet",
+      .hint = NULL,
+      .func = &cmd_blemidi_rx_stats,
+      .argtable = &blemidi_rx_stats_args
+    };
+
+    ESP_ERROR_CHECK(esp_console_cmd_register(&blemidi_rx_stats_cmd));
+  }
+
+#if BLEMIDI_ENABLE_LATENCY_TRACE
+  {
+    blemidi_latency_args.reset = arg_str0(NULL, NULL, "<reset>", "Clears the histograms after printing them");
+    blemidi_latency_args.end = arg_end(20);
+
+    const esp_console_cmd_t blemidi_latency_cmd = {
+      .command = "blemidi_latency",
+      .help = "Prints knob-to-notification latency histograms",
+      .hint = NULL,
+      .func = &cmd_blemidi_latency,
+      .argtable = &blemidi_latency_args
+    };
+
+    ESP_ERROR_CHECK(esp_console_cmd_register(&blemidi_latency_cmd));
+  }
+#endif
 }
 
 #endif
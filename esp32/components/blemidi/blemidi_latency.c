@@ -0,0 +1,221 @@
+/*
+ * BLE MIDI Latency Tracing
+ *
+ * See blemidi_latency.h for the trace points.
+ *
+ * =============================================================================
+ */
+
+#include <stdatomic.h>
+#include <string.h>
+
+#include "blemidi_latency.h"
+
+static const char* blemidi_latency_stage_names[BLEMIDI_LATENCY_NUM_STAGES] = {
+  "dequeue",
+  "send",
+  "push",
+  "notify",
+};
+
+// Recorded from several tasks, therefore every field is updated atomically.
+// A snapshot taken while samples are recorded may be off by the samples in flight.
+typedef struct
+{
+  atomic_uint count;
+  atomic_uint min_us;
+  atomic_uint max_us;
+  atomic_ullong sum_us;
+  atomic_uint buckets[BLEMIDI_LATENCY_NUM_BUCKETS];
+} blemidi_latency_stage_hist_t;
+
+static blemidi_latency_stage_hist_t blemidi_latency_stages[BLEMIDI_LATENCY_NUM_STAGES];
+
+// origin of the traced message, 0 if none is in flight
+static atomic_llong blemidi_latency_origin_us = 0;
+
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Histogram helpers
+////////////////////////////////////////////////////////////////////////////////////////////////////
+static uint32_t blemidi_latency_bucket(uint32_t latency_us)
+{
+  uint32_t bucket = 0;
+  while (latency_us > 1 && bucket < (BLEMIDI_LATENCY_NUM_BUCKETS - 1))
+  {
+    latency_us >>= 1;
+    ++bucket;
+  }
+  return bucket;
+}
+
+void blemidi_latency_hist_add(blemidi_latency_hist_t* hist, uint32_t latency_us)
+{
+  if (hist->count == 0 || latency_us < hist->min_us)
+    hist->min_us = latency_us;
+  if (hist->count == 0 || latency_us > hist->max_us)
+    hist->max_us = latency_us;
+  hist->count++;
+  hist->sum_us += latency_us;
+  hist->buckets[blemidi_latency_bucket(latency_us)]++;
+}
+
+uint32_t blemidi_latency_hist_percentile(const blemidi_latency_hist_t* hist, uint8_t percentile)
+{
+  if (hist->count == 0)
+    return 0;
+
+  if (percentile > 100)
+    percentile = 100;
+
+  // rank of the requested sample, 1-based
+  uint64_t rank = ((uint64_t) hist->count * percentile + 99) / 100;
+  if (rank == 0)
+    rank = 1;
+
+  uint64_t seen = 0;
+  uint32_t bucket;
+  for (bucket = 0; bucket < BLEMIDI_LATENCY_NUM_BUCKETS; ++bucket)
+  {
+    seen += hist->buckets[bucket];
+    if (seen >= rank)
+      break;
+  }
+
+  if (bucket >= (BLEMIDI_LATENCY_NUM_BUCKETS - 1))
+    return hist->max_us;
+
+  uint32_t upper = (2u << bucket) - 1;
+  return (upper > hist->max_us) ? hist->max_us : upper;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Stage recording
+////////////////////////////////////////////////////////////////////////////////////////////////////
+void blemidi_latency_record(blemidi_latency_stage_t stage, uint32_t latency_us)
+{
+  if (stage >= BLEMIDI_LATENCY_NUM_STAGES)
+    return;
+
+  blemidi_latency_stage_hist_t* hist = &blemidi_latency_stages[stage];
+
+  // min starts at 0 after a reset, therefore UINT32_MAX is stored when the first sample arrives
+  unsigned prev_count = atomic_fetch_add_explicit(&hist->count, 1, memory_order_relaxed);
+  if (prev_count == 0)
+    atomic_store_explicit(&hist->min_us, UINT32_MAX, memory_order_relaxed);
+
+  unsigned cur = atomic_load_explicit(&hist->min_us, memory_order_relaxed);
+  while (latency_us < cur && !atomic_compare_exchange_weak_explicit(&hist->min_us, &cur, latency_us, memory_order_relaxed, memory_order_relaxed))
+    ;
+  cur = atomic_load_explicit(&hist->max_us, memory_order_relaxed);
+  while (latency_us > cur && !atomic_compare_exchange_weak_explicit(&hist->max_us, &cur, latency_us, memory_order_relaxed, memory_order_relaxed))
+    ;
+
+  atomic_fetch_add_explicit(&hist->sum_us, latency_us, memory_order_relaxed);
+  atomic_fetch_add_explicit(&hist->buckets[blemidi_latency_bucket(latency_us)], 1, memory_order_relaxed);
+}
+
+void blemidi_latency_begin(int64_t origin_us)
+{
+  if (origin_us <= 0)
+    return;
+
+  // keep the older origin if a traced message hasn't been notified yet
+  long long expected = 0;
+  atomic_compare_exchange_strong_explicit(&blemidi_latency_origin_us, &expected, origin_us, memory_order_relaxed, memory_order_relaxed);
+}
+
+void blemidi_latency_mark(blemidi_latency_stage_t stage, int64_t now_us)
+{
+  long long origin_us;
+  if (stage == BLEMIDI_LATENCY_STAGE_NOTIFY)
+    origin_us = atomic_exchange_explicit(&blemidi_latency_origin_us, 0, memory_order_relaxed);
+  else
+    origin_us = atomic_load_explicit(&blemidi_latency_origin_us, memory_order_relaxed);
+
+  if (origin_us <= 0 || now_us < origin_us)
+    return;
+
+  int64_t latency_us = now_us - origin_us;
+  blemidi_latency_record(stage, (latency_us > UINT32_MAX) ? UINT32_MAX : (uint32_t) latency_us);
+}
+
+void blemidi_latency_get(blemidi_latency_stage_t stage, blemidi_latency_hist_t* hist)
+{
+  memset(hist, 0, sizeof(blemidi_latency_hist_t));
+  if (stage >= BLEMIDI_LATENCY_NUM_STAGES)
+    return;
+
+  blemidi_latency_stage_hist_t* src = &blemidi_latency_stages[stage];
+  hist->count = atomic_load_explicit(&src->count, memory_order_relaxed);
+  hist->min_us = atomic_load_explicit(&src->min_us, memory_order_relaxed);
+  hist->max_us = atomic_load_explicit(&src->max_us, memory_order_relaxed);
+  hist->sum_us = atomic_load_explicit(&src->sum_us, memory_order_relaxed);
+  int i;
+  for (i = 0; i < BLEMIDI_LATENCY_NUM_BUCKETS; ++i)
+  {
+    hist->buckets[i] = atomic_load_explicit(&src->buckets[i], memory_order_relaxed);
+  }
+}
+
+void blemidi_latency_reset(void)
+{
+  atomic_store_explicit(&blemidi_latency_origin_us, 0, memory_order_relaxed);
+
+  int stage;
+  for (stage = 0; stage < BLEMIDI_LATENCY_NUM_STAGES; ++stage)
+  {
+    blemidi_latency_stage_hist_t* hist = &blemidi_latency_stages[stage];
+    atomic_store_explicit(&hist->count, 0, memory_order_relaxed);
+    atomic_store_explicit(&hist->min_us, 0, memory_order_relaxed);
+    atomic_store_explicit(&hist->max_us, 0, memory_order_relaxed);
+    atomic_store_explicit(&hist->sum_us, 0, memory_order_relaxed);
+    int i;
+    for (i = 0; i < BLEMIDI_LATENCY_NUM_BUCKETS; ++i)
+    {
+      atomic_store_explicit(&hist->buckets[i], 0, memory_order_relaxed);
+    }
+  }
+}
+
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Report
+////////////////////////////////////////////////////////////////////////////////////////////////////
+void blemidi_latency_print(FILE* out)
+{
+  fprintf(out, "latency from knob timer callback [uS]\n");
+  fprintf(out, "%-8s %8s %8s %8s %8s %8s %8s\n", "stage", "count", "min", "avg", "p50", "p99", "max");
+
+  int stage;
+  for (stage = 0; stage < BLEMIDI_LATENCY_NUM_STAGES; ++stage)
+  {
+    blemidi_latency_hist_t hist;
+    blemidi_latency_get((blemidi_latency_stage_t) stage, &hist);
+    fprintf(out, "%-8s %8u %8u %8u %8u %8u %8u\n",
+      blemidi_latency_stage_names[stage],
+      (unsigned) hist.count,
+      (unsigned) hist.min_us,
+      (unsigned) (hist.count ? (hist.sum_us / hist.count) : 0),
+      (unsigned) blemidi_latency_hist_percentile(&hist, 50),
+      (unsigned) blemidi_latency_hist_percentile(&hist, 99),
+      (unsigned) hist.max_us);
+  }
+
+  // bucket distribution of the end-to-end stage
+  blemidi_latency_hist_t hist;
+  blemidi_latency_get(BLEMIDI_LATENCY_STAGE_NOTIFY, &hist);
+  if (hist.count)
+  {
+    fprintf(out, "notify distribution:\n");
+    int i;
+    for (i = 0; i < BLEMIDI_LATENCY_NUM_BUCKETS; ++i)
+    {
+      if (hist.buckets[i])
+      {
+        fprintf(out, "  < %7u uS: %u\n", (unsigned) (2u << i), (unsigned) hist.buckets[i]);
+      }
+    }
+  }
+}
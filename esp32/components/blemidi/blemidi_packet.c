@@ -0,0 +1,381 @@
+/*
+ * BLE MIDI Packet Builder
+ *
+ * See blemidi_packet.h for the protocol between producers and the flusher.
+ *
+ * =============================================================================
+ */
+
+#include <string.h>
+
+#include "blemidi_packet.h"
+
+// state word:
+//   bits  0..7  length of the active packet
+//   bit   8     index of the active buffer
+//   bits  9..15 running status of the active packet (status & 0x7f, STATE_NO_STATUS if none)
+//   bits 16..28 13 bit timestamp of the last message in the active packet
+#define STATE_LEN_MASK      0xffu
+#define STATE_IDX_SHIFT     8
+#define STATE_STATUS_SHIFT  9
+#define STATE_TS_SHIFT      16
+#define STATE_NO_STATUS     0x7fu // 0xff (System Reset) is never a running status
+
+#define TIMESTAMP_MASK      0x1fffu
+
+static inline unsigned state_make(unsigned idx, size_t len, unsigned status, unsigned timestamp)
+{
+  return (unsigned) len | (idx << STATE_IDX_SHIFT) | ((status & 0x7f) << STATE_STATUS_SHIFT) | ((timestamp & TIMESTAMP_MASK) << STATE_TS_SHIFT);
+}
+
+static inline size_t state_len(unsigned state)
+{
+  return state & STATE_LEN_MASK;
+}
+
+static inline unsigned state_idx(unsigned state)
+{
+  return (state >> STATE_IDX_SHIFT) & 1;
+}
+
+static inline unsigned state_status(unsigned state)
+{
+  return (state >> STATE_STATUS_SHIFT) & 0x7f;
+}
+
+static inline unsigned state_timestamp(unsigned state)
+{
+  return (state >> STATE_TS_SHIFT) & TIMESTAMP_MASK;
+}
+
+// Only the first message of a packet carries timestampHigh. A receiver increments it
+// whenever a timestampLow is smaller than the previous one, so within a packet the
+// timestamps must not decrease and may advance by 127 mS at most per message.
+// Returns the timestamp to write behind the active packet, or -1 if the message needs a new packet.
+static inline int32_t packet_timestamp(unsigned state, unsigned timestamp)
+{
+  timestamp &= TIMESTAMP_MASK;
+  if (state_len(state) == 0)
+    return timestamp; // new packet: any timestamp
+
+  unsigned last = state_timestamp(state);
+  unsigned delta = (timestamp - last) & TIMESTAMP_MASK;
+  if (delta > (TIMESTAMP_MASK >> 1))
+    return last; // older than the previous message (e.g. from another task): keep the order
+  if (delta > 0x7f)
+    return -1; // a receiver would miss a wraparound of timestampLow
+
+  return timestamp;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Initialization and packet size limit
+////////////////////////////////////////////////////////////////////////////////////////////////////
+void blemidi_packet_init(blemidi_packet_builder_t* builder, size_t max_len)
+{
+  atomic_init(&builder->state, state_make(0, 0, STATE_NO_STATUS, 0));
+  atomic_init(&builder->writers[0], 0);
+  atomic_init(&builder->writers[1], 0);
+  atomic_init(&builder->protected_packet[0], false);
+  atomic_init(&builder->protected_packet[1], false);
+  atomic_init(&builder->max_len, 0);
+  atomic_flag_clear(&builder->flushing);
+  builder->retired = 0;
+  blemidi_packet_set_max_len(builder, max_len);
+}
+
+void blemidi_packet_set_max_len(blemidi_packet_builder_t* builder, size_t max_len)
+{
+  if (max_len > BLEMIDI_PACKET_BUFFER_SIZE)
+    max_len = BLEMIDI_PACKET_BUFFER_SIZE;
+  atomic_store(&builder->max_len, (unsigned) max_len);
+}
+
+size_t blemidi_packet_get_max_len(blemidi_packet_builder_t* builder)
+{
+  return atomic_load(&builder->max_len);
+}
+
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Producer side
+////////////////////////////////////////////////////////////////////////////////////////////////////
+int32_t blemidi_packet_append(blemidi_packet_builder_t* builder, uint16_t timestamp, const uint8_t* stream, size_t len, bool priority)
+{
+  if (len == 0)
+    return -1; // nothing to add
+
+  const int has_status = stream[0] >= 0x80;
+  // only channel messages (0x80..0xef) may use running status; anything else cancels it
+  const int is_channel_message = has_status && stream[0] < 0xf0 && len >= 2;
+  const unsigned status = is_channel_message ? (stream[0] & 0x7f) : STATE_NO_STATUS;
+  const size_t max_len = atomic_load(&builder->max_len);
+
+  // new packet: with timestampHigh and timestampLow, or in case of continued SysEx packet: only timestampHigh
+  if ((len + 1 + has_status) > max_len)
+    return -1; // doesn't even fit into an empty packet
+
+  unsigned state = atomic_load(&builder->state);
+  for (;;)
+  {
+    unsigned idx = state_idx(state);
+    size_t pos = state_len(state);
+    size_t timestamp_bytes;
+    size_t skip = 0; // leading bytes of the message which are not written
+    int32_t packet_ts = packet_timestamp(state, timestamp);
+
+    if (packet_ts < 0)
+    {
+      unsigned current = atomic_load(&builder->state);
+      if (current == state)
+        return -2; // timestamp too far ahead of the packet
+      state = current;
+      continue;
+    }
+
+    const uint8_t timestamp_high = 0x80 | ((packet_ts >> 7) & 0x3f);
+    const uint8_t timestamp_low = 0x80 | (packet_ts & 0x7f);
+
+    if (pos == 0)
+    {
+      timestamp_bytes = 1 + has_status;
+    }
+    else if (status != STATE_NO_STATUS && status == state_status(state))
+    {
+      // running status: drop the status byte, and the timestampLow too if it didn't change
+      skip = 1;
+      timestamp_bytes = (state_timestamp(state) == (unsigned) packet_ts) ? 0 : 1;
+    }
+    else
+    {
+      timestamp_bytes = 1;
+    }
+
+    size_t needed = timestamp_bytes + len - skip;
+
+    if ((pos + needed) > max_len)
+    {
+      unsigned current = atomic_load(&builder->state);
+      if (current == state)
+        return -2; // packet is full
+      state = current;
+      continue;
+    }
+
+    // announce the write before reserving: a swap which happens after the reservation
+    // will see this writer and wait for it
+    atomic_fetch_add(&builder->writers[idx], 1);
+
+    unsigned next = state_make(idx, pos + needed, status, packet_ts);
+    if (!atomic_compare_exchange_weak(&builder->state, &state, next))
+    {
+      // swapped or another producer was faster, state holds the current value
+      atomic_fetch_sub(&builder->writers[idx], 1);
+      continue;
+    }
+
+    // the reserved range belongs to this producer only
+    uint8_t* dst = &builder->data[idx][pos];
+    if (pos == 0)
+    {
+      *dst++ = timestamp_high;
+      if (has_status)
+        *dst++ = timestamp_low;
+    }
+    else if (timestamp_bytes)
+    {
+      *dst++ = timestamp_low;
+    }
+    memcpy(dst, stream + skip, len - skip);
+
+    // only packets which consist of CCs may be dropped on congestion
+    if (priority || (stream[0] & 0xf0) != 0xb0)
+      atomic_store_explicit(&builder->protected_packet[idx], true, memory_order_relaxed);
+
+    // publishes the bytes to the flusher
+    atomic_fetch_sub_explicit(&builder->writers[idx], 1, memory_order_release);
+
+    return (pos == 0) ? 1 : 0;
+  }
+}
+
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Group of channel messages which must arrive in the same packet
+////////////////////////////////////////////////////////////////////////////////////////////////////
+static inline size_t channel_message_len(uint8_t status)
+{
+  // Program Change and Channel Pressure have one data byte
+  return ((status & 0xe0) == 0xc0) ? 2 : 3;
+}
+
+// Encodes the group behind pos with the given running status; only measures if dst is NULL.
+// Returns the encoded length, *last_status receives the running status after the group.
+static size_t encode_group(uint8_t* dst, size_t pos, unsigned running, unsigned running_ts, unsigned timestamp,
+                           const uint8_t* stream, size_t len, unsigned* last_status)
+{
+  const uint8_t timestamp_high = 0x80 | ((timestamp >> 7) & 0x3f);
+  const uint8_t timestamp_low = 0x80 | (timestamp & 0x7f);
+  size_t n = 0;
+  size_t i = 0;
+
+  while (i < len)
+  {
+    size_t message_len = channel_message_len(stream[i]);
+    unsigned status = stream[i] & 0x7f;
+    size_t skip = 0;
+
+    if ((pos + n) == 0)
+    {
+      if (dst)
+      {
+        dst[0] = timestamp_high;
+        dst[1] = timestamp_low;
+      }
+      n += 2;
+    }
+    else if (status == running)
+    {
+      // running status: drop the status byte, and the timestampLow too if it didn't change
+      skip = 1;
+      if (running_ts != timestamp)
+      {
+        if (dst)
+          dst[n] = timestamp_low;
+        n++;
+      }
+    }
+    else
+    {
+      if (dst)
+        dst[n] = timestamp_low;
+      n++;
+    }
+
+    if (dst)
+      memcpy(&dst[n], &stream[i + skip], message_len - skip);
+    n += message_len - skip;
+
+    running = status;
+    running_ts = timestamp;
+    i += message_len;
+  }
+
+  *last_status = running;
+  return n;
+}
+
+int32_t blemidi_packet_append_group(blemidi_packet_builder_t* builder, uint16_t timestamp, const uint8_t* stream, size_t len, bool priority)
+{
+  const size_t max_len = atomic_load(&builder->max_len);
+  bool protect = priority;
+  unsigned last_status;
+  size_t i;
+
+  if (len == 0)
+    return -1; // nothing to add
+
+  // only complete channel messages, each with its status byte
+  for (i = 0; i < len; i += channel_message_len(stream[i]))
+  {
+    size_t j;
+    if (stream[i] < 0x80 || stream[i] >= 0xf0 || (i + channel_message_len(stream[i])) > len)
+      return -1;
+    for (j = 1; j < channel_message_len(stream[i]); ++j)
+    {
+      if (stream[i + j] >= 0x80)
+        return -1;
+    }
+    if ((stream[i] & 0xf0) != 0xb0)
+      protect = true; // only packets which consist of CCs may be dropped on congestion
+  }
+
+  if (encode_group(NULL, 0, STATE_NO_STATUS, 0, timestamp & TIMESTAMP_MASK, stream, len, &last_status) > max_len)
+    return -1; // doesn't even fit into an empty packet
+
+  unsigned state = atomic_load(&builder->state);
+  for (;;)
+  {
+    unsigned idx = state_idx(state);
+    size_t pos = state_len(state);
+    int32_t packet_ts = packet_timestamp(state, timestamp);
+    size_t needed = (packet_ts < 0) ? max_len + 1 :
+      encode_group(NULL, pos, state_status(state), state_timestamp(state), packet_ts, stream, len, &last_status);
+
+    if ((pos + needed) > max_len)
+    {
+      unsigned current = atomic_load(&builder->state);
+      if (current == state)
+        return -2; // not enough room for all messages, or timestamp too far ahead of the packet
+      state = current;
+      continue;
+    }
+
+    // same protocol as blemidi_packet_append(): announce, then reserve the whole group at once
+    atomic_fetch_add(&builder->writers[idx], 1);
+
+    unsigned next = state_make(idx, pos + needed, last_status, packet_ts);
+    if (!atomic_compare_exchange_weak(&builder->state, &state, next))
+    {
+      atomic_fetch_sub(&builder->writers[idx], 1);
+      continue;
+    }
+
+    encode_group(&builder->data[idx][pos], pos, state_status(state), state_timestamp(state), packet_ts, stream, len, &last_status);
+
+    if (protect)
+      atomic_store_explicit(&builder->protected_packet[idx], true, memory_order_relaxed);
+
+    // publishes the bytes to the flusher
+    atomic_fetch_sub_explicit(&builder->writers[idx], 1, memory_order_release);
+
+    return (pos == 0) ? 1 : 0;
+  }
+}
+
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Flusher side
+////////////////////////////////////////////////////////////////////////////////////////////////////
+bool blemidi_packet_flush_begin(blemidi_packet_builder_t* builder)
+{
+  return !atomic_flag_test_and_set_explicit(&builder->flushing, memory_order_acquire);
+}
+
+size_t blemidi_packet_swap(blemidi_packet_builder_t* builder, const uint8_t** packet)
+{
+  unsigned state = atomic_load(&builder->state);
+  unsigned next;
+
+  // the other buffer is idle until the swap below makes it active
+  atomic_store(&builder->protected_packet[state_idx(state) ^ 1], false);
+
+  do
+  {
+    if (state_len(state) == 0)
+      return 0; // nothing to send
+
+    // the retired buffer was sent by the previous flush, so the other one is free
+    next = state_make(state_idx(state) ^ 1, 0, STATE_NO_STATUS, 0);
+  } while (!atomic_compare_exchange_weak(&builder->state, &state, next));
+
+  builder->retired = (uint8_t) state_idx(state);
+  *packet = builder->data[builder->retired];
+  return state_len(state);
+}
+
+bool blemidi_packet_swap_complete(blemidi_packet_builder_t* builder)
+{
+  return atomic_load_explicit(&builder->writers[builder->retired], memory_order_acquire) == 0;
+}
+
+bool blemidi_packet_retired_is_protected(blemidi_packet_builder_t* builder)
+{
+  return atomic_load_explicit(&builder->protected_packet[builder->retired], memory_order_relaxed);
+}
+
+void blemidi_packet_flush_end(blemidi_packet_builder_t* builder)
+{
+  atomic_flag_clear_explicit(&builder->flushing, memory_order_release);
+}
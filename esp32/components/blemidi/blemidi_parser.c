@@ -0,0 +1,187 @@
+/*
+ * BLE MIDI Packet Parser
+ *
+ * See blemidi_parser.h
+ *
+ * =============================================================================
+ */
+
+#include <stddef.h>
+
+#include "blemidi_parser.h"
+
+//! Number if expected bytes for a common MIDI event - 1
+static const uint8_t midi_expected_bytes_common[8] = {
+  2, // Note On
+  2, // Note Off
+  2, // Poly Preasure
+  2, // Controller
+  1, // Program Change
+  1, // Channel Preasure
+  2, // Pitch Bender
+  0, // System Message - must be zero, so that mios32_midi_expected_bytes_system[] will be used
+};
+
+//! Number if expected bytes for a system MIDI event - 1
+static const uint8_t midi_expected_bytes_system[16] = {
+  1, // SysEx Begin (endless until SysEx End F7)
+  1, // MTC Data frame
+  2, // Song Position
+  1, // Song Select
+  0, // Reserved
+  0, // Reserved
+  0, // Request Tuning Calibration
+  0, // SysEx End
+
+  // Note: just only for documentation, Realtime Messages don't change the running status
+  0, // MIDI Clock
+  0, // MIDI Tick
+  0, // MIDI Start
+  0, // MIDI Continue
+  0, // MIDI Stop
+  0, // Reserved
+  0, // Active Sense
+  0, // Reset
+};
+
+
+void blemidi_parser_init(blemidi_parser_t* parser)
+{
+  parser->continued_sysex_pos = 0;
+  parser->num_errors = 0;
+}
+
+// Error exit of blemidi_parse_packet: count the malformed packet, no logging here
+static int32_t blemidi_parse_error(blemidi_parser_t* parser, uint8_t blemidi_port, int32_t error, size_t pos)
+{
+  parser->num_errors++;
+  BLEMIDI_RX_TRACE_ERROR(blemidi_port, error, pos);
+  return error;
+}
+
+
+int32_t blemidi_parse_packet(blemidi_parser_t* parser, uint8_t blemidi_port, uint8_t* stream, size_t len, blemidi_message_callback_t callback)
+{
+  BLEMIDI_RX_TRACE_PACKET(blemidi_port, stream, len);
+
+  // detect continued SysEx
+  uint8_t continued_sysex = 0;
+  if (len > 2 && (stream[0] & 0x80) && !(stream[1] & 0x80))
+  {
+    continued_sysex = 1;
+  }
+  else
+  {
+    parser->continued_sysex_pos = 0;
+  }
+
+
+  if (len < 3)
+  {
+    return blemidi_parse_error(parser, blemidi_port, -1, 0); // stream length should be >= 3
+  }
+  else if (!(stream[0] & 0x80))
+  {
+    return blemidi_parse_error(parser, blemidi_port, -2, 0); // missing timestampHigh
+  }
+  else
+  {
+    size_t pos = 0;
+
+    // getting timestamp
+    uint16_t timestamp = (stream[pos++] & 0x3f) << 7;
+
+    // parsing stream
+    {
+      uint8_t midi_status = continued_sysex ? 0xf0 : 0x00;
+
+      while (pos < len)
+      {
+        if (!(stream[pos] & 0x80))
+        {
+          // continued SysEx, or running status without timestampLow: the message
+          // has the same timestamp as the previous one
+          if (!continued_sysex && !(midi_status >= 0x80 && midi_status < 0xf0))
+          {
+            return blemidi_parse_error(parser, blemidi_port, -3, pos); // missing timestampLow
+          }
+        }
+        else
+        {
+          // a timestampLow below the previous one means timestampHigh advanced
+          uint8_t timestamp_low = stream[pos++] & 0x7f;
+          if (timestamp_low < (timestamp & 0x7f))
+          {
+            timestamp = (timestamp + 0x80) & 0x1fff;
+          }
+          timestamp = (timestamp & ~0x7f) | timestamp_low;
+          continued_sysex = 0;
+          parser->continued_sysex_pos = 0;
+
+          if (pos >= len)
+          {
+            return blemidi_parse_error(parser, blemidi_port, -4, pos); // missing MIDI message after timestampLow
+          }
+        }
+
+        if (stream[pos] & 0x80)
+        {
+          if (stream[pos] >= 0xf8)
+          {
+            // Realtime messages don't change the running status
+            if (callback)
+            {
+              callback(blemidi_port, timestamp, stream[pos], &stream[pos + 1], 0, 0);
+            }
+            pos += 1;
+            continue;
+          }
+
+          midi_status = stream[pos++];
+        }
+        else if (midi_status == 0x00)
+        {
+          return blemidi_parse_error(parser, blemidi_port, -6, pos); // data byte after timestampLow, but no status to run on
+        }
+
+        if (midi_status == 0xf0)
+        {
+          size_t num_bytes = 0;
+          while ((pos + num_bytes) < len && stream[pos + num_bytes] < 0x80)
+          {
+            ++num_bytes;
+          }
+          if (callback)
+          {
+            callback(blemidi_port, timestamp, midi_status, &stream[pos], num_bytes, parser->continued_sysex_pos);
+          }
+          pos += num_bytes;
+          parser->continued_sysex_pos += num_bytes; // we expect another packet with the remaining SysEx stream
+        }
+        else
+        {
+          uint8_t num_bytes = midi_expected_bytes_common[(midi_status >> 4) & 0x7];
+          if (num_bytes == 0)
+          { // System Message
+            num_bytes = midi_expected_bytes_system[midi_status & 0xf];
+          }
+
+          if ((pos + num_bytes) > len)
+          {
+            return blemidi_parse_error(parser, blemidi_port, -5, pos); // message is missing data bytes
+          }
+          else
+          {
+            if (callback)
+            {
+              callback(blemidi_port, timestamp, midi_status, &stream[pos], num_bytes, 0);
+            }
+            pos += num_bytes;
+          }
+        }
+      }
+    }
+  }
+
+  return 0; // no error
+}
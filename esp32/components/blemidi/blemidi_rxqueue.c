@@ -0,0 +1,82 @@
+/*
+ * BLE MIDI Receive Queue
+ *
+ * See blemidi_rxqueue.h
+ *
+ * =============================================================================
+ */
+
+#include <string.h>
+
+#include "blemidi_rxqueue.h"
+
+#if (BLEMIDI_RX_QUEUE_LEN & (BLEMIDI_RX_QUEUE_LEN - 1)) != 0
+# error "BLEMIDI_RX_QUEUE_LEN must be a power of two"
+#endif
+
+
+void blemidi_rxqueue_init(blemidi_rxqueue_t* queue)
+{
+  atomic_init(&queue->head, 0);
+  atomic_init(&queue->tail, 0);
+}
+
+
+int32_t blemidi_rxqueue_push(blemidi_rxqueue_t* queue, uint8_t blemidi_port, uint16_t timestamp, uint8_t midi_status, const uint8_t* data, size_t len, size_t continued_sysex_pos, int64_t received_us)
+{
+  unsigned head = atomic_load_explicit(&queue->head, memory_order_relaxed);
+  unsigned tail = atomic_load_explicit(&queue->tail, memory_order_acquire);
+  size_t num_slots = len ? (len + BLEMIDI_RXQUEUE_SLOT_DATA - 1) / BLEMIDI_RXQUEUE_SLOT_DATA : 1;
+
+  if ((head - tail) + num_slots > BLEMIDI_RX_QUEUE_LEN)
+    return -1; // queue full
+
+  size_t pos = 0;
+  do
+  {
+    blemidi_rxqueue_slot_t* slot = &queue->slots[head++ & (BLEMIDI_RX_QUEUE_LEN - 1)];
+    size_t chunk = (len - pos) > BLEMIDI_RXQUEUE_SLOT_DATA ? BLEMIDI_RXQUEUE_SLOT_DATA : (len - pos);
+
+    slot->received_us = received_us;
+    slot->blemidi_port = blemidi_port;
+    slot->timestamp = timestamp;
+    slot->midi_status = midi_status;
+    slot->continued_sysex_pos = continued_sysex_pos + pos;
+    slot->len = chunk;
+    memcpy(slot->data, &data[pos], chunk);
+    pos += chunk;
+  } while (pos < len);
+
+  // all slots of the message become visible at once
+  atomic_store_explicit(&queue->head, head, memory_order_release);
+
+  return num_slots;
+}
+
+
+blemidi_rxqueue_slot_t* blemidi_rxqueue_peek(blemidi_rxqueue_t* queue)
+{
+  unsigned tail = atomic_load_explicit(&queue->tail, memory_order_relaxed);
+  unsigned head = atomic_load_explicit(&queue->head, memory_order_acquire);
+
+  if (tail == head)
+    return NULL; // empty
+
+  return &queue->slots[tail & (BLEMIDI_RX_QUEUE_LEN - 1)];
+}
+
+
+void blemidi_rxqueue_release(blemidi_rxqueue_t* queue)
+{
+  unsigned tail = atomic_load_explicit(&queue->tail, memory_order_relaxed);
+  atomic_store_explicit(&queue->tail, tail + 1, memory_order_release);
+}
+
+
+size_t blemidi_rxqueue_count(blemidi_rxqueue_t* queue)
+{
+  unsigned tail = atomic_load_explicit(&queue->tail, memory_order_acquire);
+  unsigned head = atomic_load_explicit(&queue->head, memory_order_acquire);
+
+  return head - tail;
+}
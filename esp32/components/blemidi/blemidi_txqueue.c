@@ -0,0 +1,299 @@
+/*
+ * BLE MIDI Transmit Queue
+ *
+ * See blemidi_txqueue.h for the drop policy.
+ *
+ * =============================================================================
+ */
+
+#include <string.h>
+
+#include "blemidi_txqueue.h"
+
+static inline blemidi_txqueue_entry_t* entry_at(blemidi_txqueue_t* queue, size_t i)
+{
+  return &queue->entries[(queue->head + i) % BLEMIDI_TX_QUEUE_LEN];
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Collects the CC keys of an unprotected packet. Such a packet only contains CCs, written as
+// [timestampLow] [status] controller value, where running status may drop the first two bytes.
+// Returns false if the packet contains anything else, it is protected then.
+////////////////////////////////////////////////////////////////////////////////////////////////////
+static bool blemidi_txqueue_collect_keys(blemidi_txqueue_entry_t* entry)
+{
+  size_t pos = 1; // skip timestampHigh
+  uint8_t status = 0;
+
+  entry->num_keys = 0;
+  while (pos < entry->len)
+  {
+    if (entry->data[pos] & 0x80)
+      pos++; // timestampLow
+    if (pos < entry->len && (entry->data[pos] & 0x80))
+      status = entry->data[pos++];
+
+    if ((status & 0xf0) != 0xb0 || (pos + 2) > entry->len || entry->num_keys >= BLEMIDI_TXQUEUE_MAX_KEYS)
+      return false;
+
+    entry->keys[entry->num_keys++] = (uint16_t) ((status << 8) | entry->data[pos]);
+    pos += 2;
+  }
+  return true;
+}
+
+static bool blemidi_txqueue_has_key(const blemidi_txqueue_entry_t* entry, uint16_t key)
+{
+  size_t i;
+  for (i = 0; i < entry->num_keys; ++i)
+  {
+    if (entry->keys[i] == key)
+      return true;
+  }
+  return false;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// A packet is superseded if every CC in it is sent again by a newer packet
+////////////////////////////////////////////////////////////////////////////////////////////////////
+static bool blemidi_txqueue_is_superseded(blemidi_txqueue_t* queue, size_t index, const blemidi_txqueue_entry_t* incoming)
+{
+  const blemidi_txqueue_entry_t* entry = entry_at(queue, index);
+  size_t k;
+
+  for (k = 0; k < entry->num_keys; ++k)
+  {
+    // the newer packet has to reach every target which still waits for this one
+    bool found = incoming != NULL && (entry->pending & ~incoming->pending) == 0 && blemidi_txqueue_has_key(incoming, entry->keys[k]);
+    size_t j;
+    for (j = index + 1; !found && j < queue->count; ++j)
+    {
+      const blemidi_txqueue_entry_t* newer = entry_at(queue, j);
+      found = !newer->protected_packet && (entry->pending & ~newer->pending) == 0 && blemidi_txqueue_has_key(newer, entry->keys[k]);
+    }
+    if (!found)
+      return false;
+  }
+  return true;
+}
+
+static void blemidi_txqueue_remove(blemidi_txqueue_t* queue, size_t index)
+{
+  if (index == 0)
+  {
+    queue->head = (queue->head + 1) % BLEMIDI_TX_QUEUE_LEN;
+    queue->count--;
+    return;
+  }
+
+  // close the gap by moving the newer entries one step towards the head
+  for (; (index + 1) < queue->count; ++index)
+  {
+    memcpy(entry_at(queue, index), entry_at(queue, index + 1), sizeof(blemidi_txqueue_entry_t));
+  }
+  queue->count--;
+}
+
+// Removes the packets which all of their targets have sent
+static void blemidi_txqueue_release_sent(blemidi_txqueue_t* queue)
+{
+  size_t i = 0;
+  while (i < queue->count)
+  {
+    if (entry_at(queue, i)->pending == 0)
+      blemidi_txqueue_remove(queue, i);
+    else
+      ++i;
+  }
+}
+
+static int blemidi_txqueue_find(const blemidi_txqueue_t* queue, uint8_t target)
+{
+  size_t i;
+  for (i = 0; i < queue->count; ++i)
+  {
+    if (queue->entries[(queue->head + i) % BLEMIDI_TX_QUEUE_LEN].pending & (1 << target))
+      return (int) i;
+  }
+  return -1;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Drops a CC-only packet if the queue is full. incoming is the packet which will be added,
+// NULL if it's written in place (it has no keys then, which could supersede older packets).
+// Returns 0 if there was room, 1 if a packet has been dropped, -1 if only protected packets are queued
+////////////////////////////////////////////////////////////////////////////////////////////////////
+static int32_t blemidi_txqueue_make_room(blemidi_txqueue_t* queue, const blemidi_txqueue_entry_t* incoming)
+{
+  int drop = -1;
+  size_t i;
+
+  if (queue->count < BLEMIDI_TX_QUEUE_LEN)
+    return 0;
+
+  // superseded values first...
+  for (i = 0; i < queue->count && drop < 0; ++i)
+  {
+    if (!entry_at(queue, i)->protected_packet && blemidi_txqueue_is_superseded(queue, i, incoming))
+    {
+      drop = (int) i;
+      queue->stats.dropped_superseded++;
+    }
+  }
+
+  // ...then the oldest CC-only packet
+  for (i = 0; i < queue->count && drop < 0; ++i)
+  {
+    if (!entry_at(queue, i)->protected_packet)
+      drop = (int) i;
+  }
+
+  if (drop < 0)
+    return -1; // only protected packets queued, wait until some have been sent
+
+  blemidi_txqueue_remove(queue, drop);
+  queue->stats.dropped++;
+  return 1;
+}
+
+static void blemidi_txqueue_append_reserved(blemidi_txqueue_t* queue)
+{
+  if (queue->targets == 0)
+  {
+    queue->stats.dropped++; // nobody to send to
+    return;
+  }
+
+  entry_at(queue, queue->count)->pending = queue->targets;
+  queue->count++;
+  queue->stats.queued++;
+  if (queue->count > queue->stats.max_depth)
+    queue->stats.max_depth = queue->count;
+}
+
+
+void blemidi_txqueue_init(blemidi_txqueue_t* queue)
+{
+  queue->head = 0;
+  queue->count = 0;
+  queue->targets = 0;
+  memset(&queue->stats, 0, sizeof(queue->stats));
+}
+
+void blemidi_txqueue_set_targets(blemidi_txqueue_t* queue, uint8_t targets)
+{
+  queue->targets = targets;
+}
+
+void blemidi_txqueue_remove_target(blemidi_txqueue_t* queue, uint8_t target)
+{
+  size_t i;
+
+  if (target >= BLEMIDI_TXQUEUE_MAX_TARGETS)
+    return;
+
+  queue->targets &= ~(1 << target);
+  for (i = 0; i < queue->count; ++i)
+  {
+    blemidi_txqueue_entry_t* entry = entry_at(queue, i);
+    if (entry->pending == (1 << target))
+      queue->stats.dropped++; // nobody else waits for it
+    entry->pending &= ~(1 << target);
+  }
+  blemidi_txqueue_release_sent(queue);
+}
+
+int32_t blemidi_txqueue_push(blemidi_txqueue_t* queue, const uint8_t* packet, size_t len, bool protected_packet)
+{
+  blemidi_txqueue_entry_t incoming;
+  int32_t status;
+
+  if (len > BLEMIDI_PACKET_BUFFER_SIZE)
+    return -2; // invalid packet
+
+  memcpy(incoming.data, packet, len);
+  incoming.len = (uint8_t) len;
+  incoming.pending = queue->targets;
+  incoming.protected_packet = protected_packet || !blemidi_txqueue_collect_keys(&incoming);
+  if (incoming.protected_packet)
+    incoming.num_keys = 0;
+
+  status = blemidi_txqueue_make_room(queue, &incoming);
+  if (status < 0)
+    return status;
+
+  memcpy(entry_at(queue, queue->count), &incoming, sizeof(incoming));
+  blemidi_txqueue_append_reserved(queue);
+
+  return status;
+}
+
+uint8_t* blemidi_txqueue_reserve(blemidi_txqueue_t* queue)
+{
+  blemidi_txqueue_entry_t* entry;
+
+  if (blemidi_txqueue_make_room(queue, NULL) < 0)
+    return NULL;
+
+  entry = entry_at(queue, queue->count);
+  entry->len = 0;
+  entry->protected_packet = true;
+  entry->num_keys = 0;
+  return entry->data;
+}
+
+int32_t blemidi_txqueue_commit(blemidi_txqueue_t* queue, size_t len)
+{
+  if (queue->count >= BLEMIDI_TX_QUEUE_LEN || len > BLEMIDI_PACKET_BUFFER_SIZE)
+    return -2; // nothing reserved, or invalid packet
+
+  entry_at(queue, queue->count)->len = (uint8_t) len;
+  blemidi_txqueue_append_reserved(queue);
+  return 0;
+}
+
+const blemidi_txqueue_entry_t* blemidi_txqueue_peek(const blemidi_txqueue_t* queue, uint8_t target)
+{
+  int i;
+
+  if (target >= BLEMIDI_TXQUEUE_MAX_TARGETS || (i = blemidi_txqueue_find(queue, target)) < 0)
+    return NULL;
+  return &queue->entries[(queue->head + i) % BLEMIDI_TX_QUEUE_LEN];
+}
+
+// The oldest packet of the target is done for it, counted by the caller's counter
+static void blemidi_txqueue_release_target(blemidi_txqueue_t* queue, uint8_t target, uint32_t* counter)
+{
+  int i;
+
+  if (target >= BLEMIDI_TXQUEUE_MAX_TARGETS || (i = blemidi_txqueue_find(queue, target)) < 0)
+    return;
+
+  blemidi_txqueue_entry_t* entry = entry_at(queue, i);
+  entry->pending &= ~(1 << target);
+  (*counter)++;
+  if (entry->pending == 0)
+    blemidi_txqueue_release_sent(queue);
+}
+
+void blemidi_txqueue_pop(blemidi_txqueue_t* queue, uint8_t target)
+{
+  blemidi_txqueue_release_target(queue, target, &queue->stats.sent);
+}
+
+void blemidi_txqueue_skip_too_long(blemidi_txqueue_t* queue, uint8_t target)
+{
+  blemidi_txqueue_release_target(queue, target, &queue->stats.too_long);
+}
+
+void blemidi_txqueue_clear(blemidi_txqueue_t* queue)
+{
+  queue->stats.dropped += queue->count;
+  queue->head = 0;
+  queue->count = 0;
+}
+
+size_t blemidi_txqueue_count(const blemidi_txqueue_t* queue)
+{
+  return queue->count;
+}
@@ -34,6 +34,10 @@
 #define _BLEMIDI_H
 
 #include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "blemidi_latency.h"
 
 #ifndef BLEMIDI_DEVICE_NAME
 #define BLEMIDI_DEVICE_NAME "MIDIbox"
@@ -47,10 +51,50 @@
 #define BLEMIDI_NUM_PORTS 1
 #endif
 
+// Centrals which can be connected at the same time (e.g. a DAW and a tablet).
+// Each packet is built once and notified to every subscribed central.
+#ifndef BLEMIDI_MAX_CONNECTIONS
+#define BLEMIDI_MAX_CONNECTIONS 2
+#endif
+
+// Default coalescing window: time between the first message pushed into an empty
+// output buffer and the flush, so that messages which follow can share the packet
 #ifndef BLEMIDI_OUTBUFFER_FLUSH_MS
-#define BLEMIDI_OUTBUFFER_FLUSH_MS 15
+#define BLEMIDI_OUTBUFFER_FLUSH_MS 5
+#endif
+
+// Retry interval for packets which the BLE stack didn't accept
+#ifndef BLEMIDI_TX_RETRY_MS
+#define BLEMIDI_TX_RETRY_MS 2
+#endif
+
+// Longest time a sender waits for room when the transmit queue only holds packets
+// which must not be dropped; the packet is dropped and counted afterwards
+#ifndef BLEMIDI_TX_ENQUEUE_TIMEOUT_MS
+#define BLEMIDI_TX_ENQUEUE_TIMEOUT_MS 50
+#endif
+
+// A new central receives packets once its MTU exchange completed, so that packets built for
+// the larger MTU of the other centrals are never sent to it. One which doesn't exchange the
+// MTU joins with the default MTU after this time.
+#ifndef BLEMIDI_MTU_EXCHANGE_WAIT_MS
+#define BLEMIDI_MTU_EXCHANGE_WAIT_MS 1000
 #endif
 
+// Link profile requested after connecting, see blemidi_set_link_profile()
+#ifndef BLEMIDI_LINK_PROFILE_DEFAULT
+#define BLEMIDI_LINK_PROFILE_DEFAULT BLEMIDI_LINK_PROFILE_BALANCED
+#endif
+
+// Upper limit for blemidi_set_flush_window()
+#define BLEMIDI_OUTBUFFER_FLUSH_MAX_MS 15
+
+// Timeout value for blemidi_outbuffer_wait_flush() which never expires
+#define BLEMIDI_WAIT_FOREVER 0xffffffff
+
+// Timestamp for blemidi_send_timestamped_message(): the time the message is pushed
+#define BLEMIDI_TIMESTAMP_NOW 0xffff
+
 #ifndef BLEMIDI_ENABLE_CONSOLE
 #define BLEMIDI_ENABLE_CONSOLE 1
 #endif
@@ -59,6 +103,68 @@
 extern "C" {
 #endif
 
+    /**
+     * @brief Transmit queue counters, see blemidi_get_tx_stats
+     */
+    typedef struct
+    {
+        uint32_t queued;             // packets handed to the transmit queue
+        uint32_t sent;               // notifications accepted by the BLE stack (one per packet and connection)
+        uint32_t retried;            // send attempts rejected by the BLE stack and retried later
+        uint32_t dropped;            // packets dropped because the queue was full, or nobody was left to send them to
+        uint32_t dropped_superseded; // part of dropped: all values were sent again by a newer packet
+        uint32_t dropped_timeout;    // part of dropped: no room within BLEMIDI_TX_ENQUEUE_TIMEOUT_MS
+        uint32_t too_long;           // packets not sent to a central because they exceed its MTU
+        uint32_t congestion_events;  // times the link reported congestion
+        uint32_t max_depth;          // highest number of queued packets
+    } blemidi_tx_stats_t;
+
+    /**
+     * @brief Receive path counters, see blemidi_get_rx_stats
+     */
+    typedef struct
+    {
+        uint32_t packets;                     // BLE MIDI packets received
+        uint32_t queued;                      // messages queued for the application task
+        uint32_t dropped;                     // messages dropped because the receive queue was full
+        uint32_t max_depth;                   // most receive queue slots in use
+        blemidi_latency_hist_t handler_time;  // time spent in the Bluetooth task per packet (parse and enqueue)
+    } blemidi_rx_stats_t;
+
+    /**
+     * @brief Connection parameter sets which can be requested from the central
+     */
+    typedef enum
+    {
+        BLEMIDI_LINK_PROFILE_LOW_LATENCY = 0, // 7.5 mS interval, 2M PHY, data length extension, largest packets
+        BLEMIDI_LINK_PROFILE_BALANCED,        // 15..20 mS interval
+        BLEMIDI_LINK_PROFILE_LOW_POWER,       // 30..50 mS interval, peripheral latency 4
+        BLEMIDI_LINK_PROFILE_NUM
+    } blemidi_link_profile_t;
+
+    /**
+     * @brief Active link profile and the parameters negotiated with a central,
+     *        see blemidi_get_link_info and blemidi_get_connection_info
+     */
+    typedef struct
+    {
+        blemidi_link_profile_t profile;
+        uint8_t connected;       // blemidi_get_link_info: number of connected centrals
+        uint8_t subscribed;      // notifications enabled by the central
+        uint8_t congested;       // the central's link reported congestion
+        uint16_t conn_id;
+        uint16_t conn_interval;  // in 1.25 mS units
+        uint16_t latency;        // connection events the peripheral may skip
+        uint16_t timeout;        // supervision timeout in 10 mS units
+        uint16_t mtu;            // negotiated ATT MTU
+        uint16_t max_packet_len; // largest BLE MIDI packet sent with the current profile and MTU, shared by all centrals
+        uint16_t tx_data_len;    // link layer payload per PDU (27 without data length extension)
+        uint16_t rx_data_len;
+        uint8_t tx_phy;          // 1: 1M, 2: 2M, 3: Coded
+        uint8_t rx_phy;
+        uint32_t rx_errors;      // blemidi_get_connection_info: malformed packets received from the central
+    } blemidi_link_info_t;
+
     /**
      * @brief Initializes the BLEMIDI Server
      *
@@ -75,21 +181,158 @@ extern "C" {
      * @param  stream       output stream
      * @param  len          output stream length
      *
-     * @return < 0 on errors
+     * @return < 0 on errors; -2 if the transmit queue stayed full for BLEMIDI_TX_ENQUEUE_TIMEOUT_MS,
+     *         then the message, or the packet flushed to make room for it, was dropped
      *
      */
     extern int32_t blemidi_send_message(uint8_t blemidi_port, uint8_t* stream, size_t len);
 
     /**
-     * @brief Flush Output Buffer (normally done by blemidi_tick_ms each 15 mS)
+     * @brief Sends a BLE MIDI message which must not be dropped when the link is congested
+     *        (e.g. a toggle). Program Change, SysEx and realtime messages are always kept,
+     *        only plain CCs sent with blemidi_send_message() can be dropped.
+     *
+     * @param  blemidi_port currently always 0 expected (we might support multiple ports in future)
+     * @param  stream       output stream
+     * @param  len          output stream length
+     *
+     * @return < 0 on errors
+     */
+    extern int32_t blemidi_send_priority_message(uint8_t blemidi_port, uint8_t* stream, size_t len);
+
+    /**
+     * @brief Sends a BLE MIDI message with the time it was created instead of the time it's sent,
+     *        e.g. the time of the encoder detent, so that the receiver can remove the jitter
+     *        of the coalescing window and the connection interval.
+     *        Within a packet timestamps never go back: a message older than the one before it
+     *        gets the previous message's timestamp.
      *
      * @param  blemidi_port currently always 0 expected (we might support multiple ports in future)
+     * @param  stream       output stream
+     * @param  len          output stream length
+     * @param  timestamp    see blemidi_timestamp_at(), or BLEMIDI_TIMESTAMP_NOW
+     * @param  priority     the message must not be dropped when the link is congested
      *
      * @return < 0 on errors
+     */
+    extern int32_t blemidi_send_timestamped_message(uint8_t blemidi_port, uint8_t* stream, size_t len, uint16_t timestamp, bool priority);
+
+    /**
+     * @brief Sends several channel messages in the same BLE packet, e.g. the MSB/LSB pair
+     *        of a 14-bit CC or the CCs of an NRPN. If they don't fit into the packet which is
+     *        currently built anymore, it's flushed first.
+     *
+     * @param  blemidi_port currently always 0 expected (we might support multiple ports in future)
+     * @param  stream       complete channel messages, each with its status byte
+     * @param  len          total length
+     * @param  priority     the messages must not be dropped when the link is congested
+     *
+     * @return < 0 on errors, e.g. invalid messages or more than fit into a packet
+     */
+    extern int32_t blemidi_send_transaction(uint8_t blemidi_port, uint8_t* stream, size_t len, bool priority);
+
+    /**
+     * @brief Like blemidi_send_transaction(), with a timestamp like blemidi_send_timestamped_message()
+     */
+    extern int32_t blemidi_send_timestamped_transaction(uint8_t blemidi_port, uint8_t* stream, size_t len, uint16_t timestamp, bool priority);
+
+    /**
+     * @brief Returns the transmit queue counters
+     */
+    extern void blemidi_get_tx_stats(blemidi_tx_stats_t* stats);
+
+    /**
+     * @brief Clears the transmit queue counters
+     */
+    extern void blemidi_reset_tx_stats(void);
+
+    /**
+     * @brief Flush Output Buffer (normally done by blemidi_outbuffer_wait_flush)
+     *
+     * @param  blemidi_port currently always 0 expected (we might support multiple ports in future)
+     *
+     * @return < 0 on errors (-2: the transmit queue stayed full, the packet was dropped)
      *
      */
     extern int32_t blemidi_outbuffer_flush(uint8_t blemidi_port);
 
+    /**
+     * @brief Waits until a message has been pushed into an empty output buffer,
+     *        then waits for the remaining coalescing window and flushes all ports.
+     *        Intended to be called in a loop by a dedicated flush task, which stays
+     *        blocked while there is nothing to send.
+     *
+     * @param  timeout_ms   maximum time to wait for a message, or BLEMIDI_WAIT_FOREVER
+     *
+     * @return < 0 on errors (-2: timeout), otherwise the number of uS the flush
+     *         happened after the end of the coalescing window
+     */
+    extern int32_t blemidi_outbuffer_wait_flush(uint32_t timeout_ms);
+
+    /**
+     * @brief Arms a flush without pushing a message, e.g. if the application holds messages
+     *        back until the pre-flush callback. Does nothing if a flush is already pending.
+     */
+    extern void blemidi_outbuffer_request_flush(void);
+
+    /**
+     * @brief Registers a callback which is called by the flush task at the end of the
+     *        coalescing window, right before the output buffer is sent.
+     *        Messages sent from the callback go out with this flush.
+     *
+     * @param  callback_pre_flush the callback, or NULL to remove it
+     */
+    extern void blemidi_set_pre_flush_callback(void (*callback_pre_flush)(void));
+
+    /**
+     * @brief Sets the coalescing window of the output buffer
+     *
+     * @param  window_ms    0 (flush as soon as the flush task runs) .. BLEMIDI_OUTBUFFER_FLUSH_MAX_MS
+     *
+     * @return < 0 on errors
+     */
+    extern int32_t blemidi_set_flush_window(uint8_t window_ms);
+
+    /**
+     * @brief Returns the coalescing window of the output buffer in mS
+     */
+    extern uint8_t blemidi_get_flush_window(void);
+
+    /**
+     * @brief Selects the connection parameters requested from the central.
+     *        Applied immediately when connected, otherwise with the next connection.
+     *        The central has the final word, blemidi_get_link_info() returns what it granted.
+     *
+     * @return < 0 if the profile doesn't exist
+     */
+    extern int32_t blemidi_set_link_profile(blemidi_link_profile_t profile);
+
+    /**
+     * @brief Returns the selected link profile
+     */
+    extern blemidi_link_profile_t blemidi_get_link_profile(void);
+
+    /**
+     * @brief Returns the name of a link profile ("low_latency", "balanced", "low_power"), or NULL
+     */
+    extern const char* blemidi_get_link_profile_name(blemidi_link_profile_t profile);
+
+    /**
+     * @brief Returns the selected link profile, the number of connected centrals and the
+     *        parameters negotiated with the first one. max_packet_len is the limit of all centrals.
+     */
+    extern void blemidi_get_link_info(blemidi_link_info_t* info);
+
+    /**
+     * @brief Returns the parameters negotiated with one of the connected centrals
+     *
+     * @param  index        0..BLEMIDI_MAX_CONNECTIONS-1
+     * @param  info         the parameters
+     *
+     * @return < 0 if no central is connected in this slot
+     */
+    extern int32_t blemidi_get_connection_info(uint8_t index, blemidi_link_info_t* info);
+
     /**
      * @brief A dummy callback which demonstrates the usage.
      *        It will just print out incoming MIDI messages on the terminal.
@@ -107,7 +350,56 @@ extern "C" {
     extern void blemidi_receive_packet_callback_for_debugging(uint8_t blemidi_port, uint16_t timestamp, uint8_t midi_status, uint8_t* remaining_message, size_t len, size_t continued_sysex_pos);
 
     /**
-     * @brief This function should be called each mS to update the timestamp and flush the output buffer
+     * @brief Hands received messages over to an application task
+     *
+     * Once a callback is registered, the Bluetooth task only parses packets and copies the
+     * messages into the receive queue. The callback is called after a packet queued messages,
+     * once until the next blemidi_process_received(); it runs in the Bluetooth task, so it
+     * should only wake the application task up.
+     * Without a callback, messages are passed to the receive callback directly from the
+     * Bluetooth task.
+     *
+     * @param  callback_notify returns false if the notification couldn't be delivered (it's
+     *         repeated with the next packet then), NULL to remove it
+     * @param  arg             passed to the callback
+     */
+    extern void blemidi_set_receive_notify_callback(bool (*callback_notify)(void* arg), void* arg);
+
+    /**
+     * @brief Passes queued messages to the receive callback given to blemidi_init(), in the
+     *        calling task. Must always be called from the same task.
+     *
+     * @param  max_messages upper limit for this batch (SysEx fragments count once per
+     *         BLEMIDI_RXQUEUE_SLOT_DATA bytes)
+     *
+     * @return number of messages processed; if it equals max_messages more may be waiting,
+     *         and no further notification is sent for them
+     */
+    extern size_t blemidi_process_received(size_t max_messages);
+
+    /**
+     * @brief Returns when the packet of the message being passed to the receive callback
+     *        arrived (esp_timer_get_time() in the GATT write event). Only valid inside the
+     *        receive callback.
+     *
+     *        Queued messages are processed later; timing sensitive messages like MIDI clock
+     *        should use this time rather than the time of the callback.
+     */
+    extern int64_t blemidi_get_received_time(void);
+
+    /**
+     * @brief Returns the receive path counters
+     */
+    extern void blemidi_get_rx_stats(blemidi_rx_stats_t* stats);
+
+    /**
+     * @brief Clears the receive path counters
+     */
+    extern void blemidi_reset_rx_stats(void);
+
+    /**
+     * @brief Polling alternative to blemidi_outbuffer_wait_flush(): updates the timestamp and
+     *        flushes the output buffer once the coalescing window has passed
      *
      * @return < 0 on errors
      */
@@ -127,13 +419,33 @@ extern "C" {
      */
     extern uint8_t blemidi_timestamp_low(void);
 
+    /**
+     * @brief Returns the 13 bit BLE MIDI timestamp (mS) of a time taken with esp_timer_get_time()
+     */
+    extern uint16_t blemidi_timestamp_at(int64_t time_us);
+
     /**
      * @brief This function returns whether a BLE MIDI connection is active
      *
-     * @return 1 if connected, 0 if not connected
+     * @return 1 if at least one central is connected, 0 if not connected
      */
     extern int32_t blemidi_is_connected(void);
 
+    /**
+     * @brief Returns the number of connected centrals
+     */
+    extern int32_t blemidi_get_num_connections(void);
+
+    /**
+     * @brief Registers a callback which is called whenever the connection state changes
+     *
+     * @param  callback_connection_changed called with the number of connected centrals whenever
+     *         one connects or disconnects, 0 when the last one is gone.
+     *         It runs in the Bluedroid task, so it should only hand the event over.
+     *         Specify NULL to remove the callback.
+     */
+    extern void blemidi_set_connection_callback(void (*callback_connection_changed)(int32_t connected));
+
 #if BLEMIDI_ENABLE_CONSOLE
     /**
      * @brief Register Console Commands
@@ -141,6 +453,14 @@ extern "C" {
      * @return < 0 on errors
      */
     extern void blemidi_register_console_commands(void);
+
+    /**
+     * @brief Registers a callback which prints the application's receive counters
+     *        (e.g. SysEx reassembly) after the driver's in the `blemidi_rx_stats` command
+     *
+     * @param  callback_print runs in the console task, or NULL to remove it
+     */
+    extern void blemidi_set_rx_stats_print_callback(void (*callback_print)(void));
 #endif
 
 #ifdef __cplusplus
@@ -0,0 +1,106 @@
+/*
+ * BLE MIDI Latency Tracing
+ *
+ * Cheap timestamped trace points between a knob detent and the BLE notification.
+ * All stages are measured from the origin passed to blemidi_latency_begin() (the
+ * knob timer callback time), so the histograms are cumulative along the path.
+ *
+ * The aggregation has no ESP-IDF dependencies and can be built on a host.
+ *
+ * =============================================================================
+ */
+
+#ifndef _BLEMIDI_LATENCY_H
+#define _BLEMIDI_LATENCY_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+#ifndef BLEMIDI_ENABLE_LATENCY_TRACE
+#define BLEMIDI_ENABLE_LATENCY_TRACE 1
+#endif
+
+#ifndef BLEMIDI_LATENCY_NUM_BUCKETS
+#define BLEMIDI_LATENCY_NUM_BUCKETS 20 // log2 buckets, the last one collects everything >= 2^19 uS
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+    typedef enum
+    {
+        BLEMIDI_LATENCY_STAGE_DEQUEUE = 0, // main loop took the detent from the encoder ring
+        BLEMIDI_LATENCY_STAGE_SEND,        // MidiService::sendParameter
+        BLEMIDI_LATENCY_STAGE_PUSH,        // blemidi_outbuffer_push
+        BLEMIDI_LATENCY_STAGE_NOTIFY,      // esp_ble_gatts_send_indicate in blemidi_outbuffer_flush
+        BLEMIDI_LATENCY_NUM_STAGES
+    } blemidi_latency_stage_t;
+
+    typedef struct
+    {
+        uint32_t count;
+        uint32_t min_us;
+        uint32_t max_us;
+        uint64_t sum_us;
+        uint32_t buckets[BLEMIDI_LATENCY_NUM_BUCKETS]; // bucket i: [2^i, 2^(i+1)) uS, bucket 0 also holds 0
+    } blemidi_latency_hist_t;
+
+    /**
+     * @brief Adds a sample to a histogram (not thread-safe, see blemidi_latency_record)
+     */
+    extern void blemidi_latency_hist_add(blemidi_latency_hist_t* hist, uint32_t latency_us);
+
+    /**
+     * @brief Returns the upper bound of the bucket containing the given percentile (0..100)
+     *
+     * @return 0 if the histogram is empty, the exact maximum for the last occupied bucket
+     */
+    extern uint32_t blemidi_latency_hist_percentile(const blemidi_latency_hist_t* hist, uint8_t percentile);
+
+    /**
+     * @brief Records a latency sample for a stage (thread-safe)
+     */
+    extern void blemidi_latency_record(blemidi_latency_stage_t stage, uint32_t latency_us);
+
+    /**
+     * @brief Starts tracing a message which originated at origin_us
+     *        If a traced message is still waiting for its notification, the older origin is kept.
+     */
+    extern void blemidi_latency_begin(int64_t origin_us);
+
+    /**
+     * @brief Records now_us - origin for the traced message, if any
+     *        BLEMIDI_LATENCY_STAGE_NOTIFY ends the trace.
+     */
+    extern void blemidi_latency_mark(blemidi_latency_stage_t stage, int64_t now_us);
+
+    /**
+     * @brief Copies the histogram of a stage
+     */
+    extern void blemidi_latency_get(blemidi_latency_stage_t stage, blemidi_latency_hist_t* hist);
+
+    /**
+     * @brief Clears all histograms and the pending trace
+     */
+    extern void blemidi_latency_reset(void);
+
+    /**
+     * @brief Prints all stage histograms as a table
+     */
+    extern void blemidi_latency_print(FILE* out);
+
+#ifdef __cplusplus
+}
+#endif
+
+#if BLEMIDI_ENABLE_LATENCY_TRACE && defined(ESP_PLATFORM)
+# include "esp_timer.h"
+# define BLEMIDI_LATENCY_BEGIN(origin_us) blemidi_latency_begin(origin_us)
+# define BLEMIDI_LATENCY_MARK(stage)      blemidi_latency_mark((stage), esp_timer_get_time())
+#else
+# define BLEMIDI_LATENCY_BEGIN(origin_us) do { } while (0)
+# define BLEMIDI_LATENCY_MARK(stage)      do { } while (0)
+#endif
+
+#endif /* _BLEMIDI_LATENCY_H */
@@ -0,0 +1,142 @@
+/*
+ * BLE MIDI Packet Builder
+ *
+ * Lock-free, double-buffered assembly of BLE MIDI packets. Any number of
+ * producers append messages to the active buffer while a single flusher
+ * swaps the buffers and transmits the retired one.
+ *
+ * A producer announces itself in the writer count of the active buffer and
+ * then reserves space with a compare-and-swap on the state word (packet length,
+ * active buffer, running status and last timestamp). After a swap the flusher waits until
+ * the writer count of the retired buffer dropped to zero, so it never sends a
+ * packet which is still being written.
+ *
+ * This file has no ESP-IDF dependencies so it can be built and stress tested
+ * on a host.
+ *
+ * =============================================================================
+ */
+
+#ifndef _BLEMIDI_PACKET_H
+#define _BLEMIDI_PACKET_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+
+#ifndef BLEMIDI_PACKET_BUFFER_SIZE
+#define BLEMIDI_PACKET_BUFFER_SIZE 244 // ATT MTU 247 - 3; must not exceed 255, the length is kept in 8 bits
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+    typedef struct
+    {
+        uint8_t data[2][BLEMIDI_PACKET_BUFFER_SIZE];
+        atomic_uint state;       // packet length, active buffer and running status, see blemidi_packet.c
+        atomic_uint writers[2];  // producers which may still write into each buffer
+        atomic_bool protected_packet[2]; // buffer holds a message which must not be dropped on congestion
+        atomic_uint max_len;     // current packet size limit (MTU - 3)
+        atomic_flag flushing;    // held by the flusher between flush_begin and flush_end
+        uint8_t retired;         // buffer handed out by the last swap (flusher only)
+    } blemidi_packet_builder_t;
+
+    /**
+     * @brief Initializes an empty builder
+     *
+     * @param  builder  the builder
+     * @param  max_len  packet size limit, clipped to BLEMIDI_PACKET_BUFFER_SIZE
+     */
+    extern void blemidi_packet_init(blemidi_packet_builder_t* builder, size_t max_len);
+
+    /**
+     * @brief Changes the packet size limit (e.g. after an MTU exchange).
+     *        Applies to the next reservation, data already in the buffer is kept.
+     */
+    extern void blemidi_packet_set_max_len(blemidi_packet_builder_t* builder, size_t max_len);
+
+    /**
+     * @brief Returns the current packet size limit
+     */
+    extern size_t blemidi_packet_get_max_len(blemidi_packet_builder_t* builder);
+
+    /**
+     * @brief Appends a message with its timestamp bytes to the active packet.
+     *        Safe to call from several tasks at once.
+     *        A channel message with the same status as the previous message in the
+     *        packet is written with running status: without its status byte, and
+     *        without timestampLow if that is the same too.
+     *        Timestamps within a packet never decrease: a message older than the previous
+     *        one gets the previous timestamp. One which is more than 127 mS newer needs a new packet.
+     *
+     * @param  builder    the builder
+     * @param  timestamp  13 bit millisecond timestamp
+     * @param  stream     the message; a first byte < 0x80 continues a SysEx stream
+     * @param  len        message length
+     * @param  priority   the packet must not be dropped (anything but a CC is never dropped anyway)
+     *
+     * @return 1 if the message started a new packet, 0 if it was added to a packet,
+     *         -1 if it can never fit into a packet,
+     *         -2 if the packet is full or the timestamp too far ahead (flush and retry)
+     */
+    extern int32_t blemidi_packet_append(blemidi_packet_builder_t* builder, uint16_t timestamp, const uint8_t* stream, size_t len, bool priority);
+
+    /**
+     * @brief Appends several channel messages to the active packet as a whole, e.g. the
+     *        MSB/LSB pair of a 14-bit CC or the four CCs of an NRPN, so that a receiver
+     *        never applies half of them. Running status is used like in blemidi_packet_append().
+     *        Safe to call from several tasks at once.
+     *
+     * @param  builder    the builder
+     * @param  timestamp  13 bit millisecond timestamp, shared by all messages (adjusted like in blemidi_packet_append())
+     * @param  stream     complete channel messages (0x80..0xef), each with its status byte
+     * @param  len        total length
+     * @param  priority   the packet must not be dropped (anything but a CC is never dropped anyway)
+     *
+     * @return 1 if the messages started a new packet, 0 if they were added to a packet,
+     *         -1 if they are invalid or can never fit into one packet,
+     *         -2 if they don't fit into the active packet anymore or the timestamp is too far ahead (flush and retry)
+     */
+    extern int32_t blemidi_packet_append_group(blemidi_packet_builder_t* builder, uint16_t timestamp, const uint8_t* stream, size_t len, bool priority);
+
+    /**
+     * @brief Claims the flusher role
+     *
+     * @return false if another flush is in progress
+     */
+    extern bool blemidi_packet_flush_begin(blemidi_packet_builder_t* builder);
+
+    /**
+     * @brief Makes the other buffer active and hands out the retired packet (flusher only).
+     *        The packet must not be sent before blemidi_packet_swap_complete() returns true.
+     *
+     * @param  builder  the builder
+     * @param  packet   receives the retired packet
+     *
+     * @return length of the retired packet, 0 if there was nothing to send (no swap done)
+     */
+    extern size_t blemidi_packet_swap(blemidi_packet_builder_t* builder, const uint8_t** packet);
+
+    /**
+     * @brief Returns true once all producers which reserved space in the retired packet are done
+     */
+    extern bool blemidi_packet_swap_complete(blemidi_packet_builder_t* builder);
+
+    /**
+     * @brief Returns true if the retired packet must not be dropped (valid once the swap is complete)
+     */
+    extern bool blemidi_packet_retired_is_protected(blemidi_packet_builder_t* builder);
+
+    /**
+     * @brief Releases the flusher role, the retired buffer may be reused afterwards
+     */
+    extern void blemidi_packet_flush_end(blemidi_packet_builder_t* builder);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _BLEMIDI_PACKET_H */
@@ -0,0 +1,98 @@
+/*
+ * BLE MIDI Packet Parser
+ *
+ * Splits a received BLE MIDI packet into MIDI messages. Handles running status
+ * (with and without timestampLow), interleaved realtime messages and SysEx
+ * streams which continue over several packets.
+ *
+ * This file has no ESP-IDF dependencies so it can be built and exercised on
+ * a host, e.g. to round-trip packets created by blemidi_packet.c.
+ *
+ * The parser doesn't log, it runs for every packet in the GATT callback.
+ * Malformed packets are counted in the parser state. For debugging, build
+ * with BLEMIDI_ENABLE_RX_TRACE=1 and provide the blemidi_rx_trace_* hooks
+ * (blemidi.c implements them with ESP_LOG), or define the BLEMIDI_RX_TRACE_*
+ * macros directly.
+ *
+ * =============================================================================
+ */
+
+#ifndef _BLEMIDI_PARSER_H
+#define _BLEMIDI_PARSER_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#ifndef BLEMIDI_ENABLE_RX_TRACE
+#define BLEMIDI_ENABLE_RX_TRACE 0
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+    /**
+     * @brief Callback for each parsed message, see blemidi_receive_packet_callback_for_debugging
+     */
+    typedef void (*blemidi_message_callback_t)(uint8_t blemidi_port, uint16_t timestamp, uint8_t midi_status, uint8_t* remaining_message, size_t len, size_t continued_sysex_pos);
+
+    typedef struct
+    {
+        size_t continued_sysex_pos; // SysEx bytes received in previous packets
+        uint32_t num_errors;        // malformed packets since blemidi_parser_init
+    } blemidi_parser_t;
+
+#if BLEMIDI_ENABLE_RX_TRACE
+    /**
+     * @brief Trace hook called with every packet before it is parsed
+     */
+    extern void blemidi_rx_trace_packet(uint8_t blemidi_port, const uint8_t* stream, size_t len);
+
+    /**
+     * @brief Trace hook called when a packet is malformed
+     *
+     * @param  error  the value returned by blemidi_parse_packet
+     * @param  pos    offset in the packet at which parsing stopped
+     */
+    extern void blemidi_rx_trace_error(uint8_t blemidi_port, int32_t error, size_t pos);
+#endif
+
+    /**
+     * @brief Resets the parser state (e.g. on connect)
+     */
+    extern void blemidi_parser_init(blemidi_parser_t* parser);
+
+    /**
+     * @brief Parses a BLE MIDI packet and calls the callback for each message
+     *
+     * @param  parser       parser state of the port
+     * @param  blemidi_port passed to the callback
+     * @param  stream       the packet
+     * @param  len          packet length
+     * @param  callback     called for each message, may be NULL
+     *
+     * @return < 0 on malformed packets; messages before the error have been delivered
+     */
+    extern int32_t blemidi_parse_packet(blemidi_parser_t* parser, uint8_t blemidi_port, uint8_t* stream, size_t len, blemidi_message_callback_t callback);
+
+#ifdef __cplusplus
+}
+#endif
+
+#ifndef BLEMIDI_RX_TRACE_PACKET
+# if BLEMIDI_ENABLE_RX_TRACE
+#  define BLEMIDI_RX_TRACE_PACKET(port, stream, len) blemidi_rx_trace_packet((port), (stream), (len))
+# else
+#  define BLEMIDI_RX_TRACE_PACKET(port, stream, len) do { (void) (port); (void) (stream); (void) (len); } while (0)
+# endif
+#endif
+
+#ifndef BLEMIDI_RX_TRACE_ERROR
+# if BLEMIDI_ENABLE_RX_TRACE
+#  define BLEMIDI_RX_TRACE_ERROR(port, error, pos) blemidi_rx_trace_error((port), (error), (pos))
+# else
+#  define BLEMIDI_RX_TRACE_ERROR(port, error, pos) do { (void) (port); (void) (error); (void) (pos); } while (0)
+# endif
+#endif
+
+#endif /* _BLEMIDI_PARSER_H */
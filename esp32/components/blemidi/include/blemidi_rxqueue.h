@@ -0,0 +1,94 @@
+/*
+ * BLE MIDI Receive Queue
+ *
+ * Lock-free single-producer / single-consumer ring of parsed MIDI messages.
+ * The Bluetooth stack's task parses a packet and pushes its messages, an
+ * application task pops them later in batches, so no application code runs
+ * in the GATT write event.
+ *
+ * A message is stored in one or more fixed-size slots: SysEx fragments longer
+ * than a slot are split, each part carries its own continued_sysex_pos. All
+ * slots of a message are published at once, and if they don't fit the whole
+ * message is dropped, so the consumer never sees half of a message.
+ *
+ * This file has no ESP-IDF dependencies so it can be built and exercised on
+ * a host.
+ *
+ * =============================================================================
+ */
+
+#ifndef _BLEMIDI_RXQUEUE_H
+#define _BLEMIDI_RXQUEUE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdatomic.h>
+
+#ifndef BLEMIDI_RX_QUEUE_LEN
+#define BLEMIDI_RX_QUEUE_LEN 128 // slots, must be a power of two
+#endif
+
+// data bytes per slot, enough for any message but a SysEx fragment
+#ifndef BLEMIDI_RXQUEUE_SLOT_DATA
+#define BLEMIDI_RXQUEUE_SLOT_DATA 24
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+    typedef struct
+    {
+        int64_t received_us;          // time the packet arrived, in the caller's clock
+        uint32_t continued_sysex_pos; // SysEx bytes before data (0xf0 only)
+        uint16_t timestamp;
+        uint8_t blemidi_port;
+        uint8_t midi_status;
+        uint8_t len;
+        uint8_t data[BLEMIDI_RXQUEUE_SLOT_DATA];
+    } blemidi_rxqueue_slot_t;
+
+    typedef struct
+    {
+        blemidi_rxqueue_slot_t slots[BLEMIDI_RX_QUEUE_LEN];
+        atomic_uint head; // written by the producer only
+        atomic_uint tail; // written by the consumer only
+    } blemidi_rxqueue_t;
+
+    /**
+     * @brief Initializes an empty queue (no producer or consumer may be active)
+     */
+    extern void blemidi_rxqueue_init(blemidi_rxqueue_t* queue);
+
+    /**
+     * @brief Appends a message (producer only)
+     *
+     * @param  queue        the queue
+     * @param  ...          the message as passed to the receive callback
+     * @param  received_us  time the packet arrived, stored with the message
+     *
+     * @return number of slots used, -1 if the message was dropped because the queue is full
+     */
+    extern int32_t blemidi_rxqueue_push(blemidi_rxqueue_t* queue, uint8_t blemidi_port, uint16_t timestamp, uint8_t midi_status, const uint8_t* data, size_t len, size_t continued_sysex_pos, int64_t received_us);
+
+    /**
+     * @brief Returns the oldest slot, NULL if the queue is empty (consumer only).
+     *        The slot stays valid until blemidi_rxqueue_release().
+     */
+    extern blemidi_rxqueue_slot_t* blemidi_rxqueue_peek(blemidi_rxqueue_t* queue);
+
+    /**
+     * @brief Removes the slot returned by blemidi_rxqueue_peek() (consumer only)
+     */
+    extern void blemidi_rxqueue_release(blemidi_rxqueue_t* queue);
+
+    /**
+     * @brief Returns the number of slots in use
+     */
+    extern size_t blemidi_rxqueue_count(blemidi_rxqueue_t* queue);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _BLEMIDI_RXQUEUE_H */
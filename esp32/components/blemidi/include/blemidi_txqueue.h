@@ -0,0 +1,146 @@
+/*
+ * BLE MIDI Transmit Queue
+ *
+ * Bounded queue of packets waiting for the BLE stack. Packets stay queued while
+ * the link is congested and are retried if the stack rejects them. When the
+ * queue is full, CC-only packets are dropped to make room: first those whose
+ * values are all superseded by newer queued packets, then the oldest one.
+ * Protected packets (Program Change, SysEx, realtime, priority messages) are
+ * never dropped - if only those are queued, the caller has to wait.
+ *
+ * Each packet is stored once, even if several centrals are connected. It
+ * carries a mask of the connections (targets) which still have to send it,
+ * and is released when the last one did, so a congested connection only
+ * holds back its own position in the queue.
+ *
+ * This file has no ESP-IDF dependencies so it can be built and exercised on
+ * a host.
+ *
+ * =============================================================================
+ */
+
+#ifndef _BLEMIDI_TXQUEUE_H
+#define _BLEMIDI_TXQUEUE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#include "blemidi.h"
+#include "blemidi_packet.h"
+
+#ifndef BLEMIDI_TX_QUEUE_LEN
+#define BLEMIDI_TX_QUEUE_LEN 8
+#endif
+
+// targets are bits of a uint8_t mask
+#define BLEMIDI_TXQUEUE_MAX_TARGETS 8
+
+// a CC-only packet carries at most one key per two bytes
+#define BLEMIDI_TXQUEUE_MAX_KEYS (BLEMIDI_PACKET_BUFFER_SIZE / 2)
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+    typedef struct
+    {
+        uint8_t data[BLEMIDI_PACKET_BUFFER_SIZE];
+        uint8_t len;
+        bool protected_packet;                   // must not be dropped
+        uint8_t pending;                         // targets which haven't sent the packet yet
+        uint8_t num_keys;
+        uint16_t keys[BLEMIDI_TXQUEUE_MAX_KEYS]; // (status << 8) | controller of each CC in an unprotected packet
+    } blemidi_txqueue_entry_t;
+
+    typedef struct
+    {
+        blemidi_txqueue_entry_t entries[BLEMIDI_TX_QUEUE_LEN];
+        uint8_t head;
+        uint8_t count;
+        uint8_t targets;                         // targets of newly queued packets
+        blemidi_tx_stats_t stats;
+    } blemidi_txqueue_t;
+
+    /**
+     * @brief Initializes an empty queue and clears the counters
+     */
+    extern void blemidi_txqueue_init(blemidi_txqueue_t* queue);
+
+    /**
+     * @brief Selects the targets which packets queued from now on are sent to.
+     *        Packets which are already queued keep their targets.
+     */
+    extern void blemidi_txqueue_set_targets(blemidi_txqueue_t* queue, uint8_t targets);
+
+    /**
+     * @brief Removes a target, e.g. on disconnect. Its pending packets are released if no other
+     *        target is waiting for them.
+     */
+    extern void blemidi_txqueue_remove_target(blemidi_txqueue_t* queue, uint8_t target);
+
+    /**
+     * @brief Appends a packet, dropping a CC-only packet if the queue is full
+     *
+     * @param  queue            the queue
+     * @param  packet           BLE MIDI packet as created by blemidi_packet.c
+     * @param  len              packet length
+     * @param  protected_packet true if the packet must never be dropped
+     *
+     * @return 0 if queued, 1 if queued after dropping another packet,
+     *         -1 if the queue is full of protected packets, -2 if the packet is too long
+     */
+    extern int32_t blemidi_txqueue_push(blemidi_txqueue_t* queue, const uint8_t* packet, size_t len, bool protected_packet);
+
+    /**
+     * @brief Hands out the slot behind the last queued packet, so that a protected packet can be
+     *        written in place instead of being built in a temporary buffer first.
+     *        The slot is owned by the caller until blemidi_txqueue_commit(); no other queue function
+     *        may be called in between. A CC-only packet is dropped if the queue is full.
+     *
+     * @return packet buffer of BLEMIDI_PACKET_BUFFER_SIZE bytes, NULL if the queue is full of protected packets
+     */
+    extern uint8_t* blemidi_txqueue_reserve(blemidi_txqueue_t* queue);
+
+    /**
+     * @brief Queues the packet written into the slot returned by blemidi_txqueue_reserve()
+     *
+     * @param  queue the queue
+     * @param  len   packet length
+     *
+     * @return 0 if queued, -2 if the packet is too long
+     */
+    extern int32_t blemidi_txqueue_commit(blemidi_txqueue_t* queue, size_t len);
+
+    /**
+     * @brief Returns the oldest packet which the target hasn't sent yet, NULL if there is none
+     */
+    extern const blemidi_txqueue_entry_t* blemidi_txqueue_peek(const blemidi_txqueue_t* queue, uint8_t target);
+
+    /**
+     * @brief Marks the packet returned by blemidi_txqueue_peek() as sent by the target.
+     *        It's removed once all of its targets have sent it.
+     */
+    extern void blemidi_txqueue_pop(blemidi_txqueue_t* queue, uint8_t target);
+
+    /**
+     * @brief Like blemidi_txqueue_pop(), for a packet which exceeds the target's MTU and is not
+     *        sent to it. It's counted as too long instead of sent.
+     */
+    extern void blemidi_txqueue_skip_too_long(blemidi_txqueue_t* queue, uint8_t target);
+
+    /**
+     * @brief Drops all packets (e.g. on disconnect), they are counted as dropped
+     */
+    extern void blemidi_txqueue_clear(blemidi_txqueue_t* queue);
+
+    /**
+     * @brief Returns the number of queued packets
+     */
+    extern size_t blemidi_txqueue_count(const blemidi_txqueue_t* queue);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _BLEMIDI_TXQUEUE_H */
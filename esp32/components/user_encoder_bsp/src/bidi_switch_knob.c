@@ -14,11 +14,11 @@
 #include "esp_log.h"
 #include "esp_timer.h"
 #include "bidi_switch_knob.h"
+#include "knob_debounce.h"
 
-static const char *TAG = "Knob";
+#if !KNOB_USE_PCNT
 
-#define TICKS_INTERVAL 3
-#define DEBOUNCE_TICKS 2
+static const char *TAG = "Knob";
 
 #define KNOB_CHECK(a, str, ret_val)                               \
     if (!(a))                                                     \
@@ -42,11 +42,10 @@ typedef struct Knob
 {
     bool encoder_a_change;                          /*<! true means Encoder A phase Inverted*/
     bool encoder_b_change;                          /*<! true means Encoder B phase Inverted*/
-    uint8_t debounce_a_cnt;                         /*!< Encoder A phase debounce count */
-    uint8_t debounce_b_cnt;                         /*!< Encoder B phase debounce count */
-    uint8_t encoder_a_level;                        /*!< Encoder A phase current level */
-    uint8_t encoder_b_level;                        /*!< Encoder B phase current Level */
+    knob_debounce_t phase_a;                        /*!< Encoder A phase debounce state */
+    knob_debounce_t phase_b;                        /*!< Encoder B phase debounce state */
     knob_event_t event;                             /*!< Current event */
+    int64_t event_time_us;                          /*!< Timer tick time of the current event */
     int count_value;                                /*!< Knob count */
     uint8_t (*hal_knob_level)(void *hardware_data); /*!< Get current level */
     void *encoder_a;                                /*!< Encoder A phase gpio number */
@@ -61,30 +60,15 @@ static esp_timer_handle_t s_knob_timer_handle;
 static bool s_is_timer_running = false;
 
 // 判定函数
-static void process_knob_channel(uint8_t current_level, uint8_t *prev_level,
-                                 uint8_t *debounce_cnt, int *count_value,
+static void process_knob_channel(uint8_t current_level, knob_debounce_t *phase,
                                  knob_event_t event, bool is_increment, knob_dev_t *knob)
 {
-    if (current_level == 0)
+    if (knob_debounce_update(phase, current_level, DEBOUNCE_TICKS))
     {
-        if (current_level != *prev_level)
-            *debounce_cnt = 0;
-        else
-            (*debounce_cnt)++;
-    }
-    else
-    {
-        if (current_level != *prev_level && ++(*debounce_cnt) >= DEBOUNCE_TICKS)
-        {
-            *debounce_cnt = 0;
-            *count_value += is_increment ? 1 : -1;
-            knob->event = event;
-            CALL_EVENT_CB(event);
-        }
-        else
-            *debounce_cnt = 0;
+        knob->count_value += is_increment ? 1 : -1;
+        knob->event = event;
+        CALL_EVENT_CB(event);
     }
-    *prev_level = current_level;
 }
 
 static void knob_handler(knob_dev_t *knob)
@@ -92,21 +76,18 @@ static void knob_handler(knob_dev_t *knob)
     uint8_t pha_value = knob->hal_knob_level(knob->encoder_a);
     uint8_t phb_value = knob->hal_knob_level(knob->encoder_b);
 
-    process_knob_channel(pha_value, &knob->encoder_a_level,
-                         &knob->debounce_a_cnt, &knob->count_value,
-                         KNOB_RIGHT, true, knob);
-
-    process_knob_channel(phb_value, &knob->encoder_b_level,
-                         &knob->debounce_b_cnt, &knob->count_value,
-                         KNOB_LEFT, false, knob);
+    process_knob_channel(pha_value, &knob->phase_a, KNOB_RIGHT, true, knob);
+    process_knob_channel(phb_value, &knob->phase_b, KNOB_LEFT, false, knob);
 }
 
 // 这是timer的回调函数，定期执行
 static void knob_cb(void *args)
 {
     knob_dev_t *target;
+    int64_t now = esp_timer_get_time();
     for (target = s_head_handle; target; target = target->next)
     {
+        target->event_time_us = now;
         knob_handler(target);
     }
 }
@@ -129,8 +110,8 @@ knob_handle_t iot_knob_create(const knob_config_t *config)
     knob->encoder_a = (void *)(long)config->gpio_encoder_a;
     knob->encoder_b = (void *)(long)config->gpio_encoder_b;
 
-    knob->encoder_a_level = knob->hal_knob_level(knob->encoder_a);
-    knob->encoder_b_level = knob->hal_knob_level(knob->encoder_b);
+    knob_debounce_init(&knob->phase_a, knob->hal_knob_level(knob->encoder_a));
+    knob_debounce_init(&knob->phase_b, knob->hal_knob_level(knob->encoder_b));
 
     knob->event = KNOB_NONE;
 
@@ -230,6 +211,13 @@ knob_event_t iot_knob_get_event(knob_handle_t knob_handle)
     return knob->event;
 }
 
+int64_t iot_knob_get_event_time(knob_handle_t knob_handle)
+{
+    KNOB_CHECK(NULL != knob_handle, "Pointer of handle is invalid", 0);
+    knob_dev_t *knob = (knob_dev_t *)knob_handle;
+    return knob->event_time_us;
+}
+
 int iot_knob_get_count_value(knob_handle_t knob_handle)
 {
     KNOB_CHECK(NULL != knob_handle, "Pointer of handle is invalid", ESP_ERR_INVALID_ARG);
@@ -267,6 +255,8 @@ esp_err_t iot_knob_stop(void)
     return ESP_OK;
 }
 
+#endif // !KNOB_USE_PCNT
+
 esp_err_t knob_gpio_init(uint32_t gpio_num)
 {
     gpio_config_t gpio_cfg = {
@@ -0,0 +1,356 @@
+/*
+ * Pulse counter (PCNT) backend for the iot_knob_* API.
+ *
+ * Instead of polling both phases from a periodic esp_timer, the falling edges
+ * are counted by the PCNT peripheral with its glitch filter enabled: phase A
+ * pulses (right) count up, phase B pulses (left) count down. The counter
+ * limits are one count, so every edge raises an interrupt and the CPU stays
+ * idle while the knob is not turned. A small task confirms each pulse after
+ * the contact bounce (see knob_pulse.h) and dispatches the event callbacks,
+ * i.e. from task context just like the timer backend does.
+ *
+ * Enable with KNOB_USE_PCNT=1 (see bidi_switch_knob.h).
+ */
+
+#include "bidi_switch_knob.h"
+
+#if KNOB_USE_PCNT
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "driver/pulse_cnt.h"
+#include "driver/gpio.h"
+#include "esp_attr.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "knob_pulse.h"
+
+static const char *TAG = "Knob";
+
+#define KNOB_CHECK(a, str, ret_val)                               \
+    if (!(a))                                                     \
+    {                                                             \
+        ESP_LOGE(TAG, "%s(%d): %s", __FUNCTION__, __LINE__, str); \
+        return (ret_val);                                         \
+    }
+
+#define KNOB_CHECK_GOTO(a, str, label)                                         \
+    if (!(a))                                                                  \
+    {                                                                          \
+        ESP_LOGE(TAG, "%s:%d (%s):%s", __FILE__, __LINE__, __FUNCTION__, str); \
+        goto label;                                                            \
+    }
+
+#define CALL_EVENT_CB(ev) \
+    if (knob->cb[ev])     \
+    knob->cb[ev](knob, knob->usr_data[ev])
+
+typedef struct
+{
+    struct Knob *knob;    /*!< Knob whose counter moved */
+    int direction;        /*!< +1 = falling edge on phase A, -1 = on phase B */
+    int64_t time_us;      /*!< Time of the edge */
+} knob_pcnt_event_t;
+
+typedef struct Knob
+{
+    pcnt_unit_handle_t unit;        /*!< PCNT unit counting both phases */
+    pcnt_channel_handle_t chan_a;   /*!< Channel counting falling edges on phase A up */
+    pcnt_channel_handle_t chan_b;   /*!< Channel counting falling edges on phase B down */
+    knob_pulse_t pulse;             /*!< Bounce windows of both phases */
+    uint8_t gpio_encoder_a;         /*!< Encoder A phase gpio number */
+    uint8_t gpio_encoder_b;         /*!< Encoder B phase gpio number */
+    bool running;                   /*!< true while the unit is counting */
+    knob_event_t event;             /*!< Current event */
+    int64_t event_time_us;          /*!< Time of the current event */
+    int count_value;                /*!< Knob count */
+    void *usr_data[KNOB_EVENT_MAX]; /*!< User data for event */
+    knob_cb_t cb[KNOB_EVENT_MAX];   /*!< Event callback */
+    struct Knob *next;              /*!< Next pointer */
+} knob_dev_t;
+
+static knob_dev_t *s_head_handle = NULL;
+static QueueHandle_t s_knob_queue = NULL;
+static bool s_knob_task_created = false;
+
+static bool IRAM_ATTR knob_pcnt_on_reach(pcnt_unit_handle_t unit, const pcnt_watch_event_data_t *edata, void *user_ctx)
+{
+    BaseType_t high_task_wakeup = pdFALSE;
+    knob_pcnt_event_t event = {
+        .knob = (knob_dev_t *)user_ctx,
+        .direction = edata->watch_point_value,
+        .time_us = esp_timer_get_time(),
+    };
+    xQueueSendFromISR(s_knob_queue, &event, &high_task_wakeup);
+    return high_task_wakeup == pdTRUE;
+}
+
+static void knob_pcnt_task(void *arg)
+{
+    knob_pcnt_event_t event;
+    while (1)
+    {
+        if (xQueueReceive(s_knob_queue, &event, portMAX_DELAY) != pdTRUE)
+        {
+            continue;
+        }
+
+        knob_dev_t *knob = event.knob;
+        if (!knob_pulse_edge(&knob->pulse, event.direction, event.time_us))
+        {
+            continue;
+        }
+
+        // Sleep until the bounce is over, a tick more as the first one may be cut short
+        int64_t wait_us = event.time_us + KNOB_PCNT_SETTLE_US - esp_timer_get_time();
+        if (wait_us > 0)
+        {
+            vTaskDelay(pdMS_TO_TICKS((wait_us + 999) / 1000) + 1);
+        }
+        // Read twice a tick apart: a crosstalk glitch on the phase can't cover both
+        int gpio_num = event.direction > 0 ? knob->gpio_encoder_a : knob->gpio_encoder_b;
+        uint8_t level = gpio_get_level(gpio_num);
+        if (!level)
+        {
+            vTaskDelay(1);
+            level = gpio_get_level(gpio_num);
+        }
+        int detent = knob_pulse_settled(&knob->pulse, event.direction, level, esp_timer_get_time());
+        if (detent == 0)
+        {
+            continue;
+        }
+
+        knob->event_time_us = event.time_us;
+        knob->count_value += detent;
+        knob->event = detent > 0 ? KNOB_RIGHT : KNOB_LEFT;
+        CALL_EVENT_CB(knob->event);
+    }
+}
+
+static esp_err_t knob_pcnt_setup(knob_dev_t *knob)
+{
+    pcnt_unit_config_t unit_config = {
+        // the counter resets to zero at either limit, i.e. after every edge
+        .high_limit = 1,
+        .low_limit = -1,
+    };
+    esp_err_t ret = pcnt_new_unit(&unit_config, &knob->unit);
+    KNOB_CHECK(ESP_OK == ret, "pcnt unit create failed", ret);
+
+    pcnt_glitch_filter_config_t filter_config = {
+        .max_glitch_ns = KNOB_PCNT_GLITCH_NS,
+    };
+    ret = pcnt_unit_set_glitch_filter(knob->unit, &filter_config);
+    KNOB_CHECK(ESP_OK == ret, "pcnt glitch filter failed", ret);
+
+    // One pulse per detent on one phase while the other stays idle high: each channel
+    // counts the falling edges of its phase, without level gating
+    pcnt_chan_config_t chan_a_config = {
+        .edge_gpio_num = knob->gpio_encoder_a,
+        .level_gpio_num = -1,
+    };
+    ret = pcnt_new_channel(knob->unit, &chan_a_config, &knob->chan_a);
+    KNOB_CHECK(ESP_OK == ret, "pcnt channel A create failed", ret);
+
+    pcnt_chan_config_t chan_b_config = {
+        .edge_gpio_num = knob->gpio_encoder_b,
+        .level_gpio_num = -1,
+    };
+    ret = pcnt_new_channel(knob->unit, &chan_b_config, &knob->chan_b);
+    KNOB_CHECK(ESP_OK == ret, "pcnt channel B create failed", ret);
+
+    // edge actions are (rising, falling)
+    pcnt_channel_set_edge_action(knob->chan_a, PCNT_CHANNEL_EDGE_ACTION_HOLD, PCNT_CHANNEL_EDGE_ACTION_INCREASE);
+    pcnt_channel_set_edge_action(knob->chan_b, PCNT_CHANNEL_EDGE_ACTION_HOLD, PCNT_CHANNEL_EDGE_ACTION_DECREASE);
+
+    // the encoder contacts switch to ground
+    gpio_set_pull_mode(knob->gpio_encoder_a, GPIO_PULLUP_ONLY);
+    gpio_set_pull_mode(knob->gpio_encoder_b, GPIO_PULLUP_ONLY);
+
+    ret = pcnt_unit_add_watch_point(knob->unit, 1);
+    KNOB_CHECK(ESP_OK == ret, "pcnt high watch point failed", ret);
+    ret = pcnt_unit_add_watch_point(knob->unit, -1);
+    KNOB_CHECK(ESP_OK == ret, "pcnt low watch point failed", ret);
+
+    pcnt_event_callbacks_t cbs = {
+        .on_reach = knob_pcnt_on_reach,
+    };
+    ret = pcnt_unit_register_event_callbacks(knob->unit, &cbs, knob);
+    KNOB_CHECK(ESP_OK == ret, "pcnt callback register failed", ret);
+
+    ret = pcnt_unit_enable(knob->unit);
+    KNOB_CHECK(ESP_OK == ret, "pcnt unit enable failed", ret);
+    ret = pcnt_unit_clear_count(knob->unit);
+    KNOB_CHECK(ESP_OK == ret, "pcnt clear count failed", ret);
+    ret = pcnt_unit_start(knob->unit);
+    KNOB_CHECK(ESP_OK == ret, "pcnt unit start failed", ret);
+    knob->running = true;
+    return ESP_OK;
+}
+
+static void knob_pcnt_teardown(knob_dev_t *knob)
+{
+    if (knob->unit)
+    {
+        // both may fail if setup didn't get that far, which is fine here
+        pcnt_unit_stop(knob->unit);
+        pcnt_unit_disable(knob->unit);
+        knob->running = false;
+        if (knob->chan_a)
+        {
+            pcnt_del_channel(knob->chan_a);
+        }
+        if (knob->chan_b)
+        {
+            pcnt_del_channel(knob->chan_b);
+        }
+        pcnt_del_unit(knob->unit);
+    }
+}
+
+knob_handle_t iot_knob_create(const knob_config_t *config)
+{
+    KNOB_CHECK(NULL != config, "config pointer can't be NULL!", NULL)
+    KNOB_CHECK(config->gpio_encoder_a != config->gpio_encoder_b, "encoder A can't be the same as encoder B", NULL);
+
+    if (!s_knob_queue)
+    {
+        s_knob_queue = xQueueCreate(KNOB_PCNT_QUEUE_SIZE, sizeof(knob_pcnt_event_t));
+        KNOB_CHECK(NULL != s_knob_queue, "knob queue create failed", NULL);
+    }
+    if (!s_knob_task_created)
+    {
+        KNOB_CHECK(NULL != config->task_create, "task_create can't be NULL!", NULL);
+        s_knob_task_created = config->task_create(knob_pcnt_task, NULL);
+        KNOB_CHECK(s_knob_task_created, "knob task create failed", NULL);
+    }
+
+    knob_dev_t *knob = (knob_dev_t *)calloc(1, sizeof(knob_dev_t));
+    KNOB_CHECK(NULL != knob, "alloc knob failed", NULL);
+
+    knob->gpio_encoder_a = config->gpio_encoder_a;
+    knob->gpio_encoder_b = config->gpio_encoder_b;
+    knob->event = KNOB_NONE;
+    knob_pulse_init(&knob->pulse, KNOB_PCNT_SETTLE_US);
+
+    esp_err_t ret = knob_pcnt_setup(knob);
+    KNOB_CHECK_GOTO(ESP_OK == ret, "pcnt setup failed", _knob_free);
+
+    knob->next = s_head_handle;
+    s_head_handle = knob;
+
+    ESP_LOGI(TAG, "Iot Knob (PCNT) Config Succeed, encoder A:%d, encoder B:%d", config->gpio_encoder_a, config->gpio_encoder_b);
+    return (knob_handle_t)knob;
+
+_knob_free:
+    knob_pcnt_teardown(knob);
+    free(knob);
+    return NULL;
+}
+
+esp_err_t iot_knob_delete(knob_handle_t knob_handle)
+{
+    KNOB_CHECK(NULL != knob_handle, "Pointer of handle is invalid", ESP_ERR_INVALID_ARG);
+    knob_dev_t *knob = (knob_dev_t *)knob_handle;
+    knob_dev_t **curr;
+    for (curr = &s_head_handle; *curr;)
+    {
+        knob_dev_t *entry = *curr;
+        if (entry == knob)
+        {
+            *curr = entry->next;
+            knob_pcnt_teardown(entry);
+            free(entry);
+        }
+        else
+        {
+            curr = &entry->next;
+        }
+    }
+    return ESP_OK;
+}
+
+esp_err_t iot_knob_register_cb(knob_handle_t knob_handle, knob_event_t event, knob_cb_t cb, void *usr_data)
+{
+    KNOB_CHECK(NULL != knob_handle, "Pointer of handle is invalid", ESP_ERR_INVALID_ARG);
+    KNOB_CHECK(event < KNOB_EVENT_MAX, "event is invalid", ESP_ERR_INVALID_ARG);
+    knob_dev_t *knob = (knob_dev_t *)knob_handle;
+    knob->cb[event] = cb;
+    knob->usr_data[event] = usr_data;
+    return ESP_OK;
+}
+
+esp_err_t iot_knob_unregister_cb(knob_handle_t knob_handle, knob_event_t event)
+{
+    KNOB_CHECK(NULL != knob_handle, "Pointer of handle is invalid", ESP_ERR_INVALID_ARG);
+    KNOB_CHECK(event < KNOB_EVENT_MAX, "event is invalid", ESP_ERR_INVALID_ARG);
+    knob_dev_t *knob = (knob_dev_t *)knob_handle;
+    knob->cb[event] = NULL;
+    knob->usr_data[event] = NULL;
+    return ESP_OK;
+}
+
+knob_event_t iot_knob_get_event(knob_handle_t knob_handle)
+{
+    KNOB_CHECK(NULL != knob_handle, "Pointer of handle is invalid", ESP_ERR_INVALID_ARG);
+    knob_dev_t *knob = (knob_dev_t *)knob_handle;
+    return knob->event;
+}
+
+int64_t iot_knob_get_event_time(knob_handle_t knob_handle)
+{
+    KNOB_CHECK(NULL != knob_handle, "Pointer of handle is invalid", 0);
+    knob_dev_t *knob = (knob_dev_t *)knob_handle;
+    return knob->event_time_us;
+}
+
+int iot_knob_get_count_value(knob_handle_t knob_handle)
+{
+    KNOB_CHECK(NULL != knob_handle, "Pointer of handle is invalid", ESP_ERR_INVALID_ARG);
+    knob_dev_t *knob = (knob_dev_t *)knob_handle;
+    return knob->count_value;
+}
+
+esp_err_t iot_knob_clear_count_value(knob_handle_t knob_handle)
+{
+    KNOB_CHECK(NULL != knob_handle, "Pointer of handle is invalid", ESP_ERR_INVALID_ARG);
+    knob_dev_t *knob = (knob_dev_t *)knob_handle;
+    knob->count_value = 0;
+    return ESP_OK;
+}
+
+esp_err_t iot_knob_resume(void)
+{
+    KNOB_CHECK(s_head_handle, "no knob created", ESP_ERR_INVALID_STATE);
+    for (knob_dev_t *knob = s_head_handle; knob; knob = knob->next)
+    {
+        if (!knob->running)
+        {
+            esp_err_t err = pcnt_unit_start(knob->unit);
+            KNOB_CHECK(ESP_OK == err, "pcnt unit start failed", ESP_FAIL);
+            knob->running = true;
+        }
+    }
+    return ESP_OK;
+}
+
+esp_err_t iot_knob_stop(void)
+{
+    KNOB_CHECK(s_head_handle, "no knob created", ESP_ERR_INVALID_STATE);
+    for (knob_dev_t *knob = s_head_handle; knob; knob = knob->next)
+    {
+        if (knob->running)
+        {
+            esp_err_t err = pcnt_unit_stop(knob->unit);
+            KNOB_CHECK(ESP_OK == err, "pcnt unit stop failed", ESP_FAIL);
+            knob->running = false;
+        }
+    }
+    return ESP_OK;
+}
+
+#endif // KNOB_USE_PCNT
@@ -0,0 +1,38 @@
+/*
+ * Per-phase debounce state machine of the polling knob backend.
+ */
+
+#include "knob_debounce.h"
+
+void knob_debounce_init(knob_debounce_t *phase, uint8_t level)
+{
+    phase->level = level;
+    phase->debounce_cnt = 0;
+    phase->rejected_edges = 0;
+}
+
+bool knob_debounce_update(knob_debounce_t *phase, uint8_t level, uint8_t debounce_ticks)
+{
+    bool detent = false;
+    if (level == 0)
+    {
+        if (level != phase->level)
+            phase->debounce_cnt = 0;
+        else if (phase->debounce_cnt < UINT8_MAX)
+            phase->debounce_cnt++;
+    }
+    else if (level != phase->level)
+    {
+        if (++phase->debounce_cnt >= debounce_ticks)
+            detent = true;
+        else
+            phase->rejected_edges++;
+        phase->debounce_cnt = 0;
+    }
+    else
+    {
+        phase->debounce_cnt = 0;
+    }
+    phase->level = level;
+    return detent;
+}
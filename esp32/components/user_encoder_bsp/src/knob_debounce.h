@@ -0,0 +1,53 @@
+/*
+ * Per-phase debounce state machine of the polling knob backend.
+ *
+ * This file has no ESP-IDF dependencies so it can be built on a host and
+ * driven with generated A/B waveforms to tune TICKS_INTERVAL/DEBOUNCE_TICKS.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+    /**
+     * @brief Debounce state of one encoder phase
+     *
+     */
+    typedef struct
+    {
+        uint8_t level;              /*!< Level seen at the previous tick */
+        uint8_t debounce_cnt;       /*!< Ticks the phase has been held low */
+        uint32_t rejected_edges;    /*!< Rising edges dropped because the low phase was too short */
+    } knob_debounce_t;
+
+    /**
+     * @brief Initialize a phase
+     *
+     * @param phase debounce state
+     * @param level current level of the phase
+     */
+    void knob_debounce_init(knob_debounce_t *phase, uint8_t level);
+
+    /**
+     * @brief Feed the level sampled at one tick
+     *
+     * A detent is reported on the rising edge that ends a low phase held for
+     * at least debounce_ticks samples (the falling edge sample included).
+     *
+     * @param phase debounce state
+     * @param level sampled level
+     * @param debounce_ticks required low samples
+     *
+     * @return true if a detent completed on this tick
+     */
+    bool knob_debounce_update(knob_debounce_t *phase, uint8_t level, uint8_t debounce_ticks);
+
+#ifdef __cplusplus
+}
+#endif
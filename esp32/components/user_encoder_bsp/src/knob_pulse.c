@@ -0,0 +1,42 @@
+/*
+ * Pulse confirmation of the PCNT knob backend.
+ */
+
+#include "knob_pulse.h"
+
+void knob_pulse_init(knob_pulse_t *pulse, uint32_t settle_us)
+{
+    pulse->settle_us = settle_us;
+    pulse->window_end_us[0] = INT64_MIN;
+    pulse->window_end_us[1] = INT64_MIN;
+    pulse->bounce_edges = 0;
+    pulse->rejected_pulses = 0;
+}
+
+bool knob_pulse_edge(knob_pulse_t *pulse, int direction, int64_t time_us)
+{
+    int64_t *window_end_us = &pulse->window_end_us[direction > 0 ? 0 : 1];
+    if (time_us < *window_end_us)
+    {
+        pulse->bounce_edges++;
+        return false;
+    }
+    *window_end_us = time_us + pulse->settle_us;
+    return true;
+}
+
+int knob_pulse_settled(knob_pulse_t *pulse, int direction, uint8_t level, int64_t time_us)
+{
+    int64_t *window_end_us = &pulse->window_end_us[direction > 0 ? 0 : 1];
+    if (time_us > *window_end_us)
+    {
+        *window_end_us = time_us;
+    }
+
+    if (level)
+    {
+        pulse->rejected_pulses++;
+        return 0;
+    }
+    return direction > 0 ? 1 : -1;
+}
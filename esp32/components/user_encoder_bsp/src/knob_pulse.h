@@ -0,0 +1,73 @@
+/*
+ * Pulse confirmation of the PCNT knob backend.
+ *
+ * The knob is a bidirectional switch: a detent to the right pulls phase A low
+ * for part of the detent, a detent to the left pulls phase B low. The PCNT
+ * peripheral reports the falling edges, with contact bounce several per pulse.
+ * The first edge opens a settle window, edges inside it are bounce, and the
+ * detent counts if the phase is still held low when the window ends. Crosstalk
+ * and release bounce are over by then. The window lasts until the phase was
+ * actually read, so edges which that read already covered don't count again.
+ *
+ * This file has no ESP-IDF dependencies, so it can be built and driven with
+ * generated waveforms on a host.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+    /**
+     * @brief Settle windows of both phases
+     *
+     */
+    typedef struct
+    {
+        uint32_t settle_us;         /*!< Window length, longer than the contact bounce */
+        int64_t window_end_us[2];   /*!< Phase A (right) and B (left), edges before this are bounce */
+        uint32_t bounce_edges;      /*!< Edges inside an open window */
+        uint32_t rejected_pulses;   /*!< Windows which ended with the phase high again */
+    } knob_pulse_t;
+
+    /**
+     * @brief Initialize the windows
+     *
+     * @param pulse window state
+     * @param settle_us window length
+     */
+    void knob_pulse_init(knob_pulse_t *pulse, uint32_t settle_us);
+
+    /**
+     * @brief Feed a falling edge reported by the counter
+     *
+     * @param pulse window state
+     * @param direction +1 = phase A, -1 = phase B
+     * @param time_us time of the edge
+     *
+     * @return true if the edge opened a window: read the phase at time_us + settle_us
+     *         and pass it to knob_pulse_settled()
+     */
+    bool knob_pulse_edge(knob_pulse_t *pulse, int direction, int64_t time_us);
+
+    /**
+     * @brief Close a window with the level of its phase
+     *
+     * @param pulse window state
+     * @param direction +1 = phase A, -1 = phase B
+     * @param level phase level read at the end of the window, high if any of the reads
+     *              was high (the caller reads a low phase again to rule out crosstalk)
+     * @param time_us time of the last read, at least the end of the window
+     *
+     * @return direction if the phase is held low (one detent), 0 otherwise
+     */
+    int knob_pulse_settled(knob_pulse_t *pulse, int direction, uint8_t level, int64_t time_us);
+
+#ifdef __cplusplus
+}
+#endif
@@ -1,4 +1,5 @@
 #include <stdio.h>
+#include <stdatomic.h>
 #include "freertos/FreeRTOS.h"
 #include "user_encoder_bsp.h"
 #include "user_config.h"
@@ -8,29 +9,109 @@
 
 static const char *TAG = "encoder";
 
-EventGroupHandle_t knob_even_ = NULL;
+// must be a power of two
+#define ENCODER_EVENT_QUEUE_SIZE 64
 
 static knob_handle_t s_knob = 0;
+
+// Single-producer (knob timer task) / single-consumer (main loop) ring of detents.
+// The producer only writes s_event_head, the consumer only writes s_event_tail.
+static encoder_event_t s_events[ENCODER_EVENT_QUEUE_SIZE];
+static atomic_uint s_event_head = 0;
+static atomic_uint s_event_tail = 0;
+// travel that didn't fit into the ring - handed out by the consumer so nothing gets lost
+static atomic_int s_overflow_delta = 0;
+static atomic_llong s_overflow_timestamp_us = 0;
+
+// consumer notification, raised once per batch and re-armed by user_encoder_read_events()
+static user_encoder_notify_cb_t s_notify_cb = NULL;
+static void *s_notify_arg = NULL;
+static atomic_bool s_notify_pending = false;
+
+static void _knob_push_event(int8_t delta, int64_t now)
+{
+  unsigned head = atomic_load_explicit(&s_event_head, memory_order_relaxed);
+  unsigned tail = atomic_load_explicit(&s_event_tail, memory_order_acquire);
+
+  if ((head - tail) >= ENCODER_EVENT_QUEUE_SIZE)
+  {
+    atomic_store_explicit(&s_overflow_timestamp_us, now, memory_order_relaxed);
+    atomic_fetch_add_explicit(&s_overflow_delta, delta, memory_order_release);
+  }
+  else
+  {
+    encoder_event_t *event = &s_events[head & (ENCODER_EVENT_QUEUE_SIZE - 1)];
+    event->delta = delta;
+    event->timestamp_us = now;
+    atomic_store_explicit(&s_event_head, head + 1, memory_order_release);
+  }
+
+  user_encoder_notify_cb_t cb = s_notify_cb;
+  if (cb && !atomic_exchange(&s_notify_pending, true))
+  {
+    if (!cb(s_notify_arg))
+    {
+      atomic_store_explicit(&s_notify_pending, false, memory_order_release);
+    }
+  }
+}
+
 static void _knob_left_cb(void *arg, void *data)
 {
-  uint8_t eventBits_ = 0;
-  SET_BIT(eventBits_, 0);
-  xEventGroupSetBits(knob_even_, eventBits_);
+  _knob_push_event(-1, iot_knob_get_event_time(arg));
 }
 static void _knob_right_cb(void *arg, void *data)
 {
-  uint8_t eventBits_ = 0;
-  SET_BIT(eventBits_, 1);
-  xEventGroupSetBits(knob_even_, eventBits_);
+  _knob_push_event(1, iot_knob_get_event_time(arg));
 }
-void user_encoder_init(void)
+
+size_t user_encoder_read_events(encoder_event_t *events, size_t max_events)
+{
+  size_t count = 0;
+  // re-arm first: anything pushed after this point notifies again
+  atomic_store(&s_notify_pending, false);
+  atomic_thread_fence(memory_order_seq_cst);
+  unsigned tail = atomic_load_explicit(&s_event_tail, memory_order_relaxed);
+  unsigned head = atomic_load_explicit(&s_event_head, memory_order_acquire);
+
+  while (tail != head && count < max_events)
+  {
+    events[count++] = s_events[tail & (ENCODER_EVENT_QUEUE_SIZE - 1)];
+    tail++;
+  }
+  atomic_store_explicit(&s_event_tail, tail, memory_order_release);
+
+  // append overflowed travel as merged events once the ring has been emptied
+  while (tail == head && count < max_events && atomic_load_explicit(&s_overflow_delta, memory_order_acquire) != 0)
+  {
+    int overflow = atomic_exchange_explicit(&s_overflow_delta, 0, memory_order_acquire);
+    int chunk = overflow > INT8_MAX ? INT8_MAX : (overflow < -INT8_MAX ? -INT8_MAX : overflow);
+    if (chunk != overflow)
+    {
+      atomic_fetch_add_explicit(&s_overflow_delta, overflow - chunk, memory_order_relaxed);
+    }
+    events[count].delta = (int8_t)chunk;
+    events[count].timestamp_us = atomic_load_explicit(&s_overflow_timestamp_us, memory_order_relaxed);
+    count++;
+  }
+
+  return count;
+}
+
+void user_encoder_set_notify_cb(user_encoder_notify_cb_t cb, void *arg)
+{
+  s_notify_arg = arg;
+  s_notify_cb = cb;
+}
+
+void user_encoder_init(user_encoder_task_create_t task_create)
 {
-  knob_even_ = xEventGroupCreate();
   // create knob
   knob_config_t cfg =
       {
           .gpio_encoder_a = EXAMPLE_ENCODER_ECA_PIN,
           .gpio_encoder_b = EXAMPLE_ENCODER_ECB_PIN,
+          .task_create = task_create,
       };
   s_knob = iot_knob_create(&cfg);
   if (NULL == s_knob)
@@ -39,4 +120,4 @@ void user_encoder_init(void)
   }
   ESP_ERROR_CHECK(iot_knob_register_cb(s_knob, KNOB_LEFT, _knob_left_cb, NULL));
   ESP_ERROR_CHECK(iot_knob_register_cb(s_knob, KNOB_RIGHT, _knob_right_cb, NULL));
-}
\ No newline at end of file
+}
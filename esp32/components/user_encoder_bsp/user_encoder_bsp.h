@@ -1,19 +1,67 @@
-
 #ifndef USER_ENCODER_H
 #define USER_ENCODER_H
 
-
-extern EventGroupHandle_t knob_even_;
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
 
 #ifdef __cplusplus
 extern "C" {
 #endif
 
-void user_encoder_init(void);
+/**
+ * @brief A single decoded detent
+ */
+typedef struct
+{
+  int8_t delta;         /*!< +1 = right, -1 = left (may be larger for merged overflow) */
+  int64_t timestamp_us; /*!< esp_timer time at which the detent was decoded */
+} encoder_event_t;
+
+/**
+ * @brief Called from the knob task when detents become pending
+ *
+ * Invoked once per batch: after a notification no further calls are made
+ * until the consumer has called user_encoder_read_events().
+ *
+ * @return false if the notification could not be delivered, the next detent retries
+ */
+typedef bool (*user_encoder_notify_cb_t)(void *arg);
+
+/**
+ * @brief Creates the knob task (PCNT backend), see knob_task_create_t
+ *
+ * @return true if the task was created
+ */
+typedef bool (*user_encoder_task_create_t)(void (*task)(void *), void *arg);
+
+/**
+ * @brief Create the knob and start decoding
+ *
+ * @param task_create creates the knob task where the application places it
+ */
+void user_encoder_init(user_encoder_task_create_t task_create);
+
+/**
+ * @brief Register the callback notified when detents become pending
+ *
+ * @param cb  callback, NULL to disable
+ * @param arg user argument passed to the callback
+ */
+void user_encoder_set_notify_cb(user_encoder_notify_cb_t cb, void *arg);
+
+/**
+ * @brief Drain queued detent events (single consumer)
+ *
+ * @param events     destination array
+ * @param max_events capacity of the destination array
+ *
+ * @return number of events written to the array
+ */
+size_t user_encoder_read_events(encoder_event_t *events, size_t max_events);
 
 #ifdef __cplusplus
 }
 #endif
 
 #endif
-
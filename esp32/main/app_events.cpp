@@ -0,0 +1,63 @@
+#include "app_events.h"
+#include "esp_log.h"
+
+static const char* TAG = "AppEvents";
+
+AppEventQueue::AppEventQueue()
+    : queue_(nullptr), dropped_(0)
+{
+}
+
+AppEventQueue::~AppEventQueue()
+{
+    if (queue_)
+    {
+        vQueueDelete(queue_);
+    }
+}
+
+esp_err_t AppEventQueue::init(size_t depth)
+{
+    if (queue_)
+    {
+        ESP_LOGW(TAG, "Event queue already initialized");
+        return ESP_OK;
+    }
+
+    queue_ = xQueueCreate(depth, sizeof(AppEvent));
+    if (!queue_)
+    {
+        ESP_LOGE(TAG, "Failed to create event queue");
+        return ESP_ERR_NO_MEM;
+    }
+    return ESP_OK;
+}
+
+bool AppEventQueue::post(const AppEvent& event)
+{
+    if (!queue_ || xQueueSend(queue_, &event, 0) != pdTRUE)
+    {
+        dropped_.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+    return true;
+}
+
+bool AppEventQueue::postFromISR(const AppEvent& event, BaseType_t* higherPriorityTaskWoken)
+{
+    if (!queue_ || xQueueSendFromISR(queue_, &event, higherPriorityTaskWoken) != pdTRUE)
+    {
+        dropped_.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+    return true;
+}
+
+bool AppEventQueue::wait(AppEvent& event, TickType_t timeout)
+{
+    if (!queue_)
+    {
+        return false;
+    }
+    return xQueueReceive(queue_, &event, timeout) == pdTRUE;
+}
@@ -0,0 +1,96 @@
+#ifndef APP_EVENTS_H
+#define APP_EVENTS_H
+
+#include <stdint.h>
+#include <atomic>
+#include "esp_err.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+
+/**
+ * @brief Type of an application event
+ */
+enum class AppEventType : uint8_t
+{
+    ENCODER_DELTA,      // Detents are waiting in the encoder ring
+    TOUCH_GESTURE,      // A gesture was recognized on the touch screen
+    BLE_CONNECTION,     // A BLE MIDI central connected or disconnected
+    MIDI_RECEIVED,      // Received MIDI messages wait in the transport's queue
+    MODULATION_TICK,    // The next modulation grid point has passed
+    SYSEX_TIMEOUT,      // A SysEx message is being received, check if it stalled
+    STORAGE_FLUSH_DONE  // Pending parameter values were committed to NVS
+};
+
+/**
+ * @brief Touch gestures forwarded to the main loop
+ */
+enum class TouchGesture : uint8_t
+{
+    TAP // Toggle between navigation and control mode
+};
+
+/**
+ * @brief Event posted to the application main loop
+ */
+struct AppEvent
+{
+    AppEventType type;
+    union
+    {
+        TouchGesture gesture;   // TOUCH_GESTURE
+        bool connected;         // BLE_CONNECTION
+        esp_err_t result;       // STORAGE_FLUSH_DONE
+    };
+};
+
+/**
+ * @brief Typed FreeRTOS queue feeding the application main loop
+ *
+ * Every subsystem posts into this queue instead of being polled. Posting never
+ * blocks, a full queue drops the event and counts it.
+ */
+class AppEventQueue
+{
+public:
+    AppEventQueue();
+    ~AppEventQueue();
+
+    /**
+     * @brief Create the underlying queue
+     * @param depth Maximum number of pending events
+     * @return ESP_OK on success
+     */
+    esp_err_t init(size_t depth = 32);
+
+    /**
+     * @brief Post an event from task context (non-blocking)
+     * @return true if queued, false if the queue is full or not initialized
+     */
+    bool post(const AppEvent& event);
+
+    /**
+     * @brief Post an event from an ISR
+     * @param higherPriorityTaskWoken Set to pdTRUE if a context switch is required
+     * @return true if queued
+     */
+    bool postFromISR(const AppEvent& event, BaseType_t* higherPriorityTaskWoken);
+
+    /**
+     * @brief Wait for the next event
+     * @param event Receives the event
+     * @param timeout Ticks to wait (portMAX_DELAY for no timeout)
+     * @return true if an event was received
+     */
+    bool wait(AppEvent& event, TickType_t timeout = portMAX_DELAY);
+
+    /**
+     * @brief Number of events dropped because the queue was full
+     */
+    uint32_t getDroppedCount() const { return dropped_.load(std::memory_order_relaxed); }
+
+private:
+    QueueHandle_t queue_;
+    std::atomic<uint32_t> dropped_;
+};
+
+#endif // APP_EVENTS_H
@@ -0,0 +1,158 @@
+#include "ble_midi_transport.h"
+#include "esp_log.h"
+
+static const char* TAG = "BleMidiTransport";
+
+BleMidiTransport* BleMidiTransport::instance_ = nullptr;
+
+BleMidiTransport::~BleMidiTransport()
+{
+    if (instance_ == this)
+    {
+        blemidi_set_connection_callback(nullptr);
+        blemidi_set_pre_flush_callback(nullptr);
+        blemidi_set_receive_notify_callback(nullptr, nullptr);
+        instance_ = nullptr;
+    }
+}
+
+int32_t BleMidiTransport::init()
+{
+    if (instance_ != nullptr)
+    {
+        ESP_LOGE(TAG, "BLE MIDI driver is already used by another transport");
+        return -1;
+    }
+
+    int32_t status = blemidi_init((void*) receivedCallback);
+    if (status < 0)
+    {
+        ESP_LOGE(TAG, "BLE MIDI driver failed to initialize, status=%d", status);
+        return status;
+    }
+
+    instance_ = this;
+    blemidi_set_connection_callback(connectionChangedCallback);
+    blemidi_set_pre_flush_callback(preFlushCallback);
+    if (receiveNotifyCallback_)
+    {
+        blemidi_set_receive_notify_callback(receiveNotifyCallback, nullptr);
+    }
+    return 0;
+}
+
+int32_t BleMidiTransport::sendBatch(const MidiOutMessage* messages, size_t count)
+{
+    int32_t status = 0;
+
+    for (size_t i = 0; i < count; i++)
+    {
+        // The driver API predates const, it doesn't modify the stream
+        uint8_t* data = const_cast<uint8_t*>(messages[i].data);
+        uint16_t timestamp = messages[i].timeUs != 0 ? blemidi_timestamp_at(messages[i].timeUs) : BLEMIDI_TIMESTAMP_NOW;
+        int32_t result;
+        if (messages[i].transaction)
+        {
+            // All messages in one packet, the packet being built is flushed first if they don't fit
+            result = blemidi_send_timestamped_transaction(0, data, messages[i].length, timestamp, messages[i].priority);
+        }
+        else
+        {
+            result = blemidi_send_timestamped_message(0, data, messages[i].length, timestamp, messages[i].priority);
+        }
+
+        if (result < 0)
+        {
+            ESP_LOGE(TAG, "Failed to send MIDI message 0x%02x, result=%d", messages[i].data[0], result);
+            status = result;
+        }
+    }
+
+    return status;
+}
+
+void BleMidiTransport::requestFlush()
+{
+    blemidi_outbuffer_request_flush();
+}
+
+int32_t BleMidiTransport::waitFlush(uint32_t timeoutMs)
+{
+    return blemidi_outbuffer_wait_flush(timeoutMs == WAIT_FOREVER ? BLEMIDI_WAIT_FOREVER : timeoutMs);
+}
+
+int32_t BleMidiTransport::setFlushWindow(uint8_t windowMs)
+{
+    return blemidi_set_flush_window(windowMs);
+}
+
+int32_t BleMidiTransport::getConnectionCount() const
+{
+    return blemidi_get_num_connections();
+}
+
+size_t BleMidiTransport::processReceived(size_t maxMessages)
+{
+    return blemidi_process_received(maxMessages);
+}
+
+void BleMidiTransport::setReceiveNotifyCallback(ReceiveNotifyCallback callback)
+{
+    receiveNotifyCallback_ = callback;
+    if (instance_ == this)
+    {
+        blemidi_set_receive_notify_callback(callback ? receiveNotifyCallback : nullptr, nullptr);
+    }
+}
+
+int32_t BleMidiTransport::setLinkProfile(blemidi_link_profile_t profile)
+{
+    if (blemidi_set_link_profile(profile) < 0)
+    {
+        return -1;
+    }
+    ESP_LOGI(TAG, "Link profile set to %s", blemidi_get_link_profile_name(profile));
+    return 0;
+}
+
+blemidi_link_info_t BleMidiTransport::getLinkInfo() const
+{
+    blemidi_link_info_t info;
+    blemidi_get_link_info(&info);
+    return info;
+}
+
+void BleMidiTransport::receivedCallback(uint8_t blemidi_port, uint16_t timestamp, uint8_t midi_status,
+    uint8_t* remaining_message, size_t len, size_t continued_sysex_pos)
+{
+    if (instance_ && instance_->receiveCallback_)
+    {
+        instance_->receiveCallback_(timestamp, midi_status, remaining_message, len, continued_sysex_pos,
+            blemidi_get_received_time());
+    }
+}
+
+void BleMidiTransport::connectionChangedCallback(int32_t connected)
+{
+    if (instance_ && instance_->connectionCallback_)
+    {
+        instance_->connectionCallback_(connected);
+    }
+}
+
+void BleMidiTransport::preFlushCallback()
+{
+    if (instance_ && instance_->preFlushCallback_)
+    {
+        instance_->preFlushCallback_();
+    }
+}
+
+bool BleMidiTransport::receiveNotifyCallback(void* arg)
+{
+    if (instance_ && instance_->receiveNotifyCallback_)
+    {
+        return instance_->receiveNotifyCallback_();
+    }
+    return false;
+}
@@ -0,0 +1,55 @@
+#ifndef BLE_MIDI_TRANSPORT_H
+#define BLE_MIDI_TRANSPORT_H
+
+#include "midi_transport.h"
+#include "blemidi.h"
+
+/**
+ * @brief MidiTransport on top of the blemidi driver
+ *
+ * The driver has a single set of C callbacks, so only one instance can be
+ * initialized. Batches are written into the driver's output buffer;
+ * transactions go into one BLE packet, priority messages are never dropped.
+ * With a receive notify callback, the Bluetooth task only parses packets into
+ * the driver's receive queue.
+ */
+class BleMidiTransport : public MidiTransport
+{
+public:
+    BleMidiTransport() = default;
+    ~BleMidiTransport() override;
+
+    int32_t init() override;
+    int32_t sendBatch(const MidiOutMessage* messages, size_t count) override;
+    void requestFlush() override;
+    int32_t waitFlush(uint32_t timeoutMs) override;
+    int32_t setFlushWindow(uint8_t windowMs) override;
+    int32_t getConnectionCount() const override;
+    size_t processReceived(size_t maxMessages) override;
+    void setReceiveNotifyCallback(ReceiveNotifyCallback callback) override;
+
+    /**
+     * @brief Select the connection parameters requested from the centrals
+     *
+     * Low latency for live use, low power when running from battery.
+     * @param profile Link profile, applied immediately to connected centrals
+     * @return 0 on success, < 0 for an unknown profile
+     */
+    int32_t setLinkProfile(blemidi_link_profile_t profile);
+
+    /**
+     * @brief Selected link profile and the parameters granted by the first central
+     */
+    blemidi_link_info_t getLinkInfo() const;
+
+private:
+    static void receivedCallback(uint8_t blemidi_port, uint16_t timestamp, uint8_t midi_status,
+        uint8_t* remaining_message, size_t len, size_t continued_sysex_pos);
+    static void connectionChangedCallback(int32_t connected);
+    static void preFlushCallback();
+    static bool receiveNotifyCallback(void* arg);
+
+    static BleMidiTransport* instance_;
+};
+
+#endif // BLE_MIDI_TRANSPORT_H
@@ -1,4 +1,5 @@
 #include "display_touch.h"
+#include "esp_attr.h"
 #include "driver/gpio.h"
 #include "driver/i2c.h"
 #include "driver/spi_master.h"
@@ -8,10 +9,17 @@
 #include "lcd_touch_bsp.h"
 #include "lcd_bl_pwm_bsp.h"
 #include "user_encoder_bsp.h"
+#include "task_config.h"
 #include <cstring>
 
 static const char* TAG = "DisplayTouch";
 
+// Packed touch snapshot: bit 31 pressed, bits 16-27 x, bits 0-11 y (already rotated)
+#define TOUCH_STATE_PRESSED ((uint32_t) 1 << 31)
+#define TOUCH_STATE_PACK(x, y) (TOUCH_STATE_PRESSED | ((uint32_t) (x) << 16) | (uint32_t) (y))
+#define TOUCH_STATE_X(state) (((state) >> 16) & 0x0FFF)
+#define TOUCH_STATE_Y(state) ((state) & 0x0FFF)
+
 #if CONFIG_LV_COLOR_DEPTH == 32
 #define LCD_BIT_PER_PIXEL (24)
 #elif CONFIG_LV_COLOR_DEPTH == 16
@@ -217,13 +225,20 @@ DisplayTouch::DisplayTouch()
     panel_handle(nullptr),
     lvgl_tick_timer(nullptr),
     lvgl_mux(nullptr),
-    disp(nullptr)
+    disp(nullptr),
+    touch_task(nullptr),
+    touch_state(0)
 {
 }
 
 // Destructor
 DisplayTouch::~DisplayTouch()
 {
+    if (touch_task)
+    {
+        gpio_isr_handler_remove(EXAMPLE_PIN_NUM_TOUCH_INT);
+        vTaskDelete(touch_task);
+    }
     if (lvgl_tick_timer)
     {
         esp_timer_stop(lvgl_tick_timer);
@@ -301,21 +316,15 @@ void DisplayTouch::lvglRounderCb(lv_event_t* e)
     area->y2 = ((y2 >> 1) << 1) + 1;
 }
 
-// LVGL touch callback
+// LVGL touch callback - only loads the snapshot published by the touch task
 void DisplayTouch::lvglTouchCb(lv_indev_t* indev, lv_indev_data_t* data)
 {
-    uint16_t tp_x;
-    uint16_t tp_y;
-    uint8_t win = tpGetCoordinates(&tp_x, &tp_y);
-    if (win)
+    DisplayTouch* dt = static_cast<DisplayTouch*>(lv_indev_get_user_data(indev));
+    uint32_t state = dt->touch_state.load(std::memory_order_acquire);
+    if (state & TOUCH_STATE_PRESSED)
     {
-        // 180° rotation: invert both X and Y coordinates
-        data->point.x = EXAMPLE_LCD_H_RES - tp_x;
-        data->point.y = EXAMPLE_LCD_V_RES - tp_y;
-        if (data->point.x > EXAMPLE_LCD_H_RES)
-            data->point.x = EXAMPLE_LCD_H_RES;
-        if (data->point.y > EXAMPLE_LCD_V_RES)
-            data->point.y = EXAMPLE_LCD_V_RES;
+        data->point.x = TOUCH_STATE_X(state);
+        data->point.y = TOUCH_STATE_Y(state);
         data->state = LV_INDEV_STATE_PRESSED;
     }
     else
@@ -324,6 +333,72 @@ void DisplayTouch::lvglTouchCb(lv_indev_t* indev, lv_indev_data_t* data)
     }
 }
 
+// Touch controller INT line - wakes the touch task
+void IRAM_ATTR DisplayTouch::touchIsrHandler(void* arg)
+{
+    DisplayTouch* dt = static_cast<DisplayTouch*>(arg);
+    BaseType_t higher_prio_woken = pdFALSE;
+    vTaskNotifyGiveFromISR(dt->touch_task, &higher_prio_woken);
+    portYIELD_FROM_ISR(higher_prio_woken);
+}
+
+// Touch task - reads the controller only after an interrupt, and periodically while pressed
+void DisplayTouch::touchTask(void* arg)
+{
+    DisplayTouch* dt = static_cast<DisplayTouch*>(arg);
+    bool pressed = true; // Read once at start in case a finger is already down
+
+    while (1)
+    {
+        ulTaskNotifyTake(pdTRUE, pressed ? pdMS_TO_TICKS(EXAMPLE_TOUCH_POLL_MS) : portMAX_DELAY);
+
+        uint16_t tp_x;
+        uint16_t tp_y;
+        pressed = tpGetCoordinates(&tp_x, &tp_y);
+        if (pressed)
+        {
+            // 180° rotation: invert both X and Y coordinates
+            int32_t x = EXAMPLE_LCD_H_RES - tp_x;
+            int32_t y = EXAMPLE_LCD_V_RES - tp_y;
+            x = x < 0 ? 0 : (x > EXAMPLE_LCD_H_RES ? EXAMPLE_LCD_H_RES : x);
+            y = y < 0 ? 0 : (y > EXAMPLE_LCD_V_RES ? EXAMPLE_LCD_V_RES : y);
+            dt->touch_state.store(TOUCH_STATE_PACK(x, y), std::memory_order_release);
+        }
+        else
+        {
+            // Keep the last coordinates, LVGL reports the release at that point
+            dt->touch_state.fetch_and(~TOUCH_STATE_PRESSED, std::memory_order_release);
+        }
+    }
+}
+
+// Start the touch task and hook the controller interrupt line
+esp_err_t DisplayTouch::initTouchInterrupt()
+{
+    BaseType_t ret = createAppTask(AppTask::TOUCH, touchTask, this, &touch_task);
+    if (ret != pdPASS)
+    {
+        ESP_LOGE(TAG, "Failed to create touch task");
+        return ESP_FAIL;
+    }
+
+    gpio_config_t int_cfg = {};
+    int_cfg.pin_bit_mask = 1ULL << EXAMPLE_PIN_NUM_TOUCH_INT;
+    int_cfg.mode = GPIO_MODE_INPUT;
+    int_cfg.pull_up_en = GPIO_PULLUP_ENABLE;
+    int_cfg.intr_type = GPIO_INTR_NEGEDGE;
+    ESP_ERROR_CHECK(gpio_config(&int_cfg));
+
+    // The ISR service may already be installed by another driver
+    esp_err_t err = gpio_install_isr_service(0);
+    if (err != ESP_OK && err != ESP_ERR_INVALID_STATE)
+    {
+        ESP_LOGE(TAG, "Failed to install GPIO ISR service: %s", esp_err_to_name(err));
+        return err;
+    }
+    return gpio_isr_handler_add(EXAMPLE_PIN_NUM_TOUCH_INT, touchIsrHandler, this);
+}
+
 // Increase LVGL tick
 void DisplayTouch::increaseLvglTick(void* arg)
 {
@@ -365,7 +440,13 @@ void DisplayTouch::lvglPortTask(void* arg)
         // Lock the mutex due to the LVGL APIs are not thread-safe
         if (dt->lock(-1))
         {
+#if TASK_JITTER_BENCH
+            int64_t start_us = esp_timer_get_time();
+            task_delay_ms = lv_timer_handler();
+            lvglRenderTimeStats.addSample(esp_timer_get_time() - start_us);
+#else
             task_delay_ms = lv_timer_handler();
+#endif
             dt->unlock();
         }
         if (task_delay_ms > EXAMPLE_LVGL_TASK_MAX_DELAY_MS)
@@ -489,7 +570,9 @@ esp_err_t DisplayTouch::init()
     lv_indev_t* indev = lv_indev_create();
     lv_indev_set_type(indev, LV_INDEV_TYPE_POINTER);
     lv_indev_set_read_cb(indev, lvglTouchCb);
+    lv_indev_set_user_data(indev, this);
     lv_indev_set_display(indev, disp);
+    ESP_ERROR_CHECK(initTouchInterrupt());
 
     // Create mutex
     lvgl_mux = xSemaphoreCreateMutex();
@@ -507,7 +590,9 @@ esp_err_t DisplayTouch::init()
 esp_err_t DisplayTouch::initEncoder()
 {
     ESP_LOGI(TAG, "Initializing rotary encoder using BSP");
-    user_encoder_init();
+    user_encoder_init([](TaskFunction_t task, void* arg) {
+        return createAppTask(AppTask::KNOB_PCNT, task, arg) == pdPASS;
+    });
     ESP_LOGI(TAG, "Rotary encoder initialized successfully");
     return ESP_OK;
 }
@@ -515,13 +600,7 @@ esp_err_t DisplayTouch::initEncoder()
 // Start LVGL task
 esp_err_t DisplayTouch::startLvglTask()
 {
-    BaseType_t ret = xTaskCreate(
-        lvglPortTask,
-        "LVGL",
-        EXAMPLE_LVGL_TASK_STACK_SIZE,
-        this, // Pass this pointer as argument
-        EXAMPLE_LVGL_TASK_PRIORITY,
-        nullptr);
+    BaseType_t ret = createAppTask(AppTask::LVGL, lvglPortTask, this); // Pass this pointer as argument
 
     if (ret != pdPASS)
     {
@@ -82,6 +82,10 @@ private:
     SemaphoreHandle_t lvgl_mux;
     lv_display_t* disp;
 
+    // Touch sampling: the touch task publishes the latest point, LVGL only loads it
+    TaskHandle_t touch_task;
+    std::atomic<uint32_t> touch_state;
+
     // Note: Encoder is now handled by user_encoder_bsp component
 
     // LVGL callbacks
@@ -94,6 +98,11 @@ private:
 
     static void lvglTouchCb(lv_indev_t* indev, lv_indev_data_t* data);
 
+    // Touch interrupt handling
+    esp_err_t initTouchInterrupt();
+    static void touchIsrHandler(void* arg);
+    static void touchTask(void* arg);
+
     // Task functions
     static void lvglPortTask(void* arg);
 };
@@ -0,0 +1,79 @@
+#include "encoder_acceleration.h"
+#include <cmath>
+
+EncoderAccelerator::EncoderAccelerator(const AccelerationConfig& config)
+    : config_(config)
+{
+    reset();
+}
+
+void EncoderAccelerator::reset()
+{
+    lastTimestampUs_ = -1;
+    smoothedIntervalUs_ = static_cast<float>(config_.slowIntervalUs);
+    remainder_ = 0.0f;
+    lastDirection_ = 0;
+}
+
+float EncoderAccelerator::getMultiplier(AccelerationCurve curve) const
+{
+    if (curve == AccelerationCurve::NONE || config_.slowIntervalUs <= config_.fastIntervalUs)
+    {
+        return 1.0f;
+    }
+
+    // Normalized speed: 0 at (or below) slowIntervalUs, 1 at (or above) fastIntervalUs
+    float speed = (static_cast<float>(config_.slowIntervalUs) - smoothedIntervalUs_) /
+        static_cast<float>(config_.slowIntervalUs - config_.fastIntervalUs);
+    if (speed <= 0.0f)
+    {
+        return 1.0f;
+    }
+    if (speed > 1.0f)
+    {
+        speed = 1.0f;
+    }
+
+    if (curve == AccelerationCurve::EXPONENTIAL)
+    {
+        return std::pow(config_.maxMultiplier, speed);
+    }
+    return 1.0f + speed * (config_.maxMultiplier - 1.0f);
+}
+
+int32_t EncoderAccelerator::apply(int8_t delta, int64_t timestampUs, AccelerationCurve curve)
+{
+    if (delta == 0)
+    {
+        return 0;
+    }
+
+    int8_t direction = delta > 0 ? 1 : -1;
+
+    // A direction change or a pause restarts the rate estimate at single steps
+    if (direction != lastDirection_ || lastTimestampUs_ < 0 ||
+        (timestampUs - lastTimestampUs_) >= config_.slowIntervalUs)
+    {
+        smoothedIntervalUs_ = static_cast<float>(config_.slowIntervalUs);
+        remainder_ = 0.0f;
+    }
+    else
+    {
+        // Merged events carry several detents within one interval
+        float interval = static_cast<float>(timestampUs - lastTimestampUs_) / std::abs(delta);
+        smoothedIntervalUs_ += config_.smoothing * (interval - smoothedIntervalUs_);
+    }
+    lastTimestampUs_ = timestampUs;
+    lastDirection_ = direction;
+
+    if (curve == AccelerationCurve::NONE)
+    {
+        remainder_ = 0.0f;
+        return delta;
+    }
+
+    remainder_ += delta * getMultiplier(curve);
+    int32_t steps = static_cast<int32_t>(remainder_);
+    remainder_ -= steps;
+    return steps;
+}
@@ -0,0 +1,61 @@
+#ifndef ENCODER_ACCELERATION_H
+#define ENCODER_ACCELERATION_H
+
+#include <stdint.h>
+#include "midi_model.h"
+
+/**
+ * @brief Tuning for the encoder acceleration curves
+ */
+struct AccelerationConfig
+{
+    uint32_t slowIntervalUs = 40000; // Detents this far apart (or slower) step by exactly 1
+    uint32_t fastIntervalUs = 5000;  // Detents this close together (or faster) get maxMultiplier
+    float maxMultiplier = 8.0f;      // Step size at full speed
+    float smoothing = 0.5f;          // Weight of the newest interval in the rate estimate (0-1]
+};
+
+/**
+ * @brief Turns timestamped detents into accelerated value steps
+ *
+ * The detent rate is estimated from the timer tick timestamps of consecutive
+ * detents. Slow turns keep single-step precision, fast spins are scaled up by
+ * the selected curve. Fractional steps are carried over so no travel is lost.
+ * This class has no platform dependencies so it can be exercised on a host.
+ */
+class EncoderAccelerator
+{
+public:
+    explicit EncoderAccelerator(const AccelerationConfig& config = AccelerationConfig());
+
+    /**
+     * @brief Process one detent event
+     * @param delta Detent delta (+1/-1, or more for merged events)
+     * @param timestampUs Time at which the detent was decoded
+     * @param curve Acceleration curve of the parameter being adjusted
+     * @return Number of value steps to apply (signed)
+     */
+    int32_t apply(int8_t delta, int64_t timestampUs, AccelerationCurve curve);
+
+    /**
+     * @brief Forget the rate history, e.g. after the selected parameter changed
+     */
+    void reset();
+
+    /**
+     * @brief Current step multiplier for a given curve (1.0 when idle)
+     */
+    float getMultiplier(AccelerationCurve curve) const;
+
+    const AccelerationConfig& getConfig() const { return config_; }
+    void setConfig(const AccelerationConfig& config) { config_ = config; reset(); }
+
+private:
+    AccelerationConfig config_;
+    int64_t lastTimestampUs_;
+    float smoothedIntervalUs_;
+    float remainder_;
+    int8_t lastDirection_;
+};
+
+#endif // ENCODER_ACCELERATION_H
@@ -1,17 +1,37 @@
 #include <stdio.h>
+#include <inttypes.h>
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
-#include "freertos/event_groups.h"
 #include "esp_log.h"
 #include "lvgl.h"
 #include "lv_demos.h"
 #include "display_touch.h"
 #include "user_encoder_bsp.h"
 #include "midi_model.h"
+#include "encoder_acceleration.h"
 #include "ui_components.h"
+#include "parameter_index.h"
+#include "tempo_clock.h"
+#include "modulation_engine.h"
 #include "midi_service.h"
+#include "ble_midi_transport.h"
 #include "storage_service.h"
+#include "app_events.h"
+#include "task_config.h"
+#include "blemidi.h"
+#include "blemidi_latency.h"
+#include "esp_timer.h"
+#if BLEMIDI_ENABLE_CONSOLE
+#include "esp_console.h"
+#endif
 #include <memory>
+#include <algorithm>
+#include <atomic>
+
+// Start a one-bar sine LFO on an extra "Filter LFO" parameter (CC 74), to try the modulation engine
+#ifndef MODULATION_DEMO
+#define MODULATION_DEMO 0
+#endif
 
 static const char* TAG = "main";
 
@@ -24,16 +44,266 @@ static StorageService* storageService = nullptr;
 // Global UI state
 static PageView* currentPageView = nullptr;
 
-// Task to periodically call blemidi_tick for timestamp and buffer handling
-static void midi_tick_task(void* pvParameters)
+// Events from all subsystems, dispatched by the main loop
+static AppEventQueue appEvents;
+
+// Inbound CC/PC → parameter of the current page (main task only)
+static ParameterIndex parameterIndex;
+
+// Incoming MIDI clock (or the internal tempo) and the LFOs synced to it (main task only)
+static TempoClock tempoClock;
+static ModulationEngine modulationEngine(tempoClock);
+static esp_timer_handle_t modulationTimer = nullptr;
+static std::atomic<bool> modulationTickPending{false};
+
+// Checks a SysEx message being received for its timeout, only runs while one is (main task only)
+static esp_timer_handle_t sysexTimer = nullptr;
+static std::atomic<bool> sysexCheckPending{false};
+static constexpr uint64_t SYSEX_CHECK_INTERVAL_US = SysexAssembler::DEFAULT_TIMEOUT_MS * 1000 / 4;
+
+// Save a parameter value to storage once it has settled
+static void saveParameterDeferred(size_t paramIndex, uint8_t value)
+{
+    if (storageService)
+    {
+        std::string key = "page1_p" + std::to_string(paramIndex);
+        storageService->saveParameterValueDeferred(key, value);
+    }
+}
+
+// Apply a net encoder delta to the model and send the resulting MIDI value.
+// Runs without the LVGL lock so the MIDI emit never waits for a render, the
+// PageView repaints asynchronously on the LVGL task.
+// originUs is the knob timer time of the oldest detent in the batch (latency tracing),
+// detentUs the one of the newest, which produced the value and becomes its MIDI timestamp.
+static void handleEncoderDelta(int16_t delta, int64_t originUs, int64_t detentUs)
+{
+    if (!currentPageView)
+    {
+        return;
+    }
+
+    currentPageView->handleEncoderRotation(delta);
+
+    // Send MIDI if in CONTROL mode
+    if (currentPageView->getMode() == UIMode::CONTROL && midiService)
+    {
+        auto param = currentPageView->getPage()->getSelectedParameter();
+        if (param)
+        {
+            BLEMIDI_LATENCY_BEGIN(originUs);
+            midiService->sendParameter(param, detentUs);
+            saveParameterDeferred(currentPageView->getPage()->getSelectedIndex(), param->getValue());
+        }
+    }
+}
+
+// Encoder notification - the detents themselves stay in the encoder ring
+static bool postEncoderEvent(void* arg)
+{
+    AppEvent event = {};
+    event.type = AppEventType::ENCODER_DELTA;
+    return appEvents.post(event);
+}
+
+// Drain all queued detents and apply the accelerated net travel at once
+static void processEncoderEvents(EncoderAccelerator& encoderAccelerator)
+{
+    // Acceleration only applies while adjusting a value, navigation stays one step per detent.
+    // The selected parameter and mode only change on this task, so this read is not racy.
+    AccelerationCurve curve = AccelerationCurve::NONE;
+    if (currentPageView && currentPageView->getMode() == UIMode::CONTROL)
+    {
+        auto param = currentPageView->getPage()->getSelectedParameter();
+        if (param)
+        {
+            curve = param->getAccelerationCurve();
+        }
+    }
+
+    encoder_event_t events[16];
+    int32_t netDelta = 0;
+    size_t numDetents = 0;
+    int64_t originUs = 0;
+    int64_t detentUs = 0;
+    size_t count;
+    while ((count = user_encoder_read_events(events, sizeof(events) / sizeof(events[0]))) > 0)
+    {
+        if (numDetents == 0)
+        {
+            originUs = events[0].timestamp_us;
+        }
+        for (size_t i = 0; i < count; i++)
+        {
+            netDelta += encoderAccelerator.apply(events[i].delta, events[i].timestamp_us, curve);
+        }
+        numDetents += count;
+        detentUs = events[count - 1].timestamp_us;
+    }
+
+#if BLEMIDI_ENABLE_LATENCY_TRACE
+    if (numDetents > 0)
+    {
+        blemidi_latency_record(BLEMIDI_LATENCY_STAGE_DEQUEUE, esp_timer_get_time() - originUs);
+    }
+#endif
+
+    if (netDelta != 0)
+    {
+        ESP_LOGD(TAG, "Encoder: net delta %" PRId32 " from %u events", netDelta, (unsigned) numDetents);
+        handleEncoderDelta(std::clamp<int32_t>(netDelta, INT16_MIN, INT16_MAX), originUs, detentUs);
+    }
+}
+
+// Received messages handled per MIDI_RECEIVED event, so encoder events get their turn in between
+static constexpr size_t MIDI_RX_BATCH = 32;
+
+// Apply DAW feedback to the model. The value is not sent back, and however
+// many updates arrive the PageView repaints at most once per refresh period.
+static void handleMidiReceived(uint8_t status, uint8_t data1, uint8_t data2)
+{
+    const ParameterIndex::Binding* binding = parameterIndex.apply(status, data1, data2);
+    if (!binding)
+    {
+        return;
+    }
+
+    ESP_LOGD(TAG, "Parameter '%s' set to %s by MIDI in",
+        binding->parameter->getName().c_str(), binding->parameter->getDisplayValue().c_str());
+    if (currentPageView)
+    {
+        currentPageView->requestRefresh();
+    }
+    saveParameterDeferred(binding->parameterIndex, binding->parameter->getValue());
+}
+
+// SysEx timer - like the modulation tick, one check waits in the event queue at most
+static void postSysexCheck(void* arg)
+{
+    if (!sysexCheckPending.exchange(true))
+    {
+        AppEvent event = {};
+        event.type = AppEventType::SYSEX_TIMEOUT;
+        if (!appEvents.post(event))
+        {
+            sysexCheckPending = false;
+        }
+    }
+}
+
+// The timer only runs while a SysEx message is being received
+static void updateSysexTimer()
+{
+    if (!sysexTimer)
+    {
+        return;
+    }
+
+    bool running = esp_timer_is_active(sysexTimer);
+    if (midiService->isReceivingSysex() && !running)
+    {
+        esp_timer_start_periodic(sysexTimer, SYSEX_CHECK_INTERVAL_US);
+    }
+    else if (!midiService->isReceivingSysex() && running)
+    {
+        esp_timer_stop(sysexTimer);
+    }
+}
+
+// A stalled SysEx stream is dropped here, its consumers get ABORTED
+static void processSysexCheck()
+{
+    sysexCheckPending = false;
+    midiService->checkSysexTimeout();
+    updateSysexTimer();
+}
+
+#if BLEMIDI_ENABLE_CONSOLE
+// Printed by the blemidi_rx_stats command. The counters are written by the main task,
+// a report may be one message behind.
+static void printSysexStats()
+{
+    SysexAssembler::Stats stats = midiService->getSysexStats();
+    printf("SysEx: completed: %" PRIu32 ", dropped overflow: %" PRIu32 ", timeout: %" PRIu32 ", incomplete: %" PRIu32
+           ", arena used: %" PRIu32 ", peak: %" PRIu32 "/%u\n",
+           stats.completed, stats.droppedOverflow, stats.droppedTimeout, stats.droppedIncomplete,
+           stats.arenaUsed, stats.arenaPeak, (unsigned) SysexAssembler::ARENA_SIZE);
+}
+#endif
+
+// Handle a batch of received messages on this task instead of the Bluetooth task
+static void processReceivedMidi()
+{
+    if (!midiService)
+    {
+        return;
+    }
+
+    if (midiService->processReceived(MIDI_RX_BATCH) == MIDI_RX_BATCH)
+    {
+        // More may be waiting, the transport only notifies again for new messages
+        AppEvent event = {};
+        event.type = AppEventType::MIDI_RECEIVED;
+        appEvents.post(event);
+    }
+    updateSysexTimer();
+}
+
+// Modulation timer - one tick waits in the event queue at most, so encoder events are never crowded out
+static void postModulationTick(void* arg)
+{
+    if (!modulationTickPending.exchange(true))
+    {
+        AppEvent event = {};
+        event.type = AppEventType::MODULATION_TICK;
+        if (!appEvents.post(event))
+        {
+            modulationTickPending = false;
+        }
+    }
+}
+
+// The timer only runs while a modulation source does
+static void updateModulationTimer()
+{
+    if (!modulationTimer)
+    {
+        return;
+    }
+
+    bool running = esp_timer_is_active(modulationTimer);
+    if (modulationEngine.isActive() && !running)
+    {
+        esp_timer_start_periodic(modulationTimer, modulationEngine.getUpdateInterval());
+    }
+    else if (!modulationEngine.isActive() && running)
+    {
+        esp_timer_stop(modulationTimer);
+    }
+}
+
+// Sample the modulation sources; the values go out stamped with their grid time
+static void processModulationTick()
+{
+    modulationTickPending = false;
+    modulationEngine.run(esp_timer_get_time());
+    updateModulationTimer();
+}
+
+// Task which sends the BLE MIDI output buffer; it sleeps until a message is queued
+static void midi_flush_task(void* pvParameters)
 {
     while (1)
     {
-        if (midiService)
+        int32_t lateUs = midiService->waitAndFlush();
+#if TASK_JITTER_BENCH
+        if (lateUs >= 0)
         {
-            midiService->tick();
+            midiFlushLatenessStats.addSample(lateUs);
         }
-        vTaskDelay(pdMS_TO_TICKS(15)); // Call every 15ms
+#else
+        (void) lateUs;
+#endif
     }
 }
 
@@ -41,6 +311,13 @@ extern "C" void app_main(void)
 {
     ESP_LOGI(TAG, "Starting application");
 
+    // Create the event queue first so every subsystem can post into it
+    checkTaskPlacement(AppTask::MAIN);
+    ESP_ERROR_CHECK(appEvents.init());
+#if TASK_JITTER_BENCH
+    startTaskJitterReport();
+#endif
+
     // Initialize storage service first
     storageService = new StorageService();
     esp_err_t ret = storageService->init();
@@ -49,9 +326,16 @@ extern "C" void app_main(void)
         ESP_LOGE(TAG, "Failed to initialize storage service: %s", esp_err_to_name(ret));
         // Continue anyway, storage won't work but app will
     }
+    storageService->setFlushCallback([](esp_err_t result) {
+        AppEvent event = {};
+        event.type = AppEventType::STORAGE_FLUSH_DONE;
+        event.result = result;
+        appEvents.post(event);
+    });
 
     // Initialize BLE MIDI service
-    midiService = new MidiService();
+    static BleMidiTransport bleTransport;
+    midiService = new MidiService(bleTransport);
     ret = midiService->init();
     if (ret != ESP_OK)
     {
@@ -60,8 +344,53 @@ extern "C" void app_main(void)
     }
     else
     {
-        // Start MIDI tick task
-        xTaskCreate(midi_tick_task, "midi_tick", 4096, NULL, 5, NULL);
+        midiService->setConnectionCallback([](bool connected) {
+            AppEvent event = {};
+            event.type = AppEventType::BLE_CONNECTION;
+            event.connected = connected;
+            appEvents.post(event);
+        });
+        // Received messages are handled by the main loop, the Bluetooth task only queues them
+        midiService->setReceiveNotifyCallback([]() {
+            AppEvent event = {};
+            event.type = AppEventType::MIDI_RECEIVED;
+            return appEvents.post(event);
+        });
+        midiService->setMessageCallback([](uint8_t status, uint8_t data1, uint8_t data2) {
+            ESP_LOGD(TAG, "MIDI in: %02x %02x %02x", status, data1, data2);
+            handleMidiReceived(status, data1, data2);
+        });
+        midiService->setRealtimeCallback([](uint8_t status, int64_t timeUs) {
+            tempoClock.receiveRealtime(status, timeUs);
+        });
+        modulationEngine.setEmitCallback([](const std::shared_ptr<Parameter>& param, int64_t timeUs) {
+            midiService->sendParameter(param, timeUs);
+            if (currentPageView)
+            {
+                currentPageView->requestRefresh();
+            }
+        });
+
+        esp_timer_create_args_t timerArgs = {};
+        timerArgs.callback = &postModulationTick;
+        timerArgs.name = "modulation";
+        timerArgs.skip_unhandled_events = true;
+        ret = esp_timer_create(&timerArgs, &modulationTimer);
+        if (ret != ESP_OK)
+        {
+            ESP_LOGE(TAG, "Failed to create modulation timer: %s", esp_err_to_name(ret));
+        }
+
+        timerArgs.callback = &postSysexCheck;
+        timerArgs.name = "sysex";
+        ret = esp_timer_create(&timerArgs, &sysexTimer);
+        if (ret != ESP_OK)
+        {
+            ESP_LOGE(TAG, "Failed to create SysEx timer: %s", esp_err_to_name(ret));
+        }
+
+        // Start MIDI output flush task
+        createAppTask(AppTask::MIDI_FLUSH, midi_flush_task, NULL);
     }
 
     // Create display/touch handler on heap to keep it alive
@@ -125,6 +454,11 @@ extern "C" void app_main(void)
             "Guitar Effects", 1, guitarPresets)
         );
 
+#if MODULATION_DEMO
+        auto filterLfo = std::make_shared<CCParameter>("Filter LFO", 0, 74);
+        page1->addParameter(filterLfo);
+#endif
+
         // Load saved parameter values
         if (storageService)
         {
@@ -132,92 +466,115 @@ extern "C" void app_main(void)
             ESP_LOGI(TAG, "Loaded parameter values from storage");
         }
 
+        size_t unbound = parameterIndex.build(*page1);
+        if (unbound > 0)
+        {
+            ESP_LOGW(TAG, "%u parameters share a controller with an earlier one, they ignore MIDI in", (unsigned) unbound);
+        }
+
         // Create UI
         lv_obj_t* screen = lv_screen_active();
         currentPageView = new PageView(screen, page1);
+        currentPageView->setGestureHandler([](TouchGesture gesture) {
+            AppEvent event = {};
+            event.type = AppEventType::TOUCH_GESTURE;
+            event.gesture = gesture;
+            appEvents.post(event);
+        });
+
+#if MODULATION_DEMO
+        ModulationConfig lfo;
+        lfo.shape = ModulationShape::SINE;
+        lfo.periodTicks = 4 * TempoClock::TICKS_PER_BEAT;
+        modulationEngine.start(filterLfo, lfo, esp_timer_get_time());
+        updateModulationTimer();
+#endif
 
         displayTouch->unlock();
     }
 
+    user_encoder_set_notify_cb(postEncoderEvent, nullptr);
+
+#if BLEMIDI_ENABLE_CONSOLE
+    // Serial console for the blemidi_debug and blemidi_latency commands
+    esp_console_repl_t* repl = nullptr;
+    esp_console_repl_config_t replConfig = ESP_CONSOLE_REPL_CONFIG_DEFAULT();
+    replConfig.prompt = "knob>";
+    esp_console_dev_uart_config_t uartConfig = ESP_CONSOLE_DEV_UART_CONFIG_DEFAULT();
+    if (esp_console_new_repl_uart(&uartConfig, &replConfig, &repl) == ESP_OK)
+    {
+        blemidi_register_console_commands();
+        if (midiService)
+        {
+            blemidi_set_rx_stats_print_callback(printSysexStats);
+        }
+        esp_console_start_repl(repl);
+    }
+    else
+    {
+        ESP_LOGW(TAG, "Failed to start the serial console");
+    }
+#endif
+
     ESP_LOGI(TAG, "Application started successfully");
 
-    // Main loop - monitor encoder events
+    // Initial Bluetooth state, later changes arrive as BLE_CONNECTION events
+    if (currentPageView)
+    {
+        currentPageView->updateBluetoothStatus(midiService && midiService->isConnected());
+    }
+
+    // Main loop - dispatch events from all subsystems, no polling
+    EncoderAccelerator encoderAccelerator;
+    AppEvent event;
     while (1)
     {
-        // Update Bluetooth connection status indicator
-        if (displayTouch->lock(10) && currentPageView && midiService)
+        if (!appEvents.wait(event))
         {
-            currentPageView->updateBluetoothStatus(midiService->isConnected());
-            displayTouch->unlock();
+            continue;
         }
 
-        // Wait for encoder events (left or right rotation)
-        EventBits_t bits = xEventGroupWaitBits(
-            knob_even_,
-            0x03,    // Wait for bit 0 (left) or bit 1 (right)
-            pdTRUE,  // Clear bits on exit
-            pdFALSE, // Wait for ANY bit (not all)
-            pdMS_TO_TICKS(1000));
-
-        if (bits & 0x01)
+        switch (event.type)
         {
-            // Bit 0 set - left rotation (decrement)
-            ESP_LOGI(TAG, "Encoder: Left rotation detected");
+        case AppEventType::ENCODER_DELTA:
+            processEncoderEvents(encoderAccelerator);
+            break;
 
-            if (displayTouch->lock(100) && currentPageView)
+        case AppEventType::TOUCH_GESTURE:
+            if (event.gesture == TouchGesture::TAP && currentPageView)
             {
-                currentPageView->handleEncoderRotation(-1);
-
-                // Send MIDI if in CONTROL mode
-                if (currentPageView->getMode() == UIMode::CONTROL && midiService)
-                {
-                    auto param = currentPageView->getPage()->getSelectedParameter();
-                    if (param)
-                    {
-                        midiService->sendParameter(param);
-
-                        // Save the parameter value to storage
-                        if (storageService)
-                        {
-                            size_t paramIndex = currentPageView->getPage()->getSelectedIndex();
-                            std::string key = "page1_p" + std::to_string(paramIndex);
-                            storageService->saveParameterValue(key, param->getValue());
-                        }
-                    }
-                }
-
-                displayTouch->unlock();
+                currentPageView->toggleMode();
             }
-        }
-        if (bits & 0x02)
-        {
-            // Bit 1 set - right rotation (increment)
-            ESP_LOGI(TAG, "Encoder: Right rotation detected");
+            // Speed from the previous mode must not carry over
+            encoderAccelerator.reset();
+            break;
+
+        case AppEventType::BLE_CONNECTION:
+            ESP_LOGI(TAG, "BLE MIDI %s", event.connected ? "connected" : "disconnected");
+            if (currentPageView)
+            {
+                currentPageView->updateBluetoothStatus(event.connected);
+            }
+            break;
+
+        case AppEventType::MIDI_RECEIVED:
+            processReceivedMidi();
+            break;
+
+        case AppEventType::MODULATION_TICK:
+            processModulationTick();
+            break;
+
+        case AppEventType::SYSEX_TIMEOUT:
+            processSysexCheck();
+            break;
 
-            if (displayTouch->lock(100) && currentPageView)
+        case AppEventType::STORAGE_FLUSH_DONE:
+            if (event.result != ESP_OK)
             {
-                currentPageView->handleEncoderRotation(1);
-
-                // Send MIDI if in CONTROL mode
-                if (currentPageView->getMode() == UIMode::CONTROL && midiService)
-                {
-                    auto param = currentPageView->getPage()->getSelectedParameter();
-                    if (param)
-                    {
-                        midiService->sendParameter(param);
-
-                        // Save the parameter value to storage
-                        if (storageService)
-                        {
-                            size_t paramIndex = currentPageView->getPage()->getSelectedIndex();
-                            std::string key = "page1_p" + std::to_string(paramIndex);
-                            storageService->saveParameterValue(key, param->getValue());
-                        }
-                    }
-                }
-
-                displayTouch->unlock();
+                ESP_LOGE(TAG, "Storage flush failed: %s", esp_err_to_name(event.result));
             }
+            break;
         }
     }
 }
@@ -0,0 +1,143 @@
+#include "midi_loopback_transport.h"
+
+// Data bytes following a status byte, same tables as the BLE MIDI parser
+static uint8_t expectedBytes(uint8_t status)
+{
+    static const uint8_t channelBytes[8] = {2, 2, 2, 2, 1, 1, 2, 0}; // 0x8n..0xEn
+    static const uint8_t systemBytes[16] = {0, 1, 2, 1, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0}; // 0xF0..0xFF
+
+    return status < 0xF0 ? channelBytes[(status >> 4) & 0x7] : systemBytes[status & 0xF];
+}
+
+int32_t MidiLoopbackTransport::sendBatch(const MidiOutMessage* messages, size_t count)
+{
+    stats_.batches++;
+    if (connections_ <= 0)
+    {
+        // Like the BLE driver: nobody to send to, the messages are discarded
+        stats_.dropped += count;
+        return 0;
+    }
+
+    if (batchCallback_)
+    {
+        batchCallback_(messages, count);
+    }
+
+    int32_t status = 0;
+    for (size_t i = 0; i < count; i++)
+    {
+        stats_.messages++;
+        stats_.bytes += messages[i].length;
+        if (messages[i].transaction)
+        {
+            stats_.transactions++;
+        }
+
+        // Same 13-bit millisecond timestamp a BLE MIDI receiver would see, arriving without delay
+        uint16_t timestamp = static_cast<uint16_t>((messages[i].timeUs / 1000) & 0x1FFF);
+        if (echo_ && receive(messages[i].data, messages[i].length, timestamp, messages[i].timeUs) < 0)
+        {
+            status = -1;
+        }
+    }
+    return status;
+}
+
+int32_t MidiLoopbackTransport::waitFlush(uint32_t timeoutMs)
+{
+    (void) timeoutMs; // nothing happens in the background, waiting can't help
+
+    if (!flushRequested_)
+    {
+        return -2; // nothing to send
+    }
+
+    flushRequested_ = false;
+    stats_.flushes++;
+    if (preFlushCallback_)
+    {
+        preFlushCallback_();
+    }
+    return 0;
+}
+
+int32_t MidiLoopbackTransport::setFlushWindow(uint8_t windowMs)
+{
+    if (windowMs > 15)
+    {
+        return -1;
+    }
+    flushWindowMs_ = windowMs;
+    return 0;
+}
+
+void MidiLoopbackTransport::setConnectionCount(int32_t connections)
+{
+    if (connections == connections_)
+    {
+        return;
+    }
+    connections_ = connections;
+    if (connectionCallback_)
+    {
+        connectionCallback_(connections_);
+    }
+}
+
+int32_t MidiLoopbackTransport::receive(const uint8_t* stream, size_t length, uint16_t timestamp, int64_t receivedUs)
+{
+    uint8_t runningStatus = 0;
+    size_t pos = 0;
+
+    while (pos < length)
+    {
+        uint8_t status = runningStatus;
+        if (stream[pos] & 0x80)
+        {
+            status = stream[pos++];
+        }
+        else if (status == 0)
+        {
+            return -1; // data byte without status
+        }
+
+        if (status >= 0xF8)
+        {
+            // Realtime messages don't change the running status
+            if (receiveCallback_)
+            {
+                receiveCallback_(timestamp, status, &stream[pos], 0, 0, receivedUs);
+            }
+            continue;
+        }
+
+        size_t numBytes;
+        if (status == 0xF0)
+        {
+            numBytes = 0;
+            while ((pos + numBytes) < length && stream[pos + numBytes] < 0x80)
+            {
+                numBytes++;
+            }
+            runningStatus = 0;
+        }
+        else
+        {
+            numBytes = expectedBytes(status);
+            if ((pos + numBytes) > length)
+            {
+                return -1; // incomplete message
+            }
+            runningStatus = status < 0xF0 ? status : 0;
+        }
+
+        if (receiveCallback_)
+        {
+            receiveCallback_(timestamp, status, &stream[pos], numBytes, 0, receivedUs);
+        }
+        pos += numBytes;
+    }
+
+    return 0;
+}
@@ -0,0 +1,78 @@
+#ifndef MIDI_LOOPBACK_TRANSPORT_H
+#define MIDI_LOOPBACK_TRANSPORT_H
+
+#include "midi_transport.h"
+
+/**
+ * @brief In-memory MidiTransport which feeds sent messages back to the receive side
+ *
+ * Nothing is copied: a batch observer gets the sender's message array, and
+ * the receive callback gets pointers into the sender's buffers. waitFlush()
+ * doesn't block, it runs a requested flush immediately, so a host program
+ * can drive the send pipeline, coalescing and receive handling in one thread.
+ * This class has no platform dependencies and is not thread safe.
+ */
+class MidiLoopbackTransport : public MidiTransport
+{
+public:
+    /**
+     * @brief Counters for benchmarks and regression checks
+     */
+    struct Stats
+    {
+        uint32_t flushes = 0;
+        uint32_t batches = 0;
+        uint32_t messages = 0;     // Batch entries, a transaction counts once
+        uint32_t transactions = 0;
+        uint32_t bytes = 0;
+        uint32_t dropped = 0;      // Entries sent while not connected
+    };
+
+    /**
+     * @brief Sees every batch before it is looped back
+     */
+    using BatchCallback = std::function<void(const MidiOutMessage* messages, size_t count)>;
+
+    MidiLoopbackTransport() = default;
+
+    int32_t init() override { return 0; }
+    int32_t sendBatch(const MidiOutMessage* messages, size_t count) override;
+    void requestFlush() override { flushRequested_ = true; }
+    int32_t waitFlush(uint32_t timeoutMs) override;
+    int32_t setFlushWindow(uint8_t windowMs) override;
+    int32_t getConnectionCount() const override { return connections_; }
+
+    /**
+     * @brief Simulate peers connecting or disconnecting
+     */
+    void setConnectionCount(int32_t connections);
+
+    /**
+     * @brief Loop sent messages back to the receive callback (default on)
+     */
+    void setEcho(bool echo) { echo_ = echo; }
+
+    void setBatchCallback(BatchCallback callback) { batchCallback_ = callback; }
+
+    /**
+     * @brief Deliver a MIDI byte stream to the receive callback as if a peer had sent it
+     * @param receivedUs Arrival time passed to the callback, 0 for unknown
+     * @return 0 on success, < 0 if the stream ends in the middle of a message
+     */
+    int32_t receive(const uint8_t* stream, size_t length, uint16_t timestamp = 0, int64_t receivedUs = 0);
+
+    bool isFlushRequested() const { return flushRequested_; }
+    uint8_t getFlushWindow() const { return flushWindowMs_; }
+    const Stats& getStats() const { return stats_; }
+    void resetStats() { stats_ = Stats(); }
+
+private:
+    int32_t connections_ = 1;
+    bool echo_ = true;
+    bool flushRequested_ = false;
+    uint8_t flushWindowMs_ = 0;
+    BatchCallback batchCallback_;
+    Stats stats_;
+};
+
+#endif // MIDI_LOOPBACK_TRANSPORT_H
@@ -4,6 +4,7 @@
 #include <string>
 #include <vector>
 #include <memory>
+#include <atomic>
 #include <stdint.h>
 
 /**
@@ -13,7 +14,19 @@ enum class ParameterType
 {
     CC,
     BOOLEAN_CC,
-    PROGRAM_CHANGE
+    PROGRAM_CHANGE,
+    CC_14BIT,
+    NRPN
+};
+
+/**
+ * @brief Encoder acceleration curve applied while adjusting a parameter
+ */
+enum class AccelerationCurve
+{
+    NONE,       // Always one step per detent
+    LINEAR,     // Step size grows linearly with detent rate
+    EXPONENTIAL // Step size grows exponentially with detent rate
 };
 
 /**
@@ -23,7 +36,8 @@ class Parameter
 {
 public:
     Parameter(const std::string& name, uint8_t channel)
-        : name_(name), channel_(channel & 0x0F), value_(0)
+        : name_(name), channel_(channel & 0x0F), value_(0),
+        accelerationCurve_(AccelerationCurve::LINEAR)
     {
     }
 
@@ -36,11 +50,15 @@ public:
     virtual ParameterType getType() const = 0;
 
     // Setter with range validation (0-127 for MIDI)
-    void setValue(uint8_t value)
+    virtual void setValue(uint8_t value)
     {
         value_ = value & 0x7F; // Ensure 7-bit value
     }
 
+    // Encoder acceleration used when adjusting this parameter
+    AccelerationCurve getAccelerationCurve() const { return accelerationCurve_; }
+    void setAccelerationCurve(AccelerationCurve curve) { accelerationCurve_ = curve; }
+
     // Virtual method for getting display text
     virtual std::string getDisplayValue() const
     {
@@ -56,7 +74,8 @@ public:
 protected:
     std::string name_;
     uint8_t channel_; // 4-bit (0-15)
-    uint8_t value_;   // 7-bit (0-127)
+    std::atomic<uint8_t> value_; // 7-bit (0-127), written by the main task, read by the LVGL task
+    AccelerationCurve accelerationCurve_;
 };
 
 /**
@@ -93,6 +112,7 @@ public:
     BooleanCCParameter(const std::string& name, uint8_t channel, uint8_t ccNumber)
         : Parameter(name, channel), ccNumber_(ccNumber & 0x7F)
     {
+        accelerationCurve_ = AccelerationCurve::NONE;
     }
 
     ParameterType getType() const override { return ParameterType::BOOLEAN_CC; }
@@ -128,6 +148,120 @@ private:
     uint8_t ccNumber_; // 7-bit (0-127)
 };
 
+/**
+ * @brief Base class for 14-bit parameters (0-16383)
+ *
+ * getValue() returns the coarse 7-bit part (MSB), so the arc and storage keep
+ * working with it. Encoder steps are mapped onto the 14-bit range through a
+ * fractional accumulator, so no travel is lost when a step isn't a whole number
+ * of 14-bit units.
+ */
+class HighResParameter : public Parameter
+{
+public:
+    static constexpr uint16_t MAX_VALUE_14BIT = 16383;
+
+    /**
+     * @param stepsPerRange Encoder steps from 0 to 16383 without acceleration
+     */
+    HighResParameter(const std::string& name, uint8_t channel, uint16_t stepsPerRange)
+        : Parameter(name, channel), value14_(0), stepFraction_(0.0f),
+        stepsPerRange_(stepsPerRange > 0 ? stepsPerRange : 1)
+    {
+    }
+
+    uint16_t getValue14() const { return value14_; }
+    uint8_t getMSB() const { return static_cast<uint8_t>(value14_ >> 7); }
+    uint8_t getLSB() const { return static_cast<uint8_t>(value14_ & 0x7F); }
+
+    void setValue14(uint16_t value)
+    {
+        if (value > MAX_VALUE_14BIT)
+        {
+            value = MAX_VALUE_14BIT;
+        }
+        value14_ = value;
+        value_ = static_cast<uint8_t>(value >> 7);
+    }
+
+    // A 7-bit value sets the MSB, e.g. when restored from storage
+    void setValue(uint8_t value) override
+    {
+        setValue14(static_cast<uint16_t>((value & 0x7F) << 7));
+        stepFraction_ = 0.0f;
+    }
+
+    /**
+     * @brief Apply encoder steps
+     * @param steps Signed number of (accelerated) encoder steps
+     */
+    void adjust(int32_t steps)
+    {
+        stepFraction_ += steps * (static_cast<float>(MAX_VALUE_14BIT) / stepsPerRange_);
+        int32_t units = static_cast<int32_t>(stepFraction_);
+        stepFraction_ -= units;
+
+        int32_t value = static_cast<int32_t>(value14_) + units;
+        if (value <= 0 || value >= MAX_VALUE_14BIT)
+        {
+            // Travel beyond the ends is dropped, turning back responds at once
+            stepFraction_ = 0.0f;
+            value = value <= 0 ? 0 : MAX_VALUE_14BIT;
+        }
+        setValue14(static_cast<uint16_t>(value));
+    }
+
+    std::string getDisplayValue() const override
+    {
+        return std::to_string(value14_);
+    }
+
+protected:
+    std::atomic<uint16_t> value14_; // written by the main task, read by the LVGL task
+    float stepFraction_;            // encoder travel not applied yet, in 14-bit units (main task only)
+    uint16_t stepsPerRange_;
+};
+
+/**
+ * @brief 14-bit CC Parameter
+ * Sent as MSB on ccNumber (0-31) and LSB on ccNumber + 32, always in the same BLE packet
+ */
+class CC14BitParameter : public HighResParameter
+{
+public:
+    CC14BitParameter(const std::string& name, uint8_t channel, uint8_t ccNumber, uint16_t stepsPerRange = 1024)
+        : HighResParameter(name, channel, stepsPerRange), ccNumber_(ccNumber & 0x1F)
+    {
+    }
+
+    ParameterType getType() const override { return ParameterType::CC_14BIT; }
+
+    uint8_t getCCNumber() const { return ccNumber_; }
+
+private:
+    uint8_t ccNumber_; // MSB controller (0-31)
+};
+
+/**
+ * @brief NRPN (Non-Registered Parameter Number) Parameter
+ * Sent as CC 99/98 (parameter number) and CC 6/38 (data entry), always in the same BLE packet
+ */
+class NRPNParameter : public HighResParameter
+{
+public:
+    NRPNParameter(const std::string& name, uint8_t channel, uint16_t parameterNumber, uint16_t stepsPerRange = 1024)
+        : HighResParameter(name, channel, stepsPerRange), parameterNumber_(parameterNumber & 0x3FFF)
+    {
+    }
+
+    ParameterType getType() const override { return ParameterType::NRPN; }
+
+    uint16_t getParameterNumber() const { return parameterNumber_; }
+
+private:
+    uint16_t parameterNumber_; // 14-bit (0-16383)
+};
+
 /**
  * @brief Program Change Parameter
  */
@@ -138,6 +272,8 @@ public:
         const std::vector<std::string>& programNames)
         : Parameter(name, channel), programNames_(programNames)
     {
+        // Stepping through presets must stay one program per detent
+        accelerationCurve_ = AccelerationCurve::NONE;
     }
 
     ParameterType getType() const override { return ParameterType::PROGRAM_CHANGE; }
@@ -229,7 +365,7 @@ public:
 private:
     std::string name_;
     std::vector<std::shared_ptr<Parameter>> parameters_;
-    size_t selectedIndex_;
+    std::atomic<size_t> selectedIndex_; // written by the main task, read by the LVGL task
 };
 
 #endif // MIDI_MODEL_H
@@ -1,32 +1,102 @@
 #include "midi_service.h"
-#include "blemidi.h"
+#include "blemidi_latency.h"
 #include "esp_log.h"
-#include "esp_log_buffer.h"
+#include "esp_timer.h"
+#include <inttypes.h>
 #include <string.h>
 
 static const char* TAG = "MidiService";
 
-// Static callback for BLE MIDI received messages
-static void midi_message_received_callback(uint8_t blemidi_port, uint16_t timestamp,
-    uint8_t midi_status, uint8_t* remaining_message,
-    size_t len, size_t continued_sysex_pos)
+bool MidiTransaction::addCC(uint8_t channel, uint8_t ccNumber, uint8_t value)
 {
-    ESP_LOGI(TAG, "Received MIDI: port=%d, timestamp=%d, status=0x%02x, len=%d",
-        blemidi_port, timestamp, midi_status, len);
-    if (len > 0 && remaining_message != nullptr)
+    if (length_ + 3u > MAX_BYTES)
     {
-        ESP_LOG_BUFFER_HEX(TAG, remaining_message, len);
+        return false;
     }
+    data_[length_++] = static_cast<uint8_t>(0xB0 | (channel & 0x0F));
+    data_[length_++] = ccNumber & 0x7F;
+    data_[length_++] = value & 0x7F;
+    return true;
+}
+
+MidiService::MidiService(MidiTransport& transport)
+    : transport_(transport),
+      initialized_(false),
+      pendingLock_(portMUX_INITIALIZER_UNLOCKED),
+      pendingCount_(0),
+      coalesceStart_(0),
+      coalescedCount_(0),
+      sendFailedCount_(0)
+{
+}
 
-    if (midi_status == 0xF0 && len >= 4 &&
-        remaining_message[0] == 0x7E &&  // Universal Non-Real Time
-        remaining_message[2] == 0x06 &&  // General Information
-        remaining_message[3] == 0x01)    // Identity Request
+esp_err_t MidiService::init()
+{
+    if (initialized_)
+    {
+        ESP_LOGW(TAG, "MIDI service already initialized");
+        return ESP_OK;
+    }
+
+    int32_t status = transport_.init();
+    if (status < 0)
+    {
+        ESP_LOGE(TAG, "MIDI transport failed to initialize, status=%d", status);
+        return ESP_FAIL;
+    }
+
+    sysex_.addConsumer(SysexDelivery::WHOLE_MESSAGE,
+        [this](const uint8_t* data, size_t length, size_t offset, SysexEvent event) {
+            handleSysex(data, length);
+        });
+
+    transport_.setReceiveCallback([this](uint16_t timestamp, uint8_t status, const uint8_t* data, size_t length, size_t continuedSysexPos, int64_t receivedUs) {
+        // Runs for every message in the BLE callback: debug level only, compiled out by default
+        ESP_LOGD(TAG, "Received MIDI: timestamp=%d, status=0x%02x, len=%d", timestamp, status, length);
+        handleReceived(status, data, length, continuedSysexPos, receivedUs > 0 ? receivedUs : esp_timer_get_time());
+    });
+    transport_.setConnectionCallback([this](int32_t connections) {
+        if (connectionCallback_)
+        {
+            connectionCallback_(connections > 0);
+        }
+    });
+    transport_.setPreFlushCallback([this]() {
+        flushPending();
+    });
+
+    initialized_ = true;
+    ESP_LOGI(TAG, "MIDI service initialized successfully");
+    return ESP_OK;
+}
+
+void MidiService::handleReceived(uint8_t status, const uint8_t* data, size_t length, size_t continuedSysexPos, int64_t receivedUs)
+{
+    sysex_.receive(status, data, length, continuedSysexPos, static_cast<uint32_t>(receivedUs / 1000));
+
+    if (status >= 0x80 && status < 0xF0 && messageCallback_)
+    {
+        messageCallback_(status,
+            length > 0 ? data[0] : 0,
+            length > 1 ? data[1] : 0);
+    }
+    else if (status >= 0xF8 && realtimeCallback_)
+    {
+        realtimeCallback_(status, receivedUs);
+    }
+}
+
+void MidiService::handleSysex(const uint8_t* data, size_t length)
+{
+    if (length >= 4 &&
+        data[0] == 0x7E &&  // Universal Non-Real Time
+        data[2] == 0x06 &&  // General Information
+        data[3] == 0x01)    // Identity Request
     {
         ESP_LOGI(TAG, "Received Universal Identity Request - sending reply");
 
         // MIDI Identity Reply: F0 7E <device> 06 02 <manufacturer> <family> <member> <version> F7
-        uint8_t identity_reply[] = {
+        static const uint8_t identity_reply[] = {
             0xF0,       // SysEx start
             0x7E,       // Universal Non-Real Time
             0x7F,       // Device ID (all devices)
@@ -39,35 +109,26 @@ static void midi_message_received_callback(uint8_t blemidi_port, uint16_t timest
             0xF7        // SysEx end
         };
 
-        blemidi_send_message(blemidi_port, identity_reply, sizeof(identity_reply));
+        const MidiOutMessage reply = {identity_reply, sizeof(identity_reply), false, true, 0};
+        if (transport_.sendBatch(&reply, 1) < 0)
+        {
+            sendFailedCount_.fetch_add(1, std::memory_order_relaxed);
+            ESP_LOGW(TAG, "Identity Reply dropped");
+        }
     }
 }
 
-MidiService::MidiService() : initialized_(false)
+int32_t MidiService::addSysexConsumer(SysexDelivery delivery, SysexAssembler::Callback callback)
 {
+    return sysex_.addConsumer(delivery, callback);
 }
 
-esp_err_t MidiService::init()
+void MidiService::checkSysexTimeout()
 {
-    if (initialized_)
-    {
-        ESP_LOGW(TAG, "MIDI service already initialized");
-        return ESP_OK;
-    }
-
-    int32_t status = blemidi_init((void*) midi_message_received_callback);
-    if (status < 0)
-    {
-        ESP_LOGE(TAG, "BLE MIDI driver failed to initialize, status=%d", status);
-        return ESP_FAIL;
-    }
-
-    initialized_ = true;
-    ESP_LOGI(TAG, "BLE MIDI service initialized successfully");
-    return ESP_OK;
+    sysex_.checkTimeout(static_cast<uint32_t>(esp_timer_get_time() / 1000));
 }
 
-void MidiService::sendCC(uint8_t channel, uint8_t ccNumber, uint8_t value)
+void MidiService::sendCC(uint8_t channel, uint8_t ccNumber, uint8_t value, bool priority, int64_t timeUs)
 {
     if (!initialized_)
     {
@@ -81,24 +142,12 @@ void MidiService::sendCC(uint8_t channel, uint8_t ccNumber, uint8_t value)
     value &= 0x7F;      // 7 bits (0-127)
 
     // MIDI CC message: [Status (0xB0 | channel), CC number, value]
-    uint8_t message[3] = {
-        static_cast<uint8_t>(0xB0 | channel),
-        ccNumber,
-        value
-    };
-
-    int32_t result = blemidi_send_message(0, message, sizeof(message));
-    if (result < 0)
-    {
-        ESP_LOGE(TAG, "Failed to send CC message, result=%d", result);
-    }
-    else
-    {
-        ESP_LOGI(TAG, "Sent CC: channel=%d, cc=%d, value=%d", channel, ccNumber, value);
-    }
+    const uint8_t message[3] = {static_cast<uint8_t>(0xB0 | channel), ccNumber, value};
+    queueMessage(message, sizeof(message), false, priority, priority ? 0 : makeKey(KEY_CC, channel, ccNumber), timeUs);
+    ESP_LOGD(TAG, "Queued CC: channel=%d, cc=%d, value=%d", channel, ccNumber, value);
 }
 
-void MidiService::sendProgramChange(uint8_t channel, uint8_t program)
+void MidiService::sendProgramChange(uint8_t channel, uint8_t program, int64_t timeUs)
 {
     if (!initialized_)
     {
@@ -111,24 +160,70 @@ void MidiService::sendProgramChange(uint8_t channel, uint8_t program)
     program &= 0x7F;  // 7 bits (0-127)
 
     // MIDI Program Change message: [Status (0xC0 | channel), program]
-    uint8_t message[2] = {
-        static_cast<uint8_t>(0xC0 | channel),
-        program
-    };
+    const uint8_t message[2] = {static_cast<uint8_t>(0xC0 | channel), program};
+    queueMessage(message, sizeof(message), false, false, 0, timeUs);
+    ESP_LOGD(TAG, "Queued Program Change: channel=%d, program=%d", channel, program);
+}
 
-    int32_t result = blemidi_send_message(0, message, sizeof(message));
-    if (result < 0)
+void MidiService::send14BitCC(uint8_t channel, uint8_t ccNumber, uint16_t value, int64_t timeUs)
+{
+    if (!initialized_)
     {
-        ESP_LOGE(TAG, "Failed to send Program Change message, result=%d", result);
+        ESP_LOGW(TAG, "Cannot send 14-bit CC: MIDI service not initialized");
+        return;
     }
-    else
+
+    channel &= 0x0F;
+    ccNumber &= 0x1F;   // MSB controllers 0-31
+    value &= 0x3FFF;
+
+    MidiTransaction transaction;
+    transaction.addCC(channel, ccNumber, static_cast<uint8_t>(value >> 7));
+    transaction.addCC(channel, ccNumber + 32, static_cast<uint8_t>(value & 0x7F));
+    queueMessage(transaction.getData(), transaction.getLength(), true, false, makeKey(KEY_CC_14BIT, channel, ccNumber), timeUs);
+    ESP_LOGD(TAG, "Queued 14-bit CC: channel=%d, cc=%d/%d, value=%d", channel, ccNumber, ccNumber + 32, value);
+}
+
+void MidiService::sendNRPN(uint8_t channel, uint16_t parameterNumber, uint16_t value, int64_t timeUs)
+{
+    if (!initialized_)
+    {
+        ESP_LOGW(TAG, "Cannot send NRPN: MIDI service not initialized");
+        return;
+    }
+
+    channel &= 0x0F;
+    parameterNumber &= 0x3FFF;
+    value &= 0x3FFF;
+
+    // Parameter number MSB/LSB, then Data Entry MSB/LSB
+    MidiTransaction transaction;
+    transaction.addCC(channel, 99, static_cast<uint8_t>(parameterNumber >> 7));
+    transaction.addCC(channel, 98, static_cast<uint8_t>(parameterNumber & 0x7F));
+    transaction.addCC(channel, 6, static_cast<uint8_t>(value >> 7));
+    transaction.addCC(channel, 38, static_cast<uint8_t>(value & 0x7F));
+    queueMessage(transaction.getData(), transaction.getLength(), true, false, makeKey(KEY_NRPN, channel, parameterNumber), timeUs);
+    ESP_LOGD(TAG, "Queued NRPN: channel=%d, parameter=%d, value=%d", channel, parameterNumber, value);
+}
+
+void MidiService::sendTransaction(const MidiTransaction& transaction, bool priority)
+{
+    if (!initialized_)
+    {
+        ESP_LOGW(TAG, "Cannot send transaction: MIDI service not initialized");
+        return;
+    }
+
+    if (transaction.getLength() > 0)
     {
-        ESP_LOGI(TAG, "Sent Program Change: channel=%d, program=%d", channel, program);
+        queueMessage(transaction.getData(), transaction.getLength(), true, priority, 0, 0);
     }
 }
 
-void MidiService::sendParameter(std::shared_ptr<Parameter> param)
+void MidiService::sendParameter(std::shared_ptr<Parameter> param, int64_t timeUs)
 {
+    BLEMIDI_LATENCY_MARK(BLEMIDI_LATENCY_STAGE_SEND);
+
     if (!param)
     {
         ESP_LOGW(TAG, "Cannot send null parameter");
@@ -143,23 +238,36 @@ void MidiService::sendParameter(std::shared_ptr<Parameter> param)
         auto ccParam = std::static_pointer_cast<CCParameter>(param);
         if (ccParam)
         {
-            sendCC(ccParam->getChannel(), ccParam->getCCNumber(), ccParam->getValue());
+            sendCC(ccParam->getChannel(), ccParam->getCCNumber(), ccParam->getValue(), false, timeUs);
         }
         break;
     }
     case ParameterType::BOOLEAN_CC:
     {
-        // Boolean CC also sends as a regular CC message (value is either 0 or 127)
+        // Boolean CC also sends as a regular CC message (value is either 0 or 127),
+        // but every toggle has to arrive, so it's neither coalesced nor dropped
         auto boolParam = std::static_pointer_cast<BooleanCCParameter>(param);
         if (boolParam)
         {
-            sendCC(boolParam->getChannel(), boolParam->getCCNumber(), boolParam->getValue());
+            sendCC(boolParam->getChannel(), boolParam->getCCNumber(), boolParam->getValue(), true, timeUs);
         }
         break;
     }
     case ParameterType::PROGRAM_CHANGE:
     {
-        sendProgramChange(param->getChannel(), param->getValue());
+        sendProgramChange(param->getChannel(), param->getValue(), timeUs);
+        break;
+    }
+    case ParameterType::CC_14BIT:
+    {
+        auto ccParam = std::static_pointer_cast<CC14BitParameter>(param);
+        send14BitCC(ccParam->getChannel(), ccParam->getCCNumber(), ccParam->getValue14(), timeUs);
+        break;
+    }
+    case ParameterType::NRPN:
+    {
+        auto nrpnParam = std::static_pointer_cast<NRPNParameter>(param);
+        sendNRPN(nrpnParam->getChannel(), nrpnParam->getParameterNumber(), nrpnParam->getValue14(), timeUs);
         break;
     }
     default:
@@ -168,12 +276,112 @@ void MidiService::sendParameter(std::shared_ptr<Parameter> param)
     }
 }
 
-void MidiService::tick()
+void MidiService::queueMessage(const uint8_t* data, uint8_t length, bool transaction, bool priority, uint32_t key, int64_t timeUs)
 {
-    if (initialized_)
+    bool full = false;
+
+    portENTER_CRITICAL(&pendingLock_);
+    if (key != 0)
     {
-        blemidi_tick();
+        // Last value wins: update a queued entry of the same controller or parameter in place
+        for (size_t i = coalesceStart_; i < pendingCount_; i++)
+        {
+            if (pending_[i].key == key)
+            {
+                // The entry keeps its place, the BLE driver keeps the timestamps of a packet in order
+                memcpy(pending_[i].data, data, length);
+                pending_[i].timeUs = timeUs;
+                coalescedCount_++;
+                portEXIT_CRITICAL(&pendingLock_);
+                return;
+            }
+        }
     }
+
+    if (pendingCount_ < MAX_PENDING_MESSAGES)
+    {
+        PendingMessage& entry = pending_[pendingCount_++];
+        memcpy(entry.data, data, length);
+        entry.length = length;
+        entry.transaction = transaction;
+        entry.priority = priority;
+        entry.key = key;
+        entry.timeUs = timeUs;
+
+        // Data bytes are < 0x80, so only status bytes can match
+        for (uint8_t i = 0; i < length; i++)
+        {
+            if ((data[i] & 0xF0) == 0xC0)
+            {
+                coalesceStart_ = pendingCount_;
+            }
+        }
+    }
+    else
+    {
+        full = true;
+    }
+    portEXIT_CRITICAL(&pendingLock_);
+
+    if (full)
+    {
+        // Hand the queue over to the transport early and start over
+        flushPending();
+        queueMessage(data, length, transaction, priority, key, timeUs);
+        return;
+    }
+
+    transport_.requestFlush();
+}
+
+void MidiService::flushPending()
+{
+    PendingMessage messages[MAX_PENDING_MESSAGES];
+    size_t count;
+
+    portENTER_CRITICAL(&pendingLock_);
+    count = pendingCount_;
+    memcpy(messages, pending_, count * sizeof(PendingMessage));
+    pendingCount_ = 0;
+    coalesceStart_ = 0;
+    portEXIT_CRITICAL(&pendingLock_);
+
+    if (count == 0)
+    {
+        return;
+    }
+
+    MidiOutMessage batch[MAX_PENDING_MESSAGES];
+    for (size_t i = 0; i < count; i++)
+    {
+        batch[i] = {messages[i].data, messages[i].length, messages[i].transaction, messages[i].priority, messages[i].timeUs};
+    }
+    if (transport_.sendBatch(batch, count) < 0)
+    {
+        uint32_t failed = sendFailedCount_.fetch_add(1, std::memory_order_relaxed) + 1;
+        ESP_LOGD(TAG, "Batch of %u messages not completely sent (%" PRIu32 " failed batches)",
+            static_cast<unsigned>(count), failed);
+    }
+}
+
+int32_t MidiService::waitAndFlush()
+{
+    if (!initialized_)
+    {
+        return -1;
+    }
+    int32_t result = transport_.waitFlush(MidiTransport::WAIT_FOREVER);
+    return result < 0 ? -1 : result;
+}
+
+esp_err_t MidiService::setFlushWindow(uint8_t windowMs)
+{
+    if (transport_.setFlushWindow(windowMs) < 0)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    ESP_LOGI(TAG, "Flush window set to %d ms", windowMs);
+    return ESP_OK;
 }
 
 bool MidiService::isConnected() const
@@ -182,5 +390,30 @@ bool MidiService::isConnected() const
     {
         return false;
     }
-    return blemidi_is_connected() != 0;
+    return transport_.getConnectionCount() > 0;
+}
+
+void MidiService::setConnectionCallback(std::function<void(bool connected)> callback)
+{
+    connectionCallback_ = callback;
+}
+
+void MidiService::setReceiveNotifyCallback(std::function<bool()> callback)
+{
+    transport_.setReceiveNotifyCallback(callback);
+}
+
+size_t MidiService::processReceived(size_t maxMessages)
+{
+    return transport_.processReceived(maxMessages);
+}
+
+void MidiService::setMessageCallback(std::function<void(uint8_t status, uint8_t data1, uint8_t data2)> callback)
+{
+    messageCallback_ = callback;
+}
+
+void MidiService::setRealtimeCallback(std::function<void(uint8_t status, int64_t timeUs)> callback)
+{
+    realtimeCallback_ = callback;
 }
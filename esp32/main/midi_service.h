@@ -3,58 +3,272 @@
 
 #include <stdint.h>
 #include "esp_err.h"
+#include "freertos/FreeRTOS.h"
 #include "midi_model.h"
+#include "midi_transport.h"
+#include "sysex_assembler.h"
+#include <atomic>
 #include <memory>
+#include <functional>
 
 /**
- * @brief MIDI Service for sending BLE MIDI messages
+ * @brief Channel messages which must reach the receiver in the same BLE packet
+ *
+ * Used for the MSB/LSB pair of a 14-bit CC and the four CCs of an NRPN; split
+ * over two packets, a receiver would briefly apply a half-updated value.
+ */
+class MidiTransaction
+{
+public:
+    static constexpr size_t MAX_MESSAGES = 4;
+    static constexpr size_t MAX_BYTES = MAX_MESSAGES * 3;
+
+    /**
+     * @brief Add a CC message
+     * @return false if the transaction is full
+     */
+    bool addCC(uint8_t channel, uint8_t ccNumber, uint8_t value);
+
+    const uint8_t* getData() const { return data_; }
+    size_t getLength() const { return length_; }
+
+private:
+    uint8_t data_[MAX_BYTES] = {};
+    uint8_t length_ = 0;
+};
+
+/**
+ * @brief MIDI Service for sending and receiving MIDI messages over a MidiTransport
+ *
+ * Outgoing messages are held back until the transport flushes its output. A CC that is sent
+ * again before the flush replaces the queued value of the same channel and
+ * controller in place, so fast knob turns only transmit the newest value.
+ * 14-bit CCs and NRPNs are merged the same way, as a whole.
+ * A Program Change is never merged and CCs are not merged across it.
  */
 class MidiService
 {
 public:
-    MidiService();
+    /**
+     * @param transport Link the messages are sent over, must outlive the service
+     */
+    explicit MidiService(MidiTransport& transport);
     ~MidiService() = default;
 
     /**
-     * @brief Initialize the BLE MIDI service
+     * @brief Initialize the transport and install the service's callbacks
      * @return ESP_OK on success, error code otherwise
      */
     esp_err_t init();
 
     /**
      * @brief Send a CC (Control Change) message
+     *
+     * Replaces a queued, not yet sent value of the same controller.
+     * Priority messages (e.g. toggles) are never replaced and are kept when the BLE link is congested.
      * @param channel MIDI channel (0-15)
      * @param ccNumber Control Change number (0-127)
      * @param value Control Change value (0-127)
+     * @param priority Every value must reach the receiver
+     * @param timeUs When the value was set, see MidiOutMessage::timeUs
      */
-    void sendCC(uint8_t channel, uint8_t ccNumber, uint8_t value);
+    void sendCC(uint8_t channel, uint8_t ccNumber, uint8_t value, bool priority = false, int64_t timeUs = 0);
 
     /**
      * @brief Send a Program Change message
      * @param channel MIDI channel (0-15)
      * @param program Program number (0-127)
+     * @param timeUs When the program was selected, see MidiOutMessage::timeUs
+     */
+    void sendProgramChange(uint8_t channel, uint8_t program, int64_t timeUs = 0);
+
+    /**
+     * @brief Send a 14-bit CC as MSB/LSB pair in one BLE packet
+     *
+     * Replaces a queued, not yet sent value of the same controller.
+     * @param channel MIDI channel (0-15)
+     * @param ccNumber MSB controller (0-31), the LSB is sent on ccNumber + 32
+     * @param value 14-bit value (0-16383)
+     * @param timeUs When the value was set, see MidiOutMessage::timeUs
      */
-    void sendProgramChange(uint8_t channel, uint8_t program);
+    void send14BitCC(uint8_t channel, uint8_t ccNumber, uint16_t value, int64_t timeUs = 0);
+
+    /**
+     * @brief Send an NRPN (CC 99/98 parameter number, CC 6/38 value) in one BLE packet
+     *
+     * Replaces a queued, not yet sent value of the same parameter.
+     * @param channel MIDI channel (0-15)
+     * @param parameterNumber 14-bit parameter number (0-16383)
+     * @param value 14-bit value (0-16383)
+     * @param timeUs When the value was set, see MidiOutMessage::timeUs
+     */
+    void sendNRPN(uint8_t channel, uint16_t parameterNumber, uint16_t value, int64_t timeUs = 0);
+
+    /**
+     * @brief Send messages which must arrive together in one BLE packet
+     *
+     * The messages are written into the packet builder at once. If the packet
+     * being built has no room left for all of them, it's flushed first.
+     * @param transaction Messages to send, never merged with others
+     * @param priority Keep the messages when the BLE link is congested
+     */
+    void sendTransaction(const MidiTransaction& transaction, bool priority = false);
 
     /**
      * @brief Send a parameter value
+     *
+     * The messages carry timeUs as their BLE MIDI timestamp, so the receiver can
+     * place the change at the time of the gesture instead of the time of the flush.
      * @param param Parameter to send
+     * @param timeUs When the value was set (esp_timer_get_time()), 0 for when it is sent
+     */
+    void sendParameter(std::shared_ptr<Parameter> param, int64_t timeUs = 0);
+
+    /**
+     * @brief Block until a message is queued, then flush it once the coalescing window has passed
+     * @return Time in microseconds the flush happened after the end of the window, or -1 on errors
+     */
+    int32_t waitAndFlush();
+
+    /**
+     * @brief Set the time queued messages are held back so that following ones share the packet
+     * @param windowMs Coalescing window (0-15 ms)
+     * @return ESP_OK on success, ESP_ERR_INVALID_ARG if out of range
+     */
+    esp_err_t setFlushWindow(uint8_t windowMs);
+
+    /**
+     * @brief Hand the queued messages over to the transport in one batch
+     *
+     * Called by the transport right before its output is sent.
+     */
+    void flushPending();
+
+    /**
+     * @brief Number of CC values which were replaced by a newer one before being sent
      */
-    void sendParameter(std::shared_ptr<Parameter> param);
+    uint32_t getCoalescedCount() const { return coalescedCount_; }
 
     /**
-     * @brief This should be called periodically (e.g., every 15ms) for timestamp handling
+     * @brief Number of batches in which the transport could not send every message,
+     *        e.g. because its queue stayed full (the messages are dropped, senders never block)
      */
-    void tick();
+    uint32_t getSendFailedCount() const { return sendFailedCount_.load(std::memory_order_relaxed); }
 
     /**
-     * @brief Check if BLE MIDI is connected
+     * @brief Check if at least one peer is connected
      * @return true if connected, false otherwise
      */
     bool isConnected() const;
 
+    /**
+     * @brief Register a handler for connection state changes
+     * @param callback Called with the new state from the transport's task, keep it short
+     */
+    void setConnectionCallback(std::function<void(bool connected)> callback);
+
+    /**
+     * @brief Register a handler for received channel messages (0x80-0xEF)
+     * @param callback Called with the status and up to two data bytes from the task which
+     *        processes received messages, see setReceiveNotifyCallback()
+     */
+    void setMessageCallback(std::function<void(uint8_t status, uint8_t data1, uint8_t data2)> callback);
+
+    /**
+     * @brief Register a handler for received realtime messages (0xF8-0xFF), e.g. MIDI clock
+     * @param callback Called with the status byte and the time the message arrived at the
+     *                 transport (esp_timer_get_time()), from the task which processes received messages
+     */
+    void setRealtimeCallback(std::function<void(uint8_t status, int64_t timeUs)> callback);
+
+    /**
+     * @brief Handle received messages in an application task instead of the transport's task
+     *
+     * The transport queues received messages and calls the callback from its own
+     * task, which should only wake the application task up; that task then calls
+     * processReceived(). Without a callback, received messages are handled in the
+     * transport's task.
+     * @param callback Returns false if the notification couldn't be delivered
+     */
+    void setReceiveNotifyCallback(std::function<bool()> callback);
+
+    /**
+     * @brief Handle a batch of queued received messages in the calling task
+     *
+     * Must always be called from the same task. The message and SysEx callbacks run from here.
+     * @param maxMessages Upper limit for this batch
+     * @return Number of messages handled, if it equals maxMessages more may be waiting
+     */
+    size_t processReceived(size_t maxMessages);
+
+    /**
+     * @brief Register a handler for received SysEx messages, which may span several packets
+     *
+     * Streaming consumers get every fragment as it arrives. Whole-message consumers get
+     * complete messages of up to SysexAssembler::ARENA_SIZE bytes, larger ones are dropped.
+     * Both are called from the task which processes received messages.
+     * @return 0 on success, -1 if SysexAssembler::MAX_CONSUMERS are registered already
+     */
+    int32_t addSysexConsumer(SysexDelivery delivery, SysexAssembler::Callback callback);
+
+    /**
+     * @brief Drop a SysEx message whose next fragment is overdue, consumers get ABORTED
+     *
+     * Call it periodically from the task which processes received messages while
+     * isReceivingSysex(), a stalled stream is only noticed on the next message otherwise.
+     */
+    void checkSysexTimeout();
+
+    /**
+     * @brief Check if a SysEx message is being collected
+     */
+    bool isReceivingSysex() const { return sysex_.isReceiving(); }
+
+    /**
+     * @brief SysEx arena usage and dropped-message counters (updated by the task which processes received messages)
+     */
+    SysexAssembler::Stats getSysexStats() const { return sysex_.getStats(); }
+
 private:
+    void handleReceived(uint8_t status, const uint8_t* data, size_t length, size_t continuedSysexPos, int64_t receivedUs);
+    void handleSysex(const uint8_t* data, size_t length);
+
+    struct PendingMessage
+    {
+        uint8_t data[MidiTransaction::MAX_BYTES]; // One message, or all messages of a transaction
+        uint8_t length;
+        bool transaction;
+        bool priority;
+        uint32_t key; // A newer entry with the same key replaces this one, 0 if never replaced
+        int64_t timeUs;
+    };
+
+    // Kinds of mergeable entries, see makeKey()
+    static constexpr uint8_t KEY_CC = 1;
+    static constexpr uint8_t KEY_CC_14BIT = 2;
+    static constexpr uint8_t KEY_NRPN = 3;
+
+    static uint32_t makeKey(uint8_t kind, uint8_t channel, uint16_t number)
+    {
+        return (static_cast<uint32_t>(kind) << 24) | (static_cast<uint32_t>(channel) << 16) | number;
+    }
+
+    void queueMessage(const uint8_t* data, uint8_t length, bool transaction, bool priority, uint32_t key, int64_t timeUs);
+
+    static constexpr size_t MAX_PENDING_MESSAGES = 32;
+
+    MidiTransport& transport_;
     bool initialized_;
+    std::function<void(bool)> connectionCallback_;
+    std::function<void(uint8_t, uint8_t, uint8_t)> messageCallback_;
+    std::function<void(uint8_t, int64_t)> realtimeCallback_;
+    SysexAssembler sysex_; // Written by the task which processes received messages only
+    portMUX_TYPE pendingLock_;
+    PendingMessage pending_[MAX_PENDING_MESSAGES];
+    size_t pendingCount_;
+    size_t coalesceStart_; // First entry after the last Program Change
+    uint32_t coalescedCount_;
+    std::atomic<uint32_t> sendFailedCount_;
 };
 
 #endif // MIDI_SERVICE_H
@@ -0,0 +1,136 @@
+#ifndef MIDI_TRANSPORT_H
+#define MIDI_TRANSPORT_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <functional>
+
+/**
+ * @brief One entry of an outgoing batch
+ *
+ * Points into the sender's buffer, transports take the bytes from there.
+ */
+struct MidiOutMessage
+{
+    const uint8_t* data;
+    uint8_t length;
+    bool transaction; // Several channel messages which must arrive together
+    bool priority;    // Must not be dropped when the link is congested
+    int64_t timeUs;   // When the message was created, e.g. the encoder detent (esp_timer_get_time() on the device), 0 for when it is sent
+};
+
+/**
+ * @brief Connection between MidiService and a MIDI link (BLE, USB, loopback)
+ *
+ * The service queues and coalesces messages, the transport decides when they
+ * are sent: requestFlush() arms it, and once the transport's coalescing window
+ * has passed it calls the pre-flush callback, from which the service hands
+ * over the queued messages with sendBatch(). Received messages and connection
+ * changes are reported through callbacks.
+ *
+ * A transport may queue received messages instead of delivering them from its
+ * own context: with a receive notify callback registered, an application task
+ * is woken up and calls processReceived(), which runs the receive callback.
+ *
+ * Other callbacks run in the transport's context (e.g. the BLE stack task), keep them short.
+ * This header has no platform dependencies.
+ */
+class MidiTransport
+{
+public:
+    static constexpr uint32_t WAIT_FOREVER = 0xFFFFFFFF;
+
+    /**
+     * @brief Received message: status byte and the bytes which follow it
+     *
+     * SysEx arrives as 0xF0 with the data bytes (possibly in several parts,
+     * continuedSysexPos > 0 for the following ones), then 0xF7 without data.
+     * receivedUs is when the message arrived (esp_timer_get_time() on the
+     * device), also if it was queued for processReceived(); 0 if unknown.
+     */
+    using ReceiveCallback = std::function<void(uint16_t timestamp, uint8_t status, const uint8_t* data, size_t length, size_t continuedSysexPos, int64_t receivedUs)>;
+
+    /**
+     * @brief Number of connected peers, called whenever it changes
+     */
+    using ConnectionCallback = std::function<void(int32_t connections)>;
+
+    /**
+     * @brief Called right before the output is sent, the place to call sendBatch()
+     */
+    using PreFlushCallback = std::function<void()>;
+
+    /**
+     * @brief Received messages are waiting for processReceived()
+     *
+     * Called once until the next processReceived(). Returns false if the
+     * notification couldn't be delivered, it's repeated with the next message then.
+     */
+    using ReceiveNotifyCallback = std::function<bool()>;
+
+    virtual ~MidiTransport() = default;
+
+    /**
+     * @brief Bring up the link
+     * @return 0 on success, < 0 on errors
+     */
+    virtual int32_t init() = 0;
+
+    /**
+     * @brief Send messages in the given order
+     * @return 0 on success, < 0 if a message could not be sent (the others are still sent)
+     */
+    virtual int32_t sendBatch(const MidiOutMessage* messages, size_t count) = 0;
+
+    /**
+     * @brief Arm a flush, does nothing if one is already pending
+     */
+    virtual void requestFlush() = 0;
+
+    /**
+     * @brief Wait until a flush was requested, then run it once the coalescing window has passed
+     * @param timeoutMs Maximum time to wait for a request, or WAIT_FOREVER
+     * @return Microseconds the flush happened after the end of the window, < 0 on errors or timeout
+     */
+    virtual int32_t waitFlush(uint32_t timeoutMs) = 0;
+
+    /**
+     * @brief Set the time between the first queued message and the flush
+     * @return 0 on success, < 0 if out of range
+     */
+    virtual int32_t setFlushWindow(uint8_t windowMs) = 0;
+
+    /**
+     * @brief Number of connected peers, 0 if nobody receives the output
+     */
+    virtual int32_t getConnectionCount() const = 0;
+
+    /**
+     * @brief Run the receive callback for queued messages in the calling task
+     *
+     * Transports which deliver received messages right away have nothing queued.
+     * @param maxMessages Upper limit for this batch
+     * @return Number of messages processed, if it equals maxMessages more may be waiting
+     */
+    virtual size_t processReceived(size_t /*maxMessages*/) { return 0; }
+
+    /**
+     * @brief Queue received messages and notify instead of delivering them from the transport's context
+     *
+     * Transports which deliver received messages right away never call it.
+     * @param callback nullptr delivers messages from the transport's context again
+     */
+    virtual void setReceiveNotifyCallback(ReceiveNotifyCallback callback) { receiveNotifyCallback_ = callback; }
+
+    void setReceiveCallback(ReceiveCallback callback) { receiveCallback_ = callback; }
+    void setConnectionCallback(ConnectionCallback callback) { connectionCallback_ = callback; }
+    void setPreFlushCallback(PreFlushCallback callback) { preFlushCallback_ = callback; }
+
+protected:
+    ReceiveCallback receiveCallback_;
+    ConnectionCallback connectionCallback_;
+    PreFlushCallback preFlushCallback_;
+    ReceiveNotifyCallback receiveNotifyCallback_;
+};
+
+#endif // MIDI_TRANSPORT_H
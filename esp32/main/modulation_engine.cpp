@@ -0,0 +1,212 @@
+#include "modulation_engine.h"
+#include <math.h>
+
+static bool isHighRes(const Parameter& parameter)
+{
+    return parameter.getType() == ParameterType::CC_14BIT || parameter.getType() == ParameterType::NRPN;
+}
+
+ModulationEngine::ModulationEngine(TempoClock& clock)
+    : clock_(clock),
+      activeCount_(0),
+      updateIntervalUs_(DEFAULT_UPDATE_INTERVAL_US),
+      lastGridUs_(-1)
+{
+}
+
+int32_t ModulationEngine::start(std::shared_ptr<Parameter> parameter, const ModulationConfig& config, int64_t nowUs)
+{
+    if (!parameter || config.periodTicks == 0 ||
+        (config.shape == ModulationShape::STEPS && (config.numSteps == 0 || config.numSteps > ModulationConfig::MAX_STEPS)))
+    {
+        return -1;
+    }
+
+    // A parameter has one source at most, a new config replaces the old one
+    int32_t slot = -1;
+    for (size_t i = 0; i < MAX_SOURCES; i++)
+    {
+        if (sources_[i].parameter == parameter)
+        {
+            slot = i;
+            break;
+        }
+        if (slot < 0 && !sources_[i].parameter)
+        {
+            slot = i;
+        }
+    }
+    if (slot < 0)
+    {
+        return -1;
+    }
+
+    uint16_t maxValue = isHighRes(*parameter) ? HighResParameter::MAX_VALUE_14BIT : parameter->getMaxValue();
+    Source& source = sources_[slot];
+    if (!source.parameter)
+    {
+        activeCount_++;
+    }
+    source.parameter = parameter;
+    source.config = config;
+    source.config.minValue = config.minValue > maxValue ? maxValue : config.minValue;
+    source.config.maxValue = config.maxValue > maxValue ? maxValue : config.maxValue;
+    source.lastValue = -1;
+
+    TempoPosition position = clock_.getPosition(nowUs);
+    source.startTicks = position.ticks;
+    source.startFraction = position.fraction;
+    return slot;
+}
+
+void ModulationEngine::stop(const Parameter* parameter)
+{
+    for (Source& source : sources_)
+    {
+        if (source.parameter && source.parameter.get() == parameter)
+        {
+            source.parameter.reset();
+            activeCount_--;
+        }
+    }
+}
+
+void ModulationEngine::stopAll()
+{
+    for (Source& source : sources_)
+    {
+        source.parameter.reset();
+    }
+    activeCount_ = 0;
+}
+
+bool ModulationEngine::isModulated(const Parameter* parameter) const
+{
+    for (const Source& source : sources_)
+    {
+        if (source.parameter && source.parameter.get() == parameter)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+float ModulationEngine::shapeLevel(const ModulationConfig& config, float cycle)
+{
+    switch (config.shape)
+    {
+    case ModulationShape::SINE:
+        return 0.5f - 0.5f * cosf(2.0f * static_cast<float>(M_PI) * cycle); // Starts at minValue like the others
+    case ModulationShape::TRIANGLE:
+        return cycle < 0.5f ? 2.0f * cycle : 2.0f - 2.0f * cycle;
+    case ModulationShape::SAW_UP:
+    case ModulationShape::RAMP:
+        return cycle;
+    case ModulationShape::SAW_DOWN:
+        return 1.0f - cycle;
+    case ModulationShape::SQUARE:
+        return cycle < 0.5f ? 0.0f : 1.0f;
+    case ModulationShape::STEPS:
+    {
+        size_t step = static_cast<size_t>(cycle * config.numSteps);
+        if (step >= config.numSteps)
+        {
+            step = config.numSteps - 1;
+        }
+        return config.steps[step] / 255.0f;
+    }
+    }
+    return 0.0f;
+}
+
+bool ModulationEngine::sample(Source& source, const TempoPosition& position, int64_t timeUs)
+{
+    const ModulationConfig& config = source.config;
+    bool finished = false;
+    float cycle;
+
+    if (config.shape == ModulationShape::RAMP)
+    {
+        float elapsed = static_cast<float>(position.ticks - source.startTicks) + (position.fraction - source.startFraction);
+        cycle = elapsed / config.periodTicks;
+        if (cycle >= 1.0f)
+        {
+            cycle = 1.0f;
+            finished = true;
+        }
+        else if (cycle < 0.0f)
+        {
+            cycle = 0.0f; // Song position was reset by a Start
+        }
+    }
+    else
+    {
+        // Locked to the song position, a cycle always starts on a multiple of its length
+        cycle = (static_cast<float>(position.ticks % config.periodTicks) + position.fraction) / config.periodTicks +
+            config.phase / 256.0f;
+        if (cycle >= 1.0f)
+        {
+            cycle -= 1.0f;
+        }
+    }
+
+    float level = shapeLevel(config, cycle);
+    int32_t value = static_cast<int32_t>(lroundf(config.minValue + level * (static_cast<int32_t>(config.maxValue) - config.minValue)));
+    if (value != source.lastValue)
+    {
+        source.lastValue = value;
+        if (isHighRes(*source.parameter))
+        {
+            static_cast<HighResParameter*>(source.parameter.get())->setValue14(static_cast<uint16_t>(value));
+        }
+        else
+        {
+            source.parameter->setValue(static_cast<uint8_t>(value));
+        }
+
+        stats_.messages++;
+        if (emitCallback_)
+        {
+            emitCallback_(source.parameter, timeUs);
+        }
+    }
+    return finished;
+}
+
+uint32_t ModulationEngine::run(int64_t nowUs)
+{
+    int64_t gridUs = nowUs - (nowUs % updateIntervalUs_);
+    uint32_t untilNextUs = updateIntervalUs_ - static_cast<uint32_t>(nowUs - gridUs);
+
+    if (gridUs <= lastGridUs_ || activeCount_ == 0)
+    {
+        return untilNextUs;
+    }
+
+    // Only the latest grid point is sampled, older values would be coalesced away anyway
+    if (lastGridUs_ >= 0 && (gridUs - lastGridUs_) > updateIntervalUs_)
+    {
+        stats_.skippedSamples += static_cast<uint32_t>((gridUs - lastGridUs_) / updateIntervalUs_ - 1);
+    }
+    lastGridUs_ = gridUs;
+
+    uint32_t lateUs = static_cast<uint32_t>(nowUs - gridUs);
+    stats_.runs++;
+    stats_.sumLateUs += lateUs;
+    if (lateUs > stats_.maxLateUs)
+    {
+        stats_.maxLateUs = lateUs;
+    }
+
+    TempoPosition position = clock_.getPosition(gridUs);
+    for (Source& source : sources_)
+    {
+        if (source.parameter && sample(source, position, gridUs))
+        {
+            source.parameter.reset(); // Ramp finished, the parameter keeps its end value
+            activeCount_--;
+        }
+    }
+    return untilNextUs;
+}
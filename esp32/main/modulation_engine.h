@@ -0,0 +1,145 @@
+#ifndef MODULATION_ENGINE_H
+#define MODULATION_ENGINE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <functional>
+#include <memory>
+#include "midi_model.h"
+#include "tempo_clock.h"
+
+/**
+ * @brief Waveform of a modulation source
+ */
+enum class ModulationShape : uint8_t
+{
+    SINE,
+    TRIANGLE,
+    SAW_UP,
+    SAW_DOWN,
+    SQUARE,
+    RAMP, // Once from min to max, then the source stops
+    STEPS // Step sequence, one step per periodTicks / numSteps
+};
+
+/**
+ * @brief Settings of one modulation source
+ */
+struct ModulationConfig
+{
+    static constexpr size_t MAX_STEPS = 16;
+
+    ModulationShape shape = ModulationShape::SINE;
+    uint16_t periodTicks = 96; // Cycle length in MIDI clock ticks (24 per quarter note), 96 = one 4/4 bar
+    uint8_t phase = 0;         // Offset into the cycle, 256 = one cycle
+    uint16_t minValue = 0;     // Output range in parameter units (0-16383 for 14-bit parameters)
+    uint16_t maxValue = 127;
+    uint8_t numSteps = 0;      // STEPS only
+    uint8_t steps[MAX_STEPS] = {}; // STEPS only, 0-255 spans minValue..maxValue
+};
+
+/**
+ * @brief Tempo-synced modulation sources (LFOs, ramps, step sequences) driving parameters
+ *
+ * Cycles are locked to the song position of the TempoClock, so an LFO of one
+ * bar restarts on every bar of the DAW. Values are sampled on a fixed grid of
+ * UPDATE_INTERVAL_US and each one is emitted with its grid time, so the BLE
+ * MIDI timestamps stay evenly spaced however late run() is called. Every
+ * source emits at most one message per grid point and only when its value
+ * changed, which bounds the rate to MAX_SOURCES messages per interval.
+ *
+ * The engine writes the value into the parameter model, then calls the emit
+ * callback which sends it. A running source owns the value of its parameter:
+ * encoder and inbound MIDI changes are overwritten with the next sample.
+ *
+ * Must be used from the task which adjusts the parameters from the encoder.
+ * This class has no platform dependencies so it can be exercised on a host.
+ */
+class ModulationEngine
+{
+public:
+    static constexpr size_t MAX_SOURCES = 8;
+    static constexpr uint32_t DEFAULT_UPDATE_INTERVAL_US = 10000;
+
+    /**
+     * @param timeUs Grid time the value belongs to, for the message timestamp
+     */
+    using EmitCallback = std::function<void(const std::shared_ptr<Parameter>& parameter, int64_t timeUs)>;
+
+    /**
+     * @brief Counters for jitter and throughput measurements
+     */
+    struct Stats
+    {
+        uint32_t runs = 0;           // Calls of run() which reached a new grid point
+        uint32_t messages = 0;       // Values emitted
+        uint32_t skippedSamples = 0; // Grid points passed without a run (the task was busy)
+        uint32_t maxLateUs = 0;      // Most time between a grid point and its run
+        uint64_t sumLateUs = 0;
+    };
+
+    explicit ModulationEngine(TempoClock& clock);
+
+    /**
+     * @brief Modulate a parameter, replaces the source already driving it
+     * @return Source number, -1 if the config is invalid or all sources are in use
+     */
+    int32_t start(std::shared_ptr<Parameter> parameter, const ModulationConfig& config, int64_t nowUs);
+
+    /**
+     * @brief Stop modulating a parameter, it keeps its last value
+     */
+    void stop(const Parameter* parameter);
+
+    void stopAll();
+
+    /**
+     * @brief Sample all sources at the latest grid point up to nowUs and emit the changed values
+     * @return Microseconds until the next grid point
+     */
+    uint32_t run(int64_t nowUs);
+
+    /**
+     * @brief True if a parameter is modulated
+     */
+    bool isModulated(const Parameter* parameter) const;
+
+    /**
+     * @brief True while at least one source runs, run() has nothing to do otherwise
+     */
+    bool isActive() const { return activeCount_ > 0; }
+
+    void setEmitCallback(EmitCallback callback) { emitCallback_ = callback; }
+
+    /**
+     * @brief Grid spacing, the upper bound of the message rate per source
+     */
+    void setUpdateInterval(uint32_t intervalUs) { updateIntervalUs_ = intervalUs > 0 ? intervalUs : 1; }
+    uint32_t getUpdateInterval() const { return updateIntervalUs_; }
+
+    const Stats& getStats() const { return stats_; }
+    void resetStats() { stats_ = Stats(); }
+
+private:
+    struct Source
+    {
+        std::shared_ptr<Parameter> parameter;
+        ModulationConfig config;
+        uint32_t startTicks;   // RAMP: song position when it started
+        float startFraction;
+        int32_t lastValue;     // -1 before the first emit
+    };
+
+    static float shapeLevel(const ModulationConfig& config, float cycle);
+    bool sample(Source& source, const TempoPosition& position, int64_t timeUs);
+
+    TempoClock& clock_;
+    Source sources_[MAX_SOURCES];
+    size_t activeCount_;
+    uint32_t updateIntervalUs_;
+    int64_t lastGridUs_;
+    EmitCallback emitCallback_;
+    Stats stats_;
+};
+
+#endif // MODULATION_ENGINE_H
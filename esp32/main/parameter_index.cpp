@@ -0,0 +1,153 @@
+#include "parameter_index.h"
+#include <string.h>
+
+ParameterIndex::ParameterIndex()
+{
+    clear();
+}
+
+void ParameterIndex::clear()
+{
+    memset(controlChangeSlots_, NO_ENTRY, sizeof(controlChangeSlots_));
+    memset(programChangeSlots_, NO_ENTRY, sizeof(programChangeSlots_));
+    entries_.clear();
+}
+
+bool ParameterIndex::bind(uint8_t* slot, Parameter* parameter, uint16_t parameterIndex, Role role)
+{
+    if (*slot != NO_ENTRY || entries_.size() >= NO_ENTRY)
+    {
+        return false;
+    }
+
+    *slot = static_cast<uint8_t>(entries_.size());
+    entries_.push_back({{parameter, parameterIndex}, role});
+    return true;
+}
+
+size_t ParameterIndex::build(Page& page)
+{
+    clear();
+
+    size_t unbound = 0;
+    for (size_t i = 0; i < page.getParameterCount(); i++)
+    {
+        Parameter* param = page.getParameter(i).get();
+        if (!param)
+        {
+            continue;
+        }
+
+        uint8_t channel = param->getChannel();
+        uint16_t index = static_cast<uint16_t>(i);
+        bool bound = true;
+
+        switch (param->getType())
+        {
+        case ParameterType::CC:
+            bound = bind(&controlChangeSlots_[channel][static_cast<CCParameter*>(param)->getCCNumber()],
+                param, index, Role::VALUE);
+            break;
+
+        case ParameterType::BOOLEAN_CC:
+            bound = bind(&controlChangeSlots_[channel][static_cast<BooleanCCParameter*>(param)->getCCNumber()],
+                param, index, Role::VALUE);
+            break;
+
+        case ParameterType::CC_14BIT:
+        {
+            uint8_t ccNumber = static_cast<CC14BitParameter*>(param)->getCCNumber();
+            bound = bind(&controlChangeSlots_[channel][ccNumber], param, index, Role::MSB_14BIT);
+            bound &= bind(&controlChangeSlots_[channel][ccNumber + 32], param, index, Role::LSB_14BIT);
+            break;
+        }
+
+        case ParameterType::PROGRAM_CHANGE:
+            bound = bind(&programChangeSlots_[channel], param, index, Role::VALUE);
+            break;
+
+        case ParameterType::NRPN:
+            // Data entry needs the parameter number selected earlier, not bound
+            break;
+        }
+
+        if (!bound)
+        {
+            unbound++;
+        }
+    }
+
+    return unbound;
+}
+
+const ParameterIndex::Binding* ParameterIndex::findControlChange(uint8_t channel, uint8_t ccNumber) const
+{
+    uint8_t slot = controlChangeSlots_[channel & 0x0F][ccNumber & 0x7F];
+    return slot != NO_ENTRY ? &entries_[slot].binding : nullptr;
+}
+
+const ParameterIndex::Binding* ParameterIndex::findProgramChange(uint8_t channel) const
+{
+    uint8_t slot = programChangeSlots_[channel & 0x0F];
+    return slot != NO_ENTRY ? &entries_[slot].binding : nullptr;
+}
+
+const ParameterIndex::Binding* ParameterIndex::apply(uint8_t status, uint8_t data1, uint8_t data2)
+{
+    uint8_t channel = status & 0x0F;
+    uint8_t slot;
+    uint8_t value;
+
+    switch (status & 0xF0)
+    {
+    case 0xB0: // Control Change
+        slot = controlChangeSlots_[channel][data1 & 0x7F];
+        value = data2 & 0x7F;
+        break;
+
+    case 0xC0: // Program Change
+        slot = programChangeSlots_[channel];
+        value = data1 & 0x7F;
+        break;
+
+    default:
+        return nullptr;
+    }
+
+    if (slot == NO_ENTRY)
+    {
+        return nullptr;
+    }
+
+    const Entry& entry = entries_[slot];
+    Parameter* param = entry.binding.parameter;
+
+    if (entry.role == Role::VALUE)
+    {
+        if (param->getValue() == value)
+        {
+            return nullptr;
+        }
+        param->setValue(value);
+    }
+    else
+    {
+        HighResParameter* highRes = static_cast<HighResParameter*>(param);
+        uint16_t previous = highRes->getValue14();
+        if (entry.role == Role::MSB_14BIT)
+        {
+            // A new MSB clears the LSB, like any MIDI receiver
+            highRes->setValue(value);
+        }
+        else
+        {
+            highRes->setValue14(static_cast<uint16_t>((previous & ~0x7F) | value));
+        }
+        if (highRes->getValue14() == previous)
+        {
+            return nullptr;
+        }
+    }
+
+    return &entry.binding;
+}
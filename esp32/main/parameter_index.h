@@ -0,0 +1,94 @@
+#ifndef PARAMETER_INDEX_H
+#define PARAMETER_INDEX_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <vector>
+#include "midi_model.h"
+
+/**
+ * @brief Maps inbound channel messages onto the parameters of a page
+ *
+ * The (channel, controller) and channel → parameter tables are filled once
+ * by build(), so applying a received Control Change or Program Change is a
+ * table lookup instead of a scan of the page. 14-bit CC parameters are bound
+ * on both their MSB and LSB controller. NRPN parameters are not bound.
+ *
+ * The page must outlive the index, and build()/apply() must run on the task
+ * which also adjusts the parameters from the encoder.
+ * This class has no platform dependencies so it can be exercised on a host.
+ */
+class ParameterIndex
+{
+public:
+    /**
+     * @brief Parameter a message was applied to
+     */
+    struct Binding
+    {
+        Parameter* parameter;
+        uint16_t parameterIndex; // Position in the page, e.g. for the storage key
+    };
+
+    ParameterIndex();
+
+    /**
+     * @brief Rebuild the tables from a page
+     *
+     * If several parameters use the same controller (or Program Change
+     * channel), the first one in the page gets the inbound updates.
+     * @return Number of parameters which could not be bound because of this
+     */
+    size_t build(Page& page);
+
+    /**
+     * @brief Forget all bindings
+     */
+    void clear();
+
+    /**
+     * @brief Update the parameter bound to a channel message
+     * @param status Status byte, only Control Change and Program Change are handled
+     * @return The updated binding, nullptr if the message isn't bound or didn't change the value
+     */
+    const Binding* apply(uint8_t status, uint8_t data1, uint8_t data2);
+
+    /**
+     * @brief Parameter bound to a controller, nullptr if none
+     */
+    const Binding* findControlChange(uint8_t channel, uint8_t ccNumber) const;
+
+    /**
+     * @brief Program Change parameter of a channel, nullptr if none
+     */
+    const Binding* findProgramChange(uint8_t channel) const;
+
+    size_t getBindingCount() const { return entries_.size(); }
+
+private:
+    static constexpr size_t NUM_CHANNELS = 16;
+    static constexpr size_t NUM_CONTROLLERS = 128;
+    static constexpr uint8_t NO_ENTRY = 0xFF;
+
+    enum class Role : uint8_t
+    {
+        VALUE,      // 7-bit CC or Program Change
+        MSB_14BIT,  // Coarse controller of a 14-bit CC
+        LSB_14BIT   // Fine controller of a 14-bit CC
+    };
+
+    struct Entry
+    {
+        Binding binding;
+        Role role;
+    };
+
+    bool bind(uint8_t* slot, Parameter* parameter, uint16_t parameterIndex, Role role);
+
+    // Entry numbers, NO_ENTRY if unbound. Bytes keep the tables at 2 KB.
+    uint8_t controlChangeSlots_[NUM_CHANNELS][NUM_CONTROLLERS];
+    uint8_t programChangeSlots_[NUM_CHANNELS];
+    std::vector<Entry> entries_;
+};
+
+#endif // PARAMETER_INDEX_H
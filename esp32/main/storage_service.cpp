@@ -1,21 +1,36 @@
 #include "storage_service.h"
 #include "midi_model.h"
+#include "task_config.h"
 #include "esp_log.h"
 #include <sstream>
 
 static const char* TAG = "StorageService";
 
 StorageService::StorageService()
-    : nvsHandle_(0), initialized_(false)
+    : nvsHandle_(0), initialized_(false), pendingMutex_(nullptr), flushTimer_(nullptr), flushTask_(nullptr)
 {
 }
 
 StorageService::~StorageService()
 {
+    if (flushTimer_)
+    {
+        esp_timer_stop(flushTimer_);
+        esp_timer_delete(flushTimer_);
+    }
+    if (flushTask_)
+    {
+        vTaskDelete(flushTask_);
+    }
     if (initialized_)
     {
+        flush();
         nvs_close(nvsHandle_);
     }
+    if (pendingMutex_)
+    {
+        vSemaphoreDelete(pendingMutex_);
+    }
 }
 
 esp_err_t StorageService::init()
@@ -44,6 +59,30 @@ esp_err_t StorageService::init()
         return ret;
     }
 
+    // Deferred writes
+    pendingMutex_ = xSemaphoreCreateMutex();
+    if (!pendingMutex_)
+    {
+        ESP_LOGE(TAG, "Failed to create pending values mutex");
+        return ESP_ERR_NO_MEM;
+    }
+
+    if (createAppTask(AppTask::STORAGE, flushTask, this, &flushTask_) != pdPASS)
+    {
+        return ESP_ERR_NO_MEM;
+    }
+
+    esp_timer_create_args_t timerArgs = {};
+    timerArgs.callback = &flushTimerCb;
+    timerArgs.arg = this;
+    timerArgs.name = "storage_flush";
+    ret = esp_timer_create(&timerArgs, &flushTimer_);
+    if (ret != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Failed to create flush timer: %s", esp_err_to_name(ret));
+        return ret;
+    }
+
     initialized_ = true;
     ESP_LOGI(TAG, "Storage service initialized successfully");
     return ESP_OK;
@@ -76,6 +115,82 @@ esp_err_t StorageService::saveParameterValue(const std::string& key, uint8_t val
     return ESP_OK;
 }
 
+esp_err_t StorageService::saveParameterValueDeferred(const std::string& key, uint8_t value)
+{
+    if (!initialized_)
+    {
+        ESP_LOGE(TAG, "Storage service not initialized");
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    xSemaphoreTake(pendingMutex_, portMAX_DELAY);
+    pending_[key] = value;
+    xSemaphoreGive(pendingMutex_);
+
+    // Restart the quiet period
+    esp_timer_stop(flushTimer_);
+    return esp_timer_start_once(flushTimer_, FLUSH_DELAY_MS * 1000ULL);
+}
+
+esp_err_t StorageService::flush()
+{
+    if (!initialized_)
+    {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    std::map<std::string, uint8_t> values;
+    xSemaphoreTake(pendingMutex_, portMAX_DELAY);
+    values.swap(pending_);
+    xSemaphoreGive(pendingMutex_);
+
+    if (values.empty())
+    {
+        return ESP_OK;
+    }
+
+    esp_err_t result = ESP_OK;
+    for (const auto& entry : values)
+    {
+        esp_err_t ret = nvs_set_u8(nvsHandle_, entry.first.c_str(), entry.second);
+        if (ret != ESP_OK)
+        {
+            ESP_LOGE(TAG, "Failed to save parameter %s: %s", entry.first.c_str(), esp_err_to_name(ret));
+            result = ret;
+        }
+    }
+
+    esp_err_t ret = nvs_commit(nvsHandle_);
+    if (ret != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Failed to commit NVS changes: %s", esp_err_to_name(ret));
+        result = ret;
+    }
+
+    ESP_LOGD(TAG, "Flushed %d parameter values", values.size());
+    if (flushCallback_)
+    {
+        flushCallback_(result);
+    }
+    return result;
+}
+
+// Runs on the esp_timer task, the write is left to flushTask
+void StorageService::flushTimerCb(void* arg)
+{
+    xTaskNotifyGive(static_cast<StorageService*>(arg)->flushTask_);
+}
+
+void StorageService::flushTask(void* arg)
+{
+    StorageService* self = static_cast<StorageService*>(arg);
+    while (1)
+    {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        self->flush();
+    }
+}
+
 uint8_t StorageService::loadParameterValue(const std::string& key, uint8_t defaultValue)
 {
     if (!initialized_)
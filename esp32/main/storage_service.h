@@ -4,8 +4,14 @@
 #include "esp_err.h"
 #include "nvs_flash.h"
 #include "nvs.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
 #include <string>
 #include <memory>
+#include <map>
+#include <functional>
 
 class Parameter;
 class Page;
@@ -33,6 +39,31 @@ public:
      */
     esp_err_t saveParameterValue(const std::string& key, uint8_t value);
 
+    /**
+     * @brief Queue a parameter value and write it once the value has settled
+     *
+     * Repeated saves of the same key within FLUSH_DELAY_MS are coalesced, so a
+     * fast encoder spin costs a single NVS write. The timer only wakes the
+     * low-priority storage task, which does the write: a flash commit must not
+     * hold up the esp_timer task, which also samples the knob.
+     * @param key Unique key for the parameter
+     * @param value The value to save (0-127)
+     * @return ESP_OK if queued
+     */
+    esp_err_t saveParameterValueDeferred(const std::string& key, uint8_t value);
+
+    /**
+     * @brief Write all queued values now
+     * @return ESP_OK on success
+     */
+    esp_err_t flush();
+
+    /**
+     * @brief Register a handler called after every flush of queued values
+     * @param callback Called with the flush result from the flushing task
+     */
+    void setFlushCallback(std::function<void(esp_err_t result)> callback) { flushCallback_ = callback; }
+
     /**
      * @brief Load a parameter value from NVS
      * @param key Unique key for the parameter
@@ -64,10 +95,21 @@ public:
     esp_err_t clearAll();
 
 private:
+    static void flushTimerCb(void* arg);
+    static void flushTask(void* arg);
+
     nvs_handle_t nvsHandle_;
     bool initialized_;
 
+    // Values queued by saveParameterValueDeferred(), guarded by pendingMutex_
+    std::map<std::string, uint8_t> pending_;
+    SemaphoreHandle_t pendingMutex_;
+    esp_timer_handle_t flushTimer_;
+    TaskHandle_t flushTask_;
+    std::function<void(esp_err_t)> flushCallback_;
+
     static constexpr const char* NVS_NAMESPACE = "midi_storage";
+    static constexpr uint32_t FLUSH_DELAY_MS = 1000;
 };
 
 #endif // STORAGE_SERVICE_H
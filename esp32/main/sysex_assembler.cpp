@@ -0,0 +1,127 @@
+#include "sysex_assembler.h"
+#include <string.h>
+
+int32_t SysexAssembler::addConsumer(SysexDelivery delivery, Callback callback)
+{
+    size_t count = consumerCount_.load(std::memory_order_relaxed);
+    if (count >= MAX_CONSUMERS)
+    {
+        return -1;
+    }
+
+    consumers_[count] = {delivery, callback};
+    // Published after it's complete, receive() may be running
+    consumerCount_.store(count + 1, std::memory_order_release);
+    return 0;
+}
+
+void SysexAssembler::deliver(SysexDelivery delivery, const uint8_t* data, size_t length, size_t offset, SysexEvent event)
+{
+    size_t count = consumerCount_.load(std::memory_order_acquire);
+    for (size_t i = 0; i < count; i++)
+    {
+        if (consumers_[i].delivery == delivery && consumers_[i].callback)
+        {
+            consumers_[i].callback(data, length, offset, event);
+        }
+    }
+}
+
+void SysexAssembler::abort(uint32_t& counter)
+{
+    counter++;
+    receiving_ = false;
+    stats_.arenaUsed = 0;
+    deliver(SysexDelivery::STREAMING, nullptr, 0, length_, SysexEvent::ABORTED);
+}
+
+void SysexAssembler::checkTimeout(uint32_t nowMs)
+{
+    if (receiving_ && (nowMs - lastFragmentMs_) > timeoutMs_)
+    {
+        abort(stats_.droppedTimeout);
+    }
+}
+
+void SysexAssembler::receive(uint8_t status, const uint8_t* data, size_t length, size_t continuedPos, uint32_t nowMs)
+{
+    checkTimeout(nowMs);
+
+    if (status >= 0xF8)
+    {
+        return; // Realtime messages may appear anywhere in a SysEx
+    }
+
+    if (status == 0xF0)
+    {
+        if (continuedPos == 0)
+        {
+            if (receiving_)
+            {
+                abort(stats_.droppedIncomplete); // F7 never arrived
+            }
+            receiving_ = true;
+            overflow_ = false;
+            length_ = 0;
+        }
+        else if (!receiving_ || continuedPos != length_)
+        {
+            if (receiving_)
+            {
+                abort(stats_.droppedIncomplete); // A packet was lost
+            }
+            return; // Rest of a dropped message, or its start was missed
+        }
+
+        lastFragmentMs_ = nowMs;
+        if (length == 0)
+        {
+            return;
+        }
+
+        if (!overflow_)
+        {
+            if (length_ + length > ARENA_SIZE)
+            {
+                overflow_ = true;
+            }
+            else
+            {
+                memcpy(&arena_[length_], data, length);
+                stats_.arenaUsed = length_ + length;
+                if (stats_.arenaUsed > stats_.arenaPeak)
+                {
+                    stats_.arenaPeak = stats_.arenaUsed;
+                }
+            }
+        }
+
+        deliver(SysexDelivery::STREAMING, data, length, length_, SysexEvent::DATA);
+        length_ += length;
+        return;
+    }
+
+    if (!receiving_)
+    {
+        return;
+    }
+
+    if (status != 0xF7)
+    {
+        abort(stats_.droppedIncomplete); // Any other status byte ends a SysEx without F7
+        return;
+    }
+
+    receiving_ = false;
+    stats_.completed++;
+    deliver(SysexDelivery::STREAMING, nullptr, 0, length_, SysexEvent::END);
+    if (overflow_)
+    {
+        stats_.droppedOverflow++;
+    }
+    else
+    {
+        deliver(SysexDelivery::WHOLE_MESSAGE, arena_, length_, 0, SysexEvent::END);
+    }
+    stats_.arenaUsed = 0;
+}
@@ -0,0 +1,117 @@
+#ifndef SYSEX_ASSEMBLER_H
+#define SYSEX_ASSEMBLER_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <atomic>
+#include <functional>
+
+/**
+ * @brief How a SysEx consumer gets its data
+ */
+enum class SysexDelivery : uint8_t
+{
+    STREAMING,    // Every fragment as it arrives, no size limit
+    WHOLE_MESSAGE // The complete message once, from the arena
+};
+
+/**
+ * @brief What a SysEx consumer callback is told
+ */
+enum class SysexEvent : uint8_t
+{
+    DATA,   // Fragment of a message which continues (STREAMING only)
+    END,    // The message is complete
+    ABORTED // The message was dropped, the fragments so far are invalid (STREAMING only)
+};
+
+/**
+ * @brief Stitches SysEx fragments received over several packets into messages
+ *
+ * The transport delivers a SysEx stream as F0 fragments with the number of
+ * bytes received before them, followed by an F7. Whole messages are collected
+ * in a fixed arena, so nothing is allocated while receiving; a message which
+ * doesn't fit is dropped for whole-message consumers only. A message is
+ * dropped for everyone if a fragment is missing, another status byte
+ * interrupts it, or no fragment arrived within the timeout. The timeout is
+ * checked whenever something is received; if the stream just stops, the
+ * receiving task calls checkTimeout() periodically while isReceiving().
+ *
+ * Data passed to consumers doesn't include the F0 and F7 bytes.
+ * receive() must always be called from the same task; consumers can be added
+ * while receiving. This class has no platform dependencies so it can be
+ * exercised on a host.
+ */
+class SysexAssembler
+{
+public:
+    static constexpr size_t ARENA_SIZE = 1024;
+    static constexpr size_t MAX_CONSUMERS = 4;
+    static constexpr uint32_t DEFAULT_TIMEOUT_MS = 1000;
+
+    /**
+     * @param data Fragment (STREAMING) or whole message (WHOLE_MESSAGE), empty for END and ABORTED of a stream
+     * @param offset Position of data in the message, 0 for whole messages
+     */
+    using Callback = std::function<void(const uint8_t* data, size_t length, size_t offset, SysexEvent event)>;
+
+    /**
+     * @brief Counters, written by the receiving task only
+     */
+    struct Stats
+    {
+        uint32_t completed = 0;         // Messages terminated by F7
+        uint32_t droppedOverflow = 0;   // Larger than the arena, not delivered to whole-message consumers
+        uint32_t droppedTimeout = 0;    // No fragment within the timeout
+        uint32_t droppedIncomplete = 0; // Fragment missing, or interrupted by another message
+        uint32_t arenaUsed = 0;         // Bytes of the message being collected
+        uint32_t arenaPeak = 0;         // Most bytes ever used
+    };
+
+    SysexAssembler() = default;
+
+    /**
+     * @brief Register a consumer
+     * @return 0 on success, -1 if MAX_CONSUMERS are registered already
+     */
+    int32_t addConsumer(SysexDelivery delivery, Callback callback);
+
+    /**
+     * @brief Feed a received message
+     * @param status Status byte, F0 fragments and the F7 are collected, other non-realtime messages abort a SysEx
+     * @param continuedPos SysEx bytes received before this fragment (F0 only)
+     * @param nowMs Monotonic time in milliseconds
+     */
+    void receive(uint8_t status, const uint8_t* data, size_t length, size_t continuedPos, uint32_t nowMs);
+
+    /**
+     * @brief Drop the message being collected if its last fragment is older than the timeout
+     */
+    void checkTimeout(uint32_t nowMs);
+
+    void setTimeout(uint32_t timeoutMs) { timeoutMs_ = timeoutMs; }
+    bool isReceiving() const { return receiving_; }
+    const Stats& getStats() const { return stats_; }
+
+private:
+    struct Consumer
+    {
+        SysexDelivery delivery;
+        Callback callback;
+    };
+
+    void deliver(SysexDelivery delivery, const uint8_t* data, size_t length, size_t offset, SysexEvent event);
+    void abort(uint32_t& counter);
+
+    Consumer consumers_[MAX_CONSUMERS];
+    std::atomic<size_t> consumerCount_{0};
+    uint8_t arena_[ARENA_SIZE];
+    size_t length_ = 0;           // Bytes received of the current message
+    bool receiving_ = false;
+    bool overflow_ = false;
+    uint32_t lastFragmentMs_ = 0;
+    uint32_t timeoutMs_ = DEFAULT_TIMEOUT_MS;
+    Stats stats_;
+};
+
+#endif // SYSEX_ASSEMBLER_H
@@ -0,0 +1,151 @@
+#include "task_config.h"
+#include "user_config.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include <algorithm>
+#include <cmath>
+
+static const char* TAG = "TaskConfig";
+
+// Central task table, indexed by AppTask
+static const TaskConfig taskConfigs[] = {
+    // name         stack                          priority                       core
+    {"main",        CONFIG_ESP_MAIN_TASK_STACK_SIZE, 1,                            TASK_CORE_RADIO},
+    {"midi_flush",  4096,                          5,                             TASK_CORE_RADIO},
+    {"LVGL",        EXAMPLE_LVGL_TASK_STACK_SIZE,  EXAMPLE_LVGL_TASK_PRIORITY,    TASK_CORE_RENDER},
+    {"Touch",       EXAMPLE_TOUCH_TASK_STACK_SIZE, EXAMPLE_TOUCH_TASK_PRIORITY,   TASK_CORE_RENDER},
+    {"knob_pcnt",   3072,                          10,                            TASK_CORE_RADIO},
+    {"storage",     3072,                          1,                             TASK_CORE_RENDER},
+};
+
+static_assert(sizeof(taskConfigs) / sizeof(taskConfigs[0]) == static_cast<size_t>(AppTask::COUNT),
+    "task table must have one entry per AppTask");
+
+const TaskConfig& getTaskConfig(AppTask task)
+{
+    return taskConfigs[static_cast<size_t>(task)];
+}
+
+BaseType_t createAppTask(AppTask task, TaskFunction_t function, void* arg, TaskHandle_t* handle)
+{
+    const TaskConfig& config = getTaskConfig(task);
+#if TASK_PINNING_ENABLED
+    BaseType_t core = config.core;
+#else
+    BaseType_t core = tskNO_AFFINITY;
+#endif
+
+    BaseType_t ret = xTaskCreatePinnedToCore(function, config.name, config.stackSize, arg,
+        config.priority, handle, core);
+    if (ret != pdPASS)
+    {
+        ESP_LOGE(TAG, "Failed to create task %s", config.name);
+    }
+    else
+    {
+        ESP_LOGI(TAG, "Task %s: priority %d, core %d", config.name, config.priority, core);
+    }
+    return ret;
+}
+
+void checkTaskPlacement(AppTask task)
+{
+#if TASK_PINNING_ENABLED
+    const TaskConfig& config = getTaskConfig(task);
+    if (xPortGetCoreID() != config.core)
+    {
+        ESP_LOGW(TAG, "Task %s runs on core %d, the task table expects core %d",
+            config.name, xPortGetCoreID(), config.core);
+    }
+#endif
+}
+
+JitterStats::JitterStats()
+    : lock_(portMUX_INITIALIZER_UNLOCKED)
+{
+    reset();
+}
+
+void JitterStats::reset()
+{
+    count_ = 0;
+    sum_ = 0;
+    sumSquares_ = 0;
+    min_ = INT64_MAX;
+    max_ = INT64_MIN;
+}
+
+void JitterStats::addSample(int64_t valueUs)
+{
+    uint64_t square = static_cast<uint64_t>(valueUs * valueUs);
+    portENTER_CRITICAL(&lock_);
+    count_++;
+    sum_ += valueUs;
+    sumSquares_ += square;
+    if (valueUs < min_)
+    {
+        min_ = valueUs;
+    }
+    if (valueUs > max_)
+    {
+        max_ = valueUs;
+    }
+    portEXIT_CRITICAL(&lock_);
+}
+
+void JitterStats::report(const char* label)
+{
+    portENTER_CRITICAL(&lock_);
+    uint32_t count = count_;
+    int64_t sum = sum_;
+    uint64_t sumSquares = sumSquares_;
+    int64_t min = min_;
+    int64_t max = max_;
+    reset();
+    portEXIT_CRITICAL(&lock_);
+
+    if (count == 0)
+    {
+        ESP_LOGI(TAG, "%s: no samples", label);
+        return;
+    }
+    double mean = static_cast<double>(sum) / count;
+    double variance = 0.0;
+    if (count > 1)
+    {
+        variance = std::max(0.0, (static_cast<double>(sumSquares) - mean * sum) / (count - 1));
+    }
+    ESP_LOGI(TAG, "%s [pinning %s]: n=%u mean=%.1fus stddev=%.1fus min=%lldus max=%lldus",
+        label, TASK_PINNING_ENABLED ? "on" : "off", count, mean, std::sqrt(variance), min, max);
+}
+
+#if TASK_JITTER_BENCH
+JitterStats midiFlushLatenessStats;
+JitterStats lvglRenderTimeStats;
+
+static void taskJitterReport(void* arg)
+{
+    midiFlushLatenessStats.report("MIDI flush lateness");
+    lvglRenderTimeStats.report("LVGL render time");
+}
+
+esp_err_t startTaskJitterReport()
+{
+    // A timer of its own, so idle periods report too
+    esp_timer_create_args_t timerArgs = {};
+    timerArgs.callback = &taskJitterReport;
+    timerArgs.name = "jitter_report";
+    timerArgs.skip_unhandled_events = true;
+    esp_timer_handle_t timer = nullptr;
+    esp_err_t ret = esp_timer_create(&timerArgs, &timer);
+    if (ret == ESP_OK)
+    {
+        ret = esp_timer_start_periodic(timer, TASK_JITTER_REPORT_MS * 1000ULL);
+    }
+    if (ret != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Failed to start the jitter report: %s", esp_err_to_name(ret));
+    }
+    return ret;
+}
+#endif
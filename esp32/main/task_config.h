@@ -0,0 +1,117 @@
+#ifndef TASK_CONFIG_H
+#define TASK_CONFIG_H
+
+#include <stdint.h>
+#include "esp_err.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+/**
+ * @brief Pin application tasks to their cores (0: let the scheduler pick any core)
+ *
+ * Building once with and once without pinning and comparing the jitter bench
+ * reports shows what the pinning buys.
+ */
+#ifndef TASK_PINNING_ENABLED
+#define TASK_PINNING_ENABLED 1
+#endif
+
+/**
+ * @brief Periodically log how late MIDI flushes run and the LVGL render time
+ */
+#ifndef TASK_JITTER_BENCH
+#define TASK_JITTER_BENCH 0
+#endif
+
+#ifndef TASK_JITTER_REPORT_MS
+#define TASK_JITTER_REPORT_MS 5000
+#endif
+
+// Bluedroid, the BT controller, esp_timer (knob sampling) and app_main run on
+// core 0 (sdkconfig), so the MIDI path stays there and rendering gets core 1.
+#define TASK_CORE_RADIO 0
+#define TASK_CORE_RENDER 1
+
+/**
+ * @brief Application tasks with an entry in the task table
+ */
+enum class AppTask
+{
+    MAIN,       // app_main event dispatcher (created by ESP-IDF)
+    MIDI_FLUSH, // BLE MIDI output buffer flush
+    LVGL,       // lv_timer_handler loop
+    TOUCH,      // Touch controller reads
+    KNOB_PCNT,  // Knob event dispatch of the PCNT backend (KNOB_USE_PCNT)
+    STORAGE,    // Deferred NVS writes, off the esp_timer task
+    COUNT
+};
+
+/**
+ * @brief Placement of one task
+ */
+struct TaskConfig
+{
+    const char* name;
+    uint32_t stackSize;
+    UBaseType_t priority;
+    BaseType_t core;
+};
+
+/**
+ * @brief Look up the configuration of a task
+ */
+const TaskConfig& getTaskConfig(AppTask task);
+
+/**
+ * @brief Create a task with the stack, priority and core from the task table
+ * @return pdPASS on success
+ */
+BaseType_t createAppTask(AppTask task, TaskFunction_t function, void* arg, TaskHandle_t* handle = nullptr);
+
+/**
+ * @brief Warn if the calling task does not run where the table places it
+ *
+ * Used for tasks which are created by ESP-IDF (app_main), whose core is set in sdkconfig.
+ */
+void checkTaskPlacement(AppTask task);
+
+/**
+ * @brief Running statistics of a periodic measurement
+ *
+ * Samples only add up integer sums under the lock, the mean and the
+ * standard deviation are computed when reporting.
+ */
+class JitterStats
+{
+public:
+    JitterStats();
+
+    void addSample(int64_t valueUs);
+    void reset();
+
+    /**
+     * @brief Log count, mean, standard deviation, min and max, then reset
+     */
+    void report(const char* label);
+
+private:
+    portMUX_TYPE lock_;
+    uint32_t count_;
+    int64_t sum_;
+    uint64_t sumSquares_;
+    int64_t min_;
+    int64_t max_;
+};
+
+#if TASK_JITTER_BENCH
+extern JitterStats midiFlushLatenessStats;
+extern JitterStats lvglRenderTimeStats;
+
+/**
+ * @brief Start a timer which logs both benchmarks every TASK_JITTER_REPORT_MS
+ * @return ESP_OK on success
+ */
+esp_err_t startTaskJitterReport();
+#endif
+
+#endif // TASK_CONFIG_H
@@ -0,0 +1,218 @@
+#include "tempo_clock.h"
+
+// Tick interval of a tempo in microseconds
+static float tickIntervalUs(float bpm)
+{
+    return 60000000.0f / (bpm * TempoClock::TICKS_PER_BEAT);
+}
+
+// Interpolation stops short of the next tick, so a late tick doesn't make the position jump back
+static constexpr float MAX_FRACTION = 0.999f;
+
+// External ticks averaged before the loop takes over, one beat
+static constexpr uint8_t ACQUIRE_TICKS = TempoClock::TICKS_PER_BEAT;
+
+// Share of a tick's timing error applied to the phase and to the interval.
+// Small enough to average out the BLE connection interval, large enough to follow tempo changes within a few beats.
+static constexpr float PHASE_GAIN = 0.125f;
+static constexpr float FREQUENCY_GAIN = 1.0f / 128.0f;
+
+static bool isBefore(const TempoPosition& a, const TempoPosition& b)
+{
+    return a.ticks < b.ticks || (a.ticks == b.ticks && a.fraction < b.fraction);
+}
+
+TempoClock::TempoClock()
+    : ticks_(0),
+      anchorUs_(0),
+      intervalUs_(tickIntervalUs(DEFAULT_TEMPO_BPM)),
+      internalIntervalUs_(intervalUs_),
+      lastExternalUs_(0),
+      acquireUs_(0),
+      lockTicks_(0),
+      stopped_(false),
+      startPending_(false),
+      lastPosition_{0, 0.0f}
+{
+}
+
+void TempoClock::setInternalTempo(float bpm)
+{
+    if (bpm < MIN_TEMPO_BPM)
+    {
+        bpm = MIN_TEMPO_BPM;
+    }
+    else if (bpm > MAX_TEMPO_BPM)
+    {
+        bpm = MAX_TEMPO_BPM;
+    }
+
+    internalIntervalUs_ = tickIntervalUs(bpm);
+    if (lockTicks_ == 0)
+    {
+        intervalUs_ = internalIntervalUs_;
+    }
+}
+
+float TempoClock::getInternalTempo() const
+{
+    return 60000000.0f / (internalIntervalUs_ * TICKS_PER_BEAT);
+}
+
+float TempoClock::getTempo() const
+{
+    return 60000000.0f / (intervalUs_ * TICKS_PER_BEAT);
+}
+
+bool TempoClock::isExternal(int64_t nowUs) const
+{
+    return lockTicks_ > 0 && (nowUs - lastExternalUs_) < EXTERNAL_TIMEOUT_US;
+}
+
+bool TempoClock::isRunning(int64_t nowUs) const
+{
+    if (startPending_ && (nowUs - lastExternalUs_) < EXTERNAL_TIMEOUT_US)
+    {
+        return false;
+    }
+    return !isExternal(nowUs) || !stopped_;
+}
+
+void TempoClock::receiveRealtime(uint8_t status, int64_t nowUs)
+{
+    advance(nowUs);
+
+    switch (status)
+    {
+    case 0xF8: // Clock
+        clockTick(nowUs);
+        break;
+
+    case 0xFA: // Start: the next clock tick is position 0
+        lastExternalUs_ = nowUs;
+        startPending_ = true;
+        stopped_ = false;
+        ticks_ = 0;
+        lastPosition_ = {0, 0.0f};
+        break;
+
+    case 0xFB: // Continue from the current position
+        stopped_ = false;
+        break;
+
+    case 0xFC: // Stop
+        stopped_ = true;
+        break;
+
+    default:
+        break;
+    }
+}
+
+void TempoClock::clockTick(int64_t nowUs)
+{
+    lastExternalUs_ = nowUs;
+
+    if (lockTicks_ == 0)
+    {
+        // Clock (re)appeared: continue at the next whole tick, the tempo follows once known
+        ticks_ = startPending_ ? 0 : lastPosition_.ticks + (lastPosition_.fraction > 0.0f ? 1 : 0);
+        anchorUs_ = nowUs;
+        acquireUs_ = nowUs;
+        lockTicks_ = 1;
+        startPending_ = false;
+        return;
+    }
+
+    // Tempo and phase of the tick stream, also followed while stopped
+    if (lockTicks_ < ACQUIRE_TICKS)
+    {
+        // Average interval since the clock appeared
+        intervalUs_ = static_cast<float>(nowUs - acquireUs_) / lockTicks_;
+        anchorUs_ = nowUs;
+        lockTicks_++;
+    }
+    else
+    {
+        float errorUs = static_cast<float>(nowUs - anchorUs_) - intervalUs_; // > 0: the tick came late
+        if (errorUs > intervalUs_)
+        {
+            errorUs = intervalUs_;
+        }
+        else if (errorUs < -intervalUs_)
+        {
+            errorUs = -intervalUs_;
+        }
+        anchorUs_ = nowUs - static_cast<int64_t>(errorUs * (1.0f - PHASE_GAIN));
+        intervalUs_ += errorUs * FREQUENCY_GAIN;
+    }
+
+    float minIntervalUs = tickIntervalUs(MAX_TEMPO_BPM);
+    float maxIntervalUs = tickIntervalUs(MIN_TEMPO_BPM);
+    if (intervalUs_ < minIntervalUs)
+    {
+        intervalUs_ = minIntervalUs;
+    }
+    else if (intervalUs_ > maxIntervalUs)
+    {
+        intervalUs_ = maxIntervalUs;
+    }
+
+    // Song position
+    if (stopped_)
+    {
+        return;
+    }
+    if (startPending_)
+    {
+        startPending_ = false; // This tick is position 0
+        return;
+    }
+    ticks_++;
+}
+
+void TempoClock::advance(int64_t nowUs)
+{
+    if (lockTicks_ > 0 && !isExternal(nowUs))
+    {
+        // External clock went away: freewheel at the internal tempo
+        lockTicks_ = 0;
+        stopped_ = false;
+        startPending_ = false;
+        intervalUs_ = internalIntervalUs_;
+    }
+
+    if (lockTicks_ == 0 && nowUs > anchorUs_)
+    {
+        int64_t elapsed = static_cast<int64_t>(static_cast<float>(nowUs - anchorUs_) / intervalUs_);
+        ticks_ += static_cast<uint32_t>(elapsed);
+        anchorUs_ += static_cast<int64_t>(elapsed * intervalUs_);
+    }
+}
+
+TempoPosition TempoClock::getPosition(int64_t nowUs)
+{
+    advance(nowUs);
+    if (!isRunning(nowUs))
+    {
+        return lastPosition_;
+    }
+
+    float fraction = static_cast<float>(nowUs - anchorUs_) / intervalUs_;
+    if (fraction < 0.0f)
+    {
+        fraction = 0.0f;
+    }
+    else if (fraction > MAX_FRACTION)
+    {
+        fraction = MAX_FRACTION;
+    }
+
+    TempoPosition position = {ticks_, fraction};
+    if (isBefore(position, lastPosition_))
+    {
+        return lastPosition_;
+    }
+    lastPosition_ = position;
+    return position;
+}
@@ -0,0 +1,96 @@
+#ifndef TEMPO_CLOCK_H
+#define TEMPO_CLOCK_H
+
+#include <stdint.h>
+
+/**
+ * @brief Song position in MIDI clock ticks: whole ticks plus the fraction to the next one
+ *
+ * Kept apart so the position doesn't lose precision in long sessions.
+ */
+struct TempoPosition
+{
+    uint32_t ticks;
+    float fraction; // 0 to < 1
+};
+
+/**
+ * @brief Musical time base for tempo-synced modulation
+ *
+ * Follows incoming MIDI clock (0xF8, 24 ticks per quarter note) and Start,
+ * Continue and Stop. Ticks arrive with the jitter of the BLE connection
+ * interval, so they steer a phase-locked loop instead of being used as is:
+ * each tick corrects the predicted tick time and the tick interval by a
+ * fraction of the error. Between ticks the position is interpolated, but
+ * never beyond the next expected tick, and it never goes back.
+ *
+ * Without external clock for EXTERNAL_TIMEOUT_US the internal tempo takes
+ * over from the current position, so modulation keeps running when the
+ * DAW goes away.
+ *
+ * All times are monotonic microseconds (esp_timer_get_time() on the device).
+ * Must be used from one task only. This class has no platform dependencies
+ * so it can be exercised on a host with a simulated clock source.
+ */
+class TempoClock
+{
+public:
+    static constexpr uint32_t TICKS_PER_BEAT = 24;
+    static constexpr float DEFAULT_TEMPO_BPM = 120.0f;
+    static constexpr float MIN_TEMPO_BPM = 20.0f;
+    static constexpr float MAX_TEMPO_BPM = 300.0f;
+    static constexpr int64_t EXTERNAL_TIMEOUT_US = 500000;
+
+    TempoClock();
+
+    /**
+     * @brief Handle a received realtime message (0xF8 Clock, 0xFA Start, 0xFB Continue, 0xFC Stop)
+     * @param nowUs Time the message arrived
+     */
+    void receiveRealtime(uint8_t status, int64_t nowUs);
+
+    /**
+     * @brief Position at a given time, at least the position returned before
+     */
+    TempoPosition getPosition(int64_t nowUs);
+
+    /**
+     * @brief Tempo used while no external clock is received (clipped to MIN/MAX_TEMPO_BPM)
+     */
+    void setInternalTempo(float bpm);
+    float getInternalTempo() const;
+
+    /**
+     * @brief Current tempo, the estimate of the external clock while it's received
+     */
+    float getTempo() const;
+
+    /**
+     * @brief True while MIDI clock is received
+     */
+    bool isExternal(int64_t nowUs) const;
+
+    /**
+     * @brief False after an external Stop until Continue, and from Start until its first tick
+     *
+     * The position holds meanwhile. When the external clock goes away it runs again.
+     */
+    bool isRunning(int64_t nowUs) const;
+
+private:
+    void advance(int64_t nowUs);
+    void clockTick(int64_t nowUs);
+
+    uint32_t ticks_;            // Whole ticks up to anchorUs_
+    int64_t anchorUs_;          // Time of tick number ticks_ (filtered for external clock)
+    float intervalUs_;          // Tick interval of the running clock
+    float internalIntervalUs_;
+    int64_t lastExternalUs_;    // Arrival of the last external tick
+    int64_t acquireUs_;         // Arrival of the first tick after the external clock (re)appeared
+    uint8_t lockTicks_;         // External ticks since then (up to the acquisition length), 0 while internal
+    bool stopped_;              // External Stop received
+    bool startPending_;         // External Start received, waiting for the first tick
+    TempoPosition lastPosition_;
+};
+
+#endif // TEMPO_CLOCK_H
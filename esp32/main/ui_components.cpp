@@ -248,7 +248,8 @@ void ValueDisplay::updateBluetoothStatus(bool connected)
 // ============================================================================
 
 PageView::PageView(lv_obj_t* parent, std::shared_ptr<Page> page)
-    : page_(page), mode_(UIMode::NAVIGATION)
+    : page_(page), mode_(UIMode::NAVIGATION), refreshPending_(false),
+    bluetoothStatus_(BT_STATUS_UNKNOWN), shownBluetoothStatus_(BT_STATUS_UNKNOWN)
 {
     // Create main container - full screen
     container_ = lv_obj_create(parent);
@@ -266,10 +267,18 @@ PageView::PageView(lv_obj_t* parent, std::shared_ptr<Page> page)
 
     // Initial update
     updateDisplay();
+
+    // Model changes from other tasks are picked up once per display refresh period
+    refreshTimer_ = lv_timer_create(refreshTimerCb, LV_DEF_REFR_PERIOD, this);
 }
 
 PageView::~PageView()
 {
+    if (refreshTimer_)
+    {
+        lv_timer_delete(refreshTimer_);
+    }
+
     delete valueDisplay_;
 
     if (container_)
@@ -283,6 +292,23 @@ void PageView::update()
     updateDisplay();
 }
 
+void PageView::refreshTimerCb(lv_timer_t* timer)
+{
+    PageView* pageView = static_cast<PageView*>(lv_timer_get_user_data(timer));
+
+    if (pageView->refreshPending_.exchange(false, std::memory_order_acquire))
+    {
+        pageView->updateDisplay();
+    }
+
+    int8_t bluetoothStatus = pageView->bluetoothStatus_.load(std::memory_order_relaxed);
+    if (bluetoothStatus != pageView->shownBluetoothStatus_ && bluetoothStatus != BT_STATUS_UNKNOWN)
+    {
+        pageView->valueDisplay_->updateBluetoothStatus(bluetoothStatus == BT_STATUS_CONNECTED);
+        pageView->shownBluetoothStatus_ = bluetoothStatus;
+    }
+}
+
 void PageView::updateDisplay()
 {
     // Gather parameter names and values
@@ -313,7 +339,7 @@ void PageView::updateDisplay()
         currentValue, maxValue, mode_);
 }
 
-void PageView::incrementValue(int8_t delta)
+void PageView::incrementValue(int16_t delta)
 {
     auto param = page_->getSelectedParameter();
     if (!param)
@@ -336,10 +362,15 @@ void PageView::incrementValue(int8_t delta)
             }
         }
     }
+    else if (param->getType() == ParameterType::CC_14BIT || param->getType() == ParameterType::NRPN)
+    {
+        // 14-bit parameters map the steps onto their full range
+        std::static_pointer_cast<HighResParameter>(param)->adjust(delta);
+    }
     else
     {
         // Normal parameter value adjustment
-        int16_t newValue = param->getValue() + delta;
+        int32_t newValue = param->getValue() + delta;
         uint8_t maxValue = param->getMaxValue();
 
         // Clamp to parameter's range
@@ -351,22 +382,23 @@ void PageView::incrementValue(int8_t delta)
         param->setValue(static_cast<uint8_t>(newValue));
     }
 
-    updateDisplay();
+    requestRefresh();
 
-    ESP_LOGI(TAG, "Parameter '%s' value changed to %d",
-        param->getName().c_str(), param->getValue());
+    // On the encoder to MIDI path: compiled out unless debug logging is enabled
+    ESP_LOGD(TAG, "Parameter '%s' value changed to %s",
+        param->getName().c_str(), param->getDisplayValue().c_str());
 }
 
 void PageView::selectNextParameter()
 {
     page_->selectNext();
-    updateDisplay();
+    requestRefresh();
 }
 
 void PageView::selectPreviousParameter()
 {
     page_->selectPrevious();
-    updateDisplay();
+    requestRefresh();
 }
 
 void PageView::toggleMode()
@@ -381,22 +413,23 @@ void PageView::toggleMode()
         mode_ = UIMode::NAVIGATION;
         ESP_LOGI(TAG, "Switched to NAVIGATION mode");
     }
-    updateDisplay();
+    requestRefresh();
 }
 
-void PageView::handleEncoderRotation(int8_t delta)
+void PageView::handleEncoderRotation(int16_t delta)
 {
     if (mode_ == UIMode::NAVIGATION)
     {
-        // Navigate through parameters
-        if (delta > 0)
+        // Navigate through parameters, one step per detent
+        for (int16_t i = 0; i < delta; i++)
         {
-            selectNextParameter();
+            page_->selectNext();
         }
-        else if (delta < 0)
+        for (int16_t i = 0; i > delta; i--)
         {
-            selectPreviousParameter();
+            page_->selectPrevious();
         }
+        requestRefresh();
     }
     else // CONTROL mode
     {
@@ -416,18 +449,25 @@ void PageView::setupTouchCallback()
 
 void PageView::touchEventHandler(lv_event_t* e)
 {
-    ESP_LOGI(TAG, "Touch event detected - toggling mode");
     PageView* pageView = (PageView*) lv_event_get_user_data(e);
-    if (pageView)
+    if (!pageView)
+    {
+        return;
+    }
+
+    if (pageView->gestureHandler_)
     {
+        ESP_LOGD(TAG, "Touch event detected - forwarding tap");
+        pageView->gestureHandler_(TouchGesture::TAP);
+    }
+    else
+    {
+        ESP_LOGI(TAG, "Touch event detected - toggling mode");
         pageView->toggleMode();
     }
 }
 
 void PageView::updateBluetoothStatus(bool connected)
 {
-    if (valueDisplay_)
-    {
-        valueDisplay_->updateBluetoothStatus(connected);
-    }
+    bluetoothStatus_.store(connected ? BT_STATUS_CONNECTED : BT_STATUS_DISCONNECTED, std::memory_order_relaxed);
 }
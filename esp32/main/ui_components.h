@@ -3,8 +3,10 @@
 
 #include "lvgl.h"
 #include "midi_model.h"
+#include "app_events.h"
 #include <memory>
 #include <functional>
+#include <atomic>
 
 /**
  * @brief UI Mode enumeration
@@ -51,6 +53,11 @@ private:
 
 /**
  * @brief Page View - Main UI component managing modes and display
+ *
+ * Construction, destruction and update() must run with the LVGL lock held.
+ * The mode, encoder and Bluetooth methods only touch the model and can be
+ * called from any single task without the lock; the display catches up on
+ * the LVGL task within one refresh period.
  */
 class PageView
 {
@@ -59,15 +66,22 @@ public:
     ~PageView();
 
     void update();
-    void incrementValue(int8_t delta);
+    void requestRefresh() { refreshPending_.store(true, std::memory_order_release); }
+    void incrementValue(int16_t delta);
     void selectNextParameter();
     void selectPreviousParameter();
 
     // Mode management
-    UIMode getMode() const { return mode_; }
+    UIMode getMode() const { return mode_.load(std::memory_order_relaxed); }
     void toggleMode();
     void updateBluetoothStatus(bool connected);
-    void handleEncoderRotation(int8_t delta);
+    void handleEncoderRotation(int16_t delta);
+
+    /**
+     * @brief Forward touch gestures instead of handling them in the LVGL task
+     * @param handler Called from the LVGL task, nullptr restores the built-in handling
+     */
+    void setGestureHandler(std::function<void(TouchGesture)> handler) { gestureHandler_ = handler; }
 
     std::shared_ptr<Page> getPage() { return page_; }
     lv_obj_t* getContainer() { return container_; }
@@ -76,10 +90,20 @@ private:
     void updateDisplay();
     void setupTouchCallback();
     static void touchEventHandler(lv_event_t* e);
+    static void refreshTimerCb(lv_timer_t* timer);
+
+    static constexpr int8_t BT_STATUS_UNKNOWN = -1;
+    static constexpr int8_t BT_STATUS_DISCONNECTED = 0;
+    static constexpr int8_t BT_STATUS_CONNECTED = 1;
 
     lv_obj_t* container_;
     std::shared_ptr<Page> page_;
-    UIMode mode_;
+    std::atomic<UIMode> mode_;
+    std::atomic<bool> refreshPending_;      // Model changed, repaint on the next refresh timer
+    std::atomic<int8_t> bluetoothStatus_;   // Latest BT_STATUS_* reported
+    int8_t shownBluetoothStatus_;           // BT_STATUS_* currently on screen (LVGL task only)
+    lv_timer_t* refreshTimer_;
+    std::function<void(TouchGesture)> gestureHandler_;
 
     ValueDisplay* valueDisplay_;
 };
@@ -33,6 +33,9 @@
 #define EXAMPLE_TOUCH_ADDR 0x15
 #define EXAMPLE_PIN_NUM_TOUCH_RST (gpio_num_t)10
 #define EXAMPLE_PIN_NUM_TOUCH_INT (gpio_num_t)9
+#define EXAMPLE_TOUCH_TASK_STACK_SIZE (3 * 1024)
+#define EXAMPLE_TOUCH_TASK_PRIORITY 3 // Above LVGL so a fresh point is ready for the next read
+#define EXAMPLE_TOUCH_POLL_MS 20      // Re-read period while pressed, detects the release
 
 #define EXAMPLE_LVGL_TICK_PERIOD_MS 2
 #define EXAMPLE_LVGL_TASK_MAX_DELAY_MS 500
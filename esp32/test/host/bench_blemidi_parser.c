@@ -0,0 +1,212 @@
+/*
+ * Throughput bench of the BLE MIDI packet parser, the work done in the GATT
+ * callback for every received packet.
+ *
+ * Streams:
+ *   CC feedback  a DAW echoing 20 CCs per packet with running status
+ *   clock        one F8 per packet, as sent at 24 ppqn
+ *   SysEx        a 184 byte dump over four packets
+ *   mixed        CCs with a clock tick, a note and a program change in between
+ *
+ *   bench_blemidi_parser                 messages per second of every stream
+ *   bench_blemidi_parser --check         short run, verify the message counts (ctest)
+ *   bench_blemidi_parser --packets N     packets parsed per stream
+ *
+ * Build with -DBLEMIDI_ENABLE_RX_TRACE=1 to see the cost of the trace hooks,
+ * they print the packet like the ESP_LOG trace of blemidi.c would.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "blemidi_parser.h"
+
+#define MAX_PACKETS 4
+
+typedef struct
+{
+    const char *name;
+    uint8_t packets[MAX_PACKETS][64];
+    size_t lens[MAX_PACKETS];
+    int num_packets;
+    unsigned long messages_per_round; // Callbacks for all packets of the stream
+} stream_t;
+
+static unsigned long s_messages;
+static volatile uint8_t s_sink;
+
+#if BLEMIDI_ENABLE_RX_TRACE
+static FILE *s_trace;
+
+void blemidi_rx_trace_packet(uint8_t blemidi_port, const uint8_t *stream, size_t len)
+{
+    fprintf(s_trace, "receive_packet blemidi_port=%d, len=%u, stream:\n", blemidi_port, (unsigned)len);
+    for (size_t i = 0; i < len; i++)
+        fprintf(s_trace, "%02x ", stream[i]);
+    fputc('\n', s_trace);
+}
+
+void blemidi_rx_trace_error(uint8_t blemidi_port, int32_t error, size_t pos)
+{
+    fprintf(s_trace, "malformed packet on port %d: error %d at %u\n", blemidi_port, (int)error, (unsigned)pos);
+}
+#endif
+
+static void on_message(uint8_t port, uint16_t timestamp, uint8_t status, uint8_t *data, size_t len, size_t continued_sysex_pos)
+{
+    s_messages++;
+    s_sink ^= status ^ (len > 0 ? data[0] : 0);
+}
+
+static double now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static void add_byte(stream_t *stream, uint8_t b)
+{
+    int p = stream->num_packets - 1;
+    stream->packets[p][stream->lens[p]++] = b;
+}
+
+static void new_packet(stream_t *stream)
+{
+    stream->lens[stream->num_packets++] = 0;
+}
+
+static void init_streams(stream_t *streams)
+{
+    stream_t *s = &streams[0];
+    s->name = "CC feedback (20 CCs/packet)";
+    new_packet(s);
+    add_byte(s, 0x80);
+    add_byte(s, 0x80);
+    add_byte(s, 0xb0);
+    for (int i = 0; i < 20; i++)
+    {
+        add_byte(s, 80 + i);
+        add_byte(s, (i * 7) & 0x7f);
+    }
+    s->messages_per_round = 20;
+
+    s = &streams[1];
+    s->name = "clock (1 F8/packet)";
+    new_packet(s);
+    add_byte(s, 0x80);
+    add_byte(s, 0x81);
+    add_byte(s, 0xf8);
+    s->messages_per_round = 1;
+
+    // F0, 60 + 2 * 62 + 10 data bytes, F7
+    s = &streams[2];
+    s->name = "SysEx (184 bytes over 4 packets)";
+    new_packet(s);
+    add_byte(s, 0x80);
+    add_byte(s, 0x80);
+    add_byte(s, 0xf0);
+    for (int i = 0; i < 60; i++)
+        add_byte(s, i & 0x7f);
+    for (int k = 0; k < 2; k++)
+    {
+        new_packet(s);
+        add_byte(s, 0x80);
+        for (int i = 0; i < 62; i++)
+            add_byte(s, i & 0x7f);
+    }
+    new_packet(s);
+    add_byte(s, 0x80);
+    for (int i = 0; i < 10; i++)
+        add_byte(s, i);
+    add_byte(s, 0x81);
+    add_byte(s, 0xf7);
+    s->messages_per_round = 5; // One chunk per packet, then the F7
+
+    s = &streams[3];
+    s->name = "mixed CC/clock/note/PC";
+    new_packet(s);
+    static const uint8_t mixed[] = {
+        0x80, 0x80, 0xb0, 7, 100, 10, 64,
+        0x81, 0xf8,
+        0x82, 0x90, 60, 100,
+        0x82, 0xc1, 3,
+        0x83, 0xb0, 11, 90,
+    };
+    for (size_t i = 0; i < sizeof(mixed); i++)
+        add_byte(s, mixed[i]);
+    s->messages_per_round = 6;
+}
+
+// Returns 0 if every message arrived and no packet was malformed
+static int run_stream(const stream_t *stream, unsigned long packets, int quiet)
+{
+    blemidi_parser_t parser;
+    blemidi_parser_init(&parser);
+    unsigned long rounds = packets / stream->num_packets;
+    if (rounds == 0)
+        rounds = 1;
+    uint8_t copy[MAX_PACKETS][64];
+    memcpy(copy, stream->packets, sizeof(copy));
+
+    s_messages = 0;
+    double start = now_ns();
+    for (unsigned long r = 0; r < rounds; r++)
+    {
+        for (int p = 0; p < stream->num_packets; p++)
+            blemidi_parse_packet(&parser, 0, copy[p], stream->lens[p], on_message);
+    }
+    double ns = now_ns() - start;
+
+    unsigned long expected = rounds * stream->messages_per_round;
+    if (!quiet)
+    {
+        printf("%-34s %8.2f M msgs/s %7.1f ns/msg %7.1f ns/packet\n", stream->name,
+               s_messages / ns * 1e3, ns / s_messages, ns / (rounds * stream->num_packets));
+    }
+    if (s_messages != expected || parser.num_errors != 0)
+    {
+        printf("%s: %lu messages, expected %lu, %u malformed packets\n",
+               stream->name, s_messages, expected, (unsigned)parser.num_errors);
+        return 1;
+    }
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    unsigned long packets = 20000000;
+    int check = 0;
+    for (int i = 1; i < argc; i++)
+    {
+        if (!strcmp(argv[i], "--check"))
+        {
+            check = 1;
+            packets = 10000;
+        }
+        else if (!strcmp(argv[i], "--packets") && i + 1 < argc)
+        {
+            packets = strtoul(argv[++i], NULL, 10);
+        }
+        else
+        {
+            fprintf(stderr, "unknown option %s\n", argv[i]);
+            return 2;
+        }
+    }
+
+#if BLEMIDI_ENABLE_RX_TRACE
+    s_trace = fopen("/dev/null", "w");
+#endif
+
+    static stream_t streams[4];
+    init_streams(streams);
+    int failures = 0;
+    for (size_t i = 0; i < sizeof(streams) / sizeof(streams[0]); i++)
+        failures += run_stream(&streams[i], packets, check);
+
+    if (check)
+        printf("%s\n", failures ? "FAILED" : "OK");
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,389 @@
+/*
+ * Decoder accuracy bench for the debounce state machine of the polling knob backend.
+ *
+ * The knob is a bidirectional switch: a detent to the right pulls phase A low
+ * for part of the detent, a detent to the left pulls phase B low. The bench
+ * generates these pulses at a given speed with contact bounce on both edges,
+ * timing jitter and optional crosstalk glitches on the idle phase. It samples
+ * them every TICKS_INTERVAL like the knob timer does and feeds the samples
+ * through knob_debounce_update().
+ *
+ * The decoder reports a detent on the release edge, so every generated detent
+ * owns the time from its release to the next release. A detent counts as
+ * missed if nothing was decoded in its window, as extra for each additional
+ * detent in its direction, and as a direction error for each detent decoded
+ * in the opposite direction.
+ *
+ *   bench_knob_debounce                     sweep tick interval, debounce ticks and speed
+ *   bench_knob_debounce --check             verify the defaults of bidi_switch_knob.h (ctest)
+ *   bench_knob_debounce --tick-ms 3 --debounce 2 --rpm 300 --bounce-ms 0.5 --jitter 10
+ *
+ * Further options: --detents-per-rev, --duty (low share of a detent, percent),
+ * --crosstalk-ms (glitch on the idle phase), --detents, --seed.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "bidi_switch_knob.h"
+#include "knob_debounce.h"
+
+#define BOUNCE_CHUNK_MS 0.05 // Contact bounce toggles at most this often
+#define GAP_MS 100.0         // Rest before the first and after the last detent
+
+typedef struct
+{
+    double tick_ms;
+    int debounce_ticks;
+    double rpm;
+    int detents_per_rev;
+    double duty;          // Share of a detent the phase is pulled low (0-1)
+    double bounce_ms;     // Bounce after each edge
+    double jitter;        // Relative spread of detent period and pulse width (0-1)
+    double crosstalk_ms;  // Length of a glitch on the idle phase, 0 = none
+    int detents;
+    unsigned seed;
+} bench_config_t;
+
+typedef struct
+{
+    int detents;
+    int missed;
+    int extra;
+    int wrong_direction;
+    double ns_per_tick;
+    double wakeups_per_s;
+} bench_result_t;
+
+typedef struct
+{
+    double start_ms;
+    double end_ms;        // Release edge
+    double window_end_ms; // Start of the next detent
+    int direction;        // +1 = right (phase A), -1 = left (phase B)
+    double glitch_ms;     // Start of the crosstalk glitch on the other phase, < 0 = none
+} pulse_t;
+
+static unsigned s_rand_state;
+
+static double random_unit(void)
+{
+    s_rand_state = s_rand_state * 1664525u + 1013904223u;
+    return (s_rand_state >> 8) / 16777216.0;
+}
+
+static unsigned hash(unsigned x)
+{
+    x ^= x >> 16;
+    x *= 0x7feb352du;
+    x ^= x >> 15;
+    x *= 0x846ca68bu;
+    x ^= x >> 16;
+    return x;
+}
+
+// Random level while the contact bounces, fixed per chunk so it doesn't depend on the tick rate
+static uint8_t bounce_level(double t_ms, unsigned pulse, unsigned seed)
+{
+    return (uint8_t)(hash((unsigned)(t_ms / BOUNCE_CHUNK_MS) * 2654435761u ^ pulse * 40503u ^ seed) & 1);
+}
+
+static uint8_t phase_level(const pulse_t *p, int n, int direction, double t_ms, const bench_config_t *cfg)
+{
+    for (int i = 0; i < n; i++)
+    {
+        if (t_ms < p[i].start_ms)
+        {
+            break;
+        }
+        if (t_ms >= p[i].window_end_ms)
+        {
+            continue;
+        }
+
+        if (p[i].direction == direction)
+        {
+            if (t_ms < p[i].start_ms + cfg->bounce_ms)
+                return bounce_level(t_ms, (unsigned)i, cfg->seed);
+            if (t_ms < p[i].end_ms)
+                return 0;
+            if (t_ms < p[i].end_ms + cfg->bounce_ms)
+                return bounce_level(t_ms, (unsigned)i, cfg->seed);
+        }
+        else if (p[i].glitch_ms >= 0 && t_ms >= p[i].glitch_ms && t_ms < p[i].glitch_ms + cfg->crosstalk_ms)
+        {
+            return 0;
+        }
+        return 1;
+    }
+    return 1;
+}
+
+static double now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static bench_result_t run_bench(const bench_config_t *cfg)
+{
+    bench_result_t result = {0};
+    int n = cfg->detents;
+    pulse_t *pulses = calloc((size_t)n, sizeof(pulse_t));
+    double period_ms = 60000.0 / (cfg->rpm * cfg->detents_per_rev);
+
+    // Right, then left, then alternating runs so both phases and reversals are covered
+    s_rand_state = cfg->seed;
+    double t = GAP_MS;
+    for (int i = 0; i < n; i++)
+    {
+        double period = period_ms * (1.0 + cfg->jitter * (random_unit() - 0.5));
+        double width = period * cfg->duty * (1.0 + cfg->jitter * (random_unit() - 0.5));
+        pulses[i].start_ms = t;
+        pulses[i].end_ms = t + width;
+        pulses[i].direction = (i < n / 2) ? 1 : (i < 3 * n / 4 ? -1 : ((i / 8) & 1 ? 1 : -1));
+        pulses[i].glitch_ms = cfg->crosstalk_ms > 0 ? t + random_unit() * (period - cfg->crosstalk_ms) : -1.0;
+        t += period;
+        pulses[i].window_end_ms = t;
+    }
+    pulses[n - 1].window_end_ms = t + GAP_MS;
+    double end_ms = t + GAP_MS;
+
+    // Sample like the knob timer, at a random phase to the pulses
+    size_t ticks = (size_t)(end_ms / cfg->tick_ms);
+    uint8_t *level_a = malloc(ticks);
+    uint8_t *level_b = malloc(ticks);
+    int8_t *decoded = calloc(ticks, 1);
+    double tick_phase = random_unit() * cfg->tick_ms;
+    for (size_t k = 0; k < ticks; k++)
+    {
+        double tk = tick_phase + k * cfg->tick_ms;
+        level_a[k] = phase_level(pulses, n, 1, tk, cfg);
+        level_b[k] = phase_level(pulses, n, -1, tk, cfg);
+    }
+
+    // Decode as process_knob_channel() does, timing only the state machine
+    knob_debounce_t phase_a;
+    knob_debounce_t phase_b;
+    double best_ns = 1e18;
+    for (int rep = 0; rep < 5; rep++)
+    {
+        knob_debounce_init(&phase_a, 1);
+        knob_debounce_init(&phase_b, 1);
+        double start = now_ns();
+        for (size_t k = 0; k < ticks; k++)
+        {
+            int8_t d = 0;
+            if (knob_debounce_update(&phase_a, level_a[k], (uint8_t)cfg->debounce_ticks))
+                d = 1;
+            if (knob_debounce_update(&phase_b, level_b[k], (uint8_t)cfg->debounce_ticks))
+                d = d ? 2 : -1; // 2: both in one tick, counted as one of each
+            decoded[k] = d;
+        }
+        double elapsed = now_ns() - start;
+        if (elapsed < best_ns)
+            best_ns = elapsed;
+    }
+
+    // Match the decoded detents to the generated ones. A detent is decoded on the
+    // release edge, so each one owns the time from its release to the next release.
+    int p = 0;
+    int same = 0;
+    for (size_t k = 0; k <= ticks; k++)
+    {
+        double tk = tick_phase + k * cfg->tick_ms;
+        while (p < n && (k == ticks || (p + 1 < n && tk >= pulses[p + 1].end_ms)))
+        {
+            if (same == 0)
+                result.missed++;
+            else
+                result.extra += same - 1;
+            same = 0;
+            p++;
+        }
+        if (k == ticks)
+            break;
+
+        int dir = pulses[p].direction;
+        int8_t d = decoded[k];
+        if (d == 2)
+        {
+            same++;
+            result.wrong_direction++;
+        }
+        else if (d == dir)
+            same++;
+        else if (d == -dir)
+            result.wrong_direction++;
+    }
+
+    result.detents = n;
+    result.ns_per_tick = best_ns / ticks;
+    result.wakeups_per_s = 1000.0 / cfg->tick_ms;
+
+    free(decoded);
+    free(level_b);
+    free(level_a);
+    free(pulses);
+    return result;
+}
+
+static void print_header(void)
+{
+    printf("tick_ms debounce   rpm  detents/s  missed  extra  wrong_dir  ns/tick  wakeups/s\n");
+}
+
+static void print_result(const bench_config_t *cfg, const bench_result_t *r)
+{
+    printf("%7.1f %8d %5.0f %10.0f %7d %6d %10d %8.1f %10.0f\n", cfg->tick_ms, cfg->debounce_ticks, cfg->rpm,
+           cfg->rpm * cfg->detents_per_rev / 60.0, r->missed, r->extra, r->wrong_direction, r->ns_per_tick,
+           r->wakeups_per_s);
+}
+
+static const double s_sweep_rpm[] = {30, 90, 150, 180, 240, 300, 450};
+
+static int sweep(bench_config_t cfg)
+{
+    static const double ticks_ms[] = {1, 2, 3, 4, 5};
+    static const int debounce[] = {1, 2, 3};
+
+    print_header();
+    for (size_t t = 0; t < sizeof(ticks_ms) / sizeof(ticks_ms[0]); t++)
+    {
+        for (size_t d = 0; d < sizeof(debounce) / sizeof(debounce[0]); d++)
+        {
+            for (size_t r = 0; r < sizeof(s_sweep_rpm) / sizeof(s_sweep_rpm[0]); r++)
+            {
+                cfg.tick_ms = ticks_ms[t];
+                cfg.debounce_ticks = debounce[d];
+                cfg.rpm = s_sweep_rpm[r];
+                bench_result_t result = run_bench(&cfg);
+                print_result(&cfg, &result);
+            }
+        }
+    }
+    return 0;
+}
+
+// Speed up to which the defaults must not miss a detent: 4 revolutions per second
+#define CHECK_MAX_RPM 240
+
+static int check_defaults(bench_config_t cfg)
+{
+    int failures = 0;
+    cfg.tick_ms = TICKS_INTERVAL;
+    cfg.debounce_ticks = DEBOUNCE_TICKS;
+
+    print_header();
+    for (size_t r = 0; r < sizeof(s_sweep_rpm) / sizeof(s_sweep_rpm[0]); r++)
+    {
+        cfg.rpm = s_sweep_rpm[r];
+        for (unsigned seed = 1; seed <= 4; seed++)
+        {
+            cfg.seed = seed;
+            bench_result_t result = run_bench(&cfg);
+            if (seed == 1)
+                print_result(&cfg, &result);
+
+            // Bounce must never turn into detents, at any speed. Up to the rated speed
+            // nothing may be missed. Two crosstalk glitches can land on consecutive
+            // samples and pass as a short pulse, which is rare but legitimate.
+            if (result.extra ||
+                (cfg.rpm <= CHECK_MAX_RPM && (result.missed || result.wrong_direction * 200 > result.detents)))
+            {
+                printf("FAIL at %.0f rpm, seed %u: %d missed, %d extra, %d wrong direction\n", cfg.rpm, seed,
+                       result.missed, result.extra, result.wrong_direction);
+                failures++;
+            }
+        }
+    }
+    printf("%s\n", failures ? "FAILED" : "OK");
+    return failures ? 1 : 0;
+}
+
+int main(int argc, char **argv)
+{
+    bench_config_t cfg = {
+        .tick_ms = TICKS_INTERVAL,
+        .debounce_ticks = DEBOUNCE_TICKS,
+        .rpm = 60,
+        .detents_per_rev = 20,
+        .duty = 0.4,
+        .bounce_ms = 0.5,
+        .jitter = 0.1,
+        .crosstalk_ms = 0.3,
+        .detents = 400,
+        .seed = 1,
+    };
+    int single = 0;
+    int check = 0;
+
+    for (int i = 1; i < argc; i++)
+    {
+        const char *arg = argv[i];
+        const char *value = i + 1 < argc ? argv[i + 1] : NULL;
+        if (!strcmp(arg, "--check"))
+        {
+            check = 1;
+            continue;
+        }
+        if (!value)
+        {
+            fprintf(stderr, "missing value for %s\n", arg);
+            return 2;
+        }
+        i++;
+        if (!strcmp(arg, "--tick-ms"))
+        {
+            cfg.tick_ms = atof(value);
+            single = 1;
+        }
+        else if (!strcmp(arg, "--debounce"))
+        {
+            cfg.debounce_ticks = atoi(value);
+            single = 1;
+        }
+        else if (!strcmp(arg, "--rpm"))
+        {
+            cfg.rpm = atof(value);
+            single = 1;
+        }
+        else if (!strcmp(arg, "--detents-per-rev"))
+            cfg.detents_per_rev = atoi(value);
+        else if (!strcmp(arg, "--duty"))
+            cfg.duty = atof(value) / 100.0;
+        else if (!strcmp(arg, "--bounce-ms"))
+            cfg.bounce_ms = atof(value);
+        else if (!strcmp(arg, "--jitter"))
+            cfg.jitter = atof(value) / 100.0;
+        else if (!strcmp(arg, "--crosstalk-ms"))
+            cfg.crosstalk_ms = atof(value);
+        else if (!strcmp(arg, "--detents"))
+            cfg.detents = atoi(value);
+        else if (!strcmp(arg, "--seed"))
+            cfg.seed = (unsigned)atoi(value);
+        else
+        {
+            fprintf(stderr, "unknown option %s\n", arg);
+            return 2;
+        }
+    }
+
+    if (cfg.tick_ms <= 0 || cfg.debounce_ticks < 1 || cfg.rpm <= 0 || cfg.detents_per_rev < 1 || cfg.detents < 2)
+    {
+        fprintf(stderr, "invalid configuration\n");
+        return 2;
+    }
+
+    if (check)
+        return check_defaults(cfg);
+    if (!single)
+        return sweep(cfg);
+
+    print_header();
+    bench_result_t result = run_bench(&cfg);
+    print_result(&cfg, &result);
+    return 0;
+}
@@ -0,0 +1,198 @@
+/*
+ * Fuzz harness of the BLE MIDI packet parser.
+ *
+ * The first input byte sets the packet length, the rest is split into packets
+ * of that length and parsed in a row, so SysEx streams continue over packets
+ * and the parser state carries over. Every packet is copied into a buffer of
+ * its exact size, the sanitizers catch reads past the end.
+ *
+ * The callback checks what a receiver relies on: a status byte, at most two
+ * data bytes outside of SysEx, SysEx chunks without status bytes, data inside
+ * the packet and 13 bit timestamps. Errors must be one of the documented codes
+ * and be counted.
+ *
+ * With clang the CMake project builds it as a libFuzzer target:
+ *
+ *   fuzz_blemidi_parser [corpus dir] [libFuzzer options]
+ *
+ * Otherwise it has its own driver which generates mostly well formed packets
+ * with a random byte now and then (ctest runs the default):
+ *
+ *   fuzz_blemidi_parser [--inputs N] [--seed S]
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "blemidi_parser.h"
+
+static blemidi_parser_t s_parser;
+static const uint8_t *s_packet;
+static size_t s_packet_len;
+static unsigned long s_packets;
+
+static void fail(const char *what, uint8_t status, long value)
+{
+    fprintf(stderr, "%s: status %02x, %ld\n", what, status, value);
+    abort();
+}
+
+static void on_message(uint8_t port, uint16_t timestamp, uint8_t status, uint8_t *data, size_t len, size_t continued_sysex_pos)
+{
+    if (!(status & 0x80))
+        fail("status without bit 7", status, len);
+    if (timestamp > 0x1fff)
+        fail("timestamp out of range", status, len);
+    if (data < s_packet || data + len > s_packet + s_packet_len)
+        fail("data outside of the packet", status, len);
+
+    if (status == 0xf0)
+    {
+        for (size_t i = 0; i < len; i++)
+        {
+            if (data[i] & 0x80)
+                fail("status byte in a SysEx chunk", status, len);
+        }
+    }
+    else if (len > 2 || continued_sysex_pos != 0)
+    {
+        fail("message too long", status, len);
+    }
+}
+
+int LLVMFuzzerTestOneInput(const uint8_t *input, size_t size)
+{
+    if (size < 1)
+        return 0;
+    size_t packet_len = (size_t)input[0] + 1;
+    input++;
+    size--;
+
+    while (size > 0)
+    {
+        size_t len = size < packet_len ? size : packet_len;
+        uint8_t *packet = malloc(len);
+        memcpy(packet, input, len);
+        s_packet = packet;
+        s_packet_len = len;
+        s_packets++;
+
+        uint32_t errors = s_parser.num_errors;
+        int32_t result = blemidi_parse_packet(&s_parser, 0, packet, len, on_message);
+        if (result > 0 || result < -6)
+            fail("undocumented result", 0, result);
+        if (s_parser.num_errors != errors + (result < 0))
+            fail("error not counted", 0, result);
+
+        free(packet);
+        input += len;
+        size -= len;
+    }
+    return 0;
+}
+
+#ifndef BLEMIDI_FUZZ_LIBFUZZER
+
+static uint32_t s_random;
+
+static uint8_t random_byte(void)
+{
+    s_random = s_random * 1103515245u + 12345u;
+    return (uint8_t)(s_random >> 16);
+}
+
+static void put(uint8_t *packet, size_t *pos, size_t len, uint8_t b)
+{
+    if (*pos < len)
+        packet[(*pos)++] = b;
+}
+
+// A mostly well formed packet of exactly len bytes, with a random byte now and then
+static void generate_packet(uint8_t *packet, size_t len)
+{
+    size_t pos = 0;
+    put(packet, &pos, len, 0x80 | (random_byte() & 0x3f));
+    while (pos < len)
+    {
+        uint8_t kind = random_byte() % 16;
+        if (kind < 6)
+        {
+            // Channel or System Common message, CC most of the time
+            uint8_t status = kind < 3 ? 0xb0 : 0x80 | (random_byte() & 0x70);
+            put(packet, &pos, len, 0x80 | random_byte());
+            put(packet, &pos, len, status | (random_byte() & 0x0f));
+            put(packet, &pos, len, random_byte() & 0x7f);
+            if ((status & 0xe0) != 0xc0)
+                put(packet, &pos, len, random_byte() & 0x7f);
+        }
+        else if (kind < 8)
+        {
+            // Running status, with or without timestampLow
+            if (kind == 6)
+                put(packet, &pos, len, 0x80 | random_byte());
+            put(packet, &pos, len, random_byte() & 0x7f);
+            put(packet, &pos, len, random_byte() & 0x7f);
+        }
+        else if (kind < 10)
+        {
+            // Realtime, System Common, SysEx end
+            put(packet, &pos, len, 0x80 | random_byte());
+            put(packet, &pos, len, 0xf0 | (random_byte() & 0x0f));
+        }
+        else if (kind < 13)
+        {
+            // SysEx start, or data continuing it
+            if (kind == 10)
+            {
+                put(packet, &pos, len, 0x80 | random_byte());
+                put(packet, &pos, len, 0xf0);
+            }
+            for (uint8_t n = random_byte() % 32; n > 0; n--)
+                put(packet, &pos, len, random_byte() & 0x7f);
+        }
+        else
+        {
+            put(packet, &pos, len, random_byte());
+        }
+    }
+}
+
+int main(int argc, char **argv)
+{
+    long inputs = 1000000;
+    s_random = 1;
+    for (int i = 1; i + 1 < argc; i += 2)
+    {
+        if (!strcmp(argv[i], "--inputs"))
+            inputs = atol(argv[i + 1]);
+        else if (!strcmp(argv[i], "--seed"))
+            s_random = (uint32_t)atol(argv[i + 1]);
+        else
+        {
+            fprintf(stderr, "unknown option %s\n", argv[i]);
+            return 2;
+        }
+    }
+
+    blemidi_parser_init(&s_parser);
+    uint8_t input[1 + 4 * 64];
+    for (long n = 0; n < inputs; n++)
+    {
+        size_t packet_len = 1 + random_byte() % 64;
+        size_t size = 1;
+        input[0] = (uint8_t)(packet_len - 1);
+        for (int packets = 1 + random_byte() % 4; packets > 0; packets--)
+        {
+            generate_packet(input + size, packet_len);
+            size += packet_len;
+        }
+        LLVMFuzzerTestOneInput(input, size);
+    }
+
+    printf("%ld inputs, %lu packets, %u malformed\n", inputs, s_packets, (unsigned)s_parser.num_errors);
+    printf("OK\n");
+    return 0;
+}
+
+#endif
@@ -0,0 +1,41 @@
+/*
+ * Minimal assertion helpers shared by the host tests.
+ *
+ * A failed CHECK prints its location and the test carries on, so one run
+ * reports every broken expectation. main() returns host_test_result().
+ */
+
+#pragma once
+
+#include <stdio.h>
+
+static int host_test_failures;
+
+#define CHECK(cond)                                                         \
+    do                                                                      \
+    {                                                                       \
+        if (!(cond))                                                        \
+        {                                                                   \
+            printf("FAIL %s:%d: %s\n", __FILE__, __LINE__, #cond);          \
+            host_test_failures++;                                           \
+        }                                                                   \
+    } while (0)
+
+#define CHECK_EQ(actual, expected)                                          \
+    do                                                                      \
+    {                                                                       \
+        long long actual_ = (long long)(actual);                            \
+        long long expected_ = (long long)(expected);                        \
+        if (actual_ != expected_)                                           \
+        {                                                                   \
+            printf("FAIL %s:%d: %s == %lld, expected %lld\n",               \
+                   __FILE__, __LINE__, #actual, actual_, expected_);        \
+            host_test_failures++;                                           \
+        }                                                                   \
+    } while (0)
+
+static inline int host_test_result(void)
+{
+    printf("%s\n", host_test_failures ? "FAILED" : "OK");
+    return host_test_failures ? 1 : 0;
+}
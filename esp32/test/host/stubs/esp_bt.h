@@ -0,0 +1,32 @@
+/*
+ * Host stand-in for the Bluetooth controller API.
+ */
+
+#pragma once
+
+#include "esp_bt_defs.h"
+
+typedef struct
+{
+    int unused;
+} esp_bt_controller_config_t;
+
+#define BT_CONTROLLER_INIT_CONFIG_DEFAULT() {0}
+
+typedef enum
+{
+    ESP_BT_MODE_BLE = 1,
+    ESP_BT_MODE_CLASSIC_BT = 2,
+} esp_bt_mode_t;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+esp_err_t esp_bt_controller_mem_release(esp_bt_mode_t mode);
+esp_err_t esp_bt_controller_init(esp_bt_controller_config_t *cfg);
+esp_err_t esp_bt_controller_enable(esp_bt_mode_t mode);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,27 @@
+/*
+ * Host stand-in for the Bluetooth types shared by the Bluedroid headers.
+ *
+ * Only the members blemidi.c uses are declared, the layouts do not match ESP-IDF.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "esp_err.h"
+
+typedef uint8_t esp_bd_addr_t[6];
+
+typedef struct
+{
+    uint16_t len;
+    union
+    {
+        uint16_t uuid16;
+        uint8_t uuid128[16];
+    } uuid;
+} esp_bt_uuid_t;
+
+#define ESP_BT_STATUS_SUCCESS 0
+#define ESP_UUID_LEN_16 2
+#define ESP_UUID_LEN_128 16
@@ -0,0 +1,18 @@
+/*
+ * Host stand-in for the Bluedroid host stack API.
+ */
+
+#pragma once
+
+#include "esp_bt_defs.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+esp_err_t esp_bluedroid_init(void);
+esp_err_t esp_bluedroid_enable(void);
+
+#ifdef __cplusplus
+}
+#endif
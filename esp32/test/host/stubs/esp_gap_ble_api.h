@@ -0,0 +1,204 @@
+/*
+ * Host stand-in for the BLE GAP API: advertising, connection parameters and security.
+ */
+
+#pragma once
+
+#include "esp_bt_defs.h"
+
+typedef uint8_t esp_ble_auth_req_t;
+typedef uint8_t esp_ble_io_cap_t;
+typedef uint8_t esp_ble_gap_phy_mask_t;
+typedef uint16_t esp_ble_gap_prefer_phy_options_t;
+
+#define ESP_BLE_ADV_FLAG_GEN_DISC 0x02
+#define ESP_BLE_ADV_FLAG_BREDR_NOT_SPT 0x04
+#define ESP_LE_AUTH_BOND 0x01
+#define ESP_IO_CAP_NONE 3
+#define ESP_BLE_ENC_KEY_MASK 0x01
+#define ESP_BLE_ID_KEY_MASK 0x02
+#define ESP_BLE_ONLY_ACCEPT_SPECIFIED_AUTH_DISABLE 0
+#define ESP_BLE_OOB_DISABLE 0
+#define ESP_BLE_GAP_PHY_1M 1
+#define ESP_BLE_GAP_PHY_2M 2
+#define ESP_BLE_GAP_PHY_1M_PREF_MASK (1 << 0)
+#define ESP_BLE_GAP_PHY_2M_PREF_MASK (1 << 1)
+#define ESP_BLE_GAP_PHY_OPTIONS_NO_PREF 0
+
+typedef enum
+{
+    ADV_TYPE_IND,
+} esp_ble_adv_type_t;
+
+typedef enum
+{
+    BLE_ADDR_TYPE_PUBLIC,
+} esp_ble_addr_type_t;
+
+typedef enum
+{
+    ADV_CHNL_ALL = 7,
+} esp_ble_adv_channel_t;
+
+typedef enum
+{
+    ADV_FILTER_ALLOW_SCAN_ANY_CON_ANY,
+} esp_ble_adv_filter_t;
+
+typedef struct
+{
+    bool set_scan_rsp;
+    bool include_name;
+    bool include_txpower;
+    int min_interval;
+    int max_interval;
+    int appearance;
+    uint16_t manufacturer_len;
+    uint8_t *p_manufacturer_data;
+    uint16_t service_data_len;
+    uint8_t *p_service_data;
+    uint16_t service_uuid_len;
+    uint8_t *p_service_uuid;
+    uint8_t flag;
+} esp_ble_adv_data_t;
+
+typedef struct
+{
+    uint16_t adv_int_min;
+    uint16_t adv_int_max;
+    esp_ble_adv_type_t adv_type;
+    esp_ble_addr_type_t own_addr_type;
+    esp_bd_addr_t peer_addr;
+    esp_ble_addr_type_t peer_addr_type;
+    esp_ble_adv_channel_t channel_map;
+    esp_ble_adv_filter_t adv_filter_policy;
+} esp_ble_adv_params_t;
+
+typedef struct
+{
+    esp_bd_addr_t bda;
+    uint16_t min_int;
+    uint16_t max_int;
+    uint16_t latency;
+    uint16_t timeout;
+} esp_ble_conn_update_params_t;
+
+typedef enum
+{
+    ESP_BLE_SM_PASSKEY,
+    ESP_BLE_SM_AUTHEN_REQ_MODE,
+    ESP_BLE_SM_IOCAP_MODE,
+    ESP_BLE_SM_SET_INIT_KEY,
+    ESP_BLE_SM_SET_RSP_KEY,
+    ESP_BLE_SM_MAX_KEY_SIZE,
+    ESP_BLE_SM_ONLY_ACCEPT_SPECIFIED_SEC_AUTH,
+    ESP_BLE_SM_OOB_SUPPORT,
+} esp_ble_sm_param_t;
+
+typedef enum
+{
+    ESP_GAP_BLE_ADV_DATA_SET_COMPLETE_EVT,
+    ESP_GAP_BLE_SCAN_RSP_DATA_SET_COMPLETE_EVT,
+    ESP_GAP_BLE_ADV_START_COMPLETE_EVT,
+    ESP_GAP_BLE_ADV_STOP_COMPLETE_EVT,
+    ESP_GAP_BLE_UPDATE_CONN_PARAMS_EVT,
+    ESP_GAP_BLE_PASSKEY_REQ_EVT,
+    ESP_GAP_BLE_OOB_REQ_EVT,
+    ESP_GAP_BLE_LOCAL_IR_EVT,
+    ESP_GAP_BLE_LOCAL_ER_EVT,
+    ESP_GAP_BLE_NC_REQ_EVT,
+    ESP_GAP_BLE_SEC_REQ_EVT,
+    ESP_GAP_BLE_PASSKEY_NOTIF_EVT,
+    ESP_GAP_BLE_KEY_EVT,
+    ESP_GAP_BLE_AUTH_CMPL_EVT,
+    ESP_GAP_BLE_REMOVE_BOND_DEV_COMPLETE_EVT,
+    ESP_GAP_BLE_SET_PKT_LENGTH_COMPLETE_EVT,
+    ESP_GAP_BLE_PHY_UPDATE_COMPLETE_EVT,
+    ESP_GAP_BLE_READ_PHY_COMPLETE_EVT,
+    ESP_GAP_BLE_SET_PREFERRED_PHY_COMPLETE_EVT,
+} esp_gap_ble_cb_event_t;
+
+typedef struct
+{
+    uint8_t rx_len;
+    uint8_t tx_len;
+} esp_ble_pkt_data_length_params_t;
+
+typedef union
+{
+    struct
+    {
+        int status;
+    } adv_start_cmpl, adv_stop_cmpl, set_perf_phy;
+    struct
+    {
+        int status;
+        esp_bd_addr_t bd_addr;
+    } remove_bond_dev_cmpl;
+    struct
+    {
+        int status;
+        esp_bd_addr_t bda;
+        uint16_t min_int;
+        uint16_t max_int;
+        uint16_t latency;
+        uint16_t conn_int;
+        uint16_t timeout;
+    } update_conn_params;
+    union
+    {
+        struct
+        {
+            esp_bd_addr_t bd_addr;
+        } ble_req;
+        struct
+        {
+            esp_bd_addr_t bd_addr;
+            uint32_t passkey;
+        } key_notif;
+        struct
+        {
+            esp_bd_addr_t bd_addr;
+            bool success;
+            uint8_t fail_reason;
+            uint8_t addr_type;
+            esp_ble_auth_req_t auth_mode;
+        } auth_cmpl;
+    } ble_security;
+    struct
+    {
+        int status;
+        esp_ble_pkt_data_length_params_t params;
+    } pkt_data_length_cmpl;
+    struct
+    {
+        int status;
+        esp_bd_addr_t bda;
+        uint8_t tx_phy;
+        uint8_t rx_phy;
+    } phy_update, read_phy;
+} esp_ble_gap_cb_param_t;
+
+typedef void (*esp_gap_ble_cb_t)(esp_gap_ble_cb_event_t event, esp_ble_gap_cb_param_t *param);
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+esp_err_t esp_ble_gap_register_callback(esp_gap_ble_cb_t callback);
+esp_err_t esp_ble_gap_set_device_name(const char *name);
+esp_err_t esp_ble_gap_config_adv_data(esp_ble_adv_data_t *adv_data);
+esp_err_t esp_ble_gap_start_advertising(esp_ble_adv_params_t *adv_params);
+esp_err_t esp_ble_gap_update_conn_params(esp_ble_conn_update_params_t *params);
+esp_err_t esp_ble_gap_set_pkt_data_len(esp_bd_addr_t remote_device, uint16_t tx_data_length);
+esp_err_t esp_ble_gap_set_preferred_phy(esp_bd_addr_t remote_device, esp_ble_gap_phy_mask_t all_phys_mask,
+                                        esp_ble_gap_phy_mask_t tx_phy_mask, esp_ble_gap_phy_mask_t rx_phy_mask,
+                                        esp_ble_gap_prefer_phy_options_t phy_options);
+esp_err_t esp_ble_gap_set_security_param(esp_ble_sm_param_t param_type, void *value, uint8_t len);
+esp_err_t esp_ble_gap_security_rsp(esp_bd_addr_t bd_addr, bool accept);
+esp_err_t esp_ble_confirm_reply(esp_bd_addr_t bd_addr, bool accept);
+esp_err_t esp_ble_gap_disconnect(esp_bd_addr_t remote_device);
+
+#ifdef __cplusplus
+}
+#endif
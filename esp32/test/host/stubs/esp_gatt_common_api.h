@@ -0,0 +1,17 @@
+/*
+ * Host stand-in for the GATT API shared by client and server.
+ */
+
+#pragma once
+
+#include "esp_bt_defs.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+esp_err_t esp_ble_gatt_set_local_mtu(uint16_t mtu);
+
+#ifdef __cplusplus
+}
+#endif
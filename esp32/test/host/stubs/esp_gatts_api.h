@@ -0,0 +1,204 @@
+/*
+ * Host stand-in for the GATT server API.
+ */
+
+#pragma once
+
+#include "esp_bt_defs.h"
+
+typedef uint8_t esp_gatt_if_t;
+typedef int esp_gatt_status_t;
+typedef uint16_t esp_gatt_perm_t;
+typedef uint8_t esp_gatt_char_prop_t;
+
+#define ESP_GATT_OK 0
+#define ESP_GATT_INVALID_OFFSET 0x07
+#define ESP_GATT_PREPARE_Q_FULL 0x09
+#define ESP_GATT_INVALID_ATTR_LEN 0x0d
+#define ESP_GATT_NO_RESOURCES 0x80
+#define ESP_GATT_AUTO_RSP 2
+#define ESP_GATT_IF_NONE 0xff
+#define ESP_GATT_AUTH_REQ_NONE 0
+#define ESP_GATT_PREP_WRITE_CANCEL 0x00
+#define ESP_GATT_PREP_WRITE_EXEC 0x01
+#define ESP_GATT_PERM_READ (1 << 0)
+#define ESP_GATT_PERM_WRITE (1 << 4)
+#define ESP_GATT_UUID_PRI_SERVICE 0x2800
+#define ESP_GATT_UUID_CHAR_DECLARE 0x2803
+#define ESP_GATT_UUID_CHAR_CLIENT_CONFIG 0x2902
+#define ESP_GATT_CHAR_PROP_BIT_READ (1 << 1)
+#define ESP_GATT_CHAR_PROP_BIT_WRITE_NR (1 << 2)
+#define ESP_GATT_CHAR_PROP_BIT_WRITE (1 << 3)
+#define ESP_GATT_CHAR_PROP_BIT_NOTIFY (1 << 4)
+
+typedef struct
+{
+    esp_bt_uuid_t uuid;
+    uint8_t inst_id;
+} esp_gatt_id_t;
+
+typedef struct
+{
+    esp_gatt_id_t id;
+    bool is_primary;
+} esp_gatt_srvc_id_t;
+
+typedef struct
+{
+    uint8_t value[600];
+    uint16_t handle;
+    uint16_t offset;
+    uint16_t len;
+    uint8_t auth_req;
+} esp_gatt_value_t;
+
+typedef union
+{
+    esp_gatt_value_t attr_value;
+    uint16_t handle;
+} esp_gatt_rsp_t;
+
+typedef struct
+{
+    uint8_t auto_rsp;
+} esp_attr_control_t;
+
+typedef struct
+{
+    uint16_t uuid_length;
+    uint8_t *uuid_p;
+    uint16_t perm;
+    uint16_t max_length;
+    uint16_t length;
+    uint8_t *value;
+} esp_attr_desc_t;
+
+typedef struct
+{
+    esp_attr_control_t attr_control;
+    esp_attr_desc_t att_desc;
+} esp_gatts_attr_db_t;
+
+typedef struct
+{
+    uint16_t interval;
+    uint16_t latency;
+    uint16_t timeout;
+} esp_gatt_conn_params_t;
+
+typedef enum
+{
+    ESP_GATTS_REG_EVT,
+    ESP_GATTS_READ_EVT,
+    ESP_GATTS_WRITE_EVT,
+    ESP_GATTS_EXEC_WRITE_EVT,
+    ESP_GATTS_MTU_EVT,
+    ESP_GATTS_CONF_EVT,
+    ESP_GATTS_UNREG_EVT,
+    ESP_GATTS_START_EVT,
+    ESP_GATTS_STOP_EVT,
+    ESP_GATTS_CONNECT_EVT,
+    ESP_GATTS_DISCONNECT_EVT,
+    ESP_GATTS_OPEN_EVT,
+    ESP_GATTS_CANCEL_OPEN_EVT,
+    ESP_GATTS_CLOSE_EVT,
+    ESP_GATTS_LISTEN_EVT,
+    ESP_GATTS_CONGEST_EVT,
+    ESP_GATTS_CREAT_ATTR_TAB_EVT,
+    ESP_GATTS_DELETE_EVT,
+    ESP_GATTS_SEND_SERVICE_CHANGE_EVT,
+} esp_gatts_cb_event_t;
+
+typedef union
+{
+    struct
+    {
+        esp_gatt_status_t status;
+        uint16_t app_id;
+    } reg;
+    struct
+    {
+        uint16_t conn_id;
+        uint32_t trans_id;
+        esp_bd_addr_t bda;
+        uint16_t handle;
+        uint16_t offset;
+        bool need_rsp;
+        bool is_prep;
+        uint16_t len;
+        uint8_t *value;
+    } write;
+    struct
+    {
+        uint16_t conn_id;
+        uint32_t trans_id;
+        esp_bd_addr_t bda;
+        uint8_t exec_write_flag;
+    } exec_write;
+    struct
+    {
+        uint16_t conn_id;
+        uint16_t mtu;
+    } mtu;
+    struct
+    {
+        esp_gatt_status_t status;
+        uint16_t conn_id;
+        uint16_t handle;
+        uint16_t len;
+        uint8_t *value;
+    } conf;
+    struct
+    {
+        esp_gatt_status_t status;
+        uint16_t service_handle;
+    } start;
+    struct
+    {
+        uint16_t conn_id;
+        uint8_t link_role;
+        esp_bd_addr_t remote_bda;
+        esp_gatt_conn_params_t conn_params;
+        uint8_t ble_addr_type;
+        uint16_t conn_handle;
+    } connect;
+    struct
+    {
+        uint16_t conn_id;
+        esp_bd_addr_t remote_bda;
+        int reason;
+    } disconnect;
+    struct
+    {
+        uint16_t conn_id;
+        bool congested;
+    } congest;
+    struct
+    {
+        esp_gatt_status_t status;
+        esp_bt_uuid_t svc_uuid;
+        uint8_t svc_inst_id;
+        uint16_t num_handle;
+        uint16_t *handles;
+    } add_attr_tab;
+} esp_ble_gatts_cb_param_t;
+
+typedef void (*esp_gatts_cb_t)(esp_gatts_cb_event_t event, esp_gatt_if_t gatts_if, esp_ble_gatts_cb_param_t *param);
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+esp_err_t esp_ble_gatts_register_callback(esp_gatts_cb_t callback);
+esp_err_t esp_ble_gatts_app_register(uint16_t app_id);
+esp_err_t esp_ble_gatts_create_attr_tab(const esp_gatts_attr_db_t *gatts_attr_db, esp_gatt_if_t gatts_if,
+                                        uint16_t max_nb_attr, uint8_t srvc_inst_id);
+esp_err_t esp_ble_gatts_start_service(uint16_t service_handle);
+esp_err_t esp_ble_gatts_send_indicate(esp_gatt_if_t gatts_if, uint16_t conn_id, uint16_t attr_handle,
+                                      uint16_t value_len, uint8_t *value, bool need_confirm);
+esp_err_t esp_ble_gatts_send_response(esp_gatt_if_t gatts_if, uint16_t conn_id, uint32_t trans_id,
+                                      esp_gatt_status_t status, esp_gatt_rsp_t *rsp);
+
+#ifdef __cplusplus
+}
+#endif
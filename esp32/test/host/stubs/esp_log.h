@@ -0,0 +1,46 @@
+/*
+ * Host stand-in for the ESP-IDF logging macros.
+ *
+ * They only type-check their arguments: the tests count heap allocations,
+ * and the first printf() to a buffered stdout would allocate.
+ */
+
+#pragma once
+
+#include <inttypes.h>
+#include <stdio.h>
+
+typedef enum
+{
+    ESP_LOG_NONE,
+    ESP_LOG_ERROR,
+    ESP_LOG_WARN,
+    ESP_LOG_INFO,
+    ESP_LOG_DEBUG,
+    ESP_LOG_VERBOSE,
+} esp_log_level_t;
+
+#define ESP_HOST_LOG(format, ...)            \
+    do                                       \
+    {                                        \
+        if (0)                               \
+            printf(format, ##__VA_ARGS__);   \
+    } while (0)
+
+#define ESP_LOGE(tag, format, ...) ESP_HOST_LOG(format, ##__VA_ARGS__)
+#define ESP_LOGW(tag, format, ...) ESP_HOST_LOG(format, ##__VA_ARGS__)
+#define ESP_LOGI(tag, format, ...) ESP_HOST_LOG(format, ##__VA_ARGS__)
+#define ESP_LOGD(tag, format, ...) ESP_HOST_LOG(format, ##__VA_ARGS__)
+#define ESP_LOGV(tag, format, ...) ESP_HOST_LOG(format, ##__VA_ARGS__)
+#define ESP_LOG_BUFFER_HEX(tag, buffer, len) ((void)(buffer), (void)(len))
+#define ESP_LOG_BUFFER_HEXDUMP(tag, buffer, len, level) ((void)(buffer), (void)(len))
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+void esp_log_level_set(const char *tag, esp_log_level_t level);
+
+#ifdef __cplusplus
+}
+#endif
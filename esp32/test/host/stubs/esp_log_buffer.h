@@ -0,0 +1,7 @@
+/*
+ * Host stand-in for esp_log_buffer.h, see esp_log.h.
+ */
+
+#pragma once
+
+#include "esp_log.h"
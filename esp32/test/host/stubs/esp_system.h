@@ -0,0 +1,7 @@
+/*
+ * Host stand-in for esp_system.h.
+ */
+
+#pragma once
+
+#include "esp_err.h"
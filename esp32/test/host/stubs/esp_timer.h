@@ -0,0 +1,17 @@
+/*
+ * Host stand-in for esp_timer.h: only the microsecond clock.
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+int64_t esp_timer_get_time(void);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,173 @@
+/*
+ * Unit test of the latency aggregation behind the blemidi_latency console command:
+ * histogram buckets and percentiles, the trace of one message along the stages,
+ * and concurrent recording from several tasks.
+ */
+
+#include <pthread.h>
+#include <string.h>
+#include "blemidi_latency.h"
+#include "host_test.h"
+
+static void test_buckets_and_percentiles(void)
+{
+    blemidi_latency_hist_t hist;
+    memset(&hist, 0, sizeof(hist));
+    CHECK_EQ(blemidi_latency_hist_percentile(&hist, 50), 0);
+
+    // Bucket i holds [2^i, 2^(i+1)), bucket 0 also 0, the last one everything above
+    blemidi_latency_hist_add(&hist, 0);
+    blemidi_latency_hist_add(&hist, 1);
+    blemidi_latency_hist_add(&hist, 2);
+    blemidi_latency_hist_add(&hist, 3);
+    blemidi_latency_hist_add(&hist, 4);
+    blemidi_latency_hist_add(&hist, 1u << 19);
+    blemidi_latency_hist_add(&hist, UINT32_MAX);
+    CHECK_EQ(hist.buckets[0], 2);
+    CHECK_EQ(hist.buckets[1], 2);
+    CHECK_EQ(hist.buckets[2], 1);
+    CHECK_EQ(hist.buckets[BLEMIDI_LATENCY_NUM_BUCKETS - 1], 2);
+    CHECK_EQ(hist.count, 7);
+    CHECK_EQ(hist.min_us, 0);
+    CHECK_EQ(hist.max_us, UINT32_MAX);
+    CHECK_EQ(hist.sum_us, 10ull + (1u << 19) + UINT32_MAX);
+
+    // 100 samples of 100..10000 uS
+    memset(&hist, 0, sizeof(hist));
+    for (uint32_t i = 1; i <= 100; i++)
+        blemidi_latency_hist_add(&hist, i * 100);
+    CHECK_EQ(hist.min_us, 100);
+    CHECK_EQ(hist.max_us, 10000);
+    CHECK_EQ(blemidi_latency_hist_percentile(&hist, 0), 127);    // First sample, 100 is in [64, 128)
+    CHECK_EQ(blemidi_latency_hist_percentile(&hist, 50), 8191);  // 5000 is in [4096, 8192)
+    CHECK_EQ(blemidi_latency_hist_percentile(&hist, 99), 10000); // Bucket reaches past the maximum
+    CHECK_EQ(blemidi_latency_hist_percentile(&hist, 100), 10000);
+    CHECK_EQ(blemidi_latency_hist_percentile(&hist, 200), 10000);
+
+    // A percentile is never below the sample it stands for
+    for (uint8_t p = 1; p <= 100; p++)
+        CHECK(blemidi_latency_hist_percentile(&hist, p) >= (uint32_t)(p * 100));
+
+    // Samples in the last bucket report the exact maximum
+    memset(&hist, 0, sizeof(hist));
+    blemidi_latency_hist_add(&hist, 700000);
+    blemidi_latency_hist_add(&hist, 900000);
+    CHECK_EQ(blemidi_latency_hist_percentile(&hist, 50), 900000);
+}
+
+static void test_trace_along_the_stages(void)
+{
+    blemidi_latency_hist_t hist;
+    blemidi_latency_reset();
+
+    // Nothing in flight: marks are ignored
+    blemidi_latency_mark(BLEMIDI_LATENCY_STAGE_SEND, 5000);
+    blemidi_latency_get(BLEMIDI_LATENCY_STAGE_SEND, &hist);
+    CHECK_EQ(hist.count, 0);
+
+    // Every stage is measured from the knob timer origin
+    blemidi_latency_begin(1000);
+    blemidi_latency_mark(BLEMIDI_LATENCY_STAGE_SEND, 1500);
+    blemidi_latency_mark(BLEMIDI_LATENCY_STAGE_PUSH, 1600);
+    // A second detent before the notification keeps the older origin
+    blemidi_latency_begin(1200);
+    blemidi_latency_mark(BLEMIDI_LATENCY_STAGE_NOTIFY, 9000);
+    // The notification ended the trace
+    blemidi_latency_mark(BLEMIDI_LATENCY_STAGE_NOTIFY, 9500);
+
+    blemidi_latency_get(BLEMIDI_LATENCY_STAGE_SEND, &hist);
+    CHECK_EQ(hist.count, 1);
+    CHECK_EQ(hist.min_us, 500);
+    blemidi_latency_get(BLEMIDI_LATENCY_STAGE_PUSH, &hist);
+    CHECK_EQ(hist.max_us, 600);
+    blemidi_latency_get(BLEMIDI_LATENCY_STAGE_NOTIFY, &hist);
+    CHECK_EQ(hist.count, 1);
+    CHECK_EQ(hist.max_us, 8000);
+
+    // Invalid origins and clocks going back are dropped
+    blemidi_latency_begin(0);
+    blemidi_latency_mark(BLEMIDI_LATENCY_STAGE_NOTIFY, 10000);
+    blemidi_latency_begin(20000);
+    blemidi_latency_mark(BLEMIDI_LATENCY_STAGE_NOTIFY, 19000);
+    blemidi_latency_get(BLEMIDI_LATENCY_STAGE_NOTIFY, &hist);
+    CHECK_EQ(hist.count, 1);
+
+    // The dequeue stage is recorded directly
+    blemidi_latency_record(BLEMIDI_LATENCY_STAGE_DEQUEUE, 0);
+    blemidi_latency_record(BLEMIDI_LATENCY_STAGE_DEQUEUE, 7);
+    blemidi_latency_record(BLEMIDI_LATENCY_NUM_STAGES, 7); // Out of range, ignored
+    blemidi_latency_get(BLEMIDI_LATENCY_STAGE_DEQUEUE, &hist);
+    CHECK_EQ(hist.count, 2);
+    CHECK_EQ(hist.min_us, 0);
+    CHECK_EQ(hist.max_us, 7);
+    CHECK_EQ(hist.sum_us, 7);
+
+    // The report lists every stage
+    char report[2048];
+    FILE *out = fmemopen(report, sizeof(report), "w");
+    blemidi_latency_print(out);
+    fclose(out);
+    CHECK(strstr(report, "dequeue") && strstr(report, "send") && strstr(report, "push") && strstr(report, "notify"));
+    CHECK(strstr(report, "notify distribution:") != NULL);
+
+    // A reset clears the histograms and the pending trace
+    blemidi_latency_begin(30000);
+    blemidi_latency_reset();
+    blemidi_latency_mark(BLEMIDI_LATENCY_STAGE_NOTIFY, 31000);
+    for (int stage = 0; stage < BLEMIDI_LATENCY_NUM_STAGES; stage++)
+    {
+        blemidi_latency_get((blemidi_latency_stage_t)stage, &hist);
+        CHECK_EQ(hist.count, 0);
+        CHECK_EQ(hist.sum_us, 0);
+    }
+    // The minimum restarts with the first sample after a reset
+    blemidi_latency_record(BLEMIDI_LATENCY_STAGE_PUSH, 300);
+    blemidi_latency_get(BLEMIDI_LATENCY_STAGE_PUSH, &hist);
+    CHECK_EQ(hist.min_us, 300);
+}
+
+#define RECORD_THREADS 4
+#define RECORD_SAMPLES 100000
+
+static void *record_thread(void *arg)
+{
+    uint32_t base = (uint32_t)(uintptr_t)arg;
+    for (uint32_t i = 0; i < RECORD_SAMPLES; i++)
+        blemidi_latency_record(BLEMIDI_LATENCY_STAGE_SEND, base + (i % 1000));
+    return NULL;
+}
+
+static void test_concurrent_recording(void)
+{
+    blemidi_latency_hist_t hist;
+    pthread_t threads[RECORD_THREADS];
+    blemidi_latency_reset();
+    blemidi_latency_record(BLEMIDI_LATENCY_STAGE_SEND, 50);
+
+    for (uintptr_t t = 0; t < RECORD_THREADS; t++)
+        pthread_create(&threads[t], NULL, record_thread, (void *)(100 + t * 1000));
+    for (int t = 0; t < RECORD_THREADS; t++)
+        pthread_join(threads[t], NULL);
+
+    blemidi_latency_get(BLEMIDI_LATENCY_STAGE_SEND, &hist);
+    unsigned long long expected_sum = 50;
+    for (int t = 0; t < RECORD_THREADS; t++)
+        expected_sum += (unsigned long long)RECORD_SAMPLES * (100 + t * 1000) + (RECORD_SAMPLES / 1000) * 499500ull;
+    CHECK_EQ(hist.count, RECORD_THREADS * RECORD_SAMPLES + 1);
+    CHECK_EQ(hist.sum_us, expected_sum);
+    CHECK_EQ(hist.min_us, 50);
+    CHECK_EQ(hist.max_us, 100 + (RECORD_THREADS - 1) * 1000 + 999);
+
+    uint64_t bucketed = 0;
+    for (int i = 0; i < BLEMIDI_LATENCY_NUM_BUCKETS; i++)
+        bucketed += hist.buckets[i];
+    CHECK_EQ(bucketed, hist.count);
+}
+
+int main(void)
+{
+    test_buckets_and_percentiles();
+    test_trace_along_the_stages();
+    test_concurrent_recording();
+    return host_test_result();
+}
@@ -0,0 +1,164 @@
+/*
+ * Stress test of the lock-free BLE MIDI packet builder: several producer
+ * threads append messages and transactions while a flusher thread swaps and
+ * parses the packets, and one producer keeps changing the packet size limit
+ * like an MTU exchange would.
+ *
+ * Every message carries its producer (channel) and a sequence number, so the
+ * receiving side can check that nothing is lost, duplicated or reordered per
+ * producer, that transactions are never split over two packets, and that the
+ * timestamps within a packet never decrease.
+ */
+
+#include <pthread.h>
+#include <sched.h>
+#include <string.h>
+#include "blemidi_packet.h"
+#include "blemidi_parser.h"
+#include "host_test.h"
+
+#define PRODUCERS 4
+#define MESSAGES_PER_PRODUCER 40000
+#define GROUP_PRODUCERS_FROM 2 // Producers from this one on append MSB/LSB pairs as one transaction
+
+static blemidi_packet_builder_t s_builder;
+static blemidi_parser_t s_parser;
+static atomic_int s_producers_done;
+static atomic_int s_append_failures;
+
+// Receiving side, only touched by the flusher thread
+static unsigned s_expected_seq[PRODUCERS];
+static unsigned s_packet;
+static unsigned s_group_packet[PRODUCERS]; // Packet of the first half of an open transaction
+static unsigned s_last_timestamp;
+static unsigned s_messages_in_packet;
+static unsigned long s_received;
+static unsigned long s_packets;
+static unsigned long s_errors;
+
+static void on_message(uint8_t port, uint16_t timestamp, uint8_t status, uint8_t *data, size_t len, size_t continued_sysex_pos)
+{
+    unsigned producer = status & 0x0f;
+    if ((status & 0xf0) != 0xb0 || producer >= PRODUCERS || len != 2)
+    {
+        s_errors++;
+        return;
+    }
+
+    unsigned seq = ((unsigned)data[0] << 7) | data[1];
+    if (seq != (s_expected_seq[producer] & 0x3fff))
+        s_errors++;
+
+    if (producer >= GROUP_PRODUCERS_FROM)
+    {
+        if ((seq & 1) == 0)
+            s_group_packet[producer] = s_packet;
+        else if (s_group_packet[producer] != s_packet)
+            s_errors++; // Second half of the transaction in another packet
+    }
+
+    // Timestamps advance by at most 127 mS within a packet (13 bit wraparound)
+    if (s_messages_in_packet > 0 && ((timestamp - s_last_timestamp) & 0x1fff) > 127)
+        s_errors++;
+    s_last_timestamp = timestamp;
+    s_messages_in_packet++;
+
+    s_expected_seq[producer]++;
+    s_received++;
+}
+
+static size_t flush(void)
+{
+    while (!blemidi_packet_flush_begin(&s_builder))
+        sched_yield();
+
+    const uint8_t *packet;
+    size_t len = blemidi_packet_swap(&s_builder, &packet);
+    if (len > 0)
+    {
+        while (!blemidi_packet_swap_complete(&s_builder))
+            sched_yield();
+
+        uint8_t copy[BLEMIDI_PACKET_BUFFER_SIZE];
+        memcpy(copy, packet, len);
+        s_packet++;
+        s_packets++;
+        s_messages_in_packet = 0;
+        if (blemidi_parse_packet(&s_parser, 0, copy, len, on_message) < 0)
+            s_errors++;
+    }
+    blemidi_packet_flush_end(&s_builder);
+    return len;
+}
+
+static void *flusher_thread(void *arg)
+{
+    while (atomic_load(&s_producers_done) < PRODUCERS)
+    {
+        if (flush() == 0)
+            sched_yield(); // Let the producers fill the next packet
+    }
+    flush();
+    return NULL;
+}
+
+static void *producer_thread(void *arg)
+{
+    unsigned producer = (unsigned)(uintptr_t)arg;
+    bool group = producer >= GROUP_PRODUCERS_FROM;
+
+    for (unsigned seq = 0; seq < MESSAGES_PER_PRODUCER; seq += group ? 2 : 1)
+    {
+        uint8_t stream[6];
+        size_t len = 0;
+        for (unsigned k = seq; k < seq + (group ? 2 : 1); k++)
+        {
+            stream[len++] = 0xb0 | producer;
+            stream[len++] = (k >> 7) & 0x7f;
+            stream[len++] = k & 0x7f;
+        }
+
+        uint16_t timestamp = (uint16_t)(seq / 16);
+        int32_t status;
+        do
+        {
+            status = group ? blemidi_packet_append_group(&s_builder, timestamp, stream, len, false)
+                           : blemidi_packet_append(&s_builder, timestamp, stream, len, false);
+            if (status == -2)
+                sched_yield(); // Full, wait for the flusher
+        } while (status == -2);
+        if (status < 0)
+            atomic_fetch_add(&s_append_failures, 1);
+
+        // MTU exchanges of other connections change the limit while the others append
+        if (producer == 1 && (seq % 1024) == 0)
+            blemidi_packet_set_max_len(&s_builder, 20 + (seq / 1024) % 78);
+    }
+
+    atomic_fetch_add(&s_producers_done, 1);
+    return NULL;
+}
+
+int main(void)
+{
+    blemidi_packet_init(&s_builder, 97);
+    blemidi_parser_init(&s_parser);
+
+    pthread_t flusher;
+    pthread_t producers[PRODUCERS];
+    pthread_create(&flusher, NULL, flusher_thread, NULL);
+    for (uintptr_t p = 0; p < PRODUCERS; p++)
+        pthread_create(&producers[p], NULL, producer_thread, (void *)p);
+    for (int p = 0; p < PRODUCERS; p++)
+        pthread_join(producers[p], NULL);
+    pthread_join(flusher, NULL);
+
+    printf("%lu messages in %lu packets\n", s_received, s_packets);
+    CHECK_EQ(atomic_load(&s_append_failures), 0);
+    CHECK_EQ(s_errors, 0);
+    CHECK_EQ(s_received, PRODUCERS * MESSAGES_PER_PRODUCER);
+    for (int p = 0; p < PRODUCERS; p++)
+        CHECK_EQ(s_expected_seq[p], MESSAGES_PER_PRODUCER);
+    CHECK_EQ(s_parser.num_errors, 0);
+    return host_test_result();
+}
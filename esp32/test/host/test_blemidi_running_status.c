@@ -0,0 +1,313 @@
+/*
+ * Running status conformance of the BLE MIDI packet builder, checked against
+ * the packet parser.
+ *
+ * The exact packets of a few known sequences are compared byte by byte with
+ * the encoding the BLE MIDI specification describes. Random message streams
+ * are then round-tripped through the builder and the parser: every message
+ * must come out with its status, data and timestamp.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "blemidi_packet.h"
+#include "blemidi_parser.h"
+#include "host_test.h"
+
+#define MAX_MESSAGES 60000
+
+typedef struct
+{
+    uint8_t status;
+    uint8_t data[2];
+    size_t len;
+    uint16_t timestamp;
+} message_t;
+
+static message_t s_sent[MAX_MESSAGES];
+static message_t s_received[MAX_MESSAGES];
+static size_t s_num_sent;
+static size_t s_num_received;
+
+static blemidi_packet_builder_t s_builder;
+static blemidi_parser_t s_parser;
+static uint8_t s_packet[BLEMIDI_PACKET_BUFFER_SIZE];
+static size_t s_packet_len;
+static size_t s_bytes_on_air;
+
+static void on_message(uint8_t port, uint16_t timestamp, uint8_t status, uint8_t *data, size_t len, size_t continued_sysex_pos)
+{
+    if (s_num_received >= MAX_MESSAGES || len > 2)
+    {
+        CHECK(0);
+        return;
+    }
+    message_t *m = &s_received[s_num_received++];
+    m->status = status;
+    m->len = len;
+    memcpy(m->data, data, len);
+    m->timestamp = timestamp;
+}
+
+static void reset(size_t max_len)
+{
+    blemidi_packet_init(&s_builder, max_len);
+    blemidi_parser_init(&s_parser);
+    s_num_sent = 0;
+    s_num_received = 0;
+    s_bytes_on_air = 0;
+}
+
+// Swap out the active packet, keep a copy and parse it
+static void flush(void)
+{
+    const uint8_t *packet;
+    CHECK(blemidi_packet_flush_begin(&s_builder));
+    s_packet_len = blemidi_packet_swap(&s_builder, &packet);
+    if (s_packet_len > 0)
+    {
+        CHECK(blemidi_packet_swap_complete(&s_builder));
+        memcpy(s_packet, packet, s_packet_len);
+        s_bytes_on_air += s_packet_len;
+
+        uint8_t copy[BLEMIDI_PACKET_BUFFER_SIZE];
+        memcpy(copy, packet, s_packet_len);
+        CHECK(blemidi_parse_packet(&s_parser, 0, copy, s_packet_len, on_message) >= 0);
+    }
+    blemidi_packet_flush_end(&s_builder);
+}
+
+static void send(uint16_t timestamp, uint8_t status, uint8_t data1, uint8_t data2, size_t len)
+{
+    message_t *m = &s_sent[s_num_sent++];
+    m->status = status;
+    m->data[0] = data1;
+    m->data[1] = data2;
+    m->len = len;
+    m->timestamp = timestamp;
+
+    uint8_t stream[3] = {status, data1, data2};
+    int32_t result;
+    while ((result = blemidi_packet_append(&s_builder, timestamp, stream, len + 1, false)) == -2)
+        flush();
+    CHECK(result >= 0);
+}
+
+// Appends all messages as one transaction, see blemidi_packet_append_group()
+static void send_group(uint16_t timestamp, const uint8_t *stream, size_t len)
+{
+    for (size_t i = 0; i < len; i += 3)
+    {
+        message_t *m = &s_sent[s_num_sent++];
+        m->status = stream[i];
+        m->data[0] = stream[i + 1];
+        m->data[1] = stream[i + 2];
+        m->len = 2;
+        m->timestamp = timestamp;
+    }
+
+    int32_t result;
+    while ((result = blemidi_packet_append_group(&s_builder, timestamp, stream, len, false)) == -2)
+        flush();
+    CHECK(result >= 0);
+}
+
+static void check_packet(const uint8_t *expected, size_t len)
+{
+    flush();
+    CHECK_EQ(s_packet_len, len);
+    for (size_t i = 0; i < len && i < s_packet_len; i++)
+    {
+        if (s_packet[i] != expected[i])
+            printf("byte %u: %02x, expected %02x\n", (unsigned)i, s_packet[i], expected[i]);
+        CHECK_EQ(s_packet[i], expected[i]);
+    }
+}
+
+static void check_round_trip(void)
+{
+    CHECK_EQ(s_num_received, s_num_sent);
+    for (size_t i = 0; i < s_num_sent && i < s_num_received; i++)
+    {
+        const message_t *sent = &s_sent[i];
+        const message_t *received = &s_received[i];
+        if (sent->status != received->status || sent->len != received->len ||
+            memcmp(sent->data, received->data, sent->len) != 0 || sent->timestamp != received->timestamp)
+        {
+            printf("message %u: sent %02x ts %u, received %02x ts %u\n", (unsigned)i,
+                   sent->status, sent->timestamp, received->status, received->timestamp);
+            CHECK(0);
+            break;
+        }
+    }
+    CHECK_EQ(s_parser.num_errors, 0);
+}
+
+static void test_running_status_encoding(void)
+{
+    reset(97);
+    send(5, 0xb0, 7, 0x10, 2);
+    send(5, 0xb0, 7, 0x20, 2); // Same status and timestamp: data bytes only
+    send(6, 0xb0, 7, 0x30, 2); // New timestamp: timestampLow, no status
+    send(6, 0x90, 60, 100, 2); // New status
+    send(6, 0xb0, 1, 2, 2);
+    static const uint8_t expected[] = {
+        0x80, 0x85, 0xb0, 7, 0x10,
+        7, 0x20,
+        0x86, 7, 0x30,
+        0x86, 0x90, 60, 100,
+        0x86, 0xb0, 1, 2,
+    };
+    check_packet(expected, sizeof(expected));
+    check_round_trip();
+}
+
+static void test_one_data_byte(void)
+{
+    reset(97);
+    send(100, 0xc3, 5, 0, 1);
+    send(100, 0xc3, 6, 0, 1);
+    send(101, 0xd3, 64, 0, 1);
+    send(101, 0xd3, 65, 0, 1);
+    static const uint8_t expected[] = {
+        0x80, 0xe4, 0xc3, 5,
+        6,
+        0xe5, 0xd3, 64,
+        65,
+    };
+    check_packet(expected, sizeof(expected));
+    check_round_trip();
+}
+
+static void test_system_messages_cancel_running_status(void)
+{
+    reset(97);
+    send(5, 0xb0, 7, 0x10, 2);
+    send(5, 0xf8, 0, 0, 0);    // Realtime
+    send(5, 0xb0, 7, 0x11, 2); // Status byte again
+    send(5, 0xf2, 1, 2, 2);    // System Common
+    send(5, 0xb0, 7, 0x12, 2);
+    static const uint8_t expected[] = {
+        0x80, 0x85, 0xb0, 7, 0x10,
+        0x85, 0xf8,
+        0x85, 0xb0, 7, 0x11,
+        0x85, 0xf2, 1, 2,
+        0x85, 0xb0, 7, 0x12,
+    };
+    check_packet(expected, sizeof(expected));
+    check_round_trip();
+}
+
+static void test_new_packet_resets_running_status(void)
+{
+    reset(97);
+    send(5, 0xb0, 7, 0x10, 2);
+    flush();
+    send(5, 0xb0, 7, 0x11, 2);
+    static const uint8_t expected[] = {0x80, 0x85, 0xb0, 7, 0x11};
+    check_packet(expected, sizeof(expected));
+    check_round_trip();
+}
+
+static void test_group_encoding(void)
+{
+    reset(97);
+    send(5, 0xb0, 99, 0, 2);
+    // NRPN: parameter MSB/LSB, data entry MSB/LSB, continuing the running status
+    static const uint8_t nrpn[] = {0xb0, 99, 1, 0xb0, 98, 2, 0xb0, 6, 3, 0xb0, 38, 4};
+    send_group(5, nrpn, sizeof(nrpn));
+    // 14 bit CC on another channel at a later time
+    static const uint8_t cc14[] = {0xb1, 7, 100, 0xb1, 39, 5};
+    send_group(9, cc14, sizeof(cc14));
+    static const uint8_t expected[] = {
+        0x80, 0x85, 0xb0, 99, 0,
+        99, 1, 98, 2, 6, 3, 38, 4,
+        0x89, 0xb1, 7, 100, 39, 5,
+    };
+    check_packet(expected, sizeof(expected));
+    check_round_trip();
+}
+
+static void test_timestamp_wraparound(void)
+{
+    // timestampLow wraps within the packet, the receiver advances timestampHigh
+    reset(97);
+    send(0x7e, 0xb0, 1, 1, 2);
+    send(0x85, 0xb0, 1, 2, 2);
+    send(0x185, 0xb0, 1, 3, 2);  // More than 127 mS ahead: next packet
+    CHECK_EQ(s_num_received, 2);
+    flush();
+    send(0x1ffe, 0xb0, 1, 4, 2);
+    send(0x0003, 0xb0, 1, 5, 2); // The 13 bit timestamp wraps too
+    flush();
+    check_round_trip();
+}
+
+static void test_random_round_trip(void)
+{
+    static const size_t packet_sizes[] = {20, 97, BLEMIDI_PACKET_BUFFER_SIZE};
+
+    srand(1);
+    for (size_t s = 0; s < sizeof(packet_sizes) / sizeof(packet_sizes[0]); s++)
+    {
+        reset(packet_sizes[s]);
+        uint16_t timestamp = 8000; // Crosses the 13 bit wraparound early
+        size_t raw_bytes = 0;
+
+        while (s_num_sent < MAX_MESSAGES - 4)
+        {
+            if (rand() % 3 == 0)
+                timestamp = (timestamp + rand() % 40) & 0x1fff;
+
+            int kind = rand() % 12;
+            uint8_t channel = rand() % 2;
+            if (kind < 5)
+                send(timestamp, 0xb0 | channel, rand() % 3, rand() & 0x7f, 2);
+            else if (kind < 6)
+                send(timestamp, 0xc0 | channel, rand() & 0x7f, 0, 1);
+            else if (kind < 7)
+                send(timestamp, 0xe0 | channel, rand() & 0x7f, rand() & 0x7f, 2);
+            else if (kind < 8)
+                send(timestamp, 0xf8, 0, 0, 0);
+            else if (kind < 9)
+                send(timestamp, 0xf2, rand() & 0x7f, rand() & 0x7f, 2);
+            else if (kind < 10)
+                send(timestamp, 0x90 | channel, 60, rand() & 0x7f, 2);
+            else
+            {
+                uint8_t group[12];
+                size_t len = (kind == 10) ? 6 : 12;
+                for (size_t i = 0; i < len; i += 3)
+                {
+                    group[i] = 0xb0 | channel;
+                    group[i + 1] = rand() & 0x7f;
+                    group[i + 2] = rand() & 0x7f;
+                }
+                send_group(timestamp, group, len);
+            }
+
+            if (rand() % 40 == 0)
+                flush();
+        }
+        flush();
+
+        for (size_t i = 0; i < s_num_sent; i++)
+            raw_bytes += 2 + s_sent[i].len; // timestampLow, status and data of every message
+        printf("%u byte packets: %u messages, %u bytes on air, %u without running status\n",
+               (unsigned)packet_sizes[s], (unsigned)s_num_sent, (unsigned)s_bytes_on_air, (unsigned)raw_bytes);
+        CHECK(s_bytes_on_air < raw_bytes);
+        check_round_trip();
+    }
+}
+
+int main(void)
+{
+    test_running_status_encoding();
+    test_one_data_byte();
+    test_system_messages_cancel_running_status();
+    test_new_packet_resets_running_status();
+    test_group_encoding();
+    test_timestamp_wraparound();
+    test_random_round_trip();
+    return host_test_result();
+}
@@ -0,0 +1,80 @@
+/*
+ * Counters of the BLE MIDI transmit queue with two targets.
+ *
+ * Every packet is accounted once per target: sent when the target popped it,
+ * too long when it was skipped for the target's MTU, dropped when nobody
+ * else waited for it after its target went away.
+ */
+
+#include <string.h>
+#include "blemidi_txqueue.h"
+#include "host_test.h"
+
+static blemidi_txqueue_t s_queue;
+
+// Header, timestamp and a realtime message, never dropped
+static void push(uint8_t id)
+{
+    uint8_t packet[] = {0x80, (uint8_t)(0x80 | id), 0xf8};
+    CHECK_EQ(blemidi_txqueue_push(&s_queue, packet, sizeof(packet), true), 0);
+}
+
+static void test_pop_and_skip(void)
+{
+    blemidi_txqueue_init(&s_queue);
+    blemidi_txqueue_set_targets(&s_queue, 0x03);
+    push(1);
+    push(2);
+    CHECK_EQ(blemidi_txqueue_count(&s_queue), 2);
+
+    // Target 0 can't take the first packet, target 1 sends it
+    const blemidi_txqueue_entry_t *entry = blemidi_txqueue_peek(&s_queue, 0);
+    CHECK(entry != NULL && entry->data[1] == 0x81);
+    blemidi_txqueue_skip_too_long(&s_queue, 0);
+    CHECK_EQ(s_queue.stats.too_long, 1);
+    CHECK_EQ(s_queue.stats.sent, 0);
+    CHECK_EQ(blemidi_txqueue_count(&s_queue), 2); // target 1 still waits for it
+
+    entry = blemidi_txqueue_peek(&s_queue, 0);
+    CHECK(entry != NULL && entry->data[1] == 0x82);
+    blemidi_txqueue_pop(&s_queue, 1);
+    CHECK_EQ(s_queue.stats.sent, 1);
+    CHECK_EQ(blemidi_txqueue_count(&s_queue), 1);
+
+    blemidi_txqueue_pop(&s_queue, 0);
+    blemidi_txqueue_skip_too_long(&s_queue, 1);
+    CHECK_EQ(blemidi_txqueue_count(&s_queue), 0);
+    CHECK_EQ(s_queue.stats.sent, 2);
+    CHECK_EQ(s_queue.stats.too_long, 2);
+    CHECK_EQ(s_queue.stats.sent + s_queue.stats.too_long, 2 * s_queue.stats.queued);
+
+    // Nothing left to release
+    blemidi_txqueue_skip_too_long(&s_queue, 0);
+    blemidi_txqueue_pop(&s_queue, 0);
+    CHECK_EQ(s_queue.stats.sent, 2);
+    CHECK_EQ(s_queue.stats.too_long, 2);
+}
+
+static void test_remove_target(void)
+{
+    blemidi_txqueue_init(&s_queue);
+    blemidi_txqueue_set_targets(&s_queue, 0x03);
+    push(1);
+    push(2);
+    blemidi_txqueue_pop(&s_queue, 1);
+    blemidi_txqueue_pop(&s_queue, 1);
+
+    // Only target 0 waited for the packets, they are gone with it
+    blemidi_txqueue_remove_target(&s_queue, 0);
+    CHECK_EQ(blemidi_txqueue_count(&s_queue), 0);
+    CHECK_EQ(s_queue.stats.dropped, 2);
+    CHECK_EQ(s_queue.stats.sent, 2);
+    CHECK_EQ(s_queue.stats.too_long, 0);
+}
+
+int main(void)
+{
+    test_pop_and_skip();
+    test_remove_target();
+    return host_test_result();
+}
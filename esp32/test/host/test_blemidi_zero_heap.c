@@ -0,0 +1,535 @@
+/*
+ * Checks that the BLE MIDI send path allocates no heap memory after
+ * blemidi_init(): malloc, calloc and realloc are wrapped by the linker and
+ * counted while two centrals connect, exchange their MTUs and receive large
+ * SysEx dumps interleaved with CCs.
+ *
+ * blemidi.c runs against the stub headers in stubs/ and the fake Bluetooth
+ * stack below, which records the notifications of every connection. They are
+ * parsed back at the end to make sure the dumps arrived intact.
+ *
+ * The same fake stack checks the per connection state of the GATT server:
+ * notifications only after a CCC write or a restored bond, data length
+ * requests answered one connection at a time and long writes of two centrals.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "blemidi.h"
+#include "blemidi_parser.h"
+#include "esp_bt.h"
+#include "esp_bt_main.h"
+#include "esp_gap_ble_api.h"
+#include "esp_gatt_common_api.h"
+#include "esp_gatts_api.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+#include "nvs.h"
+#include "nvs_flash.h"
+#include "host_test.h"
+
+#define GATTS_IF 3
+#define CCC_HANDLE 43 // Client configuration of the MIDI characteristic, the last attribute
+#define SYSEX_LEN 4000
+#define SYSEX_ROUNDS 20
+
+// Counting allocator, linked with --wrap=malloc,--wrap=calloc,--wrap=realloc
+
+static bool s_counting;
+static long s_allocations;
+
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t count, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+
+void *__wrap_malloc(size_t size)
+{
+    s_allocations += s_counting;
+    return __real_malloc(size);
+}
+
+void *__wrap_calloc(size_t count, size_t size)
+{
+    s_allocations += s_counting;
+    return __real_calloc(count, size);
+}
+
+void *__wrap_realloc(void *ptr, size_t size)
+{
+    s_allocations += s_counting;
+    return __real_realloc(ptr, size);
+}
+
+// Fake clock, advanced by vTaskDelay()
+
+static int64_t s_now_us = 1000000;
+
+int64_t esp_timer_get_time(void)
+{
+    return s_now_us;
+}
+
+TickType_t xTaskGetTickCount(void)
+{
+    return (TickType_t)(s_now_us / 1000);
+}
+
+void vTaskDelay(TickType_t ticks)
+{
+    s_now_us += (int64_t)ticks * 1000;
+}
+
+TaskHandle_t xTaskGetCurrentTaskHandle(void)
+{
+    return (TaskHandle_t)&s_now_us;
+}
+
+SemaphoreHandle_t xSemaphoreCreateMutexStatic(StaticSemaphore_t *buffer)
+{
+    buffer->count = 1;
+    buffer->binary = false;
+    return buffer;
+}
+
+SemaphoreHandle_t xSemaphoreCreateBinaryStatic(StaticSemaphore_t *buffer)
+{
+    buffer->count = 0;
+    buffer->binary = true;
+    return buffer;
+}
+
+BaseType_t xSemaphoreTake(SemaphoreHandle_t semaphore, TickType_t ticks)
+{
+    if (semaphore->count == 0)
+    {
+        // Nobody else can give it in a single threaded test
+        CHECK(semaphore->binary);
+        vTaskDelay(ticks);
+        return pdFALSE;
+    }
+    semaphore->count--;
+    return pdTRUE;
+}
+
+BaseType_t xSemaphoreGive(SemaphoreHandle_t semaphore)
+{
+    if (semaphore->binary && semaphore->count > 0)
+        return pdFALSE;
+    semaphore->count++;
+    return pdTRUE;
+}
+
+// Fake Bluetooth stack
+
+typedef struct
+{
+    uint8_t data[1 << 17];
+    size_t len;
+    size_t packet_lens[2048];
+    size_t num_packets;
+} air_t;
+
+static air_t s_air[BLEMIDI_MAX_CONNECTIONS];
+static esp_gatts_cb_t s_gatts_callback;
+static esp_gap_ble_cb_t s_gap_callback;
+static int s_disconnects;
+static int s_data_len_requests;
+static esp_gatt_status_t s_response_status;
+
+esp_err_t esp_ble_gatts_send_indicate(esp_gatt_if_t gatts_if, uint16_t conn_id, uint16_t attr_handle,
+                                      uint16_t value_len, uint8_t *value, bool need_confirm)
+{
+    if (conn_id >= BLEMIDI_MAX_CONNECTIONS)
+        return ESP_FAIL;
+    air_t *air = &s_air[conn_id];
+    if (air->len + value_len > sizeof(air->data) || air->num_packets >= sizeof(air->packet_lens) / sizeof(air->packet_lens[0]))
+        return ESP_FAIL;
+    memcpy(air->data + air->len, value, value_len);
+    air->len += value_len;
+    air->packet_lens[air->num_packets++] = value_len;
+    return ESP_OK;
+}
+
+esp_err_t esp_ble_gatts_register_callback(esp_gatts_cb_t callback)
+{
+    s_gatts_callback = callback;
+    return ESP_OK;
+}
+
+esp_err_t esp_ble_gap_disconnect(esp_bd_addr_t remote_device)
+{
+    s_disconnects++;
+    return ESP_OK;
+}
+
+esp_err_t esp_ble_gatts_app_register(uint16_t app_id) { return ESP_OK; }
+esp_err_t esp_ble_gatts_create_attr_tab(const esp_gatts_attr_db_t *gatts_attr_db, esp_gatt_if_t gatts_if,
+                                        uint16_t max_nb_attr, uint8_t srvc_inst_id) { return ESP_OK; }
+esp_err_t esp_ble_gatts_start_service(uint16_t service_handle) { return ESP_OK; }
+esp_err_t esp_ble_gatts_send_response(esp_gatt_if_t gatts_if, uint16_t conn_id, uint32_t trans_id,
+                                      esp_gatt_status_t status, esp_gatt_rsp_t *rsp)
+{
+    s_response_status = status;
+    return ESP_OK;
+}
+esp_err_t esp_ble_gatt_set_local_mtu(uint16_t mtu) { return ESP_OK; }
+esp_err_t esp_ble_gap_register_callback(esp_gap_ble_cb_t callback)
+{
+    s_gap_callback = callback;
+    return ESP_OK;
+}
+
+esp_err_t esp_ble_gap_set_device_name(const char *name) { return ESP_OK; }
+esp_err_t esp_ble_gap_config_adv_data(esp_ble_adv_data_t *adv_data) { return ESP_OK; }
+esp_err_t esp_ble_gap_start_advertising(esp_ble_adv_params_t *adv_params) { return ESP_OK; }
+esp_err_t esp_ble_gap_update_conn_params(esp_ble_conn_update_params_t *params) { return ESP_OK; }
+esp_err_t esp_ble_gap_set_pkt_data_len(esp_bd_addr_t remote_device, uint16_t tx_data_length)
+{
+    s_data_len_requests++;
+    return ESP_OK;
+}
+
+esp_err_t esp_ble_gap_set_preferred_phy(esp_bd_addr_t remote_device, esp_ble_gap_phy_mask_t all_phys_mask,
+                                        esp_ble_gap_phy_mask_t tx_phy_mask, esp_ble_gap_phy_mask_t rx_phy_mask,
+                                        esp_ble_gap_prefer_phy_options_t phy_options) { return ESP_OK; }
+esp_err_t esp_ble_gap_set_security_param(esp_ble_sm_param_t param_type, void *value, uint8_t len) { return ESP_OK; }
+esp_err_t esp_ble_gap_security_rsp(esp_bd_addr_t bd_addr, bool accept) { return ESP_OK; }
+esp_err_t esp_ble_confirm_reply(esp_bd_addr_t bd_addr, bool accept) { return ESP_OK; }
+esp_err_t esp_bt_controller_mem_release(esp_bt_mode_t mode) { return ESP_OK; }
+esp_err_t esp_bt_controller_init(esp_bt_controller_config_t *cfg) { return ESP_OK; }
+esp_err_t esp_bt_controller_enable(esp_bt_mode_t mode) { return ESP_OK; }
+esp_err_t esp_bluedroid_init(void) { return ESP_OK; }
+esp_err_t esp_bluedroid_enable(void) { return ESP_OK; }
+esp_err_t nvs_flash_init(void) { return ESP_OK; }
+esp_err_t nvs_flash_erase(void) { return ESP_OK; }
+
+// Fake NVS, a few u8 keys in one namespace
+
+#define NVS_KEYS 4
+
+static char s_nvs_keys[NVS_KEYS][NVS_KEY_NAME_MAX_SIZE];
+static uint8_t s_nvs_values[NVS_KEYS];
+
+static int nvs_find(const char *key)
+{
+    for (int i = 0; i < NVS_KEYS; i++)
+    {
+        if (strcmp(s_nvs_keys[i], key) == 0)
+            return i;
+    }
+    return -1;
+}
+
+esp_err_t nvs_open(const char *name, nvs_open_mode_t open_mode, nvs_handle_t *out_handle)
+{
+    *out_handle = 1;
+    return ESP_OK;
+}
+
+void nvs_close(nvs_handle_t handle) {}
+esp_err_t nvs_commit(nvs_handle_t handle) { return ESP_OK; }
+
+esp_err_t nvs_get_u8(nvs_handle_t handle, const char *key, uint8_t *out_value)
+{
+    int i = nvs_find(key);
+    if (i < 0)
+        return ESP_ERR_NVS_NOT_FOUND;
+    *out_value = s_nvs_values[i];
+    return ESP_OK;
+}
+
+esp_err_t nvs_set_u8(nvs_handle_t handle, const char *key, uint8_t value)
+{
+    int i = nvs_find(key);
+    if (i < 0)
+        i = nvs_find("");
+    if (i < 0)
+        return ESP_ERR_NO_MEM;
+    strncpy(s_nvs_keys[i], key, NVS_KEY_NAME_MAX_SIZE - 1);
+    s_nvs_values[i] = value;
+    return ESP_OK;
+}
+
+esp_err_t nvs_erase_key(nvs_handle_t handle, const char *key)
+{
+    int i = nvs_find(key);
+    if (i < 0)
+        return ESP_ERR_NVS_NOT_FOUND;
+    s_nvs_keys[i][0] = '\0';
+    return ESP_OK;
+}
+void esp_log_level_set(const char *tag, esp_log_level_t level) {}
+const char *esp_err_to_name(esp_err_t code) { return "ESP_ERR"; }
+
+static void gatts_event(esp_gatts_cb_event_t event, esp_ble_gatts_cb_param_t *param)
+{
+    s_gatts_callback(event, GATTS_IF, param);
+}
+
+static void connect(uint16_t conn_id, uint16_t mtu)
+{
+    esp_ble_gatts_cb_param_t param;
+    memset(&param, 0, sizeof(param));
+    param.connect.conn_id = conn_id;
+    param.connect.remote_bda[5] = (uint8_t)conn_id;
+    param.connect.conn_params.interval = 24;
+    gatts_event(ESP_GATTS_CONNECT_EVT, &param);
+
+    if (mtu > 0)
+    {
+        memset(&param, 0, sizeof(param));
+        param.mtu.conn_id = conn_id;
+        param.mtu.mtu = mtu;
+        gatts_event(ESP_GATTS_MTU_EVT, &param);
+    }
+}
+
+static void set_notifications(uint16_t conn_id, bool enabled)
+{
+    uint8_t value[2] = {enabled ? 0x01 : 0x00, 0x00};
+    esp_ble_gatts_cb_param_t param;
+    memset(&param, 0, sizeof(param));
+    param.write.conn_id = conn_id;
+    param.write.handle = CCC_HANDLE;
+    param.write.value = value;
+    param.write.len = sizeof(value);
+    gatts_event(ESP_GATTS_WRITE_EVT, &param);
+}
+
+static void authenticate(uint16_t conn_id, bool bond)
+{
+    esp_ble_gap_cb_param_t param;
+    memset(&param, 0, sizeof(param));
+    param.ble_security.auth_cmpl.bd_addr[5] = (uint8_t)conn_id;
+    param.ble_security.auth_cmpl.success = true;
+    param.ble_security.auth_cmpl.auth_mode = bond ? ESP_LE_AUTH_BOND : 0;
+    s_gap_callback(ESP_GAP_BLE_AUTH_CMPL_EVT, &param);
+}
+
+static void data_len_complete(uint8_t len)
+{
+    esp_ble_gap_cb_param_t param;
+    memset(&param, 0, sizeof(param));
+    param.pkt_data_length_cmpl.status = ESP_BT_STATUS_SUCCESS;
+    param.pkt_data_length_cmpl.params.rx_len = len;
+    param.pkt_data_length_cmpl.params.tx_len = len;
+    s_gap_callback(ESP_GAP_BLE_SET_PKT_LENGTH_COMPLETE_EVT, &param);
+}
+
+static esp_gatt_status_t prepare_write(uint16_t conn_id)
+{
+    uint8_t value[20] = {0};
+    esp_ble_gatts_cb_param_t param;
+    memset(&param, 0, sizeof(param));
+    param.write.conn_id = conn_id;
+    param.write.handle = CCC_HANDLE - 1;
+    param.write.value = value;
+    param.write.len = sizeof(value);
+    param.write.is_prep = true;
+    param.write.need_rsp = true;
+    s_response_status = ESP_GATT_OK;
+    gatts_event(ESP_GATTS_WRITE_EVT, &param);
+    return s_response_status;
+}
+
+static void exec_write(uint16_t conn_id)
+{
+    esp_ble_gatts_cb_param_t param;
+    memset(&param, 0, sizeof(param));
+    param.exec_write.conn_id = conn_id;
+    param.exec_write.exec_write_flag = ESP_GATT_PREP_WRITE_EXEC;
+    gatts_event(ESP_GATTS_EXEC_WRITE_EVT, &param);
+}
+
+static bool subscribed(uint8_t index)
+{
+    blemidi_link_info_t info;
+    CHECK_EQ(blemidi_get_connection_info(index, &info), 0);
+    return info.subscribed != 0;
+}
+
+static void disconnect(uint16_t conn_id)
+{
+    esp_ble_gatts_cb_param_t param;
+    memset(&param, 0, sizeof(param));
+    param.disconnect.conn_id = conn_id;
+    gatts_event(ESP_GATTS_DISCONNECT_EVT, &param);
+}
+
+// Receiving side
+
+static uint8_t s_sysex[SYSEX_LEN];
+static uint8_t s_received_sysex[SYSEX_ROUNDS * SYSEX_LEN];
+static size_t s_received_sysex_len;
+static int s_received_ccs;
+
+static void on_message(uint8_t port, uint16_t timestamp, uint8_t status, uint8_t *data, size_t len, size_t continued_sysex_pos)
+{
+    if (status == 0xf0)
+    {
+        if (s_received_sysex_len + len <= sizeof(s_received_sysex))
+            memcpy(s_received_sysex + s_received_sysex_len, data, len);
+        s_received_sysex_len += len;
+    }
+    else if ((status & 0xf0) == 0xb0)
+    {
+        s_received_ccs++;
+    }
+}
+
+static void fill_sysex(int round)
+{
+    s_sysex[0] = 0xf0;
+    for (size_t i = 1; i < SYSEX_LEN - 1; i++)
+        s_sysex[i] = (uint8_t)((i + round) & 0x7f);
+    s_sysex[SYSEX_LEN - 1] = 0xf7;
+}
+
+static void send_cc(uint8_t controller, uint8_t value)
+{
+    uint8_t cc[3] = {0xb0, controller, value};
+    CHECK_EQ(blemidi_send_message(0, cc, sizeof(cc)), 0);
+}
+
+int main(void)
+{
+    CHECK_EQ(blemidi_init(NULL), 0);
+    s_counting = true;
+
+    esp_ble_gatts_cb_param_t param;
+    memset(&param, 0, sizeof(param));
+    gatts_event(ESP_GATTS_REG_EVT, &param);
+
+    uint16_t handles[] = {40, 41, 42, CCC_HANDLE};
+    memset(&param, 0, sizeof(param));
+    param.add_attr_tab.num_handle = sizeof(handles) / sizeof(handles[0]);
+    param.add_attr_tab.handles = handles;
+    gatts_event(ESP_GATTS_CREAT_ATTR_TAB_EVT, &param);
+
+    // Two centrals with different MTUs, a third one is turned away
+    connect(0, 247);
+    connect(1, 100);
+    connect(2, 0);
+    CHECK_EQ(blemidi_get_num_connections(), 2);
+    CHECK_EQ(s_disconnects, 1);
+
+    // Nothing is sent before a central enables notifications
+    CHECK(!subscribed(0));
+    CHECK(!subscribed(1));
+    set_notifications(0, true);
+    set_notifications(1, true);
+    CHECK(subscribed(0));
+    CHECK(subscribed(1));
+
+    // The data length event doesn't name the central, one request is outstanding at a time
+    CHECK_EQ(blemidi_set_link_profile(BLEMIDI_LINK_PROFILE_LOW_LATENCY), 0);
+    CHECK_EQ(s_data_len_requests, 1);
+    data_len_complete(251);
+    CHECK_EQ(s_data_len_requests, 2);
+    data_len_complete(123);
+    CHECK_EQ(s_data_len_requests, 2);
+    blemidi_link_info_t link;
+    CHECK_EQ(blemidi_get_connection_info(0, &link), 0);
+    CHECK_EQ(link.tx_data_len, 251);
+    CHECK_EQ(blemidi_get_connection_info(1, &link), 0);
+    CHECK_EQ(link.tx_data_len, 123);
+
+    // A long write of the second central waits until the first one is executed
+    CHECK_EQ(prepare_write(0), ESP_GATT_OK);
+    CHECK_EQ(prepare_write(1), ESP_GATT_PREPARE_Q_FULL);
+    exec_write(1);
+    CHECK_EQ(prepare_write(0), ESP_GATT_OK);
+    exec_write(0);
+    CHECK_EQ(prepare_write(1), ESP_GATT_OK);
+    exec_write(1);
+
+    blemidi_get_link_info(&link);
+    CHECK_EQ(link.max_packet_len, 100 - 3);
+
+    // SysEx dumps split over many packets, between CCs
+    for (int round = 0; round < SYSEX_ROUNDS; round++)
+    {
+        fill_sysex(round);
+        send_cc(7, (uint8_t)round);
+        CHECK_EQ(blemidi_send_message(0, s_sysex, SYSEX_LEN), 0);
+        send_cc(7, (uint8_t)round);
+        CHECK_EQ(blemidi_outbuffer_flush(0), 0);
+    }
+
+    // Both centrals got the same packets
+    CHECK(s_air[0].num_packets > SYSEX_ROUNDS * SYSEX_LEN / 97);
+    CHECK_EQ(s_air[1].num_packets, s_air[0].num_packets);
+    CHECK_EQ(s_air[1].len, s_air[0].len);
+    CHECK(memcmp(s_air[0].data, s_air[1].data, s_air[0].len) == 0);
+
+    // A central which turned notifications off gets nothing more
+    set_notifications(1, false);
+    size_t packets_before = s_air[0].num_packets;
+    send_cc(8, 1);
+    CHECK_EQ(blemidi_outbuffer_flush(0), 0);
+    CHECK_EQ(s_air[0].num_packets, packets_before + 1);
+    CHECK_EQ(s_air[1].num_packets, packets_before);
+
+    // Once the smaller MTU is gone the packets grow to the larger one
+    disconnect(1);
+    CHECK_EQ(blemidi_get_num_connections(), 1);
+    blemidi_get_link_info(&link);
+    CHECK_EQ(link.max_packet_len, 247 - 3);
+    send_cc(8, 2);
+    CHECK_EQ(blemidi_outbuffer_flush(0), 0);
+
+    s_counting = false;
+    printf("allocations after init: %ld, %u packets, %u bytes\n",
+           s_allocations, (unsigned)s_air[0].num_packets, (unsigned)s_air[0].len);
+    CHECK_EQ(s_allocations, 0);
+
+    blemidi_tx_stats_t stats;
+    blemidi_get_tx_stats(&stats);
+    CHECK_EQ(stats.dropped, 0);
+    CHECK_EQ(stats.too_long, 0);
+
+    // Parse what the first central received: every dump byte and every CC
+    blemidi_parser_t parser;
+    blemidi_parser_init(&parser);
+    size_t pos = 0;
+    for (size_t i = 0; i < s_air[0].num_packets; i++)
+    {
+        CHECK(s_air[0].packet_lens[i] <= 247 - 3);
+        CHECK(blemidi_parse_packet(&parser, 0, s_air[0].data + pos, s_air[0].packet_lens[i], on_message) >= 0);
+        pos += s_air[0].packet_lens[i];
+    }
+    CHECK_EQ(parser.num_errors, 0);
+    CHECK_EQ(s_received_ccs, 2 * SYSEX_ROUNDS + 2);
+    CHECK_EQ(s_received_sysex_len, SYSEX_ROUNDS * (SYSEX_LEN - 2));
+    for (int round = 0; round < SYSEX_ROUNDS && s_received_sysex_len == SYSEX_ROUNDS * (SYSEX_LEN - 2); round++)
+    {
+        fill_sysex(round);
+        CHECK(memcmp(s_received_sysex + round * (SYSEX_LEN - 2), s_sysex + 1, SYSEX_LEN - 2) == 0);
+    }
+
+    // A bonded central gets its stored CCC value back once the link is encrypted
+    connect(1, 100);
+    authenticate(1, true);
+    CHECK(!subscribed(1));
+    set_notifications(1, true);
+    disconnect(1);
+    connect(1, 100);
+    CHECK(!subscribed(1));
+    authenticate(1, true);
+    CHECK(subscribed(1));
+
+    // Without a bond nothing is restored or stored
+    disconnect(1);
+    connect(1, 100);
+    authenticate(1, false);
+    CHECK(!subscribed(1));
+    set_notifications(1, false);
+    disconnect(1);
+    connect(1, 100);
+    authenticate(1, true);
+    CHECK(subscribed(1));
+
+    return host_test_result();
+}
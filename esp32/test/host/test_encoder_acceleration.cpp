@@ -0,0 +1,201 @@
+/*
+ * Replays detent timing traces through EncoderAccelerator and checks the
+ * value trajectories a CC parameter (0-127) would follow.
+ *
+ * The traces have the shape the knob timer produces: every detent carries the
+ * time of the tick which decoded it. They were recorded with the former 3 ms
+ * tick, so intervals are multiples of 3 ms (TICKS_INTERVAL is 2 ms now).
+ */
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+#include "encoder_acceleration.h"
+#include "host_test.h"
+
+struct Detent
+{
+    int8_t delta;
+    uint32_t intervalMs; // Since the previous detent of the trace
+};
+
+struct Trajectory
+{
+    std::vector<int32_t> steps;
+    std::vector<int32_t> values;
+};
+
+// Slow, deliberate turn to the right
+static const Detent SLOW_TURN[] = {
+    {1, 0}, {1, 150}, {1, 120}, {1, 96}, {1, 84}, {1, 72}, {1, 66}, {1, 60},
+    {1, 60}, {1, 63}, {1, 72}, {1, 90}, {1, 111}, {1, 135}, {1, 180}, {1, 240},
+};
+
+// One quick flick: spins up within a few detents, peaks at the (3 ms) tick rate, runs out
+static const Detent FLICK[] = {
+    {1, 0}, {1, 33}, {1, 21}, {1, 12}, {1, 9}, {1, 6}, {1, 6}, {1, 3},
+    {1, 3}, {1, 3}, {1, 3}, {1, 3}, {1, 3}, {1, 3}, {1, 6}, {1, 3},
+    {1, 6}, {1, 6}, {1, 6}, {1, 9}, {1, 9}, {1, 12}, {1, 15}, {1, 21},
+    {1, 30}, {1, 45},
+};
+
+// Flick to the top, a pause, then fine adjustment back down
+static const Detent FLICK_THEN_FINE[] = {
+    {1, 0}, {1, 24}, {1, 12}, {1, 6}, {1, 3}, {1, 3}, {1, 3}, {1, 3},
+    {1, 3}, {1, 3}, {1, 6}, {1, 6}, {1, 9}, {1, 15},
+    {-1, 420}, {-1, 210}, {-1, 180}, {-1, 240},
+};
+
+// Fast spin right, then the hand snaps back to the left
+static const Detent REVERSAL[] = {
+    {1, 0}, {1, 9}, {1, 6}, {1, 3}, {1, 3}, {1, 3}, {1, 3},
+    {-1, 3}, {-1, 3}, {-1, 3},
+};
+
+// Steady medium speed, 15 ms per detent
+static const Detent MEDIUM[] = {
+    {1, 0}, {1, 15}, {1, 15}, {1, 15}, {1, 15}, {1, 15}, {1, 15}, {1, 15},
+    {1, 15}, {1, 15}, {1, 15}, {1, 15}, {1, 15}, {1, 15}, {1, 15}, {1, 15},
+};
+
+template <size_t N>
+static Trajectory replay(const Detent (&trace)[N], AccelerationCurve curve, int32_t startValue = 0)
+{
+    EncoderAccelerator accelerator;
+    Trajectory trajectory;
+    int64_t timeUs = 1000000;
+    int32_t value = startValue;
+    for (const Detent& detent : trace)
+    {
+        timeUs += detent.intervalMs * 1000;
+        int32_t steps = accelerator.apply(detent.delta, timeUs, curve);
+        // PageView::incrementValue clamps to the parameter range
+        value = std::clamp<int32_t>(value + steps, 0, 127);
+        trajectory.steps.push_back(steps);
+        trajectory.values.push_back(value);
+    }
+    return trajectory;
+}
+
+static int32_t sum(const std::vector<int32_t>& steps)
+{
+    int32_t total = 0;
+    for (int32_t step : steps)
+    {
+        total += step;
+    }
+    return total;
+}
+
+static void testSlowTurnKeepsSingleSteps()
+{
+    for (AccelerationCurve curve : {AccelerationCurve::NONE, AccelerationCurve::LINEAR, AccelerationCurve::EXPONENTIAL})
+    {
+        Trajectory t = replay(SLOW_TURN, curve, 40);
+        for (size_t i = 0; i < t.steps.size(); i++)
+        {
+            CHECK_EQ(t.steps[i], 1);
+        }
+        CHECK_EQ(t.values.back(), 40 + 16);
+    }
+}
+
+static void testFlickCoversFullRange()
+{
+    const size_t detents = sizeof(FLICK) / sizeof(FLICK[0]);
+
+    Trajectory linear = replay(FLICK, AccelerationCurve::LINEAR);
+    CHECK_EQ(linear.values.back(), 127);
+    Trajectory exponential = replay(FLICK, AccelerationCurve::EXPONENTIAL);
+    CHECK_EQ(exponential.values.back(), 127);
+
+    // Without acceleration (ProgramChange, BooleanCC) every detent is one step
+    Trajectory none = replay(FLICK, AccelerationCurve::NONE);
+    CHECK_EQ(none.values.back(), static_cast<int32_t>(detents));
+
+    // The flick spins up: the first detent is a single step, no step exceeds the maximum multiplier
+    for (const Trajectory* t : {&linear, &exponential})
+    {
+        CHECK_EQ(t->steps[0], 1);
+        for (size_t i = 0; i < t->steps.size(); i++)
+        {
+            CHECK(t->steps[i] >= 0 && t->steps[i] <= 8);
+            CHECK(i == 0 || t->values[i] >= t->values[i - 1]);
+        }
+    }
+}
+
+static void testPauseRestoresPrecision()
+{
+    for (AccelerationCurve curve : {AccelerationCurve::LINEAR, AccelerationCurve::EXPONENTIAL})
+    {
+        Trajectory t = replay(FLICK_THEN_FINE, curve);
+        size_t firstFine = t.steps.size() - 4;
+        CHECK(t.values[firstFine - 1] > 60);
+        for (size_t i = firstFine; i < t.steps.size(); i++)
+        {
+            CHECK_EQ(t.steps[i], -1);
+        }
+    }
+}
+
+static void testReversalStartsAtSingleStep()
+{
+    Trajectory t = replay(REVERSAL, AccelerationCurve::LINEAR, 64);
+    CHECK(t.steps[6] > 1);
+    CHECK_EQ(t.steps[7], -1);
+    // Then it picks up speed in the new direction
+    CHECK(t.steps[9] < -1);
+}
+
+static void testExponentialIsGentlerAtMediumSpeed()
+{
+    Trajectory linear = replay(MEDIUM, AccelerationCurve::LINEAR);
+    Trajectory exponential = replay(MEDIUM, AccelerationCurve::EXPONENTIAL);
+    CHECK(sum(exponential.steps) < sum(linear.steps));
+    CHECK(sum(exponential.steps) > static_cast<int32_t>(sizeof(MEDIUM) / sizeof(MEDIUM[0])));
+}
+
+static void testFractionalStepsCarryOver()
+{
+    // At a constant rate the steps add up to detents * multiplier, whatever their rounding
+    EncoderAccelerator accelerator;
+    int64_t timeUs = 0;
+    int32_t total = 0;
+    accelerator.apply(1, timeUs, AccelerationCurve::LINEAR);
+    for (int i = 0; i < 40; i++)
+    {
+        timeUs += 15000;
+        accelerator.apply(1, timeUs, AccelerationCurve::LINEAR);
+    }
+    // The rate estimate has settled at 15 ms now
+    float multiplier = accelerator.getMultiplier(AccelerationCurve::LINEAR);
+    CHECK(multiplier > 1.0f && multiplier < 8.0f);
+    for (int i = 0; i < 100; i++)
+    {
+        timeUs += 15000;
+        total += accelerator.apply(1, timeUs, AccelerationCurve::LINEAR);
+    }
+    CHECK(std::abs(total - 100.0f * multiplier) <= 1.0f);
+}
+
+static void testMergedEventKeepsTravel()
+{
+    // Overflowed travel arrives as one event with a larger delta
+    EncoderAccelerator accelerator;
+    CHECK_EQ(accelerator.apply(5, 1000000, AccelerationCurve::LINEAR), 5);
+    CHECK_EQ(accelerator.apply(-3, 2000000, AccelerationCurve::EXPONENTIAL), -3);
+    CHECK_EQ(accelerator.apply(0, 2001000, AccelerationCurve::LINEAR), 0);
+}
+
+int main()
+{
+    testSlowTurnKeepsSingleSteps();
+    testFlickCoversFullRange();
+    testPauseRestoresPrecision();
+    testReversalStartsAtSingleStep();
+    testExponentialIsGentlerAtMediumSpeed();
+    testFractionalStepsCarryOver();
+    testMergedEventKeepsTravel();
+    return host_test_result();
+}
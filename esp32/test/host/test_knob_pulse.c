@@ -0,0 +1,320 @@
+/*
+ * Drives the PCNT knob backend with the pulses of the bidirectional switch.
+ *
+ * The waveform is the one of bench_knob_debounce.c: a detent to the right
+ * pulls phase A low for part of the detent, a detent to the left phase B,
+ * while the other phase stays idle high. Both edges bounce for 0.5 ms and the
+ * idle phase gets a 0.3 ms crosstalk glitch in every detent.
+ *
+ * It goes through a model of the pulse counter as knob_pcnt_setup()
+ * configures it: the glitch filter, falling edges of A counting up and of B
+ * counting down with a watch point on every count. The edges are then handled
+ * like knob_pcnt_task() does: knob_pulse_edge(), a sleep of whole RTOS ticks,
+ * the phase level (twice if low) and knob_pulse_settled().
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "bidi_switch_knob.h"
+#include "knob_pulse.h"
+#include "host_test.h"
+
+#define MAX_PULSES 400
+#define MAX_TRANSITIONS (MAX_PULSES * 32)
+#define BOUNCE_CHUNK_US 50 // Contact bounce toggles at most this often
+#define GAP_US 100000      // Rest before the first and after the last detent
+#define RTOS_TICK_US 1000
+
+typedef struct
+{
+    double rpm;
+    int detents_per_rev;
+    double duty;         // Share of a detent the phase is pulled low (0-1)
+    int64_t bounce_us;   // Bounce after each edge
+    double jitter;       // Relative spread of detent period and pulse width (0-1)
+    int64_t crosstalk_us; // Glitch on the idle phase, 0 = none
+    int detents;
+    unsigned seed;
+} pulse_config_t;
+
+typedef struct
+{
+    int64_t start_us;
+    int64_t end_us; // Release edge
+    int direction;  // +1 = right (phase A), -1 = left (phase B)
+} detent_t;
+
+typedef struct
+{
+    int64_t time_us;
+    uint8_t level;
+} transition_t;
+
+typedef struct
+{
+    transition_t t[MAX_TRANSITIONS];
+    size_t n;
+} phase_t;
+
+typedef struct
+{
+    int64_t time_us;
+    int direction;
+} edge_t;
+
+typedef struct
+{
+    int missed;
+    int extra;
+    int wrong_direction;
+} result_t;
+
+static detent_t s_detents[MAX_PULSES];
+static phase_t s_phase_a;
+static phase_t s_phase_b;
+static edge_t s_edges[2 * MAX_TRANSITIONS];
+static unsigned s_rand_state;
+
+static double random_unit(void)
+{
+    s_rand_state = s_rand_state * 1664525u + 1013904223u;
+    return (s_rand_state >> 8) / 16777216.0;
+}
+
+static void add(phase_t *phase, int64_t time_us, uint8_t level)
+{
+    uint8_t current = phase->n ? phase->t[phase->n - 1].level : 1;
+    if (level != current && phase->n < MAX_TRANSITIONS)
+    {
+        phase->t[phase->n].time_us = time_us;
+        phase->t[phase->n].level = level;
+        phase->n++;
+    }
+}
+
+// Random levels for bounce_us, then the final level
+static void bounce(phase_t *phase, int64_t time_us, int64_t bounce_us, uint8_t level)
+{
+    for (int64_t t = 0; t < bounce_us; t += BOUNCE_CHUNK_US)
+        add(phase, time_us + t, (t == 0) ? level : (random_unit() < 0.5));
+    add(phase, time_us + bounce_us, level);
+}
+
+static uint8_t level_at(const phase_t *phase, int64_t time_us)
+{
+    uint8_t level = 1;
+    for (size_t lo = 0, hi = phase->n; lo < hi;)
+    {
+        size_t mid = (lo + hi) / 2;
+        if (phase->t[mid].time_us <= time_us)
+        {
+            level = phase->t[mid].level;
+            lo = mid + 1;
+        }
+        else
+        {
+            hi = mid;
+        }
+    }
+    return level;
+}
+
+// Right, then left, then alternating runs so both phases and reversals are covered
+static int64_t generate(const pulse_config_t *cfg)
+{
+    s_rand_state = cfg->seed;
+    s_phase_a.n = 0;
+    s_phase_b.n = 0;
+    double period_us = 60e6 / (cfg->rpm * cfg->detents_per_rev);
+    int n = cfg->detents;
+    int64_t t = GAP_US;
+    for (int i = 0; i < n; i++)
+    {
+        int64_t period = (int64_t)(period_us * (1.0 + cfg->jitter * (random_unit() - 0.5)));
+        int64_t width = (int64_t)(period * cfg->duty * (1.0 + cfg->jitter * (random_unit() - 0.5)));
+        detent_t *d = &s_detents[i];
+        d->start_us = t;
+        d->end_us = t + width;
+        d->direction = (i < n / 2) ? 1 : (i < 3 * n / 4 ? -1 : ((i / 8) & 1 ? 1 : -1));
+
+        phase_t *pulsed = d->direction > 0 ? &s_phase_a : &s_phase_b;
+        phase_t *idle = d->direction > 0 ? &s_phase_b : &s_phase_a;
+        bounce(pulsed, d->start_us, cfg->bounce_us, 0);
+        bounce(pulsed, d->end_us, cfg->bounce_us, 1);
+        if (cfg->crosstalk_us > 0)
+        {
+            // Phases are generated in time order, so the glitch is added to the idle phase
+            // right here: it can't overlap a pulse of its own
+            int64_t glitch = t + (int64_t)(random_unit() * (period - cfg->crosstalk_us));
+            add(idle, glitch, 0);
+            add(idle, glitch + cfg->crosstalk_us, 1);
+        }
+        t += period;
+    }
+    return t + GAP_US;
+}
+
+// Glitch filter and falling edge counting of one channel, appended to s_edges
+static size_t count_edges(const phase_t *phase, int direction, size_t num_edges)
+{
+    const int64_t glitch_us = (KNOB_PCNT_GLITCH_NS + 999) / 1000;
+    uint8_t filtered = 1;
+    for (size_t i = 0; i < phase->n; i++)
+    {
+        // A level passes the filter once it held for the glitch time
+        int64_t settled_us = phase->t[i].time_us + glitch_us;
+        if (i + 1 < phase->n && phase->t[i + 1].time_us < settled_us)
+            continue;
+        uint8_t level = phase->t[i].level;
+        if (filtered && !level)
+        {
+            s_edges[num_edges].time_us = settled_us;
+            s_edges[num_edges].direction = direction;
+            num_edges++;
+        }
+        filtered = level;
+    }
+    return num_edges;
+}
+
+static int compare_edges(const void *a, const void *b)
+{
+    int64_t ta = ((const edge_t *)a)->time_us;
+    int64_t tb = ((const edge_t *)b)->time_us;
+    return (ta > tb) - (ta < tb);
+}
+
+static result_t run(const pulse_config_t *cfg)
+{
+    result_t result = {0};
+    generate(cfg);
+    size_t num_edges = count_edges(&s_phase_a, 1, 0);
+    num_edges = count_edges(&s_phase_b, -1, num_edges);
+    qsort(s_edges, num_edges, sizeof(edge_t), compare_edges);
+
+    // The task: one event at a time, sleeping whole ticks (plus one) while a window is open
+    knob_pulse_t pulse;
+    knob_pulse_init(&pulse, KNOB_PCNT_SETTLE_US);
+    int64_t tick_phase_us = (int64_t)(random_unit() * RTOS_TICK_US);
+    int64_t task_us = 0;
+    int decoded[MAX_PULSES] = {0};
+    int p = 0;
+    for (size_t i = 0; i < num_edges; i++)
+    {
+        const edge_t *e = &s_edges[i];
+        if (task_us < e->time_us)
+            task_us = e->time_us;
+        if (!knob_pulse_edge(&pulse, e->direction, e->time_us))
+            continue;
+
+        int64_t wait_us = e->time_us + KNOB_PCNT_SETTLE_US - task_us;
+        if (wait_us > 0)
+        {
+            int64_t ticks = (wait_us + 999) / 1000 + 1;
+            int64_t next_tick = task_us + RTOS_TICK_US - (task_us - tick_phase_us) % RTOS_TICK_US;
+            task_us = next_tick + (ticks - 1) * RTOS_TICK_US;
+        }
+        const phase_t *phase = e->direction > 0 ? &s_phase_a : &s_phase_b;
+        uint8_t level = level_at(phase, task_us);
+        if (!level)
+        {
+            task_us += RTOS_TICK_US - (task_us - tick_phase_us) % RTOS_TICK_US;
+            level = level_at(phase, task_us);
+        }
+        int detent = knob_pulse_settled(&pulse, e->direction, level, task_us);
+        if (detent == 0)
+            continue;
+
+        // A detent belongs to the generated one whose time span holds the read. A crosstalk
+        // glitch just before a pulse on its phase may open the window, the read sees the pulse.
+        while (p + 1 < cfg->detents && task_us >= s_detents[p + 1].start_us)
+            p++;
+        if (detent == s_detents[p].direction)
+            decoded[p]++;
+        else
+            result.wrong_direction++;
+    }
+
+    for (int i = 0; i < cfg->detents; i++)
+    {
+        if (decoded[i] == 0)
+            result.missed++;
+        else
+            result.extra += decoded[i] - 1;
+    }
+    return result;
+}
+
+static void test_windows(void)
+{
+    knob_pulse_t pulse;
+    knob_pulse_init(&pulse, 1000);
+
+    // Press with bounce: the first edge opens the window, the others are bounce
+    CHECK(knob_pulse_edge(&pulse, 1, 10000));
+    CHECK(!knob_pulse_edge(&pulse, 1, 10100));
+    CHECK(!knob_pulse_edge(&pulse, 1, 10999));
+    CHECK_EQ(knob_pulse_settled(&pulse, 1, 0, 11000), 1);
+    CHECK_EQ(pulse.bounce_edges, 2);
+
+    // Phase B has its own window
+    CHECK(knob_pulse_edge(&pulse, -1, 10500));
+    CHECK_EQ(knob_pulse_settled(&pulse, -1, 0, 11500), -1);
+
+    // Release bounce and crosstalk are high again when the window ends
+    CHECK(knob_pulse_edge(&pulse, 1, 11000));
+    CHECK_EQ(knob_pulse_settled(&pulse, 1, 1, 12000), 0);
+    CHECK_EQ(pulse.rejected_pulses, 1);
+
+    // A late read covers the edges up to it
+    CHECK(knob_pulse_edge(&pulse, 1, 20000));
+    CHECK_EQ(knob_pulse_settled(&pulse, 1, 0, 22500), 1);
+    CHECK(!knob_pulse_edge(&pulse, 1, 22000));
+    CHECK(knob_pulse_edge(&pulse, 1, 22500));
+}
+
+static void test_clean_pulses(void)
+{
+    pulse_config_t cfg = {
+        .rpm = 60, .detents_per_rev = 20, .duty = 0.4, .bounce_us = 0,
+        .jitter = 0, .crosstalk_us = 0, .detents = 80, .seed = 1,
+    };
+    result_t r = run(&cfg);
+    CHECK_EQ(r.missed, 0);
+    CHECK_EQ(r.extra, 0);
+    CHECK_EQ(r.wrong_direction, 0);
+}
+
+static void test_bounce_crosstalk_and_speed(void)
+{
+    // Up to 240 rpm nothing may be missed, like the polling backend. Above, pulses
+    // get shorter than the settle window plus a tick and some are dropped, but bounce
+    // and crosstalk must never turn into detents.
+    static const double rpms[] = {30, 90, 150, 180, 240, 300, 450};
+    for (size_t r = 0; r < sizeof(rpms) / sizeof(rpms[0]); r++)
+    {
+        for (unsigned seed = 1; seed <= 4; seed++)
+        {
+            pulse_config_t cfg = {
+                .rpm = rpms[r], .detents_per_rev = 20, .duty = 0.4, .bounce_us = 500,
+                .jitter = 0.1, .crosstalk_us = 300, .detents = MAX_PULSES, .seed = seed,
+            };
+            result_t result = run(&cfg);
+            if (result.missed || result.extra || result.wrong_direction)
+                printf("%.0f rpm, seed %u: %d missed, %d extra, %d wrong direction\n",
+                       cfg.rpm, seed, result.missed, result.extra, result.wrong_direction);
+            CHECK_EQ(result.extra, 0);
+            CHECK_EQ(result.wrong_direction, 0);
+            if (cfg.rpm <= 240)
+                CHECK_EQ(result.missed, 0);
+        }
+    }
+}
+
+int main(void)
+{
+    test_windows();
+    test_clean_pulses();
+    test_bounce_crosstalk_and_speed();
+    return host_test_result();
+}
@@ -0,0 +1,316 @@
+/*
+ * Drives MidiService through MidiLoopbackTransport: messages are queued,
+ * flushed with waitAndFlush() and come back through the receive side, where
+ * the message callback records them. A batch observer sees what the service
+ * handed over to the transport.
+ *
+ * Checks that a CC sent again before the flush keeps its place with the last
+ * value, that CCs are not merged across a Program Change, that 14-bit CCs and
+ * NRPNs travel as one transaction and are merged as a whole, and that a
+ * received Identity Request is answered and reaches the SysEx consumers.
+ * A SysEx stream which stops is dropped by the periodic timeout check.
+ */
+
+#include <vector>
+#include "esp_timer.h"
+#include "midi_loopback_transport.h"
+#include "midi_service.h"
+#include "host_test.h"
+
+struct Received
+{
+    uint8_t status;
+    uint8_t data1;
+    uint8_t data2;
+};
+
+struct Sent
+{
+    std::vector<uint8_t> data;
+    bool transaction;
+    bool priority;
+};
+
+static int64_t s_nowUs = 1000000;
+
+int64_t esp_timer_get_time(void)
+{
+    return s_nowUs;
+}
+
+class Harness
+{
+public:
+    Harness() : service(transport)
+    {
+        CHECK_EQ(service.init(), ESP_OK);
+        service.setMessageCallback([this](uint8_t status, uint8_t data1, uint8_t data2) {
+            received.push_back({status, data1, data2});
+        });
+        transport.setBatchCallback([this](const MidiOutMessage* messages, size_t count) {
+            for (size_t i = 0; i < count; i++)
+            {
+                sent.push_back({std::vector<uint8_t>(messages[i].data, messages[i].data + messages[i].length),
+                                messages[i].transaction, messages[i].priority});
+            }
+        });
+    }
+
+    void flush()
+    {
+        CHECK(transport.isFlushRequested());
+        CHECK_EQ(service.waitAndFlush(), 0);
+        CHECK(!transport.isFlushRequested());
+    }
+
+    void clear()
+    {
+        received.clear();
+        sent.clear();
+    }
+
+    MidiLoopbackTransport transport;
+    MidiService service;
+    std::vector<Received> received;
+    std::vector<Sent> sent;
+};
+
+static void checkCC(const Received& message, uint8_t channel, uint8_t ccNumber, uint8_t value)
+{
+    CHECK_EQ(message.status, 0xB0 | channel);
+    CHECK_EQ(message.data1, ccNumber);
+    CHECK_EQ(message.data2, value);
+}
+
+static void testLastValueWins()
+{
+    Harness h;
+
+    h.service.sendCC(0, 7, 10);
+    h.service.sendCC(0, 8, 5);
+    h.service.sendCC(0, 7, 20);
+    h.service.sendCC(1, 7, 1); // Another channel is another controller
+    h.service.sendCC(0, 7, 30);
+    h.flush();
+
+    // The first entry of CC 7 keeps its place and carries the newest value
+    CHECK_EQ(h.sent.size(), 3);
+    CHECK_EQ(h.received.size(), 3);
+    if (h.received.size() == 3)
+    {
+        checkCC(h.received[0], 0, 7, 30);
+        checkCC(h.received[1], 0, 8, 5);
+        checkCC(h.received[2], 1, 7, 1);
+    }
+    CHECK_EQ(h.service.getCoalescedCount(), 2);
+    CHECK_EQ(h.transport.getStats().flushes, 1);
+
+    // Priority values are never replaced
+    h.clear();
+    h.service.sendCC(0, 64, 127, true);
+    h.service.sendCC(0, 64, 0, true);
+    h.flush();
+    CHECK_EQ(h.received.size(), 2);
+    for (const Sent& s : h.sent)
+        CHECK(s.priority);
+    CHECK_EQ(h.service.getCoalescedCount(), 2);
+
+    // Nothing queued, nothing to flush
+    CHECK_EQ(h.service.waitAndFlush(), -1);
+}
+
+static void testProgramChangeBarrier()
+{
+    Harness h;
+
+    h.service.sendCC(0, 7, 1);
+    h.service.sendProgramChange(0, 3);
+    h.service.sendCC(0, 7, 2);
+    h.service.sendCC(0, 7, 3);
+    h.service.sendProgramChange(0, 4);
+    h.service.sendProgramChange(0, 4); // Never merged
+    h.flush();
+
+    // The value before the Program Change belongs to the old program
+    CHECK_EQ(h.received.size(), 5);
+    if (h.received.size() == 5)
+    {
+        checkCC(h.received[0], 0, 7, 1);
+        CHECK_EQ(h.received[1].status, 0xC0);
+        CHECK_EQ(h.received[1].data1, 3);
+        checkCC(h.received[2], 0, 7, 3);
+        CHECK_EQ(h.received[3].status, 0xC0);
+        CHECK_EQ(h.received[3].data1, 4);
+        CHECK_EQ(h.received[4].status, 0xC0);
+    }
+    CHECK_EQ(h.service.getCoalescedCount(), 1);
+
+    // The barrier is gone after the flush
+    h.clear();
+    h.service.sendCC(0, 7, 4);
+    h.service.sendCC(0, 7, 5);
+    h.flush();
+    CHECK_EQ(h.received.size(), 1);
+    CHECK_EQ(h.service.getCoalescedCount(), 2);
+}
+
+static void testTransactions()
+{
+    Harness h;
+
+    // 14-bit CC: MSB on the controller, LSB on controller + 32, merged as a pair
+    h.service.send14BitCC(2, 1, 1000);
+    h.service.sendCC(2, 7, 100);
+    h.service.send14BitCC(2, 1, 0x3FFF);
+    h.flush();
+
+    CHECK_EQ(h.sent.size(), 2);
+    if (h.sent.size() == 2)
+    {
+        CHECK(h.sent[0].transaction);
+        CHECK_EQ(h.sent[0].data.size(), 6);
+        CHECK(!h.sent[1].transaction);
+    }
+    CHECK_EQ(h.received.size(), 3);
+    if (h.received.size() == 3)
+    {
+        checkCC(h.received[0], 2, 1, 0x7F);
+        checkCC(h.received[1], 2, 33, 0x7F);
+        checkCC(h.received[2], 2, 7, 100);
+    }
+    CHECK_EQ(h.transport.getStats().transactions, 1);
+    CHECK_EQ(h.service.getCoalescedCount(), 1);
+
+    // NRPN: parameter number on CC 99/98, value on CC 6/38, merged per parameter
+    h.clear();
+    h.service.sendNRPN(3, 300, 500);
+    h.service.sendNRPN(3, 301, 7);
+    h.service.sendNRPN(3, 300, 600);
+    h.flush();
+
+    CHECK_EQ(h.sent.size(), 2);
+    for (const Sent& s : h.sent)
+    {
+        CHECK(s.transaction);
+        CHECK_EQ(s.data.size(), MidiTransaction::MAX_BYTES);
+    }
+    CHECK_EQ(h.received.size(), 8);
+    if (h.received.size() == 8)
+    {
+        checkCC(h.received[0], 3, 99, 300 >> 7);
+        checkCC(h.received[1], 3, 98, 300 & 0x7F);
+        checkCC(h.received[2], 3, 6, 600 >> 7);
+        checkCC(h.received[3], 3, 38, 600 & 0x7F);
+        checkCC(h.received[4], 3, 99, 301 >> 7);
+        checkCC(h.received[5], 3, 98, 301 & 0x7F);
+        checkCC(h.received[6], 3, 6, 0);
+        checkCC(h.received[7], 3, 38, 7);
+    }
+    CHECK_EQ(h.service.getCoalescedCount(), 2);
+
+    // A 14-bit CC and an NRPN with the same number are different entries
+    h.clear();
+    h.service.send14BitCC(0, 5, 1);
+    h.service.sendNRPN(0, 5, 1);
+    h.flush();
+    CHECK_EQ(h.sent.size(), 2);
+}
+
+static void testIdentityRequest()
+{
+    Harness h;
+    // The reply would otherwise be fed back into the assembler while it delivers the request
+    h.transport.setEcho(false);
+
+    std::vector<uint8_t> whole;
+    std::vector<uint8_t> streamed;
+    int ends = 0;
+    CHECK_EQ(h.service.addSysexConsumer(SysexDelivery::WHOLE_MESSAGE,
+        [&](const uint8_t* data, size_t length, size_t offset, SysexEvent event) {
+            whole.assign(data, data + length);
+        }), 0);
+    CHECK_EQ(h.service.addSysexConsumer(SysexDelivery::STREAMING,
+        [&](const uint8_t* data, size_t length, size_t offset, SysexEvent event) {
+            if (event == SysexEvent::DATA && offset == 0)
+                streamed.clear(); // Next message
+            CHECK_EQ(offset, streamed.size());
+            streamed.insert(streamed.end(), data, data + length);
+            ends += event == SysexEvent::END;
+        }), 0);
+
+    // A CC before the request and one after it still reach the message callback
+    static const uint8_t request[] = {0xB0, 0x07, 0x40, 0xF0, 0x7E, 0x7F, 0x06, 0x01, 0xF7, 0xB0, 0x07, 0x41};
+    CHECK_EQ(h.transport.receive(request, sizeof(request)), 0);
+
+    CHECK_EQ(h.received.size(), 2);
+    CHECK_EQ(whole.size(), 4);
+    CHECK(whole == std::vector<uint8_t>(request + 4, request + 8));
+    CHECK(streamed == whole);
+    CHECK_EQ(ends, 1);
+
+    // The reply is sent right away, as a priority message
+    CHECK_EQ(h.sent.size(), 1);
+    if (h.sent.size() == 1)
+    {
+        const std::vector<uint8_t>& reply = h.sent[0].data;
+        CHECK(h.sent[0].priority);
+        CHECK(reply.size() > 6);
+        CHECK_EQ(reply.front(), 0xF0);
+        CHECK_EQ(reply[1], 0x7E);
+        CHECK_EQ(reply[3], 0x06);
+        CHECK_EQ(reply[4], 0x02);
+        CHECK_EQ(reply.back(), 0xF7);
+    }
+
+    SysexAssembler::Stats stats = h.service.getSysexStats();
+    CHECK_EQ(stats.completed, 1);
+    CHECK_EQ(stats.droppedIncomplete, 0);
+
+    // Other SysEx messages are delivered but not answered
+    h.clear();
+    static const uint8_t other[] = {0xF0, 0x7D, 0x01, 0x02, 0xF7};
+    CHECK_EQ(h.transport.receive(other, sizeof(other)), 0);
+    CHECK(h.sent.empty());
+    CHECK_EQ(whole.size(), 3);
+    CHECK(streamed == whole);
+    CHECK_EQ(ends, 2);
+    CHECK_EQ(h.service.getSysexStats().completed, 2);
+    CHECK_EQ(h.service.getSendFailedCount(), 0);
+}
+
+static void testSysexTimeout()
+{
+    Harness h;
+    int aborted = 0;
+    CHECK_EQ(h.service.addSysexConsumer(SysexDelivery::STREAMING,
+        [&](const uint8_t* data, size_t length, size_t offset, SysexEvent event) {
+            aborted += event == SysexEvent::ABORTED;
+        }), 0);
+
+    // The F7 never arrives and nothing else is received
+    static const uint8_t start[] = {0xF0, 0x7D, 0x01, 0x02};
+    CHECK_EQ(h.transport.receive(start, sizeof(start), 0, s_nowUs), 0);
+    CHECK(h.service.isReceivingSysex());
+
+    s_nowUs += SysexAssembler::DEFAULT_TIMEOUT_MS * 1000 / 2;
+    h.service.checkSysexTimeout();
+    CHECK(h.service.isReceivingSysex());
+    CHECK_EQ(aborted, 0);
+
+    s_nowUs += SysexAssembler::DEFAULT_TIMEOUT_MS * 1000;
+    h.service.checkSysexTimeout();
+    CHECK(!h.service.isReceivingSysex());
+    CHECK_EQ(aborted, 1);
+    CHECK_EQ(h.service.getSysexStats().droppedTimeout, 1);
+    CHECK_EQ(h.service.getSysexStats().completed, 0);
+}
+
+int main()
+{
+    testLastValueWins();
+    testProgramChangeBarrier();
+    testTransactions();
+    testIdentityRequest();
+    testSysexTimeout();
+    return host_test_result();
+}
@@ -0,0 +1,375 @@
+/*
+ * Drives TempoClock and ModulationEngine with MIDI clock as it arrives over
+ * BLE: a tick is received at the next connection event plus up to 1.5 ms of
+ * processing, now and then one is lost. The application task samples every
+ * millisecond, the modulation task wakes up late and stalls once in a while.
+ *
+ * Checks the lock time of the tempo estimate, the position jitter against the
+ * raw estimate (last arrival plus the nominal interval), that the position
+ * never goes back, and the rates in ModulationEngine::Stats.
+ *
+ *   test_tempo_modulation             tables of lock time and jitter, then the checks
+ */
+
+#include <algorithm>
+#include <cmath>
+#include <random>
+#include <vector>
+#include "modulation_engine.h"
+#include "tempo_clock.h"
+#include "host_test.h"
+
+static const int64_t START_US = 1000000;
+static const uint32_t ARRIVAL_JITTER_US = 1500;
+
+struct Tick
+{
+    int64_t sentUs;
+    int64_t receivedUs; // -1 if lost
+};
+
+struct Link
+{
+    double bpm;
+    double stepBpm;   // Tempo after stepUs, 0 for none
+    int64_t stepUs;
+    uint32_t intervalUs;  // Connection interval
+    double lossRate;
+};
+
+// Tick times at the sender and their arrival at the receiver
+static std::vector<Tick> sendClock(const Link& link, int64_t endUs, uint32_t seed)
+{
+    std::mt19937 rng(seed);
+    std::uniform_real_distribution<double> uniform(0.0, 1.0);
+    std::vector<Tick> ticks;
+    double t = START_US;
+    while (t < endUs)
+    {
+        int64_t sentUs = static_cast<int64_t>(t);
+        int64_t receivedUs = (sentUs / link.intervalUs + 1) * link.intervalUs + static_cast<int64_t>(uniform(rng) * ARRIVAL_JITTER_US);
+        ticks.push_back({sentUs, uniform(rng) < link.lossRate ? -1 : receivedUs});
+        double bpm = (link.stepBpm > 0 && t >= link.stepUs) ? link.stepBpm : link.bpm;
+        t += 60e6 / (bpm * TempoClock::TICKS_PER_BEAT);
+    }
+    return ticks;
+}
+
+// Sender position in ticks, interpolated between its ticks
+static double sentPosition(const std::vector<Tick>& ticks, int64_t nowUs)
+{
+    auto next = std::upper_bound(ticks.begin(), ticks.end(), nowUs, [](int64_t t, const Tick& tick) { return t < tick.sentUs; });
+    size_t i = (next - ticks.begin()) - 1;
+    if (next == ticks.end())
+    {
+        return static_cast<double>(i);
+    }
+    return i + static_cast<double>(nowUs - ticks[i].sentUs) / (next->sentUs - ticks[i].sentUs);
+}
+
+static double position(const TempoPosition& p)
+{
+    return p.ticks + p.fraction;
+}
+
+struct LockResult
+{
+    int64_t lockUs;      // From the first tick until the tempo stays within 2%, -1 if never
+    double jitterUs;     // Standard deviation of the position error after lock, in time
+    double peakUs;       // Largest deviation from the mean error
+    double rawJitterUs;  // Same for the raw estimate
+    double rawPeakUs;
+    double tempoError;   // Mean of the estimate after lock
+};
+
+static LockResult measureLock(const Link& link, int64_t durationUs, int64_t settleUs)
+{
+    int64_t endUs = START_US + durationUs;
+    std::vector<Tick> ticks = sendClock(link, endUs, 1);
+    TempoClock clock;
+    LockResult result = {-1, 0, 0, 0, 0, 0};
+
+    std::vector<double> errors, rawErrors;
+    double tempoSum = 0;
+    uint32_t tempoSamples = 0;
+    size_t next = 0;
+    uint32_t rawTicks = 0;
+    int64_t rawLastUs = -1;
+    for (int64_t nowUs = START_US; nowUs < endUs; nowUs += 1000)
+    {
+        for (; next < ticks.size() && (ticks[next].receivedUs < 0 || ticks[next].receivedUs <= nowUs); next++)
+        {
+            if (ticks[next].receivedUs < 0)
+            {
+                continue;
+            }
+            clock.receiveRealtime(0xF8, ticks[next].receivedUs);
+            rawTicks += rawLastUs >= 0;
+            rawLastUs = ticks[next].receivedUs;
+        }
+        if (rawLastUs < 0)
+        {
+            continue;
+        }
+
+        double bpm = (link.stepBpm > 0 && nowUs >= link.stepUs) ? link.stepBpm : link.bpm;
+        bool inTempo = std::fabs(clock.getTempo() - bpm) < bpm * 0.02;
+        if (!inTempo)
+        {
+            result.lockUs = -1;
+        }
+        else if (result.lockUs < 0)
+        {
+            result.lockUs = nowUs - ticks[0].receivedUs;
+        }
+
+        double estimate = position(clock.getPosition(nowUs));
+        if (nowUs - START_US >= settleUs && !(link.stepBpm > 0 && nowUs >= link.stepUs && nowUs < link.stepUs + settleUs))
+        {
+            double tickUs = 60e6 / (bpm * TempoClock::TICKS_PER_BEAT);
+            double truth = sentPosition(ticks, nowUs);
+            double raw = rawTicks + std::min((nowUs - rawLastUs) / tickUs, 0.999);
+            errors.push_back((estimate - truth) * tickUs);
+            rawErrors.push_back((raw - truth) * tickUs);
+            tempoSum += clock.getTempo() - bpm;
+            tempoSamples++;
+        }
+    }
+
+    // The mean error is the constant delivery delay, only the deviation from it is jitter
+    auto spread = [](const std::vector<double>& e, double& sd, double& peak) {
+        double mean = 0, sumSq = 0;
+        for (double x : e)
+            mean += x;
+        mean /= e.size();
+        for (double x : e)
+        {
+            sumSq += (x - mean) * (x - mean);
+            peak = std::max(peak, std::fabs(x - mean));
+        }
+        sd = std::sqrt(sumSq / e.size());
+    };
+    spread(errors, result.jitterUs, result.peakUs);
+    spread(rawErrors, result.rawJitterUs, result.rawPeakUs);
+    result.tempoError = tempoSum / tempoSamples;
+    return result;
+}
+
+static void testLockTime()
+{
+    struct Case
+    {
+        const char* name;
+        Link link;
+    };
+    static const Case CASES[] = {
+        {"120 bpm, 7.5 ms interval", {120, 0, 0, 7500, 0}},
+        {"120 bpm, 15 ms interval", {120, 0, 0, 15000, 0}},
+        {"174 bpm, 15 ms interval", {174, 0, 0, 15000, 0}},
+        {"90 bpm, 30 ms interval", {90, 0, 0, 30000, 0}},
+    };
+
+    printf("%-26s %8s %16s %16s %9s\n", "", "lock", "jitter sd/peak", "raw sd/peak", "tempo err");
+    for (const Case& c : CASES)
+    {
+        LockResult r = measureLock(c.link, 20000000, 3000000);
+        printf("%-26s %6.2f s %7.2f/%5.2f ms %7.2f/%5.2f ms %+6.2f bpm\n", c.name, r.lockUs / 1e6,
+               r.jitterUs / 1000, r.peakUs / 1000, r.rawJitterUs / 1000, r.rawPeakUs / 1000, r.tempoError);
+
+        // Locked within a couple of beats, and the loop removes much of the arrival jitter.
+        // The peaks stay those of the connection interval.
+        CHECK(r.lockUs >= 0 && r.lockUs < 2000000);
+        CHECK(std::fabs(r.tempoError) < 0.2);
+        CHECK(r.jitterUs < r.rawJitterUs * 0.6);
+        CHECK(r.peakUs < c.link.intervalUs / 2 + ARRIVAL_JITTER_US);
+    }
+
+    // A tempo change in the DAW is followed within a few beats
+    Link step = {120, 128, START_US + 10000000, 15000, 0};
+    LockResult r = measureLock(step, 20000000, 3000000);
+    printf("%-26s %6.2f s %7.2f/%5.2f ms %7.2f/%5.2f ms %+6.2f bpm\n", "120 -> 128 bpm, 15 ms", (r.lockUs - (step.stepUs - START_US)) / 1e6,
+           r.jitterUs / 1000, r.peakUs / 1000, r.rawJitterUs / 1000, r.rawPeakUs / 1000, r.tempoError);
+    CHECK(r.lockUs >= 0 && r.lockUs - (step.stepUs - START_US) < 3000000);
+    CHECK(std::fabs(r.tempoError) < 0.2);
+    CHECK(r.jitterUs < r.rawJitterUs * 0.6);
+}
+
+static void testPositionMonotonic()
+{
+    Link link = {120, 0, 0, 15000, 0.02};
+    std::vector<Tick> ticks = sendClock(link, START_US + 20000000, 2);
+    TempoClock clock;
+
+    // Transport: Stop at 4 s, Continue at 5 s, Start at 8 s, clock gone from 12 to 14 s
+    struct Event
+    {
+        int64_t atUs;
+        uint8_t status;
+    };
+    static const Event EVENTS[] = {
+        {START_US + 4000000, 0xFC},
+        {START_US + 5000000, 0xFB},
+        {START_US + 8000000, 0xFA},
+    };
+    size_t nextEvent = 0;
+    size_t next = 0;
+    double last = -1;
+    uint32_t backwards = 0;
+    bool sawStopped = false, sawInternal = false;
+
+    for (int64_t nowUs = START_US; nowUs < START_US + 20000000; nowUs += 1000)
+    {
+        bool started = false;
+        if (nextEvent < sizeof(EVENTS) / sizeof(EVENTS[0]) && EVENTS[nextEvent].atUs <= nowUs)
+        {
+            clock.receiveRealtime(EVENTS[nextEvent].status, nowUs);
+            started = EVENTS[nextEvent].status == 0xFA;
+            nextEvent++;
+        }
+        for (; next < ticks.size() && (ticks[next].receivedUs < 0 || ticks[next].receivedUs <= nowUs); next++)
+        {
+            bool dropout = ticks[next].sentUs >= START_US + 12000000 && ticks[next].sentUs < START_US + 14000000;
+            if (ticks[next].receivedUs >= 0 && !dropout)
+            {
+                clock.receiveRealtime(0xF8, ticks[next].receivedUs);
+            }
+        }
+
+        double p = position(clock.getPosition(nowUs));
+        if (started)
+        {
+            CHECK(p == 0); // Start rewinds to the song start, the only jump back
+        }
+        else if (p < last)
+        {
+            backwards++;
+        }
+        last = p;
+
+        if (nowUs > START_US + 4100000 && nowUs < START_US + 5000000)
+        {
+            sawStopped |= !clock.isRunning(nowUs);
+            CHECK(!clock.isRunning(nowUs));
+        }
+        if (nowUs > START_US + 12000000 + TempoClock::EXTERNAL_TIMEOUT_US + 100000 && nowUs < START_US + 14000000)
+        {
+            sawInternal |= !clock.isExternal(nowUs);
+            CHECK(!clock.isExternal(nowUs) && clock.isRunning(nowUs));
+        }
+    }
+    CHECK_EQ(backwards, 0);
+    CHECK(sawStopped);
+    CHECK(sawInternal);
+    CHECK(clock.isExternal(START_US + 20000000));
+}
+
+static void testEngineStats()
+{
+    Link link = {120, 0, 0, 15000, 0.02};
+    const int64_t durationUs = 30000000;
+    std::vector<Tick> ticks = sendClock(link, START_US + durationUs, 3);
+    TempoClock clock;
+    ModulationEngine engine(clock);
+    const uint32_t intervalUs = engine.getUpdateInterval();
+
+    std::vector<std::shared_ptr<Parameter>> parameters;
+    std::vector<std::vector<int64_t>> emitted(ModulationEngine::MAX_SOURCES);
+    engine.setEmitCallback([&](const std::shared_ptr<Parameter>& parameter, int64_t timeUs) {
+        for (size_t i = 0; i < parameters.size(); i++)
+        {
+            if (parameters[i] == parameter)
+            {
+                emitted[i].push_back(timeUs);
+            }
+        }
+    });
+
+    static const ModulationShape SHAPES[] = {ModulationShape::SINE, ModulationShape::TRIANGLE, ModulationShape::SAW_UP, ModulationShape::SQUARE};
+    for (size_t i = 0; i < ModulationEngine::MAX_SOURCES; i++)
+    {
+        ModulationConfig config;
+        config.shape = SHAPES[i % 4];
+        config.periodTicks = i < 4 ? 24 : 96;
+        if (i == 7)
+        {
+            parameters.push_back(std::make_shared<CC14BitParameter>("p", 0, 1));
+            config.maxValue = HighResParameter::MAX_VALUE_14BIT;
+        }
+        else
+        {
+            parameters.push_back(std::make_shared<CCParameter>("p", 0, 20 + i));
+        }
+        CHECK(engine.start(parameters[i], config, START_US) == static_cast<int32_t>(i));
+    }
+
+    // The task wakes up 0-8 ms after the next grid point, every 500th time it's 40 ms busy on top
+    std::mt19937 rng(4);
+    std::uniform_int_distribution<int> late(0, 8000);
+    size_t next = 0;
+    int64_t firstUs = -1, lastUs = 0;
+    uint32_t wakeups = 0, stalls = 0;
+    for (int64_t nowUs = START_US; nowUs < START_US + durationUs;)
+    {
+        for (; next < ticks.size() && (ticks[next].receivedUs < 0 || ticks[next].receivedUs <= nowUs); next++)
+        {
+            if (ticks[next].receivedUs >= 0)
+            {
+                clock.receiveRealtime(0xF8, ticks[next].receivedUs);
+            }
+        }
+        uint32_t untilNextUs = engine.run(nowUs);
+        CHECK(untilNextUs > 0 && untilNextUs <= intervalUs);
+        if (firstUs < 0)
+        {
+            firstUs = nowUs;
+        }
+        lastUs = nowUs;
+        bool stall = ++wakeups % 500 == 0;
+        stalls += stall;
+        nowUs += untilNextUs + late(rng) + (stall ? 40000 : 0);
+    }
+
+    const ModulationEngine::Stats& stats = engine.getStats();
+    uint32_t gridPoints = static_cast<uint32_t>(lastUs / intervalUs - firstUs / intervalUs + 1);
+    printf("%u runs, %u skipped of %u grid points, %u messages (%.0f/s), late avg %.2f ms, max %.2f ms\n",
+           stats.runs, stats.skippedSamples, gridPoints, stats.messages, stats.messages / (durationUs / 1e6),
+           static_cast<double>(stats.sumLateUs) / stats.runs / 1000, stats.maxLateUs / 1000.0);
+
+    // Every grid point is either run or counted as skipped, a stall skips three or four of them.
+    // A run is never more than one interval late, the rest of a stall shows up as skipped samples.
+    CHECK_EQ(stats.runs + stats.skippedSamples, gridPoints);
+    CHECK(stats.runs <= wakeups);
+    CHECK(stats.skippedSamples >= 3 * stalls && stats.skippedSamples <= 4 * stalls);
+    CHECK(stats.maxLateUs <= 8000);
+    double meanLateUs = static_cast<double>(stats.sumLateUs) / stats.runs;
+    CHECK(meanLateUs > 3500 && meanLateUs < 4500);
+
+    // At most one message per source and run, all on the grid and evenly spaced
+    size_t total = 0;
+    for (size_t i = 0; i < emitted.size(); i++)
+    {
+        const std::vector<int64_t>& times = emitted[i];
+        total += times.size();
+        CHECK(times.size() <= stats.runs);
+        for (size_t k = 0; k < times.size(); k++)
+        {
+            CHECK(times[k] % intervalUs == 0);
+            CHECK(k == 0 || times[k] - times[k - 1] >= intervalUs);
+        }
+    }
+    CHECK_EQ(total, stats.messages);
+    CHECK(stats.messages <= stats.runs * ModulationEngine::MAX_SOURCES);
+
+    // A one beat saw over 0-127 changes on nearly every sample, a square twice per cycle
+    CHECK(emitted[2].size() > stats.runs * 9 / 10);
+    uint32_t beats = static_cast<uint32_t>(durationUs / 500000);
+    CHECK(emitted[3].size() >= 2 * beats - 2 && emitted[3].size() <= 2 * beats + 2);
+}
+
+int main()
+{
+    testLockTime();
+    testPositionMonotonic();
+    testEngineStats();
+    return host_test_result();
+}